@@ -0,0 +1,210 @@
+#include <math.h>
+#include <string.h>
+
+#include "attitude-estimator.h"
+
+
+/** Takes a struct attitude_estimator and resets it to the identity
+ * orientation with no estimated gyroscope bias, using the gains and sample
+ * period in 'config'. */
+void attitude_estimator_init(struct attitude_estimator *est, \
+    const struct attitude_estimator_config *config) {
+
+    est->config = *config;
+    est->q[0] = 1.0f;
+    est->q[1] = 0.0f;
+    est->q[2] = 0.0f;
+    est->q[3] = 0.0f;
+    memset(est->integral_error, 0, sizeof(est->integral_error));
+}
+
+
+/** Sets the orientation directly from one accelerometer reading and
+ * (optionally, may be NULL) one magnetometer reading, instead of waiting for
+ * the filter to converge from the identity orientation. Meant to be called
+ * once, while the drone is at rest.
+ *
+ * 'a_xyz' and 'm_xyz' may be in any units, only their directions are used.
+ */
+void attitude_estimator_align(struct attitude_estimator *est, \
+    const float *a_xyz, const float *m_xyz) {
+
+    /* 1. Roll and pitch from the direction of gravity. Using atan2 here (as
+     * opposed to atan) keeps the full range of both angles */
+    float roll = atan2f(a_xyz[1], a_xyz[2]);
+    float pitch = atan2f(-a_xyz[0], \
+        sqrtf(a_xyz[1] * a_xyz[1] + a_xyz[2] * a_xyz[2]));
+
+    /* 2. Yaw from the tilt compensated magnetic field */
+    float yaw = 0.0f;
+    if (m_xyz != NULL && (m_xyz[0] != 0.0f || m_xyz[1] != 0.0f || m_xyz[2] != 0.0f)) {
+        float sr = sinf(roll);
+        float cr = cosf(roll);
+        float sp = sinf(pitch);
+        float cp = cosf(pitch);
+        float mx = m_xyz[0] * cp + m_xyz[1] * sr * sp + m_xyz[2] * cr * sp;
+        float my = m_xyz[1] * cr - m_xyz[2] * sr;
+        yaw = atan2f(-my, mx);
+    }
+
+    /* 3. Convert the Euler angles (applied yaw, then pitch, then roll) to a
+     * quaternion */
+    float cr = cosf(roll * 0.5f);
+    float sr = sinf(roll * 0.5f);
+    float cp = cosf(pitch * 0.5f);
+    float sp = sinf(pitch * 0.5f);
+    float cy = cosf(yaw * 0.5f);
+    float sy = sinf(yaw * 0.5f);
+    est->q[0] = cr * cp * cy + sr * sp * sy;
+    est->q[1] = sr * cp * cy - cr * sp * sy;
+    est->q[2] = cr * sp * cy + sr * cp * sy;
+    est->q[3] = cr * cp * sy - sr * sp * cy;
+    memset(est->integral_error, 0, sizeof(est->integral_error));
+}
+
+
+/** Advances the estimate by 'dt_s' seconds, the time since the previous
+ * sample, using one gyroscope sample 'g_xyz' (in rad/s), one accelerometer
+ * sample 'a_xyz' and one magnetometer sample 'm_xyz'. The accelerometer and
+ * magnetometer samples may be in any units, only their directions are used,
+ * but all three sensors must share the same axes.
+ *
+ * 'm_xyz' may be NULL (or all zeros, e.g. before the first magnetometer sample
+ * arrives), in which case only roll and pitch are corrected and the yaw is
+ * purely integrated from the gyroscope. The same goes for 'a_xyz', in which
+ * case nothing is corrected.
+ */
+void attitude_estimator_update(struct attitude_estimator *est, \
+    const float *g_xyz, const float *a_xyz, const float *m_xyz, float dt_s) {
+
+    float q0 = est->q[0];
+    float q1 = est->q[1];
+    float q2 = est->q[2];
+    float q3 = est->q[3];
+    float gx = g_xyz[0];
+    float gy = g_xyz[1];
+    float gz = g_xyz[2];
+    const float dt = dt_s;
+
+    float ax = a_xyz[0];
+    float ay = a_xyz[1];
+    float az = a_xyz[2];
+    float a_norm_sq = ax * ax + ay * ay + az * az;
+
+    /* 1. Work out the error between where the accelerometer (and
+     * magnetometer) say the reference directions are and where our current
+     * orientation estimate says they should be */
+    if (a_norm_sq > 0.0f) {
+        float recip_norm = 1.0f / sqrtf(a_norm_sq);
+        ax *= recip_norm;
+        ay *= recip_norm;
+        az *= recip_norm;
+
+        /* 1a. Direction of gravity according to the current estimate, i.e.
+         * the third row of the rotation matrix */
+        float vx = 2.0f * (q1 * q3 - q0 * q2);
+        float vy = 2.0f * (q0 * q1 + q2 * q3);
+        float vz = q0 * q0 - q1 * q1 - q2 * q2 + q3 * q3;
+
+        /* 1b. The error is the cross product between the measured and the
+         * estimated directions */
+        float ex = ay * vz - az * vy;
+        float ey = az * vx - ax * vz;
+        float ez = ax * vy - ay * vx;
+
+        if (m_xyz != NULL) {
+            float mx = m_xyz[0];
+            float my = m_xyz[1];
+            float mz = m_xyz[2];
+            float m_norm_sq = mx * mx + my * my + mz * mz;
+
+            if (m_norm_sq > 0.0f) {
+                recip_norm = 1.0f / sqrtf(m_norm_sq);
+                mx *= recip_norm;
+                my *= recip_norm;
+                mz *= recip_norm;
+
+                /* 1c. Rotate the measured field into the earth frame and
+                 * flatten it onto the x-z plane. This is the reference
+                 * direction of the earth's field, with the inclination kept
+                 * but the declination thrown away */
+                float hx = 2.0f * (mx * (0.5f - q2 * q2 - q3 * q3) \
+                    + my * (q1 * q2 - q0 * q3) + mz * (q1 * q3 + q0 * q2));
+                float hy = 2.0f * (mx * (q1 * q2 + q0 * q3) \
+                    + my * (0.5f - q1 * q1 - q3 * q3) + mz * (q2 * q3 - q0 * q1));
+                float bx = sqrtf(hx * hx + hy * hy);
+                float bz = 2.0f * (mx * (q1 * q3 - q0 * q2) \
+                    + my * (q2 * q3 + q0 * q1) + mz * (0.5f - q1 * q1 - q2 * q2));
+
+                /* 1d. Direction of the field according to the current
+                 * estimate */
+                float wx = 2.0f * (bx * (0.5f - q2 * q2 - q3 * q3) + bz * (q1 * q3 - q0 * q2));
+                float wy = 2.0f * (bx * (q1 * q2 - q0 * q3) + bz * (q0 * q1 + q2 * q3));
+                float wz = 2.0f * (bx * (q0 * q2 + q1 * q3) + bz * (0.5f - q1 * q1 - q2 * q2));
+
+                ex += my * wz - mz * wy;
+                ey += mz * wx - mx * wz;
+                ez += mx * wy - my * wx;
+            }
+        }
+
+        /* 2. Feed the error back into the gyroscope rates. The integral term
+         * absorbs the gyroscope bias */
+        if (est->config.ki > 0.0f) {
+            est->integral_error[0] += est->config.ki * ex * dt;
+            est->integral_error[1] += est->config.ki * ey * dt;
+            est->integral_error[2] += est->config.ki * ez * dt;
+            gx += est->integral_error[0];
+            gy += est->integral_error[1];
+            gz += est->integral_error[2];
+        }
+
+        gx += est->config.kp * ex;
+        gy += est->config.kp * ey;
+        gz += est->config.kp * ez;
+    }
+
+    /* 3. Integrate the rate of change of the quaternion, q' = 0.5 * q * w */
+    gx *= 0.5f * dt;
+    gy *= 0.5f * dt;
+    gz *= 0.5f * dt;
+    float qa = q0;
+    float qb = q1;
+    float qc = q2;
+    q0 += -qb * gx - qc * gy - q3 * gz;
+    q1 += qa * gx + qc * gz - q3 * gy;
+    q2 += qa * gy - qb * gz + q3 * gx;
+    q3 += qa * gz + qb * gy - qc * gx;
+
+    /* 4. Keep the quaternion a unit quaternion */
+    float recip_norm = 1.0f / sqrtf(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+    est->q[0] = q0 * recip_norm;
+    est->q[1] = q1 * recip_norm;
+    est->q[2] = q2 * recip_norm;
+    est->q[3] = q3 * recip_norm;
+}
+
+
+/** Converts the current orientation estimate to roll (rotation around the x
+ * axis), pitch (around the y axis) and yaw (around the z axis), in radians.
+ *
+ * This is kept out of 'attitude_estimator_update()' because the
+ * trigonometric functions cost more than the update itself. It only needs to
+ * be done when the angles are actually needed.
+ */
+void attitude_estimator_get_euler(const struct attitude_estimator *est, \
+    float *roll, float *pitch, float *yaw) {
+
+    float q0 = est->q[0];
+    float q1 = est->q[1];
+    float q2 = est->q[2];
+    float q3 = est->q[3];
+
+    *roll = atan2f(q0 * q1 + q2 * q3, 0.5f - q1 * q1 - q2 * q2);
+    float sin_pitch = -2.0f * (q1 * q3 - q0 * q2);
+    /* Guard against rounding pushing this just outside of asinf's domain */
+    if (sin_pitch > 1.0f) sin_pitch = 1.0f;
+    if (sin_pitch < -1.0f) sin_pitch = -1.0f;
+    *pitch = asinf(sin_pitch);
+    *yaw = atan2f(q1 * q2 + q0 * q3, 0.5f - q2 * q2 - q3 * q3);
+}
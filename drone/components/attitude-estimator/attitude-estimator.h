@@ -0,0 +1,55 @@
+#ifndef __ATTITUDE_ESTIMATOR_H_
+#define __ATTITUDE_ESTIMATOR_H_
+
+/* Everything is done in single precision, since the ESP32's FPU has no double
+ * precision support. */
+
+
+/* The most CPU cycles one call to 'attitude_estimator_update()' with all
+ * three sensors is budgeted to take on the ESP32 (about 12.5us at 240MHz).
+ * The update is straight line code apart from the sensor validity checks: ~150
+ * multiply/adds plus 3 square roots and 3 divisions in the 9-DOF case */
+#define ATTITUDE_ESTIMATOR_UPDATE_BUDGET_CYCLES 3000
+
+
+struct attitude_estimator_config {
+    /* The nominal time between two calls to 'attitude_estimator_update()',
+     * in seconds, i.e. 1 / (the gyroscope ODR or FIFO batch data rate). Each
+     * call is given the real time since the last one, so this is only for
+     * whatever needs to know the rate ahead of time */
+    float sample_period_s;
+    /* Proportional gain, which sets how quickly the gyroscope integration is
+     * pulled towards the accelerometer/magnetometer reference. Larger values
+     * trust the accelerometer and magnetometer more */
+    float kp;
+    /* Integral gain, which is what estimates the gyroscope bias. 0 disables
+     * bias estimation */
+    float ki;
+};
+
+
+/* A Mahony complementary filter. The orientation is kept as a unit quaternion
+ * (w, x, y, z) that rotates vectors from the body frame to the earth frame */
+struct attitude_estimator {
+    struct attitude_estimator_config config;
+    float q[4];
+    /* The integral of the error, i.e. the current estimate of the negated
+     * gyroscope bias, in rad/s */
+    float integral_error[3];
+};
+
+
+void attitude_estimator_init(struct attitude_estimator *est, \
+    const struct attitude_estimator_config *config);
+
+void attitude_estimator_align(struct attitude_estimator *est, \
+    const float *a_xyz, const float *m_xyz);
+
+void attitude_estimator_update(struct attitude_estimator *est, \
+    const float *g_xyz, const float *a_xyz, const float *m_xyz, float dt_s);
+
+void attitude_estimator_get_euler(const struct attitude_estimator *est, \
+    float *roll, float *pitch, float *yaw);
+
+
+#endif
@@ -0,0 +1,266 @@
+#include <math.h>
+#include <string.h>
+
+#include "blackbox-format.h"
+
+
+/** Fills in 'header' for a log started at 'start_time_us', of samples
+ * 'sample_period_s' apart, decoded with the given calibrations and fed to an
+ * estimator with the given gains. */
+void blackbox_header_init(struct blackbox_header *header, int64_t start_time_us, \
+    float sample_period_s, float estimator_kp, float estimator_ki, \
+    const struct sensor_calibration *gyro_calibration_raw, \
+    const struct sensor_calibration *accel_calibration_raw) {
+
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, BLACKBOX_MAGIC, sizeof(header->magic));
+    header->version = BLACKBOX_VERSION;
+    header->header_len = sizeof(*header);
+    header->start_time_us = start_time_us;
+    header->sample_period_s = sample_period_s;
+    header->estimator_kp = estimator_kp;
+    header->estimator_ki = estimator_ki;
+    header->gyro_calibration_raw = *gyro_calibration_raw;
+    header->accel_calibration_raw = *accel_calibration_raw;
+}
+
+
+/** Whether 'header' starts a log this code can decode. */
+bool blackbox_header_check(const struct blackbox_header *header) {
+    return memcmp(header->magic, BLACKBOX_MAGIC, sizeof(header->magic)) == 0 \
+        && header->version == BLACKBOX_VERSION && header->header_len == sizeof(*header);
+}
+
+
+/* Rounds 'value' * 'scale' to the nearest int16_t, saturating */
+static int16_t blackbox_quantise(float value, float scale) {
+    float scaled = roundf(value * scale);
+    if (!(scaled > -32768.0f)) return (scaled != scaled) ? 0 : -32768;
+    if (scaled > 32767.0f) return 32767;
+    return (int16_t) scaled;
+}
+
+
+/** Fills in 'record' from the sensor task's state: the sample's time since
+ * the log was started, the raw IMU sample, the magnetometer reading in uT,
+ * the attitude quaternion and the motor commands (from 0 to 1). */
+void blackbox_record_pack(struct blackbox_record *record, uint32_t time_us, \
+    const int16_t *g_raw, const int16_t *a_raw, const float *m_ut, const float *q, \
+    const float *motor) {
+
+    record->time_us = time_us;
+    for (int i = 0; i < 3; i++) {
+        record->g_raw[i] = g_raw[i];
+        record->a_raw[i] = a_raw[i];
+        record->m[i] = blackbox_quantise(m_ut[i], BLACKBOX_MAG_SCALE);
+    }
+    for (int i = 0; i < 4; i++) {
+        record->q[i] = blackbox_quantise(q[i], BLACKBOX_QUATERNION_SCALE);
+        record->motor[i] = blackbox_quantise(motor[i], BLACKBOX_MOTOR_SCALE);
+    }
+}
+
+
+/* The fields of a record in the order they are coded */
+static void blackbox_record_to_fields(const struct blackbox_record *record, int32_t *fields) {
+    int n = 0;
+    fields[n++] = (int32_t) record->time_us;
+    for (int i = 0; i < 3; i++) fields[n++] = record->g_raw[i];
+    for (int i = 0; i < 3; i++) fields[n++] = record->a_raw[i];
+    for (int i = 0; i < 3; i++) fields[n++] = record->m[i];
+    for (int i = 0; i < 4; i++) fields[n++] = record->q[i];
+    for (int i = 0; i < 4; i++) fields[n++] = record->motor[i];
+}
+
+
+static void blackbox_fields_to_record(const int32_t *fields, struct blackbox_record *record) {
+    int n = 0;
+    record->time_us = (uint32_t) fields[n++];
+    for (int i = 0; i < 3; i++) record->g_raw[i] = (int16_t) fields[n++];
+    for (int i = 0; i < 3; i++) record->a_raw[i] = (int16_t) fields[n++];
+    for (int i = 0; i < 3; i++) record->m[i] = (int16_t) fields[n++];
+    for (int i = 0; i < 4; i++) record->q[i] = (int16_t) fields[n++];
+    for (int i = 0; i < 4; i++) record->motor[i] = (int16_t) fields[n++];
+}
+
+
+/* CRC-8, polynomial 0x07 */
+static uint8_t blackbox_crc8(const uint8_t *data, size_t len) {
+    uint8_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80) ? (uint8_t) ((crc << 1) ^ 0x07) : (uint8_t) (crc << 1);
+        }
+    }
+    return crc;
+}
+
+
+/* Writes 'value' as a zigzag LEB128 varint: small values of either sign
+ * take one byte */
+static size_t blackbox_put_varint(uint8_t *out, int32_t value) {
+    uint32_t zigzag = ((uint32_t) value << 1) ^ (uint32_t) (value >> 31);
+    size_t len = 0;
+    while (zigzag >= 0x80) {
+        out[len++] = (uint8_t) (zigzag | 0x80);
+        zigzag >>= 7;
+    }
+    out[len++] = (uint8_t) zigzag;
+    return len;
+}
+
+
+/* Reads a varint written by 'blackbox_put_varint()', returning how many
+ * bytes it took, or 0 if it runs past 'len' (or is longer than any varint
+ * that could have been written) */
+static size_t blackbox_get_varint(const uint8_t *in, size_t len, int32_t *value) {
+    uint32_t zigzag = 0;
+    for (size_t i = 0; i < len && i < 5; i++) {
+        zigzag |= (uint32_t) (in[i] & 0x7F) << (7 * i);
+        if (!(in[i] & 0x80)) {
+            *value = (int32_t) ((zigzag >> 1) ^ (~(zigzag & 1) + 1));
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+
+void blackbox_encoder_init(struct blackbox_encoder *encoder) {
+    memset(encoder, 0, sizeof(*encoder));
+}
+
+
+/** Makes the next frame an intra frame. Must be called whenever a frame
+ * from 'blackbox_encode()' does not make it into the log, since the frame
+ * after it would otherwise be coded against it. */
+void blackbox_encoder_resync(struct blackbox_encoder *encoder) {
+    encoder->until_intra = 0;
+}
+
+
+/** Codes 'record' into 'out', which must have room for
+ * BLACKBOX_FRAME_MAX_LEN bytes, and returns the length of the frame. */
+size_t blackbox_encode(struct blackbox_encoder *encoder, const struct blackbox_record *record, \
+    uint8_t *out) {
+
+    int32_t fields[BLACKBOX_NUM_FIELDS];
+    blackbox_record_to_fields(record, fields);
+
+    size_t len = 1;
+    if (encoder->until_intra == 0) {
+        out[0] = BLACKBOX_FRAME_INTRA;
+        for (int i = 0; i < BLACKBOX_NUM_FIELDS; i++) {
+            len += blackbox_put_varint(&out[len], fields[i]);
+        }
+        encoder->until_intra = BLACKBOX_INTRA_INTERVAL - 1;
+    } else {
+        out[0] = BLACKBOX_FRAME_PREDICTED;
+        for (int i = 0; i < BLACKBOX_NUM_FIELDS; i++) {
+            len += blackbox_put_varint(&out[len], \
+                (int32_t) ((uint32_t) fields[i] - (uint32_t) encoder->previous[i]));
+        }
+        encoder->until_intra--;
+    }
+    out[len] = blackbox_crc8(out, len);
+    len++;
+
+    memcpy(encoder->previous, fields, sizeof(fields));
+    return len;
+}
+
+
+void blackbox_decoder_init(struct blackbox_decoder *decoder) {
+    memset(decoder, 0, sizeof(*decoder));
+}
+
+
+/* Decodes the frame at the start of 'in' into 'fields' (relative to
+ * 'previous' for a P frame), returning its length, 0 if it runs past 'len'
+ * or -1 if it is not a valid frame */
+static int blackbox_decode_frame(const int32_t *previous, const uint8_t *in, size_t len, \
+    int32_t *fields) {
+
+    size_t pos = 1;
+    for (int i = 0; i < BLACKBOX_NUM_FIELDS; i++) {
+        int32_t value;
+        size_t field_len = blackbox_get_varint(&in[pos], len - pos, &value);
+        if (field_len == 0) {
+            return (len - pos >= 5) ? -1 : 0;
+        }
+        pos += field_len;
+        fields[i] = (in[0] == BLACKBOX_FRAME_PREDICTED) \
+            ? (int32_t) ((uint32_t) previous[i] + (uint32_t) value) : value;
+    }
+
+    if (pos >= len) {
+        return 0;
+    }
+    if (blackbox_crc8(in, pos) != in[pos]) {
+        return -1;
+    }
+
+    return (int) pos + 1;
+}
+
+
+/* Whether the 'len' bytes at 'in' are where the log ends: a run of
+ * BLACKBOX_END_LEN erased bytes, or fewer if that is all there is. A single
+ * one is not enough, since it could be part of a varint being skipped over */
+static bool blackbox_is_end(const uint8_t *in, size_t len) {
+    for (size_t i = 0; i < len && i < BLACKBOX_END_LEN; i++) {
+        if (in[i] != BLACKBOX_FRAME_END) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/** Decodes the next frame from the 'len' bytes at 'in' into 'record',
+ * setting 'consumed' to how many bytes it used up. Anything that is not a
+ * valid frame (including everything after it, up to the next intra frame) is
+ * skipped and counted in 'decoder->skipped'.
+ *
+ * Returns BLACKBOX_DECODE_MORE if the frame runs past the end of 'in', in
+ * which case the caller should call again with the 'len' - 'consumed' bytes
+ * left plus more, and BLACKBOX_DECODE_END at the end of the log. */
+enum blackbox_decode_result blackbox_decode(struct blackbox_decoder *decoder, \
+    const uint8_t *in, size_t len, size_t *consumed, struct blackbox_record *record) {
+
+    size_t pos = 0;
+    while (pos < len) {
+        uint8_t marker = in[pos];
+        if (marker == BLACKBOX_FRAME_END && blackbox_is_end(&in[pos], len - pos)) {
+            *consumed = pos;
+            return BLACKBOX_DECODE_END;
+        }
+
+        int32_t fields[BLACKBOX_NUM_FIELDS];
+        int frame_len = -1;
+        if (marker == BLACKBOX_FRAME_INTRA \
+            || (marker == BLACKBOX_FRAME_PREDICTED && decoder->synced)) {
+            frame_len = blackbox_decode_frame(decoder->previous, &in[pos], len - pos, fields);
+        }
+        if (frame_len == 0) {
+            *consumed = pos;
+            return BLACKBOX_DECODE_MORE;
+        }
+        if (frame_len < 0) {
+            decoder->synced = 0;
+            decoder->skipped++;
+            pos++;
+            continue;
+        }
+
+        memcpy(decoder->previous, fields, sizeof(fields));
+        decoder->synced = 1;
+        blackbox_fields_to_record(fields, record);
+        *consumed = pos + (size_t) frame_len;
+        return BLACKBOX_DECODE_OK;
+    }
+
+    *consumed = pos;
+    return BLACKBOX_DECODE_MORE;
+}
@@ -0,0 +1,143 @@
+#ifndef __BLACKBOX_FORMAT_H_
+#define __BLACKBOX_FORMAT_H_
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "sensor-calibration.h"
+
+/* The blackbox log format. A log is one struct blackbox_header followed by a
+ * stream of frames, one per logged IMU sample, and ends at the start of
+ * erased flash (a run of 0xFF bytes) or the end of the file.
+ *
+ * Every frame holds the same BLACKBOX_NUM_FIELDS integer fields (see struct
+ * blackbox_record), starts with a marker byte saying how they are coded and
+ * ends with a CRC-8 of everything before it:
+ *
+ *   'I'  intra frame: every field as a zigzag varint. Written every
+ *        BLACKBOX_INTRA_INTERVAL frames and after any frame was dropped, so a
+ *        decoder can always pick the stream back up from the next one
+ *   'P'  predicted frame: every field as the zigzag varint of its change
+ *        since the previous frame
+ *
+ * A frame that fails its CRC is skipped along with every P frame after it up
+ * to the next I frame, so a corrupted log loses samples rather than decoding
+ * wrong ones. Most fields change by a few LSBs from one sample to the next,
+ * so a frame averages about 24 bytes against the 38 bytes of the record in
+ * memory.
+ *
+ * The header carries the calibrations the IMU samples were decoded with and
+ * the estimator's gains, so a log can be replayed through the estimator
+ * exactly as it ran. */
+
+
+#define BLACKBOX_MAGIC "BBX1"
+/* Bumped whenever the header or the fields change */
+#define BLACKBOX_VERSION 2
+
+#define BLACKBOX_FRAME_INTRA 'I'
+#define BLACKBOX_FRAME_PREDICTED 'P'
+/* Erased flash, which is where a log written to a partition ends */
+#define BLACKBOX_FRAME_END 0xFF
+/* How many erased bytes in a row end a log. A varint is at most 5 bytes and
+ * its last one is below 0x80, so no frame has more than 4 in a row */
+#define BLACKBOX_END_LEN 8
+
+/* How often a frame is coded on its own rather than against the previous one */
+#define BLACKBOX_INTRA_INTERVAL 64
+
+/* Fixed point scales of the logged values that are not already integers */
+#define BLACKBOX_QUATERNION_SCALE 16384.0f
+#define BLACKBOX_MAG_SCALE 10.0f
+#define BLACKBOX_MOTOR_SCALE 10000.0f
+
+#define BLACKBOX_NUM_FIELDS 18
+/* Marker, every field as a 5 byte varint and the CRC */
+#define BLACKBOX_FRAME_MAX_LEN (1 + BLACKBOX_NUM_FIELDS * 5 + 1)
+
+
+struct blackbox_header {
+    char magic[4];
+    uint16_t version;
+    uint16_t header_len;
+    /* When the log was started, by the logger's clock (esp_timer on the
+     * drone), in microseconds. The records' times count from here */
+    int64_t start_time_us;
+    /* Time between two logged samples */
+    float sample_period_s;
+    /* The attitude estimator's gains */
+    float estimator_kp;
+    float estimator_ki;
+    /* Raw IMU samples times these (see 'sensor_calibration_apply_raw()') give
+     * what the estimator was fed */
+    struct sensor_calibration gyro_calibration_raw;
+    struct sensor_calibration accel_calibration_raw;
+};
+
+/* One logged IMU sample and what the sensor task made of it */
+struct blackbox_record {
+    /* When the sample was taken, since the log was started. It wraps after
+     * about 71 minutes, which no log gets near (the drone's partition holds
+     * a couple of minutes), so decoders need not unwrap it, but should take
+     * differences between records modulo 2^32 all the same */
+    uint32_t time_us;
+    /* Raw LSM6DSOX sample */
+    int16_t g_raw[3];
+    int16_t a_raw[3];
+    /* Calibrated magnetometer reading, in BLACKBOX_MAG_SCALE-ths of a uT */
+    int16_t m[3];
+    /* Attitude estimate as a quaternion (w, x, y, z), in Q14 */
+    int16_t q[4];
+    /* Motor commands, from 0 to BLACKBOX_MOTOR_SCALE */
+    int16_t motor[4];
+};
+
+struct blackbox_encoder {
+    int32_t previous[BLACKBOX_NUM_FIELDS];
+    /* Frames until the next intra frame */
+    uint32_t until_intra;
+};
+
+struct blackbox_decoder {
+    int32_t previous[BLACKBOX_NUM_FIELDS];
+    /* Whether 'previous' holds a decoded frame for P frames to build on */
+    int synced;
+    /* Bytes skipped looking for an intra frame to pick the stream up from */
+    uint32_t skipped;
+};
+
+enum blackbox_decode_result {
+    BLACKBOX_DECODE_OK,
+    /* 'len' bytes are not enough for the next frame */
+    BLACKBOX_DECODE_MORE,
+    /* The log ends here */
+    BLACKBOX_DECODE_END,
+};
+
+
+void blackbox_header_init(struct blackbox_header *header, int64_t start_time_us, \
+    float sample_period_s, float estimator_kp, float estimator_ki, \
+    const struct sensor_calibration *gyro_calibration_raw, \
+    const struct sensor_calibration *accel_calibration_raw);
+
+bool blackbox_header_check(const struct blackbox_header *header);
+
+void blackbox_record_pack(struct blackbox_record *record, uint32_t time_us, \
+    const int16_t *g_raw, const int16_t *a_raw, const float *m_ut, const float *q, \
+    const float *motor);
+
+void blackbox_encoder_init(struct blackbox_encoder *encoder);
+
+void blackbox_encoder_resync(struct blackbox_encoder *encoder);
+
+size_t blackbox_encode(struct blackbox_encoder *encoder, const struct blackbox_record *record, \
+    uint8_t *out);
+
+void blackbox_decoder_init(struct blackbox_decoder *decoder);
+
+enum blackbox_decode_result blackbox_decode(struct blackbox_decoder *decoder, \
+    const uint8_t *in, size_t len, size_t *consumed, struct blackbox_record *record);
+
+
+#endif
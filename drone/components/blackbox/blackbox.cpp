@@ -0,0 +1,226 @@
+#include <string.h>
+
+#include "esp_err.h"
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "blackbox.h"
+#include "blackbox-format.h"
+
+
+/* Moves 'bb' from state 'from' to 'to', returning false if it was not in
+ * 'from' */
+static bool blackbox_transition(struct blackbox *bb, uint32_t from, uint32_t to) {
+    return __atomic_compare_exchange_n(&bb->state, &from, to, false, __ATOMIC_ACQ_REL, \
+        __ATOMIC_ACQUIRE);
+}
+
+
+/* Erases the whole partition, a chunk at a time so that the other tasks get
+ * to run in between */
+static esp_err_t blackbox_erase(struct blackbox *bb) {
+    size_t size = bb->partition->size;
+    for (size_t offset = 0; offset < size; offset += BLACKBOX_ERASE_CHUNK_LEN) {
+        size_t len = (size - offset < BLACKBOX_ERASE_CHUNK_LEN) ? size - offset \
+            : BLACKBOX_ERASE_CHUNK_LEN;
+        esp_err_t err = esp_partition_erase_range(bb->partition, offset, len);
+        if (err != ESP_OK) {
+            return err;
+        }
+        vTaskDelay(1);
+    }
+
+    return ESP_OK;
+}
+
+
+/* Appends 'len' bytes of 'data' to the log, BLACKBOX_WRITE_CHUNK_LEN at a
+ * time. Whatever does not fit in the partition is cut off, and
+ * ESP_ERR_NO_MEM returned */
+static esp_err_t blackbox_append(struct blackbox *bb, const uint8_t *data, size_t len) {
+    esp_err_t result = ESP_OK;
+    if (len > bb->partition->size - bb->offset) {
+        len = bb->partition->size - bb->offset;
+        result = ESP_ERR_NO_MEM;
+    }
+
+    for (size_t done = 0; done < len; done += BLACKBOX_WRITE_CHUNK_LEN) {
+        size_t chunk = (len - done < BLACKBOX_WRITE_CHUNK_LEN) ? len - done \
+            : BLACKBOX_WRITE_CHUNK_LEN;
+        esp_err_t err = esp_partition_write(bb->partition, bb->offset, &data[done], chunk);
+        if (err != ESP_OK) {
+            return err;
+        }
+        bb->offset += chunk;
+        bb->bytes += chunk;
+        taskYIELD();
+    }
+
+    return result;
+}
+
+
+/* The writer task. It erases the partition when a log is started, writes
+ * out buffers in the order the logging task hands them over, and finishes
+ * off a log once the last one is written */
+static void blackbox_writer(void *arg) {
+    struct blackbox *bb = (struct blackbox *) arg;
+    /* Buffers are handed over alternately, starting with the first */
+    int next = 0;
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        if (__atomic_load_n(&bb->state, __ATOMIC_ACQUIRE) == BLACKBOX_ERASING) {
+            bb->offset = 0;
+            bb->bytes = 0;
+            bb->error = blackbox_erase(bb);
+            if (bb->error == ESP_OK) {
+                bb->error = blackbox_append(bb, (const uint8_t *) &bb->header, \
+                    sizeof(bb->header));
+            }
+            next = 0;
+            bb->pending[0] = 0;
+            bb->pending[1] = 0;
+            __atomic_store_n(&bb->state, (bb->error == ESP_OK) ? BLACKBOX_STARTING \
+                : BLACKBOX_FULL, __ATOMIC_RELEASE);
+            continue;
+        }
+
+        size_t len;
+        while ((len = __atomic_load_n(&bb->pending[next], __ATOMIC_ACQUIRE)) != 0) {
+            if (__atomic_load_n(&bb->state, __ATOMIC_ACQUIRE) != BLACKBOX_FULL) {
+                esp_err_t err = blackbox_append(bb, bb->buffers[next], len);
+                if (err != ESP_OK) {
+                    bb->error = err;
+                    __atomic_store_n(&bb->state, BLACKBOX_FULL, __ATOMIC_RELEASE);
+                }
+            }
+            __atomic_store_n(&bb->pending[next], 0, __ATOMIC_RELEASE);
+            next ^= 1;
+        }
+
+        if (__atomic_load_n(&bb->pending[next], __ATOMIC_ACQUIRE) == 0) {
+            blackbox_transition(bb, BLACKBOX_FLUSHING, BLACKBOX_IDLE);
+        }
+    }
+}
+
+
+/** Gets 'bb' ready to log to the data partition called 'partition_label',
+ * and starts its writer task at 'writer_priority' on 'writer_core'. */
+esp_err_t blackbox_init(struct blackbox *bb, const char *partition_label, \
+    UBaseType_t writer_priority, BaseType_t writer_core) {
+
+    memset(bb, 0, sizeof(*bb));
+    bb->state = BLACKBOX_IDLE;
+    bb->partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, \
+        ESP_PARTITION_SUBTYPE_ANY, partition_label);
+    if (bb->partition == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    /* The writer's stack is part of 'bb', so nothing is allocated */
+    bb->writer = xTaskCreateStaticPinnedToCore(blackbox_writer, "blackbox", \
+        BLACKBOX_WRITER_STACK_SIZE, bb, writer_priority, bb->writer_stack, \
+        &bb->writer_buffer, writer_core);
+    if (bb->writer == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return ESP_OK;
+}
+
+
+/** Starts a new log beginning with 'header', replacing the old one. The
+ * partition is erased first, in the background, which takes a few seconds
+ * and stalls both cores for a moment at a time, so this is for the ground
+ * only. Returns ESP_ERR_INVALID_STATE if a log is already being written. */
+esp_err_t blackbox_start(struct blackbox *bb, const struct blackbox_header *header) {
+    uint32_t state = __atomic_load_n(&bb->state, __ATOMIC_ACQUIRE);
+    if (state != BLACKBOX_IDLE && state != BLACKBOX_FULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    /* The writer only looks at the header once it sees the new state */
+    bb->header = *header;
+    if (!blackbox_transition(bb, state, BLACKBOX_ERASING)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xTaskNotifyGive(bb->writer);
+
+    return ESP_OK;
+}
+
+
+/** Ends the log being written. What is left in the logging task's buffer is
+ * written out the next time it calls 'blackbox_log()'. Returns
+ * ESP_ERR_INVALID_STATE if no log is being written. */
+esp_err_t blackbox_stop(struct blackbox *bb) {
+    /* Nothing has been logged yet if the logging task has not seen the log
+     * start, so there is nothing to hand over either */
+    if (blackbox_transition(bb, BLACKBOX_LOGGING, BLACKBOX_STOPPING) \
+        || blackbox_transition(bb, BLACKBOX_STARTING, BLACKBOX_IDLE)) {
+        return ESP_OK;
+    }
+
+    return ESP_ERR_INVALID_STATE;
+}
+
+
+enum blackbox_state blackbox_get_state(const struct blackbox *bb) {
+    return (enum blackbox_state) __atomic_load_n(&bb->state, __ATOMIC_ACQUIRE);
+}
+
+
+/** Adds 'record' to the log, if one is being written. Never blocks, and
+ * must only ever be called by one task. */
+void blackbox_log(struct blackbox *bb, const struct blackbox_record *record) {
+    uint32_t state = __atomic_load_n(&bb->state, __ATOMIC_ACQUIRE);
+
+    if (state == BLACKBOX_STARTING) {
+        blackbox_encoder_init(&bb->encoder);
+        bb->active = 0;
+        bb->fill = 0;
+        bb->records = 0;
+        bb->dropped = 0;
+        if (!blackbox_transition(bb, BLACKBOX_STARTING, BLACKBOX_LOGGING)) {
+            return;
+        }
+    } else if (state == BLACKBOX_STOPPING) {
+        /* Hand over whatever is left, even if it is not a full buffer */
+        if (bb->fill > 0) {
+            __atomic_store_n(&bb->pending[bb->active], bb->fill, __ATOMIC_RELEASE);
+            bb->active ^= 1;
+            bb->fill = 0;
+        }
+        blackbox_transition(bb, BLACKBOX_STOPPING, BLACKBOX_FLUSHING);
+        xTaskNotifyGive(bb->writer);
+        return;
+    } else if (state != BLACKBOX_LOGGING) {
+        return;
+    }
+
+    uint8_t frame[BLACKBOX_FRAME_MAX_LEN];
+    size_t len = blackbox_encode(&bb->encoder, record, frame);
+
+    if (bb->fill + len > BLACKBOX_BUFFER_LEN) {
+        int other = bb->active ^ 1;
+        if (__atomic_load_n(&bb->pending[other], __ATOMIC_ACQUIRE) != 0) {
+            /* The writer is still busy with the other buffer. Drop this
+             * record, and code the next one so it does not depend on it */
+            bb->dropped++;
+            blackbox_encoder_resync(&bb->encoder);
+            return;
+        }
+        __atomic_store_n(&bb->pending[bb->active], bb->fill, __ATOMIC_RELEASE);
+        xTaskNotifyGive(bb->writer);
+        bb->active = other;
+        bb->fill = 0;
+    }
+
+    memcpy(&bb->buffers[bb->active][bb->fill], frame, len);
+    bb->fill += len;
+    bb->records++;
+}
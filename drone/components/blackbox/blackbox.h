@@ -0,0 +1,117 @@
+#ifndef __BLACKBOX_H_
+#define __BLACKBOX_H_
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "blackbox-format.h"
+
+/* Writes a blackbox log (see blackbox-format.h) to a flash partition
+ * without holding up whoever is logging.
+ *
+ * The logging task codes each record into one of two RAM buffers. When that
+ * buffer fills up it is handed to a low priority writer task, and logging
+ * carries on into the other one. If the writer has not finished with the
+ * other buffer by the time the current one fills, records are dropped (and
+ * counted) rather than waited for, and the stream picks up again with an
+ * intra frame.
+ *
+ * Writing to flash stalls code running from flash on both cores, so the
+ * writer writes one page at a time, yielding in between. Erasing stalls for
+ * much longer, so the whole partition is erased when a log is started, which
+ * should only be done on the ground. */
+
+
+/* The size of each of the two buffers. One flash sector */
+#define BLACKBOX_BUFFER_LEN 4096
+/* How much is written to flash in one go */
+#define BLACKBOX_WRITE_CHUNK_LEN 256
+/* How much is erased in one go while starting a log */
+#define BLACKBOX_ERASE_CHUNK_LEN 65536
+#define BLACKBOX_WRITER_STACK_SIZE 4096
+
+enum blackbox_state {
+    /* Not logging */
+    BLACKBOX_IDLE,
+    /* 'blackbox_start()' was called, and the writer is erasing the partition */
+    BLACKBOX_ERASING,
+    /* The partition is ready, and the next 'blackbox_log()' starts logging */
+    BLACKBOX_STARTING,
+    BLACKBOX_LOGGING,
+    /* 'blackbox_stop()' was called, and the next 'blackbox_log()' hands over
+     * what is left in its buffer */
+    BLACKBOX_STOPPING,
+    /* The last buffer has been handed over, and the writer goes back to idle
+     * once it has written it */
+    BLACKBOX_FLUSHING,
+    /* The partition filled up, or writing to it failed */
+    BLACKBOX_FULL,
+};
+
+struct blackbox {
+    const esp_partition_t *partition;
+    TaskHandle_t writer;
+    StaticTask_t writer_buffer;
+    StackType_t writer_stack[BLACKBOX_WRITER_STACK_SIZE];
+    uint32_t state;
+
+    /* Owned by the logging task */
+    struct blackbox_encoder encoder;
+    uint8_t buffers[2][BLACKBOX_BUFFER_LEN];
+    int active;
+    size_t fill;
+
+    /* How many bytes of each buffer are waiting to be written. 0 while the
+     * logging task owns it, the writer's (until it sets it back to 0)
+     * otherwise */
+    size_t pending[2];
+
+    /* Owned by the writer */
+    struct blackbox_header header;
+    size_t offset;
+    esp_err_t error;
+
+    /* Counters, written by whichever task the comment says */
+    uint32_t records;  /* logging task */
+    uint32_t dropped;  /* logging task */
+    uint32_t bytes;  /* writer */
+};
+
+
+esp_err_t blackbox_init(struct blackbox *bb, const char *partition_label, \
+    UBaseType_t writer_priority, BaseType_t writer_core);
+
+esp_err_t blackbox_start(struct blackbox *bb, const struct blackbox_header *header);
+
+esp_err_t blackbox_stop(struct blackbox *bb);
+
+enum blackbox_state blackbox_get_state(const struct blackbox *bb);
+
+void blackbox_log(struct blackbox *bb, const struct blackbox_record *record);
+
+
+/** Whether 'blackbox_log()' would do anything with a record right now. Lets
+ * the logging task skip packing one when it would not. Once it says yes,
+ * the logging task can read the log's start time with
+ * 'blackbox_start_time_us()'. */
+static inline bool blackbox_wants_records(const struct blackbox *bb) {
+    uint32_t state = __atomic_load_n(&bb->state, __ATOMIC_ACQUIRE);
+    return state == BLACKBOX_STARTING || state == BLACKBOX_LOGGING \
+        || state == BLACKBOX_STOPPING;
+}
+
+
+
+/** When the log being written was started, which its records' times count
+ * from. Only meaningful while 'blackbox_wants_records()'. */
+static inline int64_t blackbox_start_time_us(const struct blackbox *bb) {
+    return bb->header.start_time_us;
+}
+
+#endif
@@ -1,79 +1,113 @@
 #include <inttypes.h>
+#include <string.h>
 
-#include "driver/i2c_master.h"
+#include "esp_timer.h"
 
 #include "esp32-i2c-lis3mdl.h"
 #include "esp32-i2c-lsm6dsox-lis3mdl-common.h"
 
 
-/** Takes a struct i2c_lis3mdl and sets up the device with set defaults,
- * bringing the device to a point where we can start reading data from it.
+const struct lis3mdl_config lis3mdl_profile_flight_155hz = {
+    .name = "flight-155Hz",
+    .om = LIS3MDL_OM_ULTRAHIGHPERFORMANCE,
+    .omz = LIS3MDL_OMZ_ULTRAHIGHPERFORMANCE,
+    .do_bits = LIS3MDL_DO_80Hz,
+    .fast_odr = 1,
+    .fs = LIS3MDL_FS_4GAUSS,
+    .md = LIS3MDL_MD_CONTINUOUSCONVERSION,
+    .temp_en = 0,
+    .bdu = 1,
+};
+
+const struct lis3mdl_config lis3mdl_profile_bench_low_power = {
+    .name = "bench-low-power",
+    .om = LIS3MDL_OM_LOWPOWER,
+    .omz = LIS3MDL_OMZ_LOWPOWER,
+    .do_bits = LIS3MDL_DO_10Hz,
+    .fast_odr = 0,
+    .fs = LIS3MDL_FS_4GAUSS,
+    .md = LIS3MDL_MD_CONTINUOUSCONVERSION,
+    .temp_en = 0,
+    .bdu = 1,
+};
+
+static const struct lis3mdl_config *lis3mdl_profiles[] = {
+    &lis3mdl_profile_flight_155hz,
+    &lis3mdl_profile_bench_low_power,
+};
+
+
+/** Returns the built in configuration profile called 'name', or NULL if there
+ * is no such profile. */
+const struct lis3mdl_config *esp_i2c_lis3mdl_find_profile(const char *name) {
+    for (size_t i = 0; i < sizeof(lis3mdl_profiles) / sizeof(lis3mdl_profiles[0]); i++) {
+        if (strcmp(lis3mdl_profiles[i]->name, name) == 0) {
+            return lis3mdl_profiles[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/** Takes a struct i2c_lis3mdl and sets up the device as described by
+ * 'config', bringing the device to a point where we can start reading data
+ * from it.
+ *
+ * All of the control registers (CTRL_REG1 through CTRL_REG5) are written in a
+ * single burst and then read back in a single burst. The sensitivity is
+ * derived from what was read back, so it always describes what the device is
+ * actually doing. Returns ESP_ERR_INVALID_RESPONSE if the read back does not
+ * match what was written.
  *
  * Note: this function requires that the 'i2c_lis3mdl' argument has
- * its 'i2c_handle' member set correctly with an 'i2c_master_dev_handle_t' that
- * has been added to the i2c master bus using 'i2c_master_bus_add_device()'.
+ * its 'bus' member initialised, e.g. with 'sensor_bus_init_i2c()' for a device
+ * that has been added to the i2c master bus using 'i2c_master_bus_add_device()'.
  */
-void esp_i2c_lis3mdl_begin(struct i2c_lis3mdl *i2c_lis3mdl) {
+esp_err_t esp_i2c_lis3mdl_begin(struct i2c_lis3mdl *i2c_lis3mdl, \
+    const struct lis3mdl_config *config) {
     /* {{{ */
-    printf("starting lis3mdl initialization (1)\n");
-    /* 1. Set X and Y axes to high-performance mode, set fast ODR on */
-    /* 1a. Read the current value for the CTRL_REG1 register */
-    uint8_t buf = CTRL_REG1;
-    struct lis3mdl_ctrl_reg1 ctrl_reg1_content;
-    ESP_ERROR_CHECK(i2c_master_transmit_receive(*(i2c_lis3mdl->i2c_handle), &buf, \
-        sizeof(buf), (uint8_t *)&ctrl_reg1_content, 1, -1));
-    /* 1b. Set the OM bits of the CTRL_REG1 register (datasheet page 20) */
-	ctrl_reg1_content.om = LIS3MDL_OM_HIGHPERFORMANCE;
-    /* 1c. Enable FAST_ODR in the CTRL_REG1 register (datasheet page 20) */
-	ctrl_reg1_content.fast_odr = 1;
-    /* 1d. Write the new value back to the CTRL_REG1 register */
-    uint8_t sub_and_data[2];
-    sub_and_data[0] = buf;
-    sub_and_data[1] = *((uint8_t *) &ctrl_reg1_content);
-    ESP_ERROR_CHECK(i2c_master_transmit(*(i2c_lis3mdl->i2c_handle), &sub_and_data[0], \
-        sizeof(sub_and_data), -1));
-    printf("lis3mdl initialization (2)\n");
-
-    /* 2. Set Z axis to high-performance mode */
-    /* 2a. Read the current value for the CTRL_REG4 register */
-    buf = CTRL_REG4;
-    struct lis3mdl_ctrl_reg4 ctrl_reg4_content;
-    ESP_ERROR_CHECK(i2c_master_transmit_receive(*(i2c_lis3mdl->i2c_handle), &buf, \
-        sizeof(buf), (uint8_t *)&ctrl_reg4_content, 1, -1));
-    /* 2b. Set the OMZ bits of the CTRL_REG4 register (datasheet page 22) */
-	ctrl_reg4_content.omz = LIS3MDL_OMZ_HIGHPERFORMANCE;
-    /* 2c. Write the new value back to the CTRL_REG4 register */
-    sub_and_data[0] = buf;
-    sub_and_data[1] = *((uint8_t *) &ctrl_reg4_content);
-    ESP_ERROR_CHECK(i2c_master_transmit(*(i2c_lis3mdl->i2c_handle), &sub_and_data[0], \
-        sizeof(sub_and_data), -1));
-    printf("lis3mdl initialization (3)\n");
-
-    /* 3. Set system operating mode to continuous conversion */
-    /* 3a. Read the current value for the CTRL_REG3 register */
-    buf = CTRL_REG3;
-    struct lis3mdl_ctrl_reg3 ctrl_reg3_content;
-    ESP_ERROR_CHECK(i2c_master_transmit_receive(*(i2c_lis3mdl->i2c_handle), &buf, \
-        sizeof(buf), (uint8_t *)&ctrl_reg3_content, 1, -1));
-    /* 3b. Set the MD bits of the CTRL_REG3 register (datasheet page 21) */
-	ctrl_reg3_content.md = LIS3MDL_MD_CONTINUOUSCONVERSION;
-    /* 3c. Write the new value back to the CTRL_REG3 register */
-    sub_and_data[0] = buf;
-    sub_and_data[1] = *((uint8_t *) &ctrl_reg3_content);
-    ESP_ERROR_CHECK(i2c_master_transmit(*(i2c_lis3mdl->i2c_handle), &sub_and_data[0], \
-        sizeof(sub_and_data), -1));
-    printf("lis3mdl initialization (4)\n");
-
-    /* 4. Get and store sensor sensitivities */
-    /* 4a. Read CTRL_REG2 register to get FS in order to determine the
-     * magnetometer sensitivity */
-    buf = CTRL_REG2;
-    struct lis3mdl_ctrl_reg2 ctrl_reg2_content;
-    ESP_ERROR_CHECK(i2c_master_transmit_receive(*(i2c_lis3mdl->i2c_handle), &buf, \
-        sizeof(buf), (uint8_t *)&ctrl_reg2_content, 1, -1));
-    printf("lis3mdl initialization (5)\n");
-
-    /* 4b. Set the sensitivity multiplier for the LIS3MDL (datasheet page 21) */
+    /* 1. Build the contents of every control register from 'config' */
+    /* 1a. X and Y axes operating mode and ODR (datasheet page 20) */
+    struct lis3mdl_ctrl_reg1 ctrl_reg1_content = {};
+    ctrl_reg1_content.om = config->om;
+    ctrl_reg1_content.do_bits = config->do_bits;
+    ctrl_reg1_content.fast_odr = config->fast_odr;
+    ctrl_reg1_content.temp_en = config->temp_en;
+    /* 1b. Full scale (datasheet page 21) */
+    struct lis3mdl_ctrl_reg2 ctrl_reg2_content = {};
+    ctrl_reg2_content.fs = config->fs;
+    /* 1c. System operating mode (datasheet page 21) */
+    struct lis3mdl_ctrl_reg3 ctrl_reg3_content = {};
+    ctrl_reg3_content.md = config->md;
+    /* 1d. Z axis operating mode (datasheet page 22) */
+    struct lis3mdl_ctrl_reg4 ctrl_reg4_content = {};
+    ctrl_reg4_content.omz = config->omz;
+    /* 1e. Block data update */
+    struct lis3mdl_ctrl_reg5 ctrl_reg5_content = {};
+    ctrl_reg5_content.bdu = config->bdu;
+
+    /* 2. Write CTRL_REG1 through CTRL_REG5 in one burst */
+    uint8_t ctrl[LIS3MDL_CTRL_REG_COUNT];
+    ctrl[CTRL_REG1 - CTRL_REG1] = *((uint8_t *) &ctrl_reg1_content);
+    ctrl[CTRL_REG2 - CTRL_REG1] = *((uint8_t *) &ctrl_reg2_content);
+    ctrl[CTRL_REG3 - CTRL_REG1] = *((uint8_t *) &ctrl_reg3_content);
+    ctrl[CTRL_REG4 - CTRL_REG1] = *((uint8_t *) &ctrl_reg4_content);
+    ctrl[CTRL_REG5 - CTRL_REG1] = *((uint8_t *) &ctrl_reg5_content);
+    ESP_ERROR_CHECK(sensor_bus_write(&i2c_lis3mdl->bus, CTRL_REG1 | LIS3MDL_I2C_AUTO_INCREMENT, \
+        ctrl, sizeof(ctrl)));
+
+    /* 3. Read them all back in one burst and make sure they took */
+    uint8_t readback[LIS3MDL_CTRL_REG_COUNT];
+    ESP_ERROR_CHECK(sensor_bus_read(&i2c_lis3mdl->bus, CTRL_REG1 | LIS3MDL_I2C_AUTO_INCREMENT, \
+        readback, sizeof(readback)));
+    if (memcmp(readback, ctrl, sizeof(readback)) != 0) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    /* 4. Set the sensitivity multiplier for the LIS3MDL from what the device
+     * reported (datasheet page 21) */
+    memcpy(&ctrl_reg2_content, &readback[CTRL_REG2 - CTRL_REG1], 1);
     switch (ctrl_reg2_content.fs) {
         case LIS3MDL_FS_4GAUSS:
             i2c_lis3mdl->sensitivity = LIS3MDL_SENSITIVITY_FS_4GAUSS;
@@ -90,38 +124,75 @@ void esp_i2c_lis3mdl_begin(struct i2c_lis3mdl *i2c_lis3mdl) {
         default:
             i2c_lis3mdl->sensitivity = LIS3MDL_SENSITIVITY_FS_4GAUSS;
     }
-    printf("lis3mdl initialization (6)\n");
+    i2c_lis3mdl->scale_ut = LIS3MDL_GAUSS_TO_UT / i2c_lis3mdl->sensitivity;
+
+    return ESP_OK;
     /* }}} */
 }
 
 
-void esp_i2c_lis3mdl_get_data(struct i2c_lis3mdl *i2c_lis3mdl, \
+/** Reads a sample into 'outxyz' (in uT). Returns the bus error if the
+ * read failed, in which case 'outxyz' is left alone. */
+esp_err_t esp_i2c_lis3mdl_get_data(struct i2c_lis3mdl *i2c_lis3mdl, \
     float *outxyz) {
 
+    esp_err_t err = esp_i2c_lis3mdl_get_data_start(i2c_lis3mdl);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return esp_i2c_lis3mdl_get_data_finish(i2c_lis3mdl, outxyz);
+}
+
+
+/** Starts reading a sample, returning as soon as the read is queued on the
+ * bus. Collect the sample with 'esp_i2c_lis3mdl_get_data_finish()'. */
+esp_err_t esp_i2c_lis3mdl_get_data_start(struct i2c_lis3mdl *i2c_lis3mdl) {
+    const int64_t drdy_time_us = i2c_lis3mdl->drdy.time_us;
+    i2c_lis3mdl->time_us = drdy_time_us ? drdy_time_us : esp_timer_get_time();
+
     /* Get both the lower 8 bits and the higher 8 bits for x, y, and z by
      * requesting the lower 8 bits for the x axis data, but reading for 6 bytes */
-    uint8_t buf = OUTX_L;
-    union threeaxes outxyz_raw;
-    ESP_ERROR_CHECK(i2c_master_transmit_receive(*(i2c_lis3mdl->i2c_handle), &buf, \
-        sizeof(buf), (uint8_t *)&outxyz_raw.u16, 6, -1));
+    return sensor_bus_read_start(&i2c_lis3mdl->bus, OUTX_L | LIS3MDL_I2C_AUTO_INCREMENT, \
+        (uint8_t *)&i2c_lis3mdl->raw.u16, 6);
+}
 
-    outxyz[0] = ((float) outxyz_raw.i16[0]) / i2c_lis3mdl->sensitivity;
-    outxyz[1] = ((float) outxyz_raw.i16[1]) / i2c_lis3mdl->sensitivity;
-    outxyz[2] = ((float) outxyz_raw.i16[2]) / i2c_lis3mdl->sensitivity;
 
-    return;
+/** Waits for the read started by 'esp_i2c_lis3mdl_get_data_start()' and
+ * stores the sample in 'outxyz', and when it was taken in
+ * 'i2c_lis3mdl->time_us'. If the read failed (or was never started),
+ * returns the bus error and leaves 'outxyz' alone, so a flight loop can carry
+ * on with the last good sample. */
+esp_err_t esp_i2c_lis3mdl_get_data_finish(struct i2c_lis3mdl *i2c_lis3mdl, float *outxyz) {
+    esp_err_t err = sensor_bus_read_finish(&i2c_lis3mdl->bus);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    esp_i2c_lis3mdl_convert(i2c_lis3mdl, i2c_lis3mdl->raw.i16, outxyz);
+
+    return ESP_OK;
+}
+
+
+/** Converts a raw sample read some other way (e.g. by the LSM6DSOX's sensor
+ * hub) into 'outxyz' (in uT). */
+void esp_i2c_lis3mdl_convert(const struct i2c_lis3mdl *i2c_lis3mdl, const int16_t *raw, \
+    float *outxyz) {
+
+    outxyz[0] = ((float) raw[0]) * i2c_lis3mdl->scale_ut;
+    outxyz[1] = ((float) raw[1]) * i2c_lis3mdl->scale_ut;
+    outxyz[2] = ((float) raw[2]) * i2c_lis3mdl->scale_ut;
 }
 
 
 float esp_i2c_lis3mdl_get_x(struct i2c_lis3mdl *i2c_lis3mdl) {
     /* Get both the lower 8 bits and the higher 8 bits from their respective
      * registers by requesting the lower 8 bits, but reading for 2 bytes */
-    uint8_t buf = OUTX_L;
-    uint16_t outx;
-    ESP_ERROR_CHECK(i2c_master_transmit_receive(*(i2c_lis3mdl->i2c_handle), &buf, \
-        sizeof(buf), (uint8_t *)&outx, 2, -1));
+    int16_t outx;
+    ESP_ERROR_CHECK(sensor_bus_read(&i2c_lis3mdl->bus, OUTX_L | LIS3MDL_I2C_AUTO_INCREMENT, \
+        (uint8_t *)&outx, 2));
 
-    float ret = ((float) outx) / i2c_lis3mdl->sensitivity;
+    float ret = ((float) outx) * i2c_lis3mdl->scale_ut;
 
     return ret;
 }
@@ -130,12 +201,11 @@ float esp_i2c_lis3mdl_get_x(struct i2c_lis3mdl *i2c_lis3mdl) {
 float esp_i2c_lis3mdl_get_y(struct i2c_lis3mdl *i2c_lis3mdl) {
     /* Get both the lower 8 bits and the higher 8 bits from their respective
      * registers by requesting the lower 8 bits, but reading for 2 bytes */
-    uint8_t buf = OUTY_L;
-    uint16_t outy;
-    ESP_ERROR_CHECK(i2c_master_transmit_receive(*(i2c_lis3mdl->i2c_handle), &buf, \
-        sizeof(buf), (uint8_t *)&outy, 2, -1));
+    int16_t outy;
+    ESP_ERROR_CHECK(sensor_bus_read(&i2c_lis3mdl->bus, OUTY_L | LIS3MDL_I2C_AUTO_INCREMENT, \
+        (uint8_t *)&outy, 2));
 
-    float ret = ((float) outy) / i2c_lis3mdl->sensitivity;
+    float ret = ((float) outy) * i2c_lis3mdl->scale_ut;
 
     return ret;
 }
@@ -144,12 +214,32 @@ float esp_i2c_lis3mdl_get_y(struct i2c_lis3mdl *i2c_lis3mdl) {
 float esp_i2c_lis3mdl_get_z(struct i2c_lis3mdl *i2c_lis3mdl) {
     /* Get both the lower 8 bits and the higher 8 bits from their respective
      * registers by requesting the lower 8 bits, but reading for 2 bytes */
-    uint8_t buf = OUTZ_L;
-    uint16_t outz;
-    ESP_ERROR_CHECK(i2c_master_transmit_receive(*(i2c_lis3mdl->i2c_handle), &buf, \
-        sizeof(buf), (uint8_t *)&outz, 2, -1));
+    int16_t outz;
+    ESP_ERROR_CHECK(sensor_bus_read(&i2c_lis3mdl->bus, OUTZ_L | LIS3MDL_I2C_AUTO_INCREMENT, \
+        (uint8_t *)&outz, 2));
 
-    float ret = ((float) outz) / i2c_lis3mdl->sensitivity;
+    float ret = ((float) outz) * i2c_lis3mdl->scale_ut;
 
     return ret;
 }
+
+
+/** Takes a struct i2c_lis3mdl which has already been set up with
+ * 'esp_i2c_lis3mdl_begin()' and has its 'drdy' member filled in, and starts
+ * delivering the DRDY interrupts to 'i2c_lis3mdl->drdy.task' as task
+ * notifications.
+ *
+ * The LIS3MDL always drives DRDY, so there is nothing to configure on the
+ * sensor itself. DRDY stays high until the output registers are read, after
+ * which the task must call 'esp_i2c_lis3mdl_drdy_rearm()'.
+ */
+void esp_i2c_lis3mdl_drdy_begin(struct i2c_lis3mdl *i2c_lis3mdl) {
+    drdy_irq_begin(&i2c_lis3mdl->drdy);
+}
+
+
+/** Re-enables the DRDY interrupt after the task notified by it has read the
+ * data that raised it. */
+void esp_i2c_lis3mdl_drdy_rearm(struct i2c_lis3mdl *i2c_lis3mdl) {
+    drdy_irq_rearm(&i2c_lis3mdl->drdy);
+}
@@ -1,10 +1,13 @@
 #ifndef __ESP32_I2C_LIS3MDL_H_
 #define __ESP32_I2C_LIS3MDL_H_
 
-#include "driver/i2c_master.h"
+#include "sensor-bus.h"
 
+#include "esp32-i2c-lsm6dsox-lis3mdl-common.h"
 
-#define CTRL_REG1 0x20 // datasheet page 18
+
+#define LIS3MDL_WHO_AM_I 0x0F // datasheet page 18
+#define CTRL_REG1 0x20 // ^
 #define CTRL_REG2 0x21 // ^
 #define CTRL_REG3 0x22 // ^
 #define CTRL_REG4 0x23 // ^
@@ -15,10 +18,24 @@
 #define OUTY_H 0x2B // ^
 #define OUTZ_L 0x2C // ^
 #define OUTZ_H 0x2D // ^
+/* Over I2C, the LIS3MDL only auto-increments the register address during a
+ * multi-byte read or write if the MSb of the sub-address is set (see the I2C
+ * operation section of the datasheet) */
+#define LIS3MDL_I2C_AUTO_INCREMENT 0x80
+/* Over SPI, that bit is the read/write bit instead, and it is the MS bit
+ * (bit 6) of the address byte that asks for the address to auto-increment.
+ * Pass this as the 'multi_byte_bit' of 'sensor_bus_init_spi()' */
+#define LIS3MDL_SPI_AUTO_INCREMENT 0x40
+/* The number of control registers, CTRL_REG1 through CTRL_REG5, which are
+ * written (and read back) in one burst by 'esp_i2c_lis3mdl_begin()' */
+#define LIS3MDL_CTRL_REG_COUNT 5
+/* What LIS3MDL_WHO_AM_I always reads back as (datasheet page 20) */
+#define LIS3MDL_WHO_AM_I_VALUE 0x3D
 #define LIS3MDL_SENSITIVITY_FS_4GAUSS 6842.0f // datasheet page 4
 #define LIS3MDL_SENSITIVITY_FS_8GAUSS 3421.0f // ^
 #define LIS3MDL_SENSITIVITY_FS_12GAUSS 2281.0f // ^
 #define LIS3MDL_SENSITIVITY_FS_16GAUSS 1711.0f // ^
+#define LIS3MDL_GAUSS_TO_UT 100.0f
 
 
 struct lis3mdl_ctrl_reg1 {
@@ -29,6 +46,17 @@ struct lis3mdl_ctrl_reg1 {
     uint8_t temp_en:1;
 };
 
+typedef enum {
+    LIS3MDL_DO_0Hz625 = 0,
+    LIS3MDL_DO_1Hz25  = 1,
+    LIS3MDL_DO_2Hz5   = 2,
+    LIS3MDL_DO_5Hz    = 3,
+    LIS3MDL_DO_10Hz   = 4,
+    LIS3MDL_DO_20Hz   = 5,
+    LIS3MDL_DO_40Hz   = 6,
+    LIS3MDL_DO_80Hz   = 7,
+} lis3mdl_do_t;
+
 typedef enum {
     LIS3MDL_OM_LOWPOWER             = 0,
     LIS3MDL_OM_MEDIUMPERFORMANCE    = 1,
@@ -85,15 +113,68 @@ typedef enum {
 } lis3mdl_omz_t;
 
 
+struct lis3mdl_ctrl_reg5 {
+    uint8_t not_used1:6;
+    uint8_t bdu:1;
+    uint8_t fast_read:1;
+};
+
+
+/* Everything 'esp_i2c_lis3mdl_begin()' needs to know to bring up the
+ * magnetometer. See the 'lis3mdl_profile_*' definitions for ready made
+ * configurations */
+struct lis3mdl_config {
+    const char *name;
+    /* Operating mode of the X and Y axes (CTRL_REG1) and Z axis (CTRL_REG4) */
+    lis3mdl_om_t om;
+    lis3mdl_omz_t omz;
+    /* ODR. With 'fast_odr' set, 'do_bits' is ignored and the ODR is
+     * determined by the operating mode instead (datasheet page 20) */
+    lis3mdl_do_t do_bits;
+    uint8_t fast_odr;
+    lis3mdl_fs_t fs;
+    lis3mdl_md_t md;
+    uint8_t temp_en;
+    uint8_t bdu;
+};
+
+/* Ultra-high-performance mode with FAST_ODR, giving 155Hz. Meant for flight */
+extern const struct lis3mdl_config lis3mdl_profile_flight_155hz;
+/* Low-power mode at 10Hz. Meant for bench work */
+extern const struct lis3mdl_config lis3mdl_profile_bench_low_power;
+
+
 struct i2c_lis3mdl {
-    i2c_master_dev_handle_t *i2c_handle;
+    struct sensor_bus bus;
 	float sensitivity;
+    /* Multiplying a raw sample by this gives microtesla. It is worked out
+     * once from 'sensitivity' (which is in LSB/gauss, so would otherwise need
+     * dividing by on every sample) */
+    float scale_ut;
+    /* Where 'esp_i2c_lis3mdl_get_data_start()' has the bus put the sample */
+    union threeaxes raw;
+    /* When that sample was taken, by esp_timer: when DRDY last went high if
+     * it is wired up, otherwise when the read started */
+    int64_t time_us;
+    /* The DRDY line, used by 'esp_i2c_lis3mdl_drdy_begin()'. 'drdy.pin'
+     * should be GPIO_NUM_NC if DRDY is not wired to the ESP32 */
+    struct drdy_irq drdy;
 };
 
 
-void esp_i2c_lis3mdl_begin(struct i2c_lis3mdl *i2c_lis3mdl);
+const struct lis3mdl_config *esp_i2c_lis3mdl_find_profile(const char *name);
+
+esp_err_t esp_i2c_lis3mdl_begin(struct i2c_lis3mdl *i2c_lis3mdl, \
+    const struct lis3mdl_config *config);
+
+esp_err_t esp_i2c_lis3mdl_get_data(struct i2c_lis3mdl *i2c_lis3mdl, float *outxyz);
 
-void esp_i2c_lis3mdl_get_data(struct i2c_lis3mdl *i2c_lis3mdl, float *outxyz);
+esp_err_t esp_i2c_lis3mdl_get_data_start(struct i2c_lis3mdl *i2c_lis3mdl);
+
+esp_err_t esp_i2c_lis3mdl_get_data_finish(struct i2c_lis3mdl *i2c_lis3mdl, float *outxyz);
+
+void esp_i2c_lis3mdl_convert(const struct i2c_lis3mdl *i2c_lis3mdl, const int16_t *raw, \
+    float *outxyz);
 
 float esp_i2c_lis3mdl_get_x(struct i2c_lis3mdl *i2c_lis3mdl);
 
@@ -101,5 +182,9 @@ float esp_i2c_lis3mdl_get_y(struct i2c_lis3mdl *i2c_lis3mdl);
 
 float esp_i2c_lis3mdl_get_z(struct i2c_lis3mdl *i2c_lis3mdl);
 
+void esp_i2c_lis3mdl_drdy_begin(struct i2c_lis3mdl *i2c_lis3mdl);
+
+void esp_i2c_lis3mdl_drdy_rearm(struct i2c_lis3mdl *i2c_lis3mdl);
+
 
 #endif
@@ -0,0 +1,62 @@
+#include <inttypes.h>
+
+#include "driver/gpio.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp32-i2c-lsm6dsox-lis3mdl-common.h"
+
+
+static void IRAM_ATTR drdy_irq_isr(void *arg) {
+    struct drdy_irq *drdy_irq = (struct drdy_irq *) arg;
+    BaseType_t higher_priority_task_woken = pdFALSE;
+
+    /* Mask the line until the task has read the sensor (which is what clears
+     * the line), otherwise the level triggered interrupt would fire
+     * continuously */
+    gpio_intr_disable(drdy_irq->pin);
+    drdy_irq->time_us = esp_timer_get_time();
+    xTaskNotifyFromISR(drdy_irq->task, drdy_irq->notify_bits, eSetBits, \
+        &higher_priority_task_woken);
+
+    if (higher_priority_task_woken == pdTRUE) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+
+/** Takes a struct drdy_irq with its 'pin', 'task' and 'notify_bits' members
+ * set and starts delivering the interrupts from that pin to the task as task
+ * notifications.
+ *
+ * Both sensors drive their interrupt lines active high (push-pull) by
+ * default, which is what this expects.
+ */
+void drdy_irq_begin(struct drdy_irq *drdy_irq) {
+    drdy_irq->time_us = 0;
+
+    gpio_config_t io_conf = {};
+    io_conf.pin_bit_mask = 1ULL << drdy_irq->pin;
+    io_conf.mode = GPIO_MODE_INPUT;
+    io_conf.pull_up_en = GPIO_PULLUP_DISABLE;
+    io_conf.pull_down_en = GPIO_PULLDOWN_ENABLE;
+    io_conf.intr_type = GPIO_INTR_HIGH_LEVEL;
+    ESP_ERROR_CHECK(gpio_config(&io_conf));
+
+    /* The ISR service is shared by every pin, so it may already have been
+     * installed for the other sensor */
+    esp_err_t err = gpio_install_isr_service(ESP_INTR_FLAG_IRAM);
+    if (err != ESP_ERR_INVALID_STATE) {
+        ESP_ERROR_CHECK(err);
+    }
+    ESP_ERROR_CHECK(gpio_isr_handler_add(drdy_irq->pin, drdy_irq_isr, drdy_irq));
+}
+
+
+/** Unmasks the interrupt line described by 'drdy_irq'. Must be called by the
+ * notified task once it has serviced the sensor. */
+void drdy_irq_rearm(struct drdy_irq *drdy_irq) {
+    gpio_intr_enable(drdy_irq->pin);
+}
@@ -1,6 +1,12 @@
 #ifndef __ESP32_I2C_LSM6DSOX_LIS3MDL_COMMON_H_
 #define __ESP32_I2C_LSM6DSOX_LIS3MDL_COMMON_H_
 
+#include <inttypes.h>
+
+#include "driver/gpio.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
 /* A union which we use for reinterpreting data. We can read data into the
  * 'u16' element as an unsigned int if required, but then interpret the 0s and
  * 1s that comprised 'u16' as a signed integer through accessing the 'i16'
@@ -11,4 +17,29 @@ union threeaxes {
 };
 
 
+/* Describes a data-ready (or FIFO threshold) interrupt line coming from one of
+ * the sensors. When the line goes high, the ISR masks it and sets
+ * 'notify_bits' in the notification value of 'task', which is expected to
+ * read the sensor and then call 'drdy_irq_rearm()'.
+ *
+ * The line is level triggered rather than edge triggered so that a sample
+ * which arrives while the task is still busy with the previous one (and so
+ * never produces a fresh rising edge) still wakes the task once it rearms.
+ * In that case 'time_us' is when the task rearmed rather than when the
+ * sample arrived. */
+struct drdy_irq {
+    gpio_num_t pin; /* GPIO_NUM_NC if the line is not wired up */
+    TaskHandle_t task;
+    uint32_t notify_bits;
+    /* When the ISR last saw the line high, by esp_timer (in microseconds
+     * since boot). 0 until it first has */
+    volatile int64_t time_us;
+};
+
+
+void drdy_irq_begin(struct drdy_irq *drdy_irq);
+
+void drdy_irq_rearm(struct drdy_irq *drdy_irq);
+
+
 #endif
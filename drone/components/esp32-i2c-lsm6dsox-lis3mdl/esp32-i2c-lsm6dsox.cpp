@@ -1,87 +1,156 @@
 #include <inttypes.h>
+#include <string.h>
 
-#include "driver/i2c_master.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 
 #include "esp32-i2c-lsm6dsox.h"
 #include "esp32-i2c-lsm6dsox-lis3mdl-common.h"
 
 
-/** Takes a struct i2c_lsm6dsox and sets up the device with set defaults,
- * bringing the device to a point where we can start reading data from it.
- *
- * Note: this function requires that the 'i2c_lsm6dsox' argument has
- * its 'i2c_handle' member set correctly with an 'i2c_master_dev_handle_t' that
- * has been added to the i2c master bus using 'i2c_master_bus_add_device()'.
- */
-void esp_i2c_lsm6dsox_begin(struct i2c_lsm6dsox *i2c_lsm6dsox) {
+const struct lsm6dsox_config lsm6dsox_profile_flight_1k6hz = {
+    .name = "flight-1.6kHz",
+    .odr_xl = LSM6DSOX_XL_ODR_1667Hz,
+    .fs_xl = LSM6DSOX_FS_XL_01, /* +-16g */
+    .xl_fs_mode = 0,
+    .odr_g = LSM6DSOX_GY_ODR_1667Hz,
+    .fs_g = LSM6DSOX_FS_G_11, /* +-2000dps */
+    .fs_125 = 0,
+    .lpf2_xl_en = 1,
+    .hp_slope_xl_en = 0,
+    .hpcf_xl = 2, /* LPF2 at ODR/20 */
+    .lpf1_sel_g = 1,
+    .ftype = 0,
+    .hp_en_g = 0,
+    .hpm_g = 0,
+    .xl_high_performance = 1,
+    .g_high_performance = 1,
+    .bdu = 1,
+    .timestamp_en = 1,
+};
+
+const struct lsm6dsox_config lsm6dsox_profile_bench_low_power = {
+    .name = "bench-low-power",
+    .odr_xl = LSM6DSOX_XL_ODR_52Hz,
+    .fs_xl = LSM6DSOX_FS_XL_10, /* +-4g */
+    .xl_fs_mode = 0,
+    .odr_g = LSM6DSOX_GY_ODR_52Hz,
+    .fs_g = LSM6DSOX_FS_G_00, /* +-250dps */
+    .fs_125 = 0,
+    .lpf2_xl_en = 0,
+    .hp_slope_xl_en = 0,
+    .hpcf_xl = 0,
+    .lpf1_sel_g = 0,
+    .ftype = 0,
+    .hp_en_g = 0,
+    .hpm_g = 0,
+    .xl_high_performance = 0,
+    .g_high_performance = 0,
+    .bdu = 1,
+    .timestamp_en = 0,
+};
+
+static const struct lsm6dsox_config *lsm6dsox_profiles[] = {
+    &lsm6dsox_profile_flight_1k6hz,
+    &lsm6dsox_profile_bench_low_power,
+};
+
+
+/** Returns the built in configuration profile called 'name', or NULL if there
+ * is no such profile. */
+const struct lsm6dsox_config *esp_i2c_lsm6dsox_find_profile(const char *name) {
+    for (size_t i = 0; i < sizeof(lsm6dsox_profiles) / sizeof(lsm6dsox_profiles[0]); i++) {
+        if (strcmp(lsm6dsox_profiles[i]->name, name) == 0) {
+            return lsm6dsox_profiles[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/* The nominal rates selected by each ODR_G/BDR_GY value, in Hz */
+static const float lsm6dsox_gyro_rates_hz[] = {
+    0.0f, 12.5f, 26.0f, 52.0f, 104.0f, 208.0f, 416.0f, 833.0f, 1666.0f, \
+    3332.0f, 6664.0f,
+};
+
+
+/** Returns the nominal gyroscope output data rate selected by 'odr_g', in
+ * Hz. */
+float esp_i2c_lsm6dsox_odr_g_to_hz(lsm6dsox_odr_g_t odr_g) {
+    if ((size_t) odr_g >= sizeof(lsm6dsox_gyro_rates_hz) / sizeof(lsm6dsox_gyro_rates_hz[0])) {
+        return 0.0f;
+    }
+
+    return lsm6dsox_gyro_rates_hz[odr_g];
+}
+
+
+/** Returns the nominal gyroscope FIFO batch data rate selected by 'bdr_gy',
+ * in Hz. */
+float esp_i2c_lsm6dsox_bdr_gy_to_hz(lsm6dsox_bdr_gy_t bdr_gy) {
+    if (bdr_gy == LSM6DSOX_BDR_GY_6Hz5) {
+        return 6.5f;
+    }
+    if ((size_t) bdr_gy >= sizeof(lsm6dsox_gyro_rates_hz) / sizeof(lsm6dsox_gyro_rates_hz[0])) {
+        return 0.0f;
+    }
+
+    return lsm6dsox_gyro_rates_hz[bdr_gy];
+}
+
+
+/* The accelerometer's batch data rates are the gyroscope's, apart from the
+ * slowest */
+static float lsm6dsox_bdr_xl_to_hz(lsm6dsox_bdr_xl_t bdr_xl) {
+    if (bdr_xl == LSM6DSOX_BDR_XL_1Hz6) {
+        return 1.6f;
+    }
+
+    return esp_i2c_lsm6dsox_bdr_gy_to_hz((lsm6dsox_bdr_gy_t) bdr_xl);
+}
+
+
+/* The nominal rates selected by each SHUB_ODR value, in Hz */
+static const float lsm6dsox_shub_rates_hz[] = { 104.0f, 52.0f, 26.0f, 12.5f };
+
+
+/** Returns how many words 'fifo_config' has batched into the FIFO, on
+ * average, for every gyroscope sample: the gyroscope's own, the
+ * accelerometer's (at its own batch data rate), a timestamp every 1, 8 or
+ * 32 gyroscope batches, and the sensor hub's readings if 'shub_config' is
+ * not NULL and batches them. The hub is taken to read at its own ODR, which
+ * holds as long as the accelerometer's ODR is at least that. Returns 0 if
+ * the gyroscope is not batched. */
+float esp_i2c_lsm6dsox_fifo_words_per_sample(const struct lsm6dsox_fifo_config *fifo_config, \
+    const struct lsm6dsox_shub_config *shub_config) {
+
+    const float bdr_gy_hz = esp_i2c_lsm6dsox_bdr_gy_to_hz(fifo_config->bdr_gy);
+    if (bdr_gy_hz <= 0.0f) {
+        return 0.0f;
+    }
+
+    static const float ts_words[] = { 0.0f, 1.0f, 1.0f / 8, 1.0f / 32 };
+    float words = 1.0f + lsm6dsox_bdr_xl_to_hz(fifo_config->bdr_xl) / bdr_gy_hz \
+        + ts_words[fifo_config->ts_batch & 3];
+    if (shub_config != NULL && shub_config->batch) {
+        words += lsm6dsox_shub_rates_hz[shub_config->odr & 3] / bdr_gy_hz;
+    }
+
+    return words;
+}
+
+
+/** Works out the accelerometer and gyroscope sensitivities from the contents
+ * of the CTRL1_XL, CTRL2_G and CTRL8_XL registers, and stores them in
+ * 'i2c_lsm6dsox'. */
+static void lsm6dsox_set_sensitivities(struct i2c_lsm6dsox *i2c_lsm6dsox, \
+    struct lsm6dsox_ctrl1_xl ctrl1_xl_content, struct lsm6dsox_ctrl2_g ctrl2_g_content, \
+    struct lsm6dsox_ctrl8_xl ctrl8_xl_content) {
     /* {{{ */
-    /* 1. Set accelerometer to ON and the specific output data rate */
-    /* 1a. Read the current value for the CTRL1_XL register */
-    uint8_t buf = CTRL1_XL;
-    struct lsm6dsox_ctrl1_xl ctrl1_xl_content;
-    ESP_ERROR_CHECK(i2c_master_transmit_receive(*(i2c_lsm6dsox->i2c_handle), &buf, \
-        sizeof(buf), (uint8_t *)&ctrl1_xl_content, 1, -1));
-    /* 1b. Set the ODR bits of the CTRL1_XL register (datasheet page 56) */
-	ctrl1_xl_content.odr_xl = LSM6DSOX_XL_ODR_12Hz5;
-    ctrl1_xl_content.lpf2_xl_en = 1;
-    /* 1c. Write the new value back to the CTRL1_XL register */
-    uint8_t sub_and_data[2];
-    sub_and_data[0] = buf;
-    sub_and_data[1] = *((uint8_t *) &ctrl1_xl_content);
-    ESP_ERROR_CHECK(i2c_master_transmit(*(i2c_lsm6dsox->i2c_handle), &sub_and_data[0], \
-        sizeof(sub_and_data), -1));
-
-    /* 2. Turn on high-performance mode for the accelerometer */
-    /* 2a. Read the current value for the CTRL6_C register */
-    buf = CTRL6_C;
-    struct lsm6dsox_ctrl6_c ctrl6_c_content;
-    ESP_ERROR_CHECK(i2c_master_transmit_receive(*(i2c_lsm6dsox->i2c_handle), &buf, \
-        sizeof(buf), (uint8_t *)&ctrl6_c_content, 1, -1));
-    /* 2b. Enable high-performance mode for the accelerometer (datasheet page 61) */
-	ctrl6_c_content.xl_hm_mode = 1;
-    /* 2c. Write the new contents back to the register */
-    sub_and_data[0] = buf;
-    sub_and_data[1] = *((uint8_t *) &ctrl6_c_content);
-    ESP_ERROR_CHECK(i2c_master_transmit(*(i2c_lsm6dsox->i2c_handle), &sub_and_data[0], \
-        sizeof(sub_and_data), -1));
-
-    /* 3. Set gyroscope to ON and at the specific output data rate */
-    /* 3a. Read the current value for the CTRL2_G register */
-    buf = CTRL2_G;
-    struct lsm6dsox_ctrl2_g ctrl2_g_content;
-    ESP_ERROR_CHECK(i2c_master_transmit_receive(*(i2c_lsm6dsox->i2c_handle), &buf, \
-        sizeof(buf), (uint8_t *)&ctrl2_g_content, 1, -1));
-    /* 3b. Set the ODR bits of the CTRL2_G register (datasheet page 56) */
-	ctrl2_g_content.odr_g = LSM6DSOX_GY_ODR_12Hz5;
-    /* 3c. Write the new value back to the CTRL2_G register */
-    sub_and_data[0] = buf;
-    sub_and_data[1] = *((uint8_t *) &ctrl2_g_content);
-    ESP_ERROR_CHECK(i2c_master_transmit(*(i2c_lsm6dsox->i2c_handle), &sub_and_data[0], \
-        sizeof(sub_and_data), -1));
-
-    /* 4. Turn on high-performance mode for the gyroscope */
-    /* 4a. Read the current value for the CTRL7_G register */
-    buf = CTRL7_G;
-    struct lsm6dsox_ctrl7_g ctrl7_g_content;
-    ESP_ERROR_CHECK(i2c_master_transmit_receive(*(i2c_lsm6dsox->i2c_handle), &buf, \
-        sizeof(buf), (uint8_t *)&ctrl7_g_content, 1, -1));
-    /* 4b. Enable high-performance mode for the gyroscope (datasheet page 62) */
-	ctrl7_g_content.g_hm_mode = 1;
-    /* 4c. Write the new contents back to the register */
-    sub_and_data[0] = buf;
-    sub_and_data[1] = *((uint8_t *) &ctrl7_g_content);
-    ESP_ERROR_CHECK(i2c_master_transmit(*(i2c_lsm6dsox->i2c_handle), &sub_and_data[0], \
-        sizeof(sub_and_data), -1));
-
-    /* 5. Get and store sensor sensitivities */
-    /* 5a. Read CTRL8_XL register to get XL_FS_MODE in order to determine
-     * accelerometer sensitivity */
-    buf = CTRL8_XL;
-    struct lsm6dsox_ctrl8_xl ctrl8_xl_content;
-    ESP_ERROR_CHECK(i2c_master_transmit_receive(*(i2c_lsm6dsox->i2c_handle), &buf, \
-        sizeof(buf), (uint8_t *)&ctrl8_xl_content, 1, -1));
-
-    /* 5b. Set the accelerometer sensitivity multiplier for the LSM6DSOX
+    /* 1. Set the accelerometer sensitivity multiplier for the LSM6DSOX
      * (datasheet page 56) */
     switch (ctrl1_xl_content.fs_xl) {
         case LSM6DSOX_FS_XL_00:
@@ -100,7 +169,7 @@ void esp_i2c_lsm6dsox_begin(struct i2c_lsm6dsox *i2c_lsm6dsox) {
             i2c_lsm6dsox->accelerometer_sensitivity = LSM6DSOX_ACC_SENSITIVITY_FS_2G;
     }
 
-    /* 5c. Set the gyroscope sensitivity multiplier for the LSM6DSOX. Remember
+    /* 2. Set the gyroscope sensitivity multiplier for the LSM6DSOX. Remember
      * (datasheet page 57) */
     switch (ctrl2_g_content.fs_125) {
         case 1:
@@ -125,6 +194,116 @@ void esp_i2c_lsm6dsox_begin(struct i2c_lsm6dsox *i2c_lsm6dsox) {
             }
             break;
     }
+
+    /* 3. Fold the conversion to SI units into them, so that it costs nothing
+     * per sample */
+    i2c_lsm6dsox->accelerometer_scale_m_s2 = \
+        i2c_lsm6dsox->accelerometer_sensitivity * LSM6DSOX_MG_TO_M_PER_S2;
+    i2c_lsm6dsox->gyroscope_scale_rad_s = \
+        i2c_lsm6dsox->gyroscope_sensitivity * LSM6DSOX_MDPS_TO_RAD_PER_S;
+    /* }}} */
+}
+
+
+/** Takes a struct i2c_lsm6dsox and sets up the device as described by
+ * 'config', bringing the device to a point where we can start reading data
+ * from it.
+ *
+ * All of the control registers (CTRL1_XL through CTRL10_C) are written in a
+ * single burst and then read back in a single burst. The sensitivities are
+ * derived from what was read back, so they always describe what the device is
+ * actually doing. Returns ESP_ERR_INVALID_RESPONSE if the read back does not
+ * match what was written.
+ *
+ * Note: this function requires that the 'i2c_lsm6dsox' argument has
+ * its 'bus' member initialised, e.g. with 'sensor_bus_init_i2c()' for a device
+ * that has been added to the i2c master bus using 'i2c_master_bus_add_device()'.
+ */
+esp_err_t esp_i2c_lsm6dsox_begin(struct i2c_lsm6dsox *i2c_lsm6dsox, \
+    const struct lsm6dsox_config *config) {
+    /* {{{ */
+    /* 1. Build the contents of every control register from 'config' */
+    /* 1a. Accelerometer ODR, full scale and LPF2 (datasheet page 56) */
+    struct lsm6dsox_ctrl1_xl ctrl1_xl_content = {};
+    ctrl1_xl_content.odr_xl = config->odr_xl;
+    ctrl1_xl_content.fs_xl = config->fs_xl;
+    ctrl1_xl_content.lpf2_xl_en = config->lpf2_xl_en;
+    /* 1b. Gyroscope ODR and full scale (datasheet page 57) */
+    struct lsm6dsox_ctrl2_g ctrl2_g_content = {};
+    ctrl2_g_content.odr_g = config->odr_g;
+    ctrl2_g_content.fs_g = config->fs_g;
+    ctrl2_g_content.fs_125 = config->fs_125;
+    /* 1c. Keep register address auto-increment on, since every multi-byte
+     * read in this driver depends on it */
+    struct lsm6dsox_ctrl3_c ctrl3_c_content = {};
+    ctrl3_c_content.if_inc = 1;
+    ctrl3_c_content.bdu = config->bdu;
+    /* 1d. Gyroscope LPF1. On SPI, also turn the I2C interface off so that
+     * SPI traffic can never be mistaken for an I2C start condition */
+    struct lsm6dsox_ctrl4_c ctrl4_c_content = {};
+    ctrl4_c_content.lpf1_sel_g = config->lpf1_sel_g;
+    ctrl4_c_content.i2c_disable = (i2c_lsm6dsox->bus.type == SENSOR_BUS_SPI);
+    /* 1e. Gyroscope LPF1 bandwidth and accelerometer high-performance mode.
+     * XL_HM_MODE set to 1 *disables* high-performance mode (datasheet page
+     * 61) */
+    struct lsm6dsox_ctrl6_c ctrl6_c_content = {};
+    ctrl6_c_content.ftype = config->ftype;
+    ctrl6_c_content.xl_hm_mode = config->xl_high_performance ? 0 : 1;
+    /* 1f. Gyroscope HPF and high-performance mode. As above, G_HM_MODE set to
+     * 1 *disables* high-performance mode (datasheet page 62) */
+    struct lsm6dsox_ctrl7_g ctrl7_g_content = {};
+    ctrl7_g_content.hp_en_g = config->hp_en_g;
+    ctrl7_g_content.hpm_g = config->hpm_g;
+    ctrl7_g_content.g_hm_mode = config->g_high_performance ? 0 : 1;
+    /* 1g. Accelerometer full scale mode and filter cutoffs */
+    struct lsm6dsox_ctrl8_xl ctrl8_xl_content = {};
+    ctrl8_xl_content.xl_fs_mode = config->xl_fs_mode;
+    ctrl8_xl_content.hp_slope_xl_en = config->hp_slope_xl_en;
+    ctrl8_xl_content.hpcf_xl = config->hpcf_xl;
+    /* 1h. Timestamp counter */
+    struct lsm6dsox_ctrl10_c ctrl10_c_content = {};
+    ctrl10_c_content.timestamp_en = config->timestamp_en;
+
+    /* 2. Write CTRL1_XL through CTRL10_C in one burst */
+    uint8_t ctrl[LSM6DSOX_CTRL_REG_COUNT];
+    ctrl[CTRL1_XL - CTRL1_XL] = *((uint8_t *) &ctrl1_xl_content);
+    ctrl[CTRL2_G - CTRL1_XL] = *((uint8_t *) &ctrl2_g_content);
+    ctrl[CTRL3_C - CTRL1_XL] = *((uint8_t *) &ctrl3_c_content);
+    ctrl[CTRL4_C - CTRL1_XL] = *((uint8_t *) &ctrl4_c_content);
+    ctrl[CTRL5_C - CTRL1_XL] = 0;
+    ctrl[CTRL6_C - CTRL1_XL] = *((uint8_t *) &ctrl6_c_content);
+    ctrl[CTRL7_G - CTRL1_XL] = *((uint8_t *) &ctrl7_g_content);
+    ctrl[CTRL8_XL - CTRL1_XL] = *((uint8_t *) &ctrl8_xl_content);
+    ctrl[CTRL9_XL - CTRL1_XL] = LSM6DSOX_CTRL9_XL_DEFAULT;
+    ctrl[CTRL10_C - CTRL1_XL] = *((uint8_t *) &ctrl10_c_content);
+    ESP_ERROR_CHECK(sensor_bus_write(&i2c_lsm6dsox->bus, CTRL1_XL, ctrl, sizeof(ctrl)));
+
+    /* 3. Read them all back in one burst and make sure they took */
+    uint8_t readback[LSM6DSOX_CTRL_REG_COUNT];
+    ESP_ERROR_CHECK(sensor_bus_read(&i2c_lsm6dsox->bus, CTRL1_XL, \
+        readback, sizeof(readback)));
+    if (memcmp(readback, ctrl, sizeof(readback)) != 0) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    /* 4. Get and store sensor sensitivities from what the device reported */
+    memcpy(&ctrl1_xl_content, &readback[CTRL1_XL - CTRL1_XL], 1);
+    memcpy(&ctrl2_g_content, &readback[CTRL2_G - CTRL1_XL], 1);
+    memcpy(&ctrl8_xl_content, &readback[CTRL8_XL - CTRL1_XL], 1);
+    lsm6dsox_set_sensitivities(i2c_lsm6dsox, ctrl1_xl_content, ctrl2_g_content, \
+        ctrl8_xl_content);
+
+    /* 5. Start the timestamp counter's tick length off at what the device
+     * says its oscillator is trimmed to. 'esp_i2c_lsm6dsox_clock_sync()'
+     * takes it from there */
+    int8_t freq_fine;
+    ESP_ERROR_CHECK(sensor_bus_read(&i2c_lsm6dsox->bus, INTERNAL_FREQ_FINE, \
+        (uint8_t *) &freq_fine, 1));
+    i2c_lsm6dsox->clock.us_per_tick = LSM6DSOX_TIMESTAMP_LSB_US \
+        / (1.0f + LSM6DSOX_FREQ_FINE_STEP * freq_fine);
+    i2c_lsm6dsox->clock.synced = 0;
+
+    return ESP_OK;
     /* }}} */
 }
 
@@ -136,10 +315,9 @@ void esp_i2c_lsm6dsox_get_gyro_data(struct i2c_lsm6dsox *i2c_lsm6dsox, \
 
     /* Get both the lower 8 bits and the higher 8 bits for x, y, and z by
      * requesting the lower 8 bits for the x axis data, but reading for 6 bytes */
-    uint8_t buf = OUTX_L_G;
     union threeaxes outxyz_g_raw;
-    ESP_ERROR_CHECK(i2c_master_transmit_receive(*(i2c_lsm6dsox->i2c_handle), &buf, \
-        sizeof(buf), (uint8_t *)outxyz_g_raw.u16, 6, -1));
+    ESP_ERROR_CHECK(sensor_bus_read(&i2c_lsm6dsox->bus, OUTX_L_G, \
+        (uint8_t *)outxyz_g_raw.u16, 6));
 
     outxyz_g[0] = ((float) outxyz_g_raw.i16[0]) * i2c_lsm6dsox->gyroscope_sensitivity;
     outxyz_g[1] = ((float) outxyz_g_raw.i16[1]) * i2c_lsm6dsox->gyroscope_sensitivity;
@@ -152,10 +330,9 @@ void esp_i2c_lsm6dsox_get_gyro_data(struct i2c_lsm6dsox *i2c_lsm6dsox, \
 float esp_i2c_lsm6dsox_get_gyro_x(struct i2c_lsm6dsox *i2c_lsm6dsox) {
     /* Get both the lower 8 bits and the higher 8 bits from their respective
      * registers by requesting the lower 8 bits, but reading for 2 bytes */
-    uint8_t buf = OUTX_L_G;
     uint16_t outx_g;
-    ESP_ERROR_CHECK(i2c_master_transmit_receive(*(i2c_lsm6dsox->i2c_handle), &buf, \
-        sizeof(buf), (uint8_t *)&outx_g, 2, -1));
+    ESP_ERROR_CHECK(sensor_bus_read(&i2c_lsm6dsox->bus, OUTX_L_G, \
+        (uint8_t *)&outx_g, 2));
 
     float ret = ((float) outx_g) * i2c_lsm6dsox->gyroscope_sensitivity;
 
@@ -166,10 +343,9 @@ float esp_i2c_lsm6dsox_get_gyro_x(struct i2c_lsm6dsox *i2c_lsm6dsox) {
 float esp_i2c_lsm6dsox_get_gyro_y(struct i2c_lsm6dsox *i2c_lsm6dsox) {
     /* Get both the lower 8 bits and the higher 8 bits from their respective
      * registers by requesting the lower 8 bits, but reading for 2 bytes */
-    uint8_t buf = OUTY_L_G;
     uint16_t outy_g;
-    ESP_ERROR_CHECK(i2c_master_transmit_receive(*(i2c_lsm6dsox->i2c_handle), &buf, \
-        sizeof(buf), (uint8_t *)&outy_g, 2, -1));
+    ESP_ERROR_CHECK(sensor_bus_read(&i2c_lsm6dsox->bus, OUTY_L_G, \
+        (uint8_t *)&outy_g, 2));
 
     float ret = ((float) outy_g) * i2c_lsm6dsox->gyroscope_sensitivity;
 
@@ -180,10 +356,9 @@ float esp_i2c_lsm6dsox_get_gyro_y(struct i2c_lsm6dsox *i2c_lsm6dsox) {
 float esp_i2c_lsm6dsox_get_gyro_z(struct i2c_lsm6dsox *i2c_lsm6dsox) {
     /* Get both the lower 8 bits and the higher 8 bits from their respective
      * registers by requesting the lower 8 bits, but reading for 2 bytes */
-    uint8_t buf = OUTZ_L_G;
     uint16_t outz_g;
-    ESP_ERROR_CHECK(i2c_master_transmit_receive(*(i2c_lsm6dsox->i2c_handle), &buf, \
-        sizeof(buf), (uint8_t *)&outz_g, 2, -1));
+    ESP_ERROR_CHECK(sensor_bus_read(&i2c_lsm6dsox->bus, OUTZ_L_G, \
+        (uint8_t *)&outz_g, 2));
 
     float ret = ((float) outz_g) * i2c_lsm6dsox->gyroscope_sensitivity;
 
@@ -196,10 +371,9 @@ void esp_i2c_lsm6dsox_get_accel_data(struct i2c_lsm6dsox *i2c_lsm6dsox, \
 
     /* Get both the lower 8 bits and the higher 8 bits for x, y, and z by
      * requesting the lower 8 bits for the x axis data, but reading for 6 bytes */
-    uint8_t buf = OUTX_L_A;
     union threeaxes outxyz_a_raw;
-    ESP_ERROR_CHECK(i2c_master_transmit_receive(*(i2c_lsm6dsox->i2c_handle), &buf, \
-        sizeof(buf), (uint8_t *)&outxyz_a_raw.u16, 6, -1));
+    ESP_ERROR_CHECK(sensor_bus_read(&i2c_lsm6dsox->bus, OUTX_L_A, \
+        (uint8_t *)&outxyz_a_raw.u16, 6));
 
     outxyz_a[0] = ((float) outxyz_a_raw.i16[0]) * i2c_lsm6dsox->accelerometer_sensitivity;
     outxyz_a[1] = ((float) outxyz_a_raw.i16[1]) * i2c_lsm6dsox->accelerometer_sensitivity;
@@ -212,10 +386,9 @@ void esp_i2c_lsm6dsox_get_accel_data(struct i2c_lsm6dsox *i2c_lsm6dsox, \
 float esp_i2c_lsm6dsox_get_accel_x(struct i2c_lsm6dsox *i2c_lsm6dsox) {
     /* Get both the lower 8 bits and the higher 8 bits from their respective
      * registers by requesting the lower 8 bits, but reading for 2 bytes */
-    uint8_t buf = OUTX_L_A;
     int16_t outx_a = 0;
-    ESP_ERROR_CHECK(i2c_master_transmit_receive(*(i2c_lsm6dsox->i2c_handle), &buf, \
-        sizeof(buf), (uint8_t *)&outx_a, 2, -1));
+    ESP_ERROR_CHECK(sensor_bus_read(&i2c_lsm6dsox->bus, OUTX_L_A, \
+        (uint8_t *)&outx_a, 2));
 
     float ret = ((float) outx_a) * i2c_lsm6dsox->accelerometer_sensitivity;
 
@@ -226,10 +399,9 @@ float esp_i2c_lsm6dsox_get_accel_x(struct i2c_lsm6dsox *i2c_lsm6dsox) {
 float esp_i2c_lsm6dsox_get_accel_y(struct i2c_lsm6dsox *i2c_lsm6dsox) {
     /* Get both the lower 8 bits and the higher 8 bits from their respective
      * registers by requesting the lower 8 bits, but reading for 2 bytes */
-    uint8_t buf = OUTY_L_A;
     int16_t outy_a = 0;
-    ESP_ERROR_CHECK(i2c_master_transmit_receive(*(i2c_lsm6dsox->i2c_handle), &buf, \
-        sizeof(buf), (uint8_t *)&outy_a, 2, -1));
+    ESP_ERROR_CHECK(sensor_bus_read(&i2c_lsm6dsox->bus, OUTY_L_A, \
+        (uint8_t *)&outy_a, 2));
 
     float ret = ((float) outy_a) * i2c_lsm6dsox->accelerometer_sensitivity;
 
@@ -240,12 +412,714 @@ float esp_i2c_lsm6dsox_get_accel_y(struct i2c_lsm6dsox *i2c_lsm6dsox) {
 float esp_i2c_lsm6dsox_get_accel_z(struct i2c_lsm6dsox *i2c_lsm6dsox) {
     /* Get both the lower 8 bits and the higher 8 bits from their respective
      * registers by requesting the lower 8 bits, but reading for 2 bytes */
-    uint8_t buf = OUTZ_L_A;
     int16_t outz_a = 0;
-    ESP_ERROR_CHECK(i2c_master_transmit_receive(*(i2c_lsm6dsox->i2c_handle), &buf, \
-        sizeof(buf), (uint8_t *)&outz_a, 2, -1));
+    ESP_ERROR_CHECK(sensor_bus_read(&i2c_lsm6dsox->bus, OUTZ_L_A, \
+        (uint8_t *)&outz_a, 2));
 
     float ret = ((float) outz_a) * i2c_lsm6dsox->accelerometer_sensitivity;
 
     return ret;
 }
+
+
+/** Reads the gyroscope and the accelerometer output registers (OUTX_L_G
+ * through OUTZ_H_A) in a single 12 byte burst and stores the results in
+ * 'g_rad_s' (in rad/s) and 'a_m_s2' (in m/s^2). Returns the bus error if the
+ * read failed, in which case both are left alone.
+ *
+ * This costs one start/address/stop sequence instead of the two required
+ * by calling 'esp_i2c_lsm6dsox_get_gyro_data()' and
+ * 'esp_i2c_lsm6dsox_get_accel_data()' back to back, and because both triplets
+ * come out of the same read they are guaranteed to be from the same sample
+ * when BDU is set.
+ */
+esp_err_t esp_i2c_lsm6dsox_get_gyro_accel_data(struct i2c_lsm6dsox *i2c_lsm6dsox, \
+    float *g_rad_s, float *a_m_s2) {
+
+    esp_err_t err = esp_i2c_lsm6dsox_get_gyro_accel_data_start(i2c_lsm6dsox);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    int16_t g_raw[3];
+    int16_t a_raw[3];
+    err = esp_i2c_lsm6dsox_get_gyro_accel_data_finish(i2c_lsm6dsox, g_raw, a_raw);
+    if (err != ESP_OK) {
+        return err;
+    }
+    esp_i2c_lsm6dsox_to_si(i2c_lsm6dsox, g_raw, a_raw, g_rad_s, a_m_s2);
+
+    return ESP_OK;
+}
+
+
+/** Starts the same burst read as 'esp_i2c_lsm6dsox_get_gyro_accel_data()',
+ * but returns as soon as it is queued on the bus. The caller can do something
+ * else (including start a read on another sensor) and then collect the
+ * sample with 'esp_i2c_lsm6dsox_get_gyro_accel_data_finish()'. */
+esp_err_t esp_i2c_lsm6dsox_get_gyro_accel_data_start(struct i2c_lsm6dsox *i2c_lsm6dsox) {
+    const int64_t int1_time_us = i2c_lsm6dsox->int1.time_us;
+    i2c_lsm6dsox->time_us = int1_time_us ? int1_time_us : esp_timer_get_time();
+
+    return sensor_bus_read_start(&i2c_lsm6dsox->bus, OUTX_L_G, \
+        i2c_lsm6dsox->gyro_accel_raw, sizeof(i2c_lsm6dsox->gyro_accel_raw));
+}
+
+
+/** Waits for the read started by 'esp_i2c_lsm6dsox_get_gyro_accel_data_start()'
+ * and stores the sample, as it came off the sensor, in 'g_raw' and 'a_raw'
+ * (see 'esp_i2c_lsm6dsox_to_si()'). When it was taken is left in
+ * 'i2c_lsm6dsox->time_us'. If the read failed (or was never
+ * started), returns the bus error and leaves both alone. */
+esp_err_t esp_i2c_lsm6dsox_get_gyro_accel_data_finish(struct i2c_lsm6dsox *i2c_lsm6dsox, \
+    int16_t *g_raw, int16_t *a_raw) {
+
+    esp_err_t err = sensor_bus_read_finish(&i2c_lsm6dsox->bus);
+    if (err != ESP_OK) {
+        return err;
+    }
+    esp_i2c_lsm6dsox_decode_gyro_accel(i2c_lsm6dsox->gyro_accel_raw, g_raw, a_raw);
+
+    return ESP_OK;
+}
+
+
+/** Decodes a 12 byte buffer holding the contents of OUTX_L_G through OUTZ_H_A
+ * into a raw gyroscope triplet and a raw accelerometer triplet.
+ *
+ * This is kept separate from the bus access so that it can be exercised
+ * without a real device on the other end of the bus.
+ */
+void esp_i2c_lsm6dsox_decode_gyro_accel(const uint8_t *raw, int16_t *g_raw, int16_t *a_raw) {
+    /* The output registers are little endian (low byte at the lower
+     * address), two's complement (datasheet page 45) */
+    for (int i = 0; i < 3; i++) {
+        g_raw[i] = (int16_t) ((uint16_t) raw[2 * i] | ((uint16_t) raw[2 * i + 1] << 8));
+        a_raw[i] = (int16_t) ((uint16_t) raw[6 + 2 * i] | ((uint16_t) raw[6 + 2 * i + 1] << 8));
+    }
+}
+
+
+/* Bits of 'i2c_lsm6dsox->fifo_pending_flags' */
+#define FIFO_PENDING_GYRO  0x1
+#define FIFO_PENDING_ACCEL 0x2
+
+
+/** Takes a struct i2c_lsm6dsox which has already been set up with
+ * 'esp_i2c_lsm6dsox_begin()' and puts the LSM6DSOX's FIFO into the batching
+ * mode described by 'fifo_config'. Any data already in the FIFO is discarded.
+ *
+ * Once this returns, samples can be taken out of the FIFO with
+ * 'esp_i2c_lsm6dsox_fifo_read()' instead of polling the output registers,
+ * meaning that samples produced while the caller is busy are kept (up to the
+ * size of the FIFO) rather than lost.
+ */
+void esp_i2c_lsm6dsox_fifo_begin(struct i2c_lsm6dsox *i2c_lsm6dsox, \
+    const struct lsm6dsox_fifo_config *fifo_config) {
+    /* {{{ */
+    /* 1. Put the FIFO into bypass mode, which empties it */
+    struct lsm6dsox_fifo_ctrl4 fifo_ctrl4_content = {};
+    fifo_ctrl4_content.fifo_mode = LSM6DSOX_FIFO_MODE_BYPASS;
+    ESP_ERROR_CHECK(sensor_bus_write(&i2c_lsm6dsox->bus, FIFO_CTRL4, \
+        (uint8_t *)&fifo_ctrl4_content, 1));
+
+    /* 2. If timestamps are to be batched, the timestamp counter has to be
+     * running */
+    if (fifo_config->ts_batch != LSM6DSOX_DEC_TS_OFF) {
+        /* 2a. Read the current value for the CTRL10_C register */
+        struct lsm6dsox_ctrl10_c ctrl10_c_content;
+        ESP_ERROR_CHECK(sensor_bus_read(&i2c_lsm6dsox->bus, CTRL10_C, \
+            (uint8_t *)&ctrl10_c_content, 1));
+        /* 2b. Enable the timestamp counter */
+        ctrl10_c_content.timestamp_en = 1;
+        /* 2c. Write the new value back to the CTRL10_C register */
+        ESP_ERROR_CHECK(sensor_bus_write(&i2c_lsm6dsox->bus, CTRL10_C, \
+            (uint8_t *)&ctrl10_c_content, 1));
+    }
+
+    /* 3. Write FIFO_CTRL1 through FIFO_CTRL4 in one burst */
+    uint16_t watermark = fifo_config->watermark;
+    if (watermark > LSM6DSOX_FIFO_WATERMARK_MAX) {
+        watermark = LSM6DSOX_FIFO_WATERMARK_MAX;
+    }
+
+    struct lsm6dsox_fifo_ctrl2 fifo_ctrl2_content = {};
+    fifo_ctrl2_content.wtm8 = (watermark >> 8) & 0x1;
+
+    struct lsm6dsox_fifo_ctrl3 fifo_ctrl3_content = {};
+    fifo_ctrl3_content.bdr_xl = fifo_config->bdr_xl;
+    fifo_ctrl3_content.bdr_gy = fifo_config->bdr_gy;
+
+    fifo_ctrl4_content.fifo_mode = fifo_config->mode;
+    fifo_ctrl4_content.dec_ts_batch = fifo_config->ts_batch;
+
+    uint8_t fifo_ctrl[4];
+    fifo_ctrl[0] = watermark & 0xFF;
+    fifo_ctrl[1] = *((uint8_t *) &fifo_ctrl2_content);
+    fifo_ctrl[2] = *((uint8_t *) &fifo_ctrl3_content);
+    fifo_ctrl[3] = *((uint8_t *) &fifo_ctrl4_content);
+    ESP_ERROR_CHECK(sensor_bus_write(&i2c_lsm6dsox->bus, FIFO_CTRL1, fifo_ctrl, \
+        sizeof(fifo_ctrl)));
+
+    /* 4. Forget any half-parsed sample from a previous FIFO session, and
+     * wait for the first timestamp word before timing samples, expecting the
+     * words to be as far apart as the batch data rate says */
+    memset(&i2c_lsm6dsox->fifo_pending, 0, sizeof(i2c_lsm6dsox->fifo_pending));
+    i2c_lsm6dsox->fifo_pending_flags = 0;
+    i2c_lsm6dsox->fifo_overruns = 0;
+    i2c_lsm6dsox->fifo_ts_valid = 0;
+    const float bdr_gy_hz = esp_i2c_lsm6dsox_bdr_gy_to_hz(fifo_config->bdr_gy);
+    i2c_lsm6dsox->fifo_ts_ticks_per_gyro = (bdr_gy_hz > 0.0f) ? \
+        1e6f / (bdr_gy_hz * LSM6DSOX_TIMESTAMP_LSB_US) : 0.0f;
+    /* }}} */
+}
+
+
+/** Returns the number of unread words currently stored in the FIFO, or 0 if
+ * the status registers could not be read (the words stay in the FIFO for next
+ * time). */
+uint16_t esp_i2c_lsm6dsox_fifo_get_level(struct i2c_lsm6dsox *i2c_lsm6dsox) {
+    uint8_t status[2];
+    if (sensor_bus_read(&i2c_lsm6dsox->bus, FIFO_STATUS1, status, sizeof(status)) != ESP_OK) {
+        return 0;
+    }
+
+    struct lsm6dsox_fifo_status2 *fifo_status2 = (struct lsm6dsox_fifo_status2 *) &status[1];
+    if (fifo_status2->fifo_ovr_ia) {
+        i2c_lsm6dsox->fifo_overruns++;
+    }
+
+    return ((uint16_t) fifo_status2->diff_fifo_hi << 8) | status[0];
+}
+
+
+/** Drains the FIFO of as many words as are available (bounded by
+ * 'max_samples' and LSM6DSOX_FIFO_MAX_BURST_WORDS) in a single burst read and
+ * stores the gyroscope + accelerometer samples they hold in 'samples'.
+ * Returns the number of samples written to 'samples'.
+ *
+ * Each FIFO word produces at most one sample, so 'samples' only needs to have
+ * room for 'max_samples' samples.
+ */
+int esp_i2c_lsm6dsox_fifo_read(struct i2c_lsm6dsox *i2c_lsm6dsox, \
+    struct lsm6dsox_fifo_sample *samples, int max_samples) {
+
+    /* 1. Find out how many words are waiting to be read */
+    int num_words = esp_i2c_lsm6dsox_fifo_get_level(i2c_lsm6dsox);
+    if (num_words > max_samples) num_words = max_samples;
+
+    /* 2. Read all of them in one burst and turn them into samples */
+    if (esp_i2c_lsm6dsox_fifo_read_start(i2c_lsm6dsox, num_words) == 0) {
+        return 0;
+    }
+    return esp_i2c_lsm6dsox_fifo_read_finish(i2c_lsm6dsox, samples);
+}
+
+
+/** Starts reading 'num_words' words (bounded by
+ * LSM6DSOX_FIFO_MAX_BURST_WORDS) out of the FIFO in a single burst, and
+ * returns as soon as the read is queued on the bus. Returns the number of
+ * words being read, which is 0 if there was nothing to read or the read
+ * could not be started.
+ *
+ * The caller should have found out how many words there are with
+ * 'esp_i2c_lsm6dsox_fifo_get_level()'. The address pointer wraps around from
+ * FIFO_DATA_OUT_Z_H back to FIFO_DATA_OUT_TAG, so a backlog can be drained in
+ * several bursts, with each one's samples processed (after
+ * 'esp_i2c_lsm6dsox_fifo_read_finish()') while the next is on the bus.
+ */
+int esp_i2c_lsm6dsox_fifo_read_start(struct i2c_lsm6dsox *i2c_lsm6dsox, int num_words) {
+    if (num_words > LSM6DSOX_FIFO_MAX_BURST_WORDS) num_words = LSM6DSOX_FIFO_MAX_BURST_WORDS;
+    if (num_words <= 0) return 0;
+
+    if (sensor_bus_read_start(&i2c_lsm6dsox->bus, FIFO_DATA_OUT_TAG, \
+        i2c_lsm6dsox->fifo_words, num_words * LSM6DSOX_FIFO_WORD_LEN) != ESP_OK) {
+        return 0;
+    }
+    i2c_lsm6dsox->fifo_words_pending = num_words;
+
+    return num_words;
+}
+
+
+/** Waits for the burst started by 'esp_i2c_lsm6dsox_fifo_read_start()' and
+ * stores the gyroscope + accelerometer samples its words hold in 'samples',
+ * which needs room for as many samples as words were read. Returns the number
+ * of samples written to 'samples', which is 0 if the read failed.
+ *
+ * A failed burst loses whatever words it had taken out of the FIFO, along
+ * with any half-paired sample from before it, since the next word can't be
+ * assumed to follow on from it. Samples go untimed until the next timestamp
+ * word for the same reason. */
+int esp_i2c_lsm6dsox_fifo_read_finish(struct i2c_lsm6dsox *i2c_lsm6dsox, \
+    struct lsm6dsox_fifo_sample *samples) {
+
+    int num_words = i2c_lsm6dsox->fifo_words_pending;
+    i2c_lsm6dsox->fifo_words_pending = 0;
+    if (sensor_bus_read_finish(&i2c_lsm6dsox->bus) != ESP_OK) {
+        i2c_lsm6dsox->fifo_pending_flags = 0;
+        i2c_lsm6dsox->fifo_ts_valid = 0;
+        return 0;
+    }
+
+    return esp_i2c_lsm6dsox_fifo_decode(i2c_lsm6dsox, i2c_lsm6dsox->fifo_words, num_words, \
+        samples);
+}
+
+
+/* The 6 data bytes of a gyroscope or accelerometer FIFO word are the same
+ * little endian, two's complement triplet as the output registers */
+static inline void lsm6dsox_fifo_decode_triplet(const uint8_t *data, int16_t *raw) {
+    for (int j = 0; j < 3; j++) {
+        raw[j] = (int16_t) ((uint16_t) data[2 * j] | ((uint16_t) data[2 * j + 1] << 8));
+    }
+}
+
+
+/* Hands the sample 'pending' has built up to 'sample', and starts on the
+ * next one */
+static inline void lsm6dsox_fifo_emit(struct i2c_lsm6dsox *i2c_lsm6dsox, \
+    struct lsm6dsox_fifo_sample *sample) {
+
+    *sample = i2c_lsm6dsox->fifo_pending;
+    sample->time_us = (i2c_lsm6dsox->fifo_ts_valid && i2c_lsm6dsox->clock.synced) ? \
+        esp_i2c_lsm6dsox_clock_to_us(i2c_lsm6dsox, sample->timestamp) : 0;
+    i2c_lsm6dsox->fifo_pending.m_new = 0;
+    i2c_lsm6dsox->fifo_pending_flags = 0;
+}
+
+
+/** Decodes 'num_words' FIFO words (each LSM6DSOX_FIFO_WORD_LEN bytes long,
+ * as read from FIFO_DATA_OUT_TAG onwards) into raw gyroscope + accelerometer
+ * samples, storing them in 'samples'. Returns the number of samples written.
+ *
+ * A sample is produced once both a gyroscope and an accelerometer word have
+ * been seen. If the two sensors are batched at different rates, the slower
+ * sensor's last value is held and paired with each new value from the faster
+ * one, so at most one sample is produced per word. Sensor hub words (see
+ * 'esp_i2c_lsm6dsox_shub_begin()') are held the same way, in 'm_raw'.
+ *
+ * Each sample is timed from the last timestamp word and the number of
+ * gyroscope words since. The gap between timestamp words is measured as they
+ * come in, so this follows the device's real batch data rate rather than the
+ * nominal one.
+ */
+int esp_i2c_lsm6dsox_fifo_decode(struct i2c_lsm6dsox *i2c_lsm6dsox, \
+    const uint8_t *words, int num_words, struct lsm6dsox_fifo_sample *samples) {
+
+    struct lsm6dsox_fifo_sample *pending = &i2c_lsm6dsox->fifo_pending;
+    int num_samples = 0;
+
+    for (int i = 0; i < num_words; i++) {
+        const uint8_t *word = &words[i * LSM6DSOX_FIFO_WORD_LEN];
+        const struct lsm6dsox_fifo_data_out_tag *tag = \
+            (const struct lsm6dsox_fifo_data_out_tag *) &word[0];
+        const uint8_t *data = &word[1];
+
+
+        switch (tag->tag_sensor) {
+            case LSM6DSOX_TAG_GYRO_NC:
+                /* A second gyroscope word before an accelerometer one means
+                 * the accelerometer is batched more slowly: emit what we have
+                 * with the accelerometer value held */
+                if (i2c_lsm6dsox->fifo_pending_flags & FIFO_PENDING_GYRO) {
+                    lsm6dsox_fifo_emit(i2c_lsm6dsox, &samples[num_samples++]);
+                }
+                lsm6dsox_fifo_decode_triplet(data, pending->g_raw);
+                pending->timestamp = i2c_lsm6dsox->fifo_ts + (uint32_t) lroundf( \
+                    i2c_lsm6dsox->fifo_ts_gyro_words * i2c_lsm6dsox->fifo_ts_ticks_per_gyro);
+                i2c_lsm6dsox->fifo_ts_gyro_words++;
+                i2c_lsm6dsox->fifo_pending_flags |= FIFO_PENDING_GYRO;
+                break;
+            case LSM6DSOX_TAG_XL_NC:
+                if (i2c_lsm6dsox->fifo_pending_flags & FIFO_PENDING_ACCEL) {
+                    lsm6dsox_fifo_emit(i2c_lsm6dsox, &samples[num_samples++]);
+                }
+                lsm6dsox_fifo_decode_triplet(data, pending->a_raw);
+                i2c_lsm6dsox->fifo_pending_flags |= FIFO_PENDING_ACCEL;
+                break;
+            case LSM6DSOX_TAG_TIMESTAMP: {
+                /* The first 4 data bytes hold TIMESTAMP0 through TIMESTAMP3 */
+                const uint32_t ts = (uint32_t) data[0] | ((uint32_t) data[1] << 8) \
+                    | ((uint32_t) data[2] << 16) | ((uint32_t) data[3] << 24);
+                /* Measure the gyroscope words' spacing against the last
+                 * timestamp word, unless the gap is too far out to be
+                 * trusted (words were lost, or the rate changed) */
+                if (i2c_lsm6dsox->fifo_ts_valid && i2c_lsm6dsox->fifo_ts_gyro_words > 0) {
+                    const float ticks_per_gyro = (float) (ts - i2c_lsm6dsox->fifo_ts) \
+                        / i2c_lsm6dsox->fifo_ts_gyro_words;
+                    const float expected = i2c_lsm6dsox->fifo_ts_ticks_per_gyro;
+                    if (fabsf(ticks_per_gyro - expected) < LSM6DSOX_CLOCK_MAX_ERROR * expected) {
+                        i2c_lsm6dsox->fifo_ts_ticks_per_gyro = ticks_per_gyro;
+                    }
+                }
+                i2c_lsm6dsox->fifo_ts = ts;
+                i2c_lsm6dsox->fifo_ts_gyro_words = 0;
+                i2c_lsm6dsox->fifo_ts_valid = 1;
+                break;
+            }
+            case LSM6DSOX_TAG_SHUB_SLAVE0:
+                lsm6dsox_fifo_decode_triplet(data, pending->m_raw);
+                pending->m_new = 1;
+                break;
+            case LSM6DSOX_TAG_SHUB_NACK:
+                i2c_lsm6dsox->shub_nacks++;
+                break;
+            default:
+                /* Temperature, config change and any other words are of no
+                 * interest to us */
+                break;
+        }
+
+        if (i2c_lsm6dsox->fifo_pending_flags == (FIFO_PENDING_GYRO | FIFO_PENDING_ACCEL)) {
+            lsm6dsox_fifo_emit(i2c_lsm6dsox, &samples[num_samples++]);
+        }
+    }
+
+    return num_samples;
+}
+
+
+/** Takes a struct i2c_lsm6dsox which has already been set up with
+ * 'esp_i2c_lsm6dsox_begin()' and has its 'int1' member filled in, routes the
+ * events selected in 'int1_ctrl' to the INT1 pin and starts delivering them to
+ * 'i2c_lsm6dsox->int1.task' as task notifications.
+ *
+ * Use 'int1_drdy_xl'/'int1_drdy_g' when polling the output registers and
+ * 'int1_fifo_th' when reading from the FIFO. In both cases the line stays
+ * high until the data is read, after which the task must call
+ * 'esp_i2c_lsm6dsox_int1_rearm()'.
+ */
+void esp_i2c_lsm6dsox_int1_begin(struct i2c_lsm6dsox *i2c_lsm6dsox, \
+    struct lsm6dsox_int1_ctrl int1_ctrl) {
+
+    /* 1. Route the requested events to INT1 */
+    ESP_ERROR_CHECK(sensor_bus_write(&i2c_lsm6dsox->bus, INT1_CTRL, \
+        (uint8_t *)&int1_ctrl, 1));
+
+    /* 2. Start listening for them */
+    drdy_irq_begin(&i2c_lsm6dsox->int1);
+}
+
+
+/** Re-enables the INT1 interrupt after the task notified by it has read the
+ * data that raised it. */
+void esp_i2c_lsm6dsox_int1_rearm(struct i2c_lsm6dsox *i2c_lsm6dsox) {
+    drdy_irq_rearm(&i2c_lsm6dsox->int1);
+}
+
+
+/** Takes a reading of the timestamp counter against esp_timer and uses it to
+ * keep 'i2c_lsm6dsox->clock' (and so 'esp_i2c_lsm6dsox_clock_to_us()') lined
+ * up with esp_timer. Call it once after 'esp_i2c_lsm6dsox_fifo_begin()' and
+ * then every second or so; readings closer together than
+ * LSM6DSOX_CLOCK_SYNC_MIN_TICKS are skipped.
+ *
+ * The first reading sets the offset between the clocks outright. Later ones
+ * nudge both the offset and the tick length towards what they measure, so a
+ * single reading delayed by the bus (or by an interrupt) can't throw the
+ * samples' times out by much, while the slow drift of either oscillator with
+ * temperature is still followed.
+ */
+esp_err_t esp_i2c_lsm6dsox_clock_sync(struct i2c_lsm6dsox *i2c_lsm6dsox) {
+    struct lsm6dsox_clock *clock = &i2c_lsm6dsox->clock;
+
+    /* 1. Read the counter, and take the time halfway through the read as
+     * when it was sampled */
+    uint8_t raw[4];
+    const int64_t before_us = esp_timer_get_time();
+    esp_err_t err = sensor_bus_read(&i2c_lsm6dsox->bus, TIMESTAMP0, raw, sizeof(raw));
+    const int64_t after_us = esp_timer_get_time();
+    if (err != ESP_OK) {
+        return err;
+    }
+    const uint32_t ticks = (uint32_t) raw[0] | ((uint32_t) raw[1] << 8) \
+        | ((uint32_t) raw[2] << 16) | ((uint32_t) raw[3] << 24);
+    const int64_t now_us = before_us + (after_us - before_us) / 2;
+
+    /* 2. The first reading is all there is to go on */
+    if (!clock->synced) {
+        clock->base_ticks = ticks;
+        clock->base_us = now_us;
+        clock->synced = 1;
+        return ESP_OK;
+    }
+
+    const int32_t elapsed_ticks = (int32_t) (ticks - clock->base_ticks);
+    if (elapsed_ticks < LSM6DSOX_CLOCK_SYNC_MIN_TICKS) {
+        /* Too soon to say anything about the tick length. A counter that has
+         * gone backwards was reset, so start again */
+        if (elapsed_ticks < 0) {
+            clock->synced = 0;
+        }
+        return ESP_OK;
+    }
+
+    /* 3. Compare how far each clock has moved since the base reading */
+    const float measured_us_per_tick = (float) (now_us - clock->base_us) / elapsed_ticks;
+    if (fabsf(measured_us_per_tick - clock->us_per_tick) \
+        > LSM6DSOX_CLOCK_MAX_ERROR * clock->us_per_tick) {
+        clock->synced = 0;
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    clock->us_per_tick += LSM6DSOX_CLOCK_RATE_GAIN * (measured_us_per_tick - clock->us_per_tick);
+
+    /* 4. Move the base up to this reading, keeping most of where the old
+     * one put it so that the samples' times stay smooth */
+    const int64_t predicted_us = esp_i2c_lsm6dsox_clock_to_us(i2c_lsm6dsox, ticks);
+    clock->base_ticks = ticks;
+    clock->base_us = predicted_us \
+        + (int64_t) lroundf(LSM6DSOX_CLOCK_OFFSET_GAIN * (float) (now_us - predicted_us));
+
+    return ESP_OK;
+}
+
+
+/** Returns when the timestamp counter read 'ticks', by esp_timer. Only
+ * meaningful once 'esp_i2c_lsm6dsox_clock_sync()' has been called, and for
+ * values of the counter within a few minutes of its last call. */
+int64_t esp_i2c_lsm6dsox_clock_to_us(const struct i2c_lsm6dsox *i2c_lsm6dsox, uint32_t ticks) {
+    const struct lsm6dsox_clock *clock = &i2c_lsm6dsox->clock;
+    /* Scale by the nominal tick length in integers, and only the (small)
+     * difference from it in floating point, which keeps the result to the
+     * microsecond well past the point a float of the whole product would not */
+    const int32_t elapsed_ticks = (int32_t) (ticks - clock->base_ticks);
+    return clock->base_us + (int64_t) elapsed_ticks * LSM6DSOX_TIMESTAMP_LSB_US \
+        + lroundf((float) elapsed_ticks * (clock->us_per_tick - LSM6DSOX_TIMESTAMP_LSB_US));
+}
+
+
+/* Sensor hub {{{ */
+/* Switches the registers at SENSOR_HUB_1 through STATUS_MASTER between the
+ * sensor hub's and the main page's */
+static esp_err_t lsm6dsox_shub_access(struct i2c_lsm6dsox *i2c_lsm6dsox, bool on) {
+    struct lsm6dsox_func_cfg_access func_cfg_access_content = {};
+    func_cfg_access_content.shub_reg_access = on;
+    return sensor_bus_write(&i2c_lsm6dsox->bus, FUNC_CFG_ACCESS, \
+        (uint8_t *) &func_cfg_access_content, 1);
+}
+
+
+/* Turns the sensor hub's I2C master on or off. With 'write_once', a slave 0
+ * write is only done on the first cycle rather than on every one */
+static esp_err_t lsm6dsox_shub_master(struct i2c_lsm6dsox *i2c_lsm6dsox, bool on, \
+    bool write_once) {
+
+    struct lsm6dsox_master_config master_config_content = {};
+    master_config_content.master_on = on;
+    master_config_content.shub_pu_en = i2c_lsm6dsox->shub_pull_up;
+    master_config_content.write_once = write_once;
+    return sensor_bus_write(&i2c_lsm6dsox->bus, MASTER_CONFIG, \
+        (uint8_t *) &master_config_content, 1);
+}
+
+
+/* Points slave 0 at 'reg' on the device on the auxiliary bus, reading 'len'
+ * bytes or (if 'read' is false) writing DATAWRITE_SLV0. Sensor hub register
+ * access has to be on */
+static esp_err_t lsm6dsox_shub_slave0(struct i2c_lsm6dsox *i2c_lsm6dsox, bool read, \
+    uint8_t reg, uint8_t len, lsm6dsox_shub_odr_t odr, bool batch) {
+
+    struct lsm6dsox_slv0_add slv0_add_content = {};
+    slv0_add_content.slave0_add = i2c_lsm6dsox->shub_address;
+    slv0_add_content.rw_0 = read;
+    struct lsm6dsox_slv0_config slv0_config_content = {};
+    slv0_config_content.slave0_numop = read ? len : 0;
+    slv0_config_content.batch_ext_sens_0_en = batch;
+    slv0_config_content.shub_odr = odr;
+
+    /* SLV0_ADD, SLV0_SUBADD and SLV0_CONFIG are next to each other */
+    uint8_t slv0[3];
+    slv0[0] = *((uint8_t *) &slv0_add_content);
+    slv0[1] = reg;
+    slv0[2] = *((uint8_t *) &slv0_config_content);
+    return sensor_bus_write(&i2c_lsm6dsox->bus, SLV0_ADD, slv0, sizeof(slv0));
+}
+
+
+/* Runs the slave 0 transaction already set up by 'lsm6dsox_shub_slave0()'
+ * once: turns the master on, waits for the end of a sensor hub cycle and
+ * turns it off again. Returns ESP_ERR_NOT_FOUND if the device did not
+ * answer */
+static esp_err_t lsm6dsox_shub_run_once(struct i2c_lsm6dsox *i2c_lsm6dsox, bool write) {
+    esp_err_t err = lsm6dsox_shub_master(i2c_lsm6dsox, true, write);
+    if (err == ESP_OK) {
+        err = lsm6dsox_shub_access(i2c_lsm6dsox, false);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    /* The hub runs a cycle on each accelerometer sample. SENS_HUB_ENDOP can
+     * still be set from before the master was turned on, so a cycle only
+     * counts once a tick has gone by */
+    struct lsm6dsox_status_master status_master_content = {};
+    TickType_t timeout_ticks = pdMS_TO_TICKS(LSM6DSOX_SHUB_TIMEOUT_MS);
+    for (TickType_t tick = 0; tick <= timeout_ticks; tick++) {
+        vTaskDelay(1);
+        err = sensor_bus_read(&i2c_lsm6dsox->bus, STATUS_MASTER_MAINPAGE, \
+            (uint8_t *) &status_master_content, 1);
+        if (err != ESP_OK || status_master_content.sens_hub_endop) {
+            break;
+        }
+    }
+    if (err == ESP_OK && !status_master_content.sens_hub_endop) {
+        err = ESP_ERR_TIMEOUT;
+    }
+
+    /* Turn the master off again whatever happened */
+    esp_err_t off_err = lsm6dsox_shub_access(i2c_lsm6dsox, true);
+    if (off_err == ESP_OK) {
+        off_err = lsm6dsox_shub_master(i2c_lsm6dsox, false, false);
+    }
+    if (err == ESP_OK) {
+        err = off_err;
+    }
+    if (err == ESP_OK && status_master_content.slave0_nack) {
+        err = ESP_ERR_NOT_FOUND;
+    }
+
+    return err;
+}
+
+
+/* The struct sensor_bus_hub read for the device on the auxiliary bus. Each
+ * sensor hub cycle can read at most LSM6DSOX_SHUB_MAX_READ_LEN bytes, so
+ * longer reads take a cycle per chunk. The master is off between reads */
+static esp_err_t lsm6dsox_shub_read(void *ctx, uint8_t reg, uint8_t *data, size_t len) {
+    struct i2c_lsm6dsox *i2c_lsm6dsox = (struct i2c_lsm6dsox *) ctx;
+
+    for (size_t offset = 0; offset < len; offset += LSM6DSOX_SHUB_MAX_READ_LEN) {
+        uint8_t chunk = (len - offset < LSM6DSOX_SHUB_MAX_READ_LEN) \
+            ? (uint8_t) (len - offset) : LSM6DSOX_SHUB_MAX_READ_LEN;
+
+        esp_err_t err = lsm6dsox_shub_access(i2c_lsm6dsox, true);
+        if (err == ESP_OK) {
+            err = lsm6dsox_shub_slave0(i2c_lsm6dsox, true, (uint8_t) (reg + offset), chunk, \
+                LSM6DSOX_SHUB_ODR_104Hz, false);
+        }
+        if (err == ESP_OK) {
+            err = lsm6dsox_shub_run_once(i2c_lsm6dsox, false);
+        }
+        /* Sensor hub register access is still on */
+        if (err == ESP_OK) {
+            err = sensor_bus_read(&i2c_lsm6dsox->bus, SENSOR_HUB_1, &data[offset], chunk);
+        }
+        esp_err_t access_err = lsm6dsox_shub_access(i2c_lsm6dsox, false);
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (access_err != ESP_OK) {
+            return access_err;
+        }
+    }
+
+    return ESP_OK;
+}
+
+
+/* The struct sensor_bus_hub write for the device on the auxiliary bus. The
+ * sensor hub writes one byte per cycle, so a burst becomes one write per
+ * byte, with the register address moved on by hand */
+static esp_err_t lsm6dsox_shub_write(void *ctx, uint8_t reg, const uint8_t *data, \
+    size_t len) {
+
+    struct i2c_lsm6dsox *i2c_lsm6dsox = (struct i2c_lsm6dsox *) ctx;
+
+    for (size_t i = 0; i < len; i++) {
+        esp_err_t err = lsm6dsox_shub_access(i2c_lsm6dsox, true);
+        if (err == ESP_OK) {
+            err = lsm6dsox_shub_slave0(i2c_lsm6dsox, false, (uint8_t) (reg + i), 0, \
+                LSM6DSOX_SHUB_ODR_104Hz, false);
+        }
+        if (err == ESP_OK) {
+            err = sensor_bus_write(&i2c_lsm6dsox->bus, DATAWRITE_SLV0, &data[i], 1);
+        }
+        if (err == ESP_OK) {
+            err = lsm6dsox_shub_run_once(i2c_lsm6dsox, true);
+        }
+        esp_err_t access_err = lsm6dsox_shub_access(i2c_lsm6dsox, false);
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (access_err != ESP_OK) {
+            return access_err;
+        }
+    }
+
+    return ESP_OK;
+}
+
+
+/** Takes a struct i2c_lsm6dsox which has already been set up with
+ * 'esp_i2c_lsm6dsox_begin()' and points 'bus' at the device at 7 bit I2C
+ * address 'address' on the LSM6DSOX's auxiliary I2C bus (SDx/SCx), with the
+ * LSM6DSOX's own pull-ups on that bus if 'pull_up'. The device's driver can
+ * then set it up over 'bus' as if it were on the ESP32's bus, one sensor
+ * hub cycle per transaction (and per byte written), so this is only meant
+ * for bringing it up.
+ *
+ * The accelerometer has to be running, since its samples pace the sensor
+ * hub. Once 'esp_i2c_lsm6dsox_shub_begin()' has started the hub reading the
+ * device by itself, 'bus' must not be used again. */
+void esp_i2c_lsm6dsox_shub_init_bus(struct i2c_lsm6dsox *i2c_lsm6dsox, uint8_t address, \
+    bool pull_up, struct sensor_bus *bus) {
+
+    i2c_lsm6dsox->shub_address = address;
+    i2c_lsm6dsox->shub_pull_up = pull_up;
+    i2c_lsm6dsox->shub_nacks = 0;
+    i2c_lsm6dsox->shub.ctx = i2c_lsm6dsox;
+    i2c_lsm6dsox->shub.read = lsm6dsox_shub_read;
+    i2c_lsm6dsox->shub.write = lsm6dsox_shub_write;
+    sensor_bus_init_hub(bus, &i2c_lsm6dsox->shub);
+}
+
+
+/** Starts the sensor hub reading the block of registers described by
+ * 'shub_config' from the device set up with
+ * 'esp_i2c_lsm6dsox_shub_init_bus()', over and over, without the ESP32 being
+ * involved. With 'batch' set, each reading goes into the FIFO between the
+ * gyroscope and accelerometer words, and comes out of
+ * 'esp_i2c_lsm6dsox_fifo_decode()' in 'm_raw', so a magnetometer costs no
+ * transactions of its own and its samples line up with the others'. The
+ * latest reading can also be read with 'esp_i2c_lsm6dsox_shub_get_data()'.
+ *
+ * Call this before 'esp_i2c_lsm6dsox_fifo_begin()'. */
+esp_err_t esp_i2c_lsm6dsox_shub_begin(struct i2c_lsm6dsox *i2c_lsm6dsox, \
+    const struct lsm6dsox_shub_config *shub_config) {
+
+    if (shub_config->len == 0 || shub_config->len > LSM6DSOX_SHUB_MAX_READ_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = lsm6dsox_shub_access(i2c_lsm6dsox, true);
+    if (err == ESP_OK) {
+        err = lsm6dsox_shub_slave0(i2c_lsm6dsox, true, shub_config->reg, shub_config->len, \
+            shub_config->odr, shub_config->batch);
+    }
+    if (err == ESP_OK) {
+        err = lsm6dsox_shub_master(i2c_lsm6dsox, true, false);
+    }
+    esp_err_t access_err = lsm6dsox_shub_access(i2c_lsm6dsox, false);
+
+    return (err != ESP_OK) ? err : access_err;
+}
+
+
+/** Reads the latest 'len' bytes the sensor hub read from the device on the
+ * auxiliary bus (see 'esp_i2c_lsm6dsox_shub_begin()') into 'data'. The
+ * registers they are in have to be switched in and out, so this takes three
+ * transactions, and reading the FIFO is the better way to get them every
+ * sample. */
+esp_err_t esp_i2c_lsm6dsox_shub_get_data(struct i2c_lsm6dsox *i2c_lsm6dsox, uint8_t *data, \
+    size_t len) {
+
+    esp_err_t err = lsm6dsox_shub_access(i2c_lsm6dsox, true);
+    if (err == ESP_OK) {
+        err = sensor_bus_read(&i2c_lsm6dsox->bus, SENSOR_HUB_1, data, len);
+    }
+    esp_err_t access_err = lsm6dsox_shub_access(i2c_lsm6dsox, false);
+
+    return (err != ESP_OK) ? err : access_err;
+}
+/* }}} */
@@ -1,10 +1,22 @@
 #ifndef __ESP32_I2C_LSM6DSOX_H_
 #define __ESP32_I2C_LSM6DSOX_H_
 
-#include "driver/i2c_master.h"
+#include <math.h>
+#include <stdbool.h>
 
+#include "sensor-bus.h"
 
-#define CTRL1_XL 0x10 // datasheet page 44
+#include "esp32-i2c-lsm6dsox-lis3mdl-common.h"
+
+
+#define FUNC_CFG_ACCESS 0x01 // datasheet page 44
+#define FIFO_CTRL1 0x07 // ^
+#define FIFO_CTRL2 0x08 // ^
+#define FIFO_CTRL3 0x09 // ^
+#define FIFO_CTRL4 0x0A // ^
+#define INT1_CTRL 0x0D // ^
+#define LSM6DSOX_WHO_AM_I 0x0F // ^
+#define CTRL1_XL 0x10 // ^
 #define CTRL2_G 0x11 // ^
 #define CTRL3_C 0x12 // ^
 #define CTRL4_C 0x13 // ^
@@ -14,6 +26,9 @@
 #define CTRL8_XL 0x17 // ^
 #define CTRL9_XL 0x18 // ^
 #define CTRL10_C 0x19 // ^
+/* The number of control registers, CTRL1_XL through CTRL10_C, which are
+ * written (and read back) in one burst by 'esp_i2c_lsm6dsox_begin()' */
+#define LSM6DSOX_CTRL_REG_COUNT 10
 #define OUTX_L_G 0x22 // datasheet page 45
 #define OUTX_H_G 0x23 // ^
 #define OUTY_L_G 0x24 // ^
@@ -26,6 +41,62 @@
 #define OUTY_H_A 0x2B // ^
 #define OUTZ_L_A 0x2C // ^
 #define OUTZ_H_A 0x2D // ^
+#define STATUS_MASTER_MAINPAGE 0x39 // datasheet page 45
+#define FIFO_STATUS1 0x3A // ^
+#define FIFO_STATUS2 0x3B // ^
+#define TIMESTAMP0 0x40 // ^
+#define INTERNAL_FREQ_FINE 0x63 // ^
+#define FIFO_DATA_OUT_TAG 0x78 // ^
+/* The sensor hub's registers. These share addresses with the main page, and
+ * are only reachable while SHUB_REG_ACCESS is set in FUNC_CFG_ACCESS */
+#define SENSOR_HUB_1 0x02 // datasheet, sensor hub registers
+#define MASTER_CONFIG 0x14 // ^
+#define SLV0_ADD 0x15 // ^
+#define SLV0_SUBADD 0x16 // ^
+#define SLV0_CONFIG 0x17 // ^
+#define DATAWRITE_SLV0 0x21 // ^
+#define STATUS_MASTER 0x22 // ^
+/* SLV0_CONFIG has 3 bits for the number of bytes to read */
+#define LSM6DSOX_SHUB_MAX_READ_LEN 7
+/* How long a single sensor hub transaction is given to happen. The hub runs
+ * one transaction per accelerometer sample, so this has to cover a few
+ * samples at the slowest ODR the accelerometer is ever run at */
+#define LSM6DSOX_SHUB_TIMEOUT_MS 200
+/* Number of bytes covered by OUTX_L_G through OUTZ_H_A. Read in one
+ * auto-incremented burst (IF_INC in CTRL3_C, set by default) this gives us
+ * both the gyroscope and accelerometer triplets in a single transaction */
+#define LSM6DSOX_GYRO_ACCEL_BURST_LEN 12
+/* Each FIFO word is a tag byte followed by 6 bytes of data (see
+ * FIFO_DATA_OUT_TAG in the datasheet). When IF_INC is set, reading past
+ * FIFO_DATA_OUT_Z_H rolls the address back to FIFO_DATA_OUT_TAG, so any number
+ * of words can be drained in a single burst read */
+#define LSM6DSOX_FIFO_WORD_LEN 7
+/* FIFO_CTRL1/FIFO_CTRL2 give us 9 bits of watermark */
+#define LSM6DSOX_FIFO_WATERMARK_MAX 511
+/* The most words 'esp_i2c_lsm6dsox_fifo_read()' will drain in one burst. This
+ * bounds the size of the read buffer it keeps on the stack */
+#define LSM6DSOX_FIFO_MAX_BURST_WORDS 64
+/* What LSM6DSOX_WHO_AM_I always reads back as (datasheet page 52) */
+#define LSM6DSOX_WHO_AM_I_VALUE 0x6C
+/* Nominal resolution of the timestamp counter (see TIMESTAMP0). The real
+ * one is off from this by the device's internal oscillator error, which
+ * INTERNAL_FREQ_FINE gives in steps of LSM6DSOX_FREQ_FINE_STEP (datasheet
+ * page 88) */
+#define LSM6DSOX_TIMESTAMP_LSB_US 25
+#define LSM6DSOX_FREQ_FINE_STEP 0.0015f
+/* How 'esp_i2c_lsm6dsox_clock_sync()' keeps the timestamp counter lined up
+ * with esp_timer. It only takes a new reading once this many ticks (about
+ * half a second) have gone by, so that the few microseconds of uncertainty
+ * in each reading stay small next to the interval they are spread over, then
+ * moves its estimates of the tick length and of the offset between the two
+ * clocks this far towards what the reading says */
+#define LSM6DSOX_CLOCK_SYNC_MIN_TICKS 20000
+#define LSM6DSOX_CLOCK_RATE_GAIN 0.1f
+#define LSM6DSOX_CLOCK_OFFSET_GAIN 0.2f
+/* Neither oscillator is anywhere near this far out, so a tick length (or a
+ * gap between FIFO timestamps) further than this from what was expected
+ * means a reading went wrong, and it is thrown away */
+#define LSM6DSOX_CLOCK_MAX_ERROR 0.05f
 #define LSM6DSOX_ACC_SENSITIVITY_FS_2G  0.061f // datasheet page 10
 #define LSM6DSOX_ACC_SENSITIVITY_FS_4G  0.122f // ^
 #define LSM6DSOX_ACC_SENSITIVITY_FS_8G  0.244f // ^
@@ -35,6 +106,170 @@
 #define LSM6DSOX_GYRO_SENSITIVITY_FS_500DPS  17.500f // ^
 #define LSM6DSOX_GYRO_SENSITIVITY_FS_1000DPS 35.000f // ^
 #define LSM6DSOX_GYRO_SENSITIVITY_FS_2000DPS 70.000f // ^
+/* For turning the sensitivities above into SI scale factors */
+#define LSM6DSOX_MDPS_TO_RAD_PER_S ((float) M_PI / 180000.0f)
+#define LSM6DSOX_MG_TO_M_PER_S2 (9.80665f / 1000.0f)
+
+
+struct lsm6dsox_fifo_ctrl2 {
+    uint8_t wtm8:1;
+    uint8_t uncoptr_rate:2;
+    uint8_t not_used_01:1;
+    uint8_t odrchg_en:1;
+    uint8_t not_used_02:1;
+    uint8_t fifo_compr_rt_en:1;
+    uint8_t stop_on_wtm:1;
+};
+
+
+struct lsm6dsox_fifo_ctrl3 {
+    uint8_t bdr_xl:4;
+    uint8_t bdr_gy:4;
+};
+
+typedef enum {
+    LSM6DSOX_BDR_XL_OFF    = 0, // datasheet FIFO_CTRL3
+    LSM6DSOX_BDR_XL_12Hz5  = 1, // ^
+    LSM6DSOX_BDR_XL_26Hz   = 2, // ^
+    LSM6DSOX_BDR_XL_52Hz   = 3, // ^
+    LSM6DSOX_BDR_XL_104Hz  = 4, // ^
+    LSM6DSOX_BDR_XL_208Hz  = 5, // ^
+    LSM6DSOX_BDR_XL_417Hz  = 6, // ^
+    LSM6DSOX_BDR_XL_833Hz  = 7, // ^
+    LSM6DSOX_BDR_XL_1667Hz = 8, // ^
+    LSM6DSOX_BDR_XL_3333Hz = 9, // ^
+    LSM6DSOX_BDR_XL_6667Hz = 10, // ^
+    LSM6DSOX_BDR_XL_1Hz6   = 11, // ^
+} lsm6dsox_bdr_xl_t;
+
+typedef enum {
+    LSM6DSOX_BDR_GY_OFF    = 0, // datasheet FIFO_CTRL3
+    LSM6DSOX_BDR_GY_12Hz5  = 1, // ^
+    LSM6DSOX_BDR_GY_26Hz   = 2, // ^
+    LSM6DSOX_BDR_GY_52Hz   = 3, // ^
+    LSM6DSOX_BDR_GY_104Hz  = 4, // ^
+    LSM6DSOX_BDR_GY_208Hz  = 5, // ^
+    LSM6DSOX_BDR_GY_417Hz  = 6, // ^
+    LSM6DSOX_BDR_GY_833Hz  = 7, // ^
+    LSM6DSOX_BDR_GY_1667Hz = 8, // ^
+    LSM6DSOX_BDR_GY_3333Hz = 9, // ^
+    LSM6DSOX_BDR_GY_6667Hz = 10, // ^
+    LSM6DSOX_BDR_GY_6Hz5   = 11, // ^
+} lsm6dsox_bdr_gy_t;
+
+
+struct lsm6dsox_fifo_ctrl4 {
+    uint8_t fifo_mode:3;
+    uint8_t not_used_01:1;
+    uint8_t odr_t_batch:2;
+    uint8_t dec_ts_batch:2;
+};
+
+typedef enum {
+    LSM6DSOX_FIFO_MODE_BYPASS           = 0, // datasheet FIFO_CTRL4
+    LSM6DSOX_FIFO_MODE_FIFO             = 1, // ^
+    LSM6DSOX_FIFO_MODE_STREAM_TO_FIFO   = 3, // ^
+    LSM6DSOX_FIFO_MODE_BYPASS_TO_STREAM = 4, // ^
+    LSM6DSOX_FIFO_MODE_STREAM           = 6, // ^
+    LSM6DSOX_FIFO_MODE_BYPASS_TO_FIFO   = 7, // ^
+} lsm6dsox_fifo_mode_t;
+
+typedef enum {
+    LSM6DSOX_DEC_TS_OFF = 0, // datasheet FIFO_CTRL4
+    LSM6DSOX_DEC_TS_1   = 1, // ^
+    LSM6DSOX_DEC_TS_8   = 2, // ^
+    LSM6DSOX_DEC_TS_32  = 3, // ^
+} lsm6dsox_dec_ts_batch_t;
+
+
+struct lsm6dsox_fifo_status2 {
+    uint8_t diff_fifo_hi:2;
+    uint8_t not_used_01:1;
+    uint8_t over_run_latched:1;
+    uint8_t counter_bdr_ia:1;
+    uint8_t fifo_full_ia:1;
+    uint8_t fifo_ovr_ia:1;
+    uint8_t fifo_wtm_ia:1;
+};
+
+
+struct lsm6dsox_fifo_data_out_tag {
+    uint8_t tag_parity:1;
+    uint8_t tag_cnt:2;
+    uint8_t tag_sensor:5;
+};
+
+typedef enum {
+    LSM6DSOX_TAG_GYRO_NC      = 0x01, // datasheet FIFO_DATA_OUT_TAG
+    LSM6DSOX_TAG_XL_NC        = 0x02, // ^
+    LSM6DSOX_TAG_TEMPERATURE  = 0x03, // ^
+    LSM6DSOX_TAG_TIMESTAMP    = 0x04, // ^
+    LSM6DSOX_TAG_CFG_CHANGE   = 0x05, // ^
+    LSM6DSOX_TAG_SHUB_SLAVE0  = 0x0E, // ^
+    LSM6DSOX_TAG_SHUB_NACK    = 0x19, // ^
+} lsm6dsox_fifo_tag_t;
+
+
+struct lsm6dsox_func_cfg_access {
+    uint8_t not_used_01:6;
+    uint8_t shub_reg_access:1;
+    uint8_t func_cfg_access:1;
+};
+
+
+struct lsm6dsox_master_config {
+    uint8_t aux_sens_on:2;
+    uint8_t master_on:1;
+    uint8_t shub_pu_en:1;
+    uint8_t pass_through_mode:1;
+    uint8_t start_config:1;
+    uint8_t write_once:1;
+    uint8_t rst_master_regs:1;
+};
+
+
+struct lsm6dsox_slv0_add {
+    uint8_t rw_0:1;
+    uint8_t slave0_add:7;
+};
+
+
+struct lsm6dsox_slv0_config {
+    uint8_t slave0_numop:3;
+    uint8_t batch_ext_sens_0_en:1;
+    uint8_t not_used_01:2;
+    uint8_t shub_odr:2;
+};
+
+typedef enum {
+    LSM6DSOX_SHUB_ODR_104Hz = 0, // datasheet SLV0_CONFIG
+    LSM6DSOX_SHUB_ODR_52Hz  = 1, // ^
+    LSM6DSOX_SHUB_ODR_26Hz  = 2, // ^
+    LSM6DSOX_SHUB_ODR_12Hz5 = 3, // ^
+} lsm6dsox_shub_odr_t;
+
+
+struct lsm6dsox_status_master {
+    uint8_t sens_hub_endop:1;
+    uint8_t not_used_01:2;
+    uint8_t slave0_nack:1;
+    uint8_t slave1_nack:1;
+    uint8_t slave2_nack:1;
+    uint8_t slave3_nack:1;
+    uint8_t wr_once_done:1;
+};
+
+
+struct lsm6dsox_int1_ctrl {
+    uint8_t int1_drdy_xl:1;
+    uint8_t int1_drdy_g:1;
+    uint8_t int1_boot:1;
+    uint8_t int1_fifo_th:1;
+    uint8_t int1_fifo_ovr:1;
+    uint8_t int1_fifo_full:1;
+    uint8_t int1_cnt_bdr:1;
+    uint8_t den_drdy_flag:1;
+};
 
 
 struct lsm6dsox_ctrl1_xl {
@@ -95,6 +330,30 @@ typedef enum {
 } lsm6dsox_fs_g_t;
 
 
+struct lsm6dsox_ctrl3_c {
+    uint8_t sw_reset:1;
+    uint8_t not_used_01:1;
+    uint8_t if_inc:1;
+    uint8_t sim:1;
+    uint8_t pp_od:1;
+    uint8_t h_lactive:1;
+    uint8_t bdu:1;
+    uint8_t boot:1;
+};
+
+
+struct lsm6dsox_ctrl4_c {
+    uint8_t not_used_01:1;
+    uint8_t lpf1_sel_g:1;
+    uint8_t i2c_disable:1;
+    uint8_t drdy_mask:1;
+    uint8_t not_used_02:1;
+    uint8_t int2_on_int1:1;
+    uint8_t sleep_g:1;
+    uint8_t not_used_03:1;
+};
+
+
 struct lsm6dsox_ctrl6_c {
     uint8_t ftype:3;
     uint8_t usr_off_w:1;
@@ -124,14 +383,175 @@ struct lsm6dsox_ctrl8_xl {
 };
 
 
+struct lsm6dsox_ctrl10_c {
+    uint8_t not_used_01:5;
+    uint8_t timestamp_en:1;
+    uint8_t not_used_02:2;
+};
+
+
+/* Reset value of CTRL9_XL (DEN_X, DEN_Y and DEN_Z set). None of the settings
+ * in it are of interest to us, but it sits in the middle of the control
+ * register block so it is written along with the rest */
+#define LSM6DSOX_CTRL9_XL_DEFAULT 0xE0
+
+
+/* Everything 'esp_i2c_lsm6dsox_begin()' needs to know to bring up the
+ * accelerometer and gyroscope. See the 'lsm6dsox_profile_*' definitions for
+ * ready made configurations */
+struct lsm6dsox_config {
+    const char *name;
+    /* Accelerometer ODR and full scale (CTRL1_XL, CTRL8_XL) */
+    lsm6dsox_odr_xl_t odr_xl;
+    lsm6dsox_fs_xl_t fs_xl;
+    uint8_t xl_fs_mode; /* If 1, FS_XL = 01 selects +-2g instead of +-16g */
+    /* Gyroscope ODR and full scale (CTRL2_G) */
+    lsm6dsox_odr_g_t odr_g;
+    lsm6dsox_fs_g_t fs_g;
+    uint8_t fs_125; /* If 1, overrides 'fs_g' with +-125dps */
+    /* Accelerometer filter chain (CTRL1_XL, CTRL8_XL) */
+    uint8_t lpf2_xl_en;
+    uint8_t hp_slope_xl_en;
+    uint8_t hpcf_xl; /* LPF2/HPF cutoff as a fraction of the ODR */
+    /* Gyroscope filter chain (CTRL4_C, CTRL6_C, CTRL7_G) */
+    uint8_t lpf1_sel_g;
+    uint8_t ftype; /* LPF1 bandwidth, only used if 'lpf1_sel_g' is 1 */
+    uint8_t hp_en_g;
+    uint8_t hpm_g;
+    /* High-performance mode (CTRL6_C, CTRL7_G). Note that the register bits
+     * are "high-performance disable" bits, the driver inverts these */
+    uint8_t xl_high_performance;
+    uint8_t g_high_performance;
+    /* Block data update (CTRL3_C) and the timestamp counter (CTRL10_C) */
+    uint8_t bdu;
+    uint8_t timestamp_en;
+};
+
+/* Both sensors at 1.667kHz with wide full scales, high-performance mode and
+ * the low-pass filters on. Meant for flight */
+extern const struct lsm6dsox_config lsm6dsox_profile_flight_1k6hz;
+/* Both sensors at 52Hz in low-power mode. Meant for bench work where nothing
+ * is moving quickly */
+extern const struct lsm6dsox_config lsm6dsox_profile_bench_low_power;
+
+
+/* The settings used to put the LSM6DSOX's FIFO into a batching mode */
+struct lsm6dsox_fifo_config {
+    lsm6dsox_bdr_xl_t bdr_xl;
+    lsm6dsox_bdr_gy_t bdr_gy;
+    uint16_t watermark; /* In FIFO words, at most LSM6DSOX_FIFO_WATERMARK_MAX */
+    lsm6dsox_fifo_mode_t mode;
+    lsm6dsox_dec_ts_batch_t ts_batch;
+};
+
+/* What 'esp_i2c_lsm6dsox_shub_begin()' has the sensor hub read from the
+ * device set up with 'esp_i2c_lsm6dsox_shub_init_bus()', over and over */
+struct lsm6dsox_shub_config {
+    /* The block of registers to read, with whatever bit the device needs to
+     * auto-increment through it. 'len' is at most LSM6DSOX_SHUB_MAX_READ_LEN */
+    uint8_t reg;
+    uint8_t len;
+    /* How often to read it. The hub is paced by the accelerometer, so this
+     * is also capped at the accelerometer's ODR */
+    lsm6dsox_shub_odr_t odr;
+    /* If 1, every reading is also batched into the FIFO, as a triplet */
+    uint8_t batch;
+};
+
+/* One gyroscope + accelerometer sample taken out of the FIFO, as it came
+ * off the sensor. 'esp_i2c_lsm6dsox_to_si()' turns it into SI units */
+struct lsm6dsox_fifo_sample {
+    int16_t g_raw[3];
+    int16_t a_raw[3];
+    /* The latest triplet the sensor hub batched (the magnetometer), held
+     * from one sample to the next like a slower sensor's. 'm_new' is 1 on
+     * the first sample after a fresh one was batched */
+    int16_t m_raw[3];
+    uint8_t m_new;
+    /* When the gyroscope sample was taken, by the timestamp counter (in
+     * ticks of LSM6DSOX_TIMESTAMP_LSB_US). Timestamp words are only batched
+     * every so often, so this is worked out from the last one and the number
+     * of gyroscope words since. Only meaningful if timestamp batching is
+     * enabled */
+    uint32_t timestamp;
+    /* The same time by esp_timer (see 'esp_i2c_lsm6dsox_clock_to_us()'), or
+     * 0 if it is not known yet */
+    int64_t time_us;
+};
+
+
+/* How the LSM6DSOX's timestamp counter lines up with esp_timer. The two run
+ * off different oscillators, which are each a little off and drift apart
+ * with temperature, so this is kept up to date by
+ * 'esp_i2c_lsm6dsox_clock_sync()' */
+struct lsm6dsox_clock {
+    /* A counter value and the esp_timer time it was read at */
+    uint32_t base_ticks;
+    int64_t base_us;
+    /* How long one tick of the counter is, in esp_timer microseconds */
+    float us_per_tick;
+    /* 0 until the first reading has been taken */
+    uint8_t synced;
+};
+
+
 struct i2c_lsm6dsox {
-    i2c_master_dev_handle_t *i2c_handle;
+    struct sensor_bus bus;
 	float accelerometer_sensitivity;
 	float gyroscope_sensitivity;
+    /* The same sensitivities folded together with the conversion to SI
+     * units, so a raw sample only needs one multiply per axis */
+    float accelerometer_scale_m_s2;
+    float gyroscope_scale_rad_s;
+    /* FIFO parsing state. A gyroscope word and its matching accelerometer
+     * word can be split across two calls to 'esp_i2c_lsm6dsox_fifo_read()',
+     * so the half-built sample is carried over between calls */
+    struct lsm6dsox_fifo_sample fifo_pending;
+    uint8_t fifo_pending_flags;
+    /* The last timestamp word, the number of gyroscope words seen since, and
+     * how many ticks apart those are, going by the last two timestamp
+     * words. 'fifo_ts_valid' is 0 until the first timestamp word */
+    uint32_t fifo_ts;
+    uint32_t fifo_ts_gyro_words;
+    float fifo_ts_ticks_per_gyro;
+    uint8_t fifo_ts_valid;
+    /* The number of times the FIFO was found to have overrun (and so
+     * samples were lost) since 'esp_i2c_lsm6dsox_fifo_begin()' */
+    uint32_t fifo_overruns;
+    /* Where the asynchronous reads ('*_start()' / '*_finish()') land. The
+     * bus fills them in while the caller gets on with something else */
+    uint8_t fifo_words[LSM6DSOX_FIFO_MAX_BURST_WORDS * LSM6DSOX_FIFO_WORD_LEN];
+    int fifo_words_pending;
+    uint8_t gyro_accel_raw[LSM6DSOX_GYRO_ACCEL_BURST_LEN];
+    /* When the sample in 'gyro_accel_raw' was taken, by esp_timer: when INT1
+     * last went high if it is wired up, otherwise when the read started */
+    int64_t time_us;
+    /* The INT1 line, used by 'esp_i2c_lsm6dsox_int1_begin()'. 'int1.pin'
+     * should be GPIO_NUM_NC if INT1 is not wired to the ESP32 */
+    struct drdy_irq int1;
+    /* The device on the auxiliary I2C bus, see
+     * 'esp_i2c_lsm6dsox_shub_init_bus()', whether the hub's own pull-ups are
+     * on, and how many readings it missed because the device did not
+     * answer */
+    uint8_t shub_address;
+    uint8_t shub_pull_up;
+    struct sensor_bus_hub shub;
+    uint32_t shub_nacks;
+    struct lsm6dsox_clock clock;
 };
 
 
-void esp_i2c_lsm6dsox_begin(struct i2c_lsm6dsox *i2c_lsm6dsox);
+const struct lsm6dsox_config *esp_i2c_lsm6dsox_find_profile(const char *name);
+
+float esp_i2c_lsm6dsox_odr_g_to_hz(lsm6dsox_odr_g_t odr_g);
+
+float esp_i2c_lsm6dsox_bdr_gy_to_hz(lsm6dsox_bdr_gy_t bdr_gy);
+
+float esp_i2c_lsm6dsox_fifo_words_per_sample(const struct lsm6dsox_fifo_config *fifo_config, \
+    const struct lsm6dsox_shub_config *shub_config);
+
+esp_err_t esp_i2c_lsm6dsox_begin(struct i2c_lsm6dsox *i2c_lsm6dsox, \
+    const struct lsm6dsox_config *config);
 
 void esp_i2c_lsm6dsox_get_gyro_data(struct i2c_lsm6dsox *i2c_lsm6dsox, float *outxyz_g);
 
@@ -149,5 +569,67 @@ float esp_i2c_lsm6dsox_get_accel_y(struct i2c_lsm6dsox *i2c_lsm6dsox);
 
 float esp_i2c_lsm6dsox_get_accel_z(struct i2c_lsm6dsox *i2c_lsm6dsox);
 
+esp_err_t esp_i2c_lsm6dsox_get_gyro_accel_data(struct i2c_lsm6dsox *i2c_lsm6dsox, \
+    float *g_rad_s, float *a_m_s2);
+
+esp_err_t esp_i2c_lsm6dsox_get_gyro_accel_data_start(struct i2c_lsm6dsox *i2c_lsm6dsox);
+
+esp_err_t esp_i2c_lsm6dsox_get_gyro_accel_data_finish(struct i2c_lsm6dsox *i2c_lsm6dsox, \
+    int16_t *g_raw, int16_t *a_raw);
+
+void esp_i2c_lsm6dsox_decode_gyro_accel(const uint8_t *raw, int16_t *g_raw, int16_t *a_raw);
+
+void esp_i2c_lsm6dsox_fifo_begin(struct i2c_lsm6dsox *i2c_lsm6dsox, \
+    const struct lsm6dsox_fifo_config *fifo_config);
+
+uint16_t esp_i2c_lsm6dsox_fifo_get_level(struct i2c_lsm6dsox *i2c_lsm6dsox);
+
+int esp_i2c_lsm6dsox_fifo_read(struct i2c_lsm6dsox *i2c_lsm6dsox, \
+    struct lsm6dsox_fifo_sample *samples, int max_samples);
+
+int esp_i2c_lsm6dsox_fifo_read_start(struct i2c_lsm6dsox *i2c_lsm6dsox, int num_words);
+
+int esp_i2c_lsm6dsox_fifo_read_finish(struct i2c_lsm6dsox *i2c_lsm6dsox, \
+    struct lsm6dsox_fifo_sample *samples);
+
+void esp_i2c_lsm6dsox_int1_begin(struct i2c_lsm6dsox *i2c_lsm6dsox, \
+    struct lsm6dsox_int1_ctrl int1_ctrl);
+
+void esp_i2c_lsm6dsox_int1_rearm(struct i2c_lsm6dsox *i2c_lsm6dsox);
+
+void esp_i2c_lsm6dsox_shub_init_bus(struct i2c_lsm6dsox *i2c_lsm6dsox, uint8_t address, \
+    bool pull_up, struct sensor_bus *bus);
+
+esp_err_t esp_i2c_lsm6dsox_shub_begin(struct i2c_lsm6dsox *i2c_lsm6dsox, \
+    const struct lsm6dsox_shub_config *shub_config);
+
+esp_err_t esp_i2c_lsm6dsox_shub_get_data(struct i2c_lsm6dsox *i2c_lsm6dsox, uint8_t *data, \
+    size_t len);
+
+int esp_i2c_lsm6dsox_fifo_decode(struct i2c_lsm6dsox *i2c_lsm6dsox, \
+    const uint8_t *words, int num_words, struct lsm6dsox_fifo_sample *samples);
+
+esp_err_t esp_i2c_lsm6dsox_clock_sync(struct i2c_lsm6dsox *i2c_lsm6dsox);
+
+int64_t esp_i2c_lsm6dsox_clock_to_us(const struct i2c_lsm6dsox *i2c_lsm6dsox, uint32_t ticks);
+
+
+/** Turns a raw gyroscope + accelerometer sample into rad/s and m/s^2. This
+ * runs once per sample for every sample the drone takes, so it lives here
+ * where it can be inlined: one int to float conversion and one multiply per
+ * axis. */
+static inline void esp_i2c_lsm6dsox_to_si(const struct i2c_lsm6dsox *i2c_lsm6dsox, \
+    const int16_t *g_raw, const int16_t *a_raw, float *g_rad_s, float *a_m_s2) {
+
+    const float g_scale = i2c_lsm6dsox->gyroscope_scale_rad_s;
+    const float a_scale = i2c_lsm6dsox->accelerometer_scale_m_s2;
+    g_rad_s[0] = (float) g_raw[0] * g_scale;
+    g_rad_s[1] = (float) g_raw[1] * g_scale;
+    g_rad_s[2] = (float) g_raw[2] * g_scale;
+    a_m_s2[0] = (float) a_raw[0] * a_scale;
+    a_m_s2[1] = (float) a_raw[1] * a_scale;
+    a_m_s2[2] = (float) a_raw[2] * a_scale;
+}
+
 
 #endif
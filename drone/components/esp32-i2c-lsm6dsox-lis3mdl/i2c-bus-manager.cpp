@@ -0,0 +1,201 @@
+#include <inttypes.h>
+#include <string.h>
+
+#include "driver/i2c_master.h"
+#include "esp_err.h"
+
+#include "i2c-bus-manager.h"
+#include "sensor-bus.h"
+
+
+/** Creates the I2C master bus described by 'config' and gets 'manager' ready
+ * to have devices added to it. Failed transactions on those devices are
+ * retried up to 'max_retries' times, and each transaction gives up after
+ * 'timeout_ms'.
+ *
+ * 'config' needs a non-zero 'trans_queue_depth', see 'sensor_bus_init_i2c()'.
+ */
+esp_err_t i2c_bus_manager_init(struct i2c_bus_manager *manager, \
+    const i2c_master_bus_config_t *config, int max_retries, int timeout_ms) {
+
+    memset(manager, 0, sizeof(*manager));
+    manager->max_retries = max_retries;
+    manager->timeout_ms = timeout_ms;
+
+    return i2c_new_master_bus(config, &manager->handle);
+}
+
+
+/* Waits for everything queued on the bus to finish. A transaction which
+ * timed out on the sensor bus's side can still be queued in the driver, and
+ * the bus must not be reset nor its device removed from under it */
+static esp_err_t i2c_bus_manager_wait_idle(struct i2c_bus_manager *manager) {
+    return i2c_master_bus_wait_all_done(manager->handle, manager->timeout_ms);
+}
+
+
+/* Clears the bus, clocking SCL until whichever device is holding SDA low
+ * (having been cut off part way through a byte) lets go of it, once nothing
+ * is queued on it any more */
+static esp_err_t i2c_bus_manager_clear_bus(struct i2c_bus_manager *manager) {
+    esp_err_t err = i2c_bus_manager_wait_idle(manager);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = i2c_master_bus_reset(manager->handle);
+    if (err == ESP_OK) {
+        manager->bus_resets++;
+    }
+
+    return err;
+}
+
+
+/* Adds 'device' to the bus at 'speeds_hz[speed]' and points its sensor bus
+ * at it, replacing the handle it had (if any). The new handle is added
+ * before the old one is removed, so the device is never left without one */
+static esp_err_t i2c_bus_manager_attach(struct i2c_bus_manager_device *device, size_t speed) {
+    struct i2c_bus_manager *manager = device->manager;
+
+    if (device->handle) {
+        esp_err_t err = i2c_bus_manager_wait_idle(manager);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    i2c_device_config_t config = {};
+    config.dev_addr_length = I2C_ADDR_BIT_LEN_7;
+    config.device_address = device->address;
+    config.scl_speed_hz = device->speeds_hz[speed];
+
+    i2c_master_dev_handle_t handle;
+    esp_err_t err = i2c_master_bus_add_device(manager->handle, &config, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    if (device->handle) {
+        err = sensor_bus_i2c_set_device(device->bus, handle);
+    } else {
+        err = sensor_bus_init_i2c(device->bus, handle, manager->timeout_ms);
+    }
+    if (err != ESP_OK) {
+        i2c_master_bus_rm_device(handle);
+        return err;
+    }
+
+    if (device->handle) {
+        i2c_master_bus_rm_device(device->handle);
+    }
+    device->handle = handle;
+    device->speed = speed;
+
+    return ESP_OK;
+}
+
+
+/* Whether 'device' reads back its identity correctly every time */
+static bool i2c_bus_manager_probe(struct i2c_bus_manager_device *device) {
+    for (int i = 0; i < I2C_BUS_MANAGER_PROBE_READS; i++) {
+        uint8_t who_am_i;
+        if (sensor_bus_read(device->bus, device->who_am_i_reg, &who_am_i, 1) != ESP_OK \
+            || who_am_i != device->who_am_i) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/* The sensor_bus_recover_fn for every device on the bus. The first retries
+ * go out at the same speed after clearing the bus, in case that was a
+ * one-off; if it keeps failing, the last retry (and everything after it)
+ * goes out at the next speed down */
+static esp_err_t i2c_bus_manager_recover(void *ctx, struct sensor_bus *bus, esp_err_t err, \
+    int attempt) {
+
+    struct i2c_bus_manager_device *device = (struct i2c_bus_manager_device *) ctx;
+    struct i2c_bus_manager *manager = device->manager;
+
+    if (attempt > manager->max_retries) {
+        device->failures++;
+        return err;
+    }
+
+    /* If the bus is still busy with an earlier transaction, a retry would
+     * only queue up behind it */
+    device->retries++;
+    esp_err_t clear_err = i2c_bus_manager_clear_bus(manager);
+    if (clear_err != ESP_OK) {
+        device->failures++;
+        return err;
+    }
+    if (attempt == manager->max_retries && device->speed + 1 < device->num_speeds \
+        && i2c_bus_manager_attach(device, device->speed + 1) == ESP_OK) {
+        device->fallbacks++;
+    }
+
+    return ESP_OK;
+}
+
+
+/** Adds 'device' to the bus looked after by 'manager' at the fastest of its
+ * 'speeds_hz' it answers reliably at (reading back 'who_am_i' from
+ * 'who_am_i_reg' I2C_BUS_MANAGER_PROBE_READS times in a row), and sets up
+ * 'bus' to talk to it. From then on, failed transactions on 'bus' clear the
+ * I2C bus and are retried, falling back to slower speeds if they keep
+ * failing, rather than being handed straight back to the driver.
+ *
+ * Returns ESP_ERR_NOT_FOUND if the device does not answer properly at any of
+ * its speeds.
+ */
+esp_err_t i2c_bus_manager_add_device(struct i2c_bus_manager *manager, \
+    struct i2c_bus_manager_device *device, struct sensor_bus *bus) {
+
+    if (manager->num_devices >= I2C_BUS_MANAGER_MAX_DEVICES) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (device->num_speeds == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    device->manager = manager;
+    device->bus = bus;
+    device->handle = NULL;
+    device->retries = 0;
+    device->fallbacks = 0;
+    device->failures = 0;
+
+    for (size_t speed = 0; speed < device->num_speeds; speed++) {
+        esp_err_t err = i2c_bus_manager_attach(device, speed);
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (i2c_bus_manager_probe(device)) {
+            sensor_bus_on_error(bus, i2c_bus_manager_recover, device);
+            manager->devices[manager->num_devices++] = device;
+            return ESP_OK;
+        }
+
+        err = i2c_bus_manager_clear_bus(manager);
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (speed + 1 < device->num_speeds) {
+            device->fallbacks++;
+        }
+    }
+
+    i2c_master_bus_rm_device(device->handle);
+    device->handle = NULL;
+
+    return ESP_ERR_NOT_FOUND;
+}
+
+
+/** Returns the SCL speed 'device' is running at. */
+uint32_t i2c_bus_manager_speed_hz(const struct i2c_bus_manager_device *device) {
+    return device->speeds_hz[device->speed];
+}
@@ -0,0 +1,72 @@
+#ifndef __I2C_BUS_MANAGER_H_
+#define __I2C_BUS_MANAGER_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "driver/i2c_master.h"
+#include "esp_err.h"
+
+#include "sensor-bus.h"
+
+
+/* How many times a failed transaction is retried (each time after clearing
+ * the bus) before the error goes back to the driver */
+#define I2C_BUS_MANAGER_DEFAULT_RETRIES 3
+/* How many times the identity register is read back at each speed while
+ * finding out how fast a device can be run. One lucky read proves little,
+ * so every one of these has to come back right */
+#define I2C_BUS_MANAGER_PROBE_READS 16
+/* The most devices one manager looks after */
+#define I2C_BUS_MANAGER_MAX_DEVICES 4
+
+
+struct i2c_bus_manager;
+
+/* A device on a bus looked after by a struct i2c_bus_manager */
+struct i2c_bus_manager_device {
+    /* Filled in by the caller before 'i2c_bus_manager_add_device()' */
+    uint16_t address;
+    /* SCL speeds to run the device at, fastest first. It starts at the
+     * fastest one it answers reliably at and moves down the list when
+     * transactions keep failing */
+    const uint32_t *speeds_hz;
+    size_t num_speeds;
+    /* A register which always reads back as 'who_am_i' */
+    uint8_t who_am_i_reg;
+    uint8_t who_am_i;
+
+    /* Filled in by the manager */
+    struct i2c_bus_manager *manager;
+    struct sensor_bus *bus;
+    i2c_master_dev_handle_t handle;
+    /* Index into 'speeds_hz' of the speed the device is running at */
+    size_t speed;
+    /* Transactions retried, moves to a slower speed (including while
+     * probing) and transactions which failed even after every retry */
+    uint32_t retries;
+    uint32_t fallbacks;
+    uint32_t failures;
+};
+
+struct i2c_bus_manager {
+    i2c_master_bus_handle_t handle;
+    int max_retries;
+    int timeout_ms;
+    struct i2c_bus_manager_device *devices[I2C_BUS_MANAGER_MAX_DEVICES];
+    size_t num_devices;
+    /* Times the bus has been cleared */
+    uint32_t bus_resets;
+};
+
+
+esp_err_t i2c_bus_manager_init(struct i2c_bus_manager *manager, \
+    const i2c_master_bus_config_t *config, int max_retries, int timeout_ms);
+
+esp_err_t i2c_bus_manager_add_device(struct i2c_bus_manager *manager, \
+    struct i2c_bus_manager_device *device, struct sensor_bus *bus);
+
+uint32_t i2c_bus_manager_speed_hz(const struct i2c_bus_manager_device *device);
+
+
+#endif
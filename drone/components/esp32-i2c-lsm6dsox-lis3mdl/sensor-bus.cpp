@@ -0,0 +1,571 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#ifdef ESP_PLATFORM
+#include "driver/i2c_master.h"
+#include "driver/spi_master.h"
+#include "freertos/semphr.h"
+#endif
+
+#include "sensor-bus.h"
+
+
+#ifdef ESP_PLATFORM
+/* Called from the I2C ISR whenever a transaction on the device finishes */
+static bool IRAM_ATTR sensor_bus_i2c_done(i2c_master_dev_handle_t i2c_dev, \
+    const i2c_master_event_data_t *evt_data, void *arg) {
+
+    struct sensor_bus *bus = (struct sensor_bus *) arg;
+    BaseType_t higher_priority_task_woken = pdFALSE;
+
+    bus->async.err = (evt_data->event == I2C_EVENT_DONE) ? ESP_OK : ESP_FAIL;
+    bus->i2c.completed++;
+    xSemaphoreGiveFromISR(bus->i2c.done, &higher_priority_task_woken);
+    if (bus->async.notify && bus->async.task) {
+        xTaskNotifyFromISR(bus->async.task, bus->async.notify_bits, eSetBits, \
+            &higher_priority_task_woken);
+    }
+
+    return higher_priority_task_woken == pdTRUE;
+}
+
+
+/** Takes a struct sensor_bus and points it at 'handle', an I2C device which
+ * has already been added to its bus with 'i2c_master_bus_add_device()'. Each
+ * transaction gives up after 'timeout_ms'.
+ *
+ * The bus has to have been created with a non-zero 'trans_queue_depth', which
+ * puts it in asynchronous mode: transactions are queued and return straight
+ * away, and a callback registered here says when each one is done. This is
+ * what lets 'sensor_bus_read_start()' return before the read has happened.
+ *
+ * The completion semaphore is kept in 'bus' itself, so nothing is allocated. */
+esp_err_t sensor_bus_init_i2c(struct sensor_bus *bus, i2c_master_dev_handle_t handle, \
+    int timeout_ms) {
+
+    memset(bus, 0, sizeof(*bus));
+    bus->type = SENSOR_BUS_I2C;
+    bus->i2c.timeout_ms = timeout_ms;
+    bus->i2c.done = xSemaphoreCreateBinaryStatic(&bus->i2c.done_buffer);
+
+    return sensor_bus_i2c_set_device(bus, handle);
+}
+
+
+/** Points an I2C sensor_bus which has already been set up with
+ * 'sensor_bus_init_i2c()' at a different device handle, keeping everything
+ * else (including its counters). This is how a device is moved to another
+ * SCL speed: it has to be removed from the bus and added back, which gives
+ * it a new handle. There must not be a read pending. */
+esp_err_t sensor_bus_i2c_set_device(struct sensor_bus *bus, i2c_master_dev_handle_t handle) {
+    if (bus->async.pending) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    bus->i2c.handle = handle;
+    /* Nothing is queued on the new handle yet */
+    bus->i2c.queued = bus->i2c.completed;
+
+    i2c_master_event_callbacks_t callbacks = {
+        .on_trans_done = sensor_bus_i2c_done,
+    };
+    return i2c_master_register_event_callbacks(handle, &callbacks, bus);
+}
+
+
+/* Counts in a transaction 'i2c_master_transmit()' or
+ * 'i2c_master_transmit_receive()' returned 'err' for, see
+ * 'sensor_bus_i2c_wait()' */
+static esp_err_t sensor_bus_i2c_queued(struct sensor_bus *bus, esp_err_t err) {
+    if (err == ESP_OK) {
+        bus->i2c.queued++;
+    }
+
+    return err;
+}
+
+
+/* Waits for the transaction last queued on an I2C bus to finish. Any
+ * completions before it are from transactions which already timed out,
+ * and are skipped */
+static esp_err_t sensor_bus_i2c_wait(struct sensor_bus *bus) {
+    const TickType_t timeout = pdMS_TO_TICKS(bus->i2c.timeout_ms);
+    const TickType_t start = xTaskGetTickCount();
+
+    while (bus->i2c.completed != bus->i2c.queued) {
+        TickType_t waited = xTaskGetTickCount() - start;
+        if (waited >= timeout || xSemaphoreTake(bus->i2c.done, timeout - waited) != pdTRUE) {
+            return ESP_ERR_TIMEOUT;
+        }
+    }
+
+    return bus->async.err;
+}
+
+
+/** Takes a struct sensor_bus and points it at 'handle', an SPI device which
+ * has already been added to its bus with 'spi_bus_add_device()'. Register
+ * addresses have their top bit cleared and replaced by
+ * SENSOR_BUS_SPI_READ_BIT for reads, and 'multi_byte_bit' is set on any
+ * transaction longer than one byte. Each transaction can move at most
+ * 'max_len' data bytes and gives up after 'timeout_ms'. 'tx' and 'rx' are
+ * where the transactions are built and read back, and must each be
+ * SENSOR_BUS_SPI_BUFFER_LEN('max_len') bytes of DMA-capable memory (a
+ * DMA_ATTR static array, say) that outlives the bus.
+ *
+ * For 'sensor_bus_notify()' to work, the device has to have been added with
+ * 'sensor_bus_spi_post_cb' as its 'post_cb'.
+ *
+ * Returns ESP_ERR_INVALID_ARG if either buffer is missing. */
+esp_err_t sensor_bus_init_spi(struct sensor_bus *bus, spi_device_handle_t handle, \
+    uint8_t multi_byte_bit, uint8_t *tx, uint8_t *rx, size_t max_len, int timeout_ms) {
+
+    if (!tx || !rx) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(bus, 0, sizeof(*bus));
+    bus->type = SENSOR_BUS_SPI;
+    bus->spi.handle = handle;
+    bus->spi.timeout_ms = timeout_ms;
+    bus->spi.multi_byte_bit = multi_byte_bit;
+    bus->spi.max_len = max_len;
+    bus->spi.tx = tx;
+    bus->spi.rx = rx;
+
+    return ESP_OK;
+}
+
+
+/** The 'post_cb' for SPI devices behind a struct sensor_bus. Called from the
+ * SPI ISR once a transaction is done, it notifies whoever asked to be with
+ * 'sensor_bus_notify()'. */
+void IRAM_ATTR sensor_bus_spi_post_cb(spi_transaction_t *trans) {
+    struct sensor_bus *bus = (struct sensor_bus *) trans->user;
+    if (!bus || !bus->async.notify || !bus->async.task) {
+        return;
+    }
+
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    xTaskNotifyFromISR(bus->async.task, bus->async.notify_bits, eSetBits, \
+        &higher_priority_task_woken);
+    if (higher_priority_task_woken == pdTRUE) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+
+/* Queues the first 'len' bytes of the bus's tx buffer (and, if 'read',
+ * clocks the same number into its rx buffer) as one transaction. It is done
+ * once 'spi_device_get_trans_result()' hands it back */
+static esp_err_t sensor_bus_spi_queue(struct sensor_bus *bus, size_t len, int read) {
+    spi_transaction_t *trans = &bus->spi.trans;
+    memset(trans, 0, sizeof(*trans));
+    trans->length = 8 * len;
+    trans->tx_buffer = bus->spi.tx;
+    trans->rx_buffer = read ? bus->spi.rx : NULL;
+    trans->user = bus;
+
+    return spi_device_queue_trans(bus->spi.handle, trans, \
+        pdMS_TO_TICKS(bus->spi.timeout_ms));
+}
+
+
+/* Waits for the transaction queued by 'sensor_bus_spi_queue()' to finish */
+static esp_err_t sensor_bus_spi_wait(struct sensor_bus *bus) {
+    spi_transaction_t *done;
+    return spi_device_get_trans_result(bus->spi.handle, &done, \
+        pdMS_TO_TICKS(bus->spi.timeout_ms));
+}
+
+
+/* The address byte for a transaction of 'len' bytes at 'reg' */
+static uint8_t sensor_bus_spi_address(const struct sensor_bus *bus, uint8_t reg, \
+    size_t len, int read) {
+
+    uint8_t address = reg & ~SENSOR_BUS_SPI_READ_BIT;
+    if (read) {
+        address |= SENSOR_BUS_SPI_READ_BIT;
+    }
+    if (len > 1) {
+        address |= bus->spi.multi_byte_bit;
+    }
+
+    return address;
+}
+#endif
+
+
+/** Takes a struct sensor_bus and points it at the in-memory sensor 'mock'. */
+void sensor_bus_init_mock(struct sensor_bus *bus, struct sensor_bus_mock *mock) {
+    memset(bus, 0, sizeof(*bus));
+    bus->type = SENSOR_BUS_MOCK;
+    bus->mock = mock;
+}
+
+
+/** Takes a struct sensor_bus and has it play back the transaction log in
+ * 'replay'. Reads return the recorded data, and any transaction which does
+ * not match the next one in the log fails with ESP_ERR_INVALID_STATE. */
+void sensor_bus_init_replay(struct sensor_bus *bus, FILE *replay) {
+    memset(bus, 0, sizeof(*bus));
+    bus->type = SENSOR_BUS_REPLAY;
+    bus->replay = replay;
+}
+
+
+/** Takes a struct sensor_bus and has 'hub' run its transactions. Reads
+ * started with 'sensor_bus_read_start()' are done by the time it returns,
+ * so nothing overlaps them. */
+void sensor_bus_init_hub(struct sensor_bus *bus, struct sensor_bus_hub *hub) {
+    memset(bus, 0, sizeof(*bus));
+    bus->type = SENSOR_BUS_HUB;
+    bus->hub = hub;
+}
+
+
+/** Starts appending every transaction on 'bus' to 'record' (or stops, if
+ * 'record' is NULL), in the format read by a SENSOR_BUS_REPLAY bus: one line
+ * per transaction of 'r' or 'w', the register and the length, then the data
+ * bytes, all in hex. */
+void sensor_bus_record(struct sensor_bus *bus, FILE *record) {
+    bus->record = record;
+}
+
+
+/** Has 'recover' called whenever a transaction on 'bus' fails, before the
+ * error goes back to the caller. If it returns ESP_OK the transaction is
+ * tried again (and 'recover' called again if that fails too, with 'attempt'
+ * one higher), so it is up to 'recover' to give up at some point. Pass a NULL
+ * 'recover' to have errors returned straight away, which is the default.
+ *
+ * A retried read which moves data out of the device (like a FIFO burst)
+ * picks up wherever the failed attempt left off, so what the failed attempt
+ * took out is lost rather than read twice. */
+void sensor_bus_on_error(struct sensor_bus *bus, sensor_bus_recover_fn recover, void *ctx) {
+    bus->recover = recover;
+    bus->recover_ctx = ctx;
+}
+
+
+/* Whether a transaction which failed with 'err' on its 'attempt'th try
+ * should be tried again */
+static bool sensor_bus_retry(struct sensor_bus *bus, esp_err_t err, int attempt) {
+    if (err == ESP_OK || !bus->recover) {
+        return false;
+    }
+
+    return bus->recover(bus->recover_ctx, bus, err, attempt) == ESP_OK;
+}
+
+
+/** Has 'task' notified with 'notify_bits' (set with eSetBits) every time a
+ * read started with 'sensor_bus_read_start()' is done, so it can wait for the
+ * data alongside whatever else it waits on. Pass a NULL 'task' to stop. */
+void sensor_bus_notify(struct sensor_bus *bus, TaskHandle_t task, uint32_t notify_bits) {
+    bus->async.task = task;
+    bus->async.notify_bits = notify_bits;
+}
+
+
+static void sensor_bus_log(FILE *file, char op, uint8_t reg, const uint8_t *data, \
+    size_t len) {
+
+    fprintf(file, "%c %02x %02x ", op, reg, (unsigned int) len);
+    for (size_t i = 0; i < len; i++) {
+        fprintf(file, "%02x", data[i]);
+    }
+    fputc('\n', file);
+}
+
+
+/* Takes the next transaction out of the replay log, checks it is a 'op' of
+ * 'len' bytes at 'reg' and stores its data in 'data' */
+static esp_err_t sensor_bus_replay_next(FILE *file, char op, uint8_t reg, uint8_t *data, \
+    size_t len) {
+
+    char logged_op;
+    unsigned int logged_reg;
+    unsigned int logged_len;
+    if (fscanf(file, " %c %x %x ", &logged_op, &logged_reg, &logged_len) != 3) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (logged_op != op || logged_reg != reg || logged_len != len) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    for (size_t i = 0; i < len; i++) {
+        unsigned int byte;
+        if (fscanf(file, "%2x", &byte) != 1) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        data[i] = (uint8_t) byte;
+    }
+
+    return ESP_OK;
+}
+
+
+/* Puts the read described by 'bus->async' on the bus. The in-memory
+ * backends do the whole read here, and set 'done' */
+static esp_err_t sensor_bus_read_issue(struct sensor_bus *bus, int *done) {
+    struct sensor_bus_async *async = &bus->async;
+    async->err = ESP_OK;
+    *done = 0;
+
+    switch (bus->type) {
+#ifdef ESP_PLATFORM
+        case SENSOR_BUS_I2C:
+            /* The register byte has to outlive this call, hence
+             * 'async.reg' */
+            return sensor_bus_i2c_queued(bus, i2c_master_transmit_receive(bus->i2c.handle, \
+                &async->reg, 1, async->data, async->len, bus->i2c.timeout_ms));
+        case SENSOR_BUS_SPI:
+            if (async->len > bus->spi.max_len) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            /* Whatever goes out after the address byte is ignored by the
+             * device, and whatever comes in during it is junk */
+            bus->spi.tx[0] = sensor_bus_spi_address(bus, async->reg, async->len, 1);
+            return sensor_bus_spi_queue(bus, 1 + async->len, 1);
+#endif
+        case SENSOR_BUS_MOCK: {
+            struct sensor_bus_mock *mock = bus->mock;
+            if (mock->read) {
+                mock->read(mock->ctx, async->reg, async->data, async->len);
+            } else {
+                uint8_t r = async->reg & ~mock->reg_flags_mask;
+                for (size_t i = 0; i < async->len; i++) {
+                    async->data[i] = mock->regs[r++];
+                }
+            }
+            *done = 1;
+            return ESP_OK;
+        }
+        case SENSOR_BUS_REPLAY:
+            async->err = sensor_bus_replay_next(bus->replay, 'r', async->reg, async->data, \
+                async->len);
+            *done = 1;
+            return ESP_OK;
+        case SENSOR_BUS_HUB:
+            async->err = bus->hub->read(bus->hub->ctx, async->reg, async->data, async->len);
+            *done = 1;
+            return ESP_OK;
+        default:
+            return ESP_ERR_NOT_SUPPORTED;
+    }
+}
+
+
+/* Waits for the read put on the bus by 'sensor_bus_read_issue()' */
+static esp_err_t sensor_bus_read_wait(struct sensor_bus *bus) {
+    struct sensor_bus_async *async = &bus->async;
+
+    switch (bus->type) {
+#ifdef ESP_PLATFORM
+        case SENSOR_BUS_I2C:
+            return sensor_bus_i2c_wait(bus);
+        case SENSOR_BUS_SPI: {
+            esp_err_t err = sensor_bus_spi_wait(bus);
+            if (err == ESP_OK) {
+                memcpy(async->data, &bus->spi.rx[1], async->len);
+            }
+            return err;
+        }
+#endif
+        default:
+            return async->err;
+    }
+}
+
+
+/* Gets a read going */
+static esp_err_t sensor_bus_read_begin(struct sensor_bus *bus, uint8_t reg, uint8_t *data, \
+    size_t len, int notify) {
+
+    if (bus->async.pending) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    bus->async.reg = reg;
+    bus->async.data = data;
+    bus->async.len = len;
+    bus->async.notify = notify;
+
+    int done;
+    esp_err_t err = sensor_bus_read_issue(bus, &done);
+    for (int attempt = 1; sensor_bus_retry(bus, err, attempt); attempt++) {
+        err = sensor_bus_read_issue(bus, &done);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    bus->async.pending = 1;
+    if (done && notify && bus->async.task) {
+        xTaskNotify(bus->async.task, bus->async.notify_bits, eSetBits);
+    }
+
+    return ESP_OK;
+}
+
+
+/** Starts reading 'len' bytes starting at register 'reg' into 'data', in a
+ * single transaction, and returns without waiting for it. 'data' has to stay
+ * valid until 'sensor_bus_read_finish()' is called, which has to happen
+ * before anything else is done on 'bus'. Other buses (even ones on the same
+ * physical bus) can be used in the meantime.
+ *
+ * If the bus has been set up with 'sensor_bus_notify()', the task is notified
+ * when the read is done. */
+esp_err_t sensor_bus_read_start(struct sensor_bus *bus, uint8_t reg, uint8_t *data, \
+    size_t len) {
+
+    return sensor_bus_read_begin(bus, reg, data, len, 1);
+}
+
+
+/** Waits (for up to the bus's timeout) for the read started by
+ * 'sensor_bus_read_start()' to finish. Once this returns ESP_OK, its data is
+ * in place. */
+esp_err_t sensor_bus_read_finish(struct sensor_bus *bus) {
+    struct sensor_bus_async *async = &bus->async;
+    if (!async->pending) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    async->pending = 0;
+
+    esp_err_t err = sensor_bus_read_wait(bus);
+    for (int attempt = 1; sensor_bus_retry(bus, err, attempt); attempt++) {
+        /* The caller has already been told about the failed attempt (if
+         * they asked to be), so the retry goes out quietly */
+        int done;
+        async->notify = 0;
+        err = sensor_bus_read_issue(bus, &done);
+        if (err == ESP_OK) {
+            err = sensor_bus_read_wait(bus);
+        }
+    }
+
+    if (err != ESP_OK) {
+        return err;
+    }
+    bus->stats.reads++;
+    bus->stats.bytes += async->len;
+    if (bus->record) {
+        sensor_bus_log(bus->record, 'r', async->reg, async->data, async->len);
+    }
+
+    return ESP_OK;
+}
+
+
+/** Reads 'len' bytes starting at register 'reg' into 'data', in a single
+ * transaction, and waits for them. Whether the register address advances
+ * between bytes is up to the device (and, for some, to bits in 'reg'). */
+esp_err_t sensor_bus_read(struct sensor_bus *bus, uint8_t reg, uint8_t *data, size_t len) {
+    esp_err_t err = sensor_bus_read_begin(bus, reg, data, len, 0);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    return sensor_bus_read_finish(bus);
+}
+
+
+/* Does one attempt at a write, see 'sensor_bus_write()' */
+static esp_err_t sensor_bus_write_once(struct sensor_bus *bus, uint8_t reg, \
+    const uint8_t *data, size_t len) {
+
+    esp_err_t err = ESP_OK;
+
+    switch (bus->type) {
+#ifdef ESP_PLATFORM
+        case SENSOR_BUS_I2C: {
+            /* The register address and the data have to go out back to back
+             * in one transaction */
+            bus->i2c.write_buffer[0] = reg;
+            memcpy(&bus->i2c.write_buffer[1], data, len);
+            bus->async.notify = 0;
+            err = sensor_bus_i2c_queued(bus, i2c_master_transmit(bus->i2c.handle, \
+                bus->i2c.write_buffer, 1 + len, bus->i2c.timeout_ms));
+            if (err == ESP_OK) {
+                err = sensor_bus_i2c_wait(bus);
+            }
+            break;
+        }
+        case SENSOR_BUS_SPI:
+            if (len > bus->spi.max_len) {
+                err = ESP_ERR_INVALID_SIZE;
+                break;
+            }
+            bus->spi.tx[0] = sensor_bus_spi_address(bus, reg, len, 0);
+            memcpy(&bus->spi.tx[1], data, len);
+            bus->async.notify = 0;
+            err = sensor_bus_spi_queue(bus, 1 + len, 0);
+            if (err == ESP_OK) {
+                err = sensor_bus_spi_wait(bus);
+            }
+            break;
+#endif
+        case SENSOR_BUS_MOCK: {
+            struct sensor_bus_mock *mock = bus->mock;
+            if (mock->write) {
+                mock->write(mock->ctx, reg, data, len);
+            } else {
+                uint8_t r = reg & ~mock->reg_flags_mask;
+                for (size_t i = 0; i < len; i++) {
+                    mock->regs[r++] = data[i];
+                }
+            }
+            break;
+        }
+        case SENSOR_BUS_REPLAY: {
+            uint8_t logged[SENSOR_BUS_MAX_WRITE_LEN];
+            err = sensor_bus_replay_next(bus->replay, 'w', reg, logged, len);
+            if (err == ESP_OK && memcmp(logged, data, len) != 0) {
+                err = ESP_ERR_INVALID_STATE;
+            }
+            break;
+        }
+        case SENSOR_BUS_HUB:
+            err = bus->hub->write(bus->hub->ctx, reg, data, len);
+            break;
+        default:
+            err = ESP_ERR_NOT_SUPPORTED;
+    }
+
+    return err;
+}
+
+
+/** Writes the 'len' bytes in 'data' to the registers starting at 'reg', in a
+ * single transaction, and waits for it. 'len' can be at most
+ * SENSOR_BUS_MAX_WRITE_LEN. */
+esp_err_t sensor_bus_write(struct sensor_bus *bus, uint8_t reg, const uint8_t *data, \
+    size_t len) {
+
+    if (len > SENSOR_BUS_MAX_WRITE_LEN) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (bus->async.pending) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_err_t err = sensor_bus_write_once(bus, reg, data, len);
+    for (int attempt = 1; sensor_bus_retry(bus, err, attempt); attempt++) {
+        err = sensor_bus_write_once(bus, reg, data, len);
+    }
+
+    if (err != ESP_OK) {
+        return err;
+    }
+    bus->stats.writes++;
+    bus->stats.bytes += len;
+    if (bus->record) {
+        sensor_bus_log(bus->record, 'w', reg, data, len);
+    }
+
+    return ESP_OK;
+}
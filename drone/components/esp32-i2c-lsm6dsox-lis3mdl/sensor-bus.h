@@ -0,0 +1,202 @@
+#ifndef __SENSOR_BUS_H_
+#define __SENSOR_BUS_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#ifdef ESP_PLATFORM
+#include "driver/i2c_master.h"
+#include "driver/spi_master.h"
+#include "freertos/semphr.h"
+#endif
+
+
+/* The largest number of data bytes 'sensor_bus_write()' will send in one
+ * transaction. The drivers never write more than a block of control
+ * registers at a time */
+#define SENSOR_BUS_MAX_WRITE_LEN 16
+/* On SPI, the first byte of every transaction is the register address with
+ * this bit set for a read */
+#define SENSOR_BUS_SPI_READ_BIT 0x80
+/* The default timeout for a single transaction on a real bus. A full batch
+ * out of the LSM6DSOX FIFO takes tens of milliseconds at 100kHz, so this has
+ * to be comfortably longer than that */
+#define SENSOR_BUS_DEFAULT_TIMEOUT_MS 100
+/* How long each of the buffers given to 'sensor_bus_init_spi()' has to be
+ * for transactions of up to 'max_len' data bytes: the address byte goes out
+ * first */
+#define SENSOR_BUS_SPI_BUFFER_LEN(max_len) (1 + (max_len))
+
+
+/* Where a sensor's register reads and writes end up */
+enum sensor_bus_type {
+    /* An ESP-IDF I2C master device. Only available on the target */
+    SENSOR_BUS_I2C,
+    /* An ESP-IDF SPI master device. Only available on the target */
+    SENSOR_BUS_SPI,
+    /* An in-memory register map, see struct sensor_bus_mock */
+    SENSOR_BUS_MOCK,
+    /* Plays back a transaction log written by a recording bus, see
+     * 'sensor_bus_record()' */
+    SENSOR_BUS_REPLAY,
+    /* A device behind another one, see struct sensor_bus_hub */
+    SENSOR_BUS_HUB,
+};
+
+
+/* An in-memory stand-in for a sensor. By default reads and writes go to
+ * 'regs', with the register address advancing after each byte (wrapping at
+ * 'regs'' size). If 'read' or 'write' are set they are called instead, which
+ * is how a simulated sensor can produce live data */
+struct sensor_bus_mock {
+    uint8_t regs[256];
+    /* Register address bits which are not part of the address (like the
+     * LIS3MDL's auto-increment bit), and so are cleared before indexing
+     * 'regs' */
+    uint8_t reg_flags_mask;
+    void *ctx;
+    void (*read)(void *ctx, uint8_t reg, uint8_t *data, size_t len);
+    void (*write)(void *ctx, uint8_t reg, const uint8_t *data, size_t len);
+};
+
+/* A device the ESP32 cannot reach directly, only through another device
+ * that runs the transactions for it (like the LSM6DSOX's sensor hub, which
+ * has an I2C bus of its own). Each transaction is handed to 'read' or
+ * 'write', which do the whole thing before returning */
+struct sensor_bus_hub {
+    void *ctx;
+    esp_err_t (*read)(void *ctx, uint8_t reg, uint8_t *data, size_t len);
+    esp_err_t (*write)(void *ctx, uint8_t reg, const uint8_t *data, size_t len);
+};
+
+/* What a bus has been asked to do, for working out how busy it is */
+struct sensor_bus_stats {
+    uint32_t reads;
+    uint32_t writes;
+    /* Bytes moved, not counting the register address byte */
+    uint64_t bytes;
+};
+
+/* The read started by 'sensor_bus_read_start()', until
+ * 'sensor_bus_read_finish()' collects it */
+struct sensor_bus_async {
+    /* Whether a read is in flight, and whether it was started by
+     * 'sensor_bus_read_start()' (rather than being the first half of a
+     * blocking 'sensor_bus_read()'), which is what gets 'task' notified */
+    int pending;
+    int notify;
+    uint8_t reg;
+    uint8_t *data;
+    size_t len;
+    /* How the transaction went, once it is done. Written from the
+     * completion callback on the target */
+    volatile esp_err_t err;
+    /* If 'task' is not NULL, it is notified with 'notify_bits' as soon as
+     * the read is done, see 'sensor_bus_notify()' */
+    TaskHandle_t task;
+    uint32_t notify_bits;
+};
+
+struct sensor_bus;
+
+/* Called when a transaction on a bus fails with 'err', having been tried
+ * 'attempt' times so far. Returning ESP_OK has it tried again, anything
+ * else is handed back to whoever asked for the transaction */
+typedef esp_err_t (*sensor_bus_recover_fn)(void *ctx, struct sensor_bus *bus, \
+    esp_err_t err, int attempt);
+
+struct sensor_bus {
+    enum sensor_bus_type type;
+    union {
+#ifdef ESP_PLATFORM
+        struct {
+            i2c_master_dev_handle_t handle;
+            int timeout_ms;
+            /* The device's bus is in asynchronous mode, so every transaction
+             * returns straight away and this is given once it is done */
+            SemaphoreHandle_t done;
+            StaticSemaphore_t done_buffer;
+            /* The transactions queued on the device, and the ones the driver
+             * has said are done. The driver finishes them in order, so the
+             * one last queued is done once the two match, and a late
+             * completion from one that timed out is never taken for it */
+            uint32_t queued;
+            volatile uint32_t completed;
+            /* The register address and data of the write last queued,
+             * which the driver reads after 'i2c_master_transmit()' has
+             * returned, so they can't be on the stack */
+            uint8_t write_buffer[1 + SENSOR_BUS_MAX_WRITE_LEN];
+        } i2c;
+        struct {
+            spi_device_handle_t handle;
+            int timeout_ms;
+            /* The address bit the device wants set to keep incrementing the
+             * register address through a multi-byte transaction (0 if it
+             * does that on its own) */
+            uint8_t multi_byte_bit;
+            /* DMA-capable buffers for the address byte plus up to
+             * 'max_len' data bytes, so transactions never need bouncing.
+             * Owned by whoever set the bus up */
+            uint8_t *tx;
+            uint8_t *rx;
+            size_t max_len;
+            /* The transaction in flight. The driver holds on to it until
+             * 'spi_device_get_trans_result()' hands it back */
+            spi_transaction_t trans;
+        } spi;
+#endif
+        struct sensor_bus_mock *mock;
+        FILE *replay;
+        struct sensor_bus_hub *hub;
+    };
+    /* If not NULL, every transaction is also appended to this file */
+    FILE *record;
+    /* If not NULL, given a chance to do something about every failed
+     * transaction, see 'sensor_bus_on_error()' */
+    sensor_bus_recover_fn recover;
+    void *recover_ctx;
+    struct sensor_bus_stats stats;
+    struct sensor_bus_async async;
+};
+
+
+#ifdef ESP_PLATFORM
+esp_err_t sensor_bus_init_i2c(struct sensor_bus *bus, i2c_master_dev_handle_t handle, \
+    int timeout_ms);
+
+esp_err_t sensor_bus_i2c_set_device(struct sensor_bus *bus, i2c_master_dev_handle_t handle);
+
+esp_err_t sensor_bus_init_spi(struct sensor_bus *bus, spi_device_handle_t handle, \
+    uint8_t multi_byte_bit, uint8_t *tx, uint8_t *rx, size_t max_len, int timeout_ms);
+
+void sensor_bus_spi_post_cb(spi_transaction_t *trans);
+#endif
+
+void sensor_bus_init_mock(struct sensor_bus *bus, struct sensor_bus_mock *mock);
+
+void sensor_bus_init_replay(struct sensor_bus *bus, FILE *replay);
+
+void sensor_bus_init_hub(struct sensor_bus *bus, struct sensor_bus_hub *hub);
+
+void sensor_bus_record(struct sensor_bus *bus, FILE *record);
+
+void sensor_bus_on_error(struct sensor_bus *bus, sensor_bus_recover_fn recover, void *ctx);
+
+void sensor_bus_notify(struct sensor_bus *bus, TaskHandle_t task, uint32_t notify_bits);
+
+esp_err_t sensor_bus_read_start(struct sensor_bus *bus, uint8_t reg, uint8_t *data, \
+    size_t len);
+
+esp_err_t sensor_bus_read_finish(struct sensor_bus *bus);
+
+esp_err_t sensor_bus_read(struct sensor_bus *bus, uint8_t reg, uint8_t *data, size_t len);
+
+esp_err_t sensor_bus_write(struct sensor_bus *bus, uint8_t reg, const uint8_t *data, \
+    size_t len);
+
+
+#endif
@@ -0,0 +1,262 @@
+#include <math.h>
+#include <string.h>
+
+#include "flight-controller.h"
+
+
+/* How much each of roll, pitch and yaw torque adds to each motor. See
+ * 'flight-controller.h' for the axis conventions and motor numbering. To roll
+ * right the left motors speed up, to pitch down the rear motors speed up, and
+ * to yaw left the clockwise motors speed up (since their drag pushes the body
+ * counter-clockwise) */
+static const float quad_x_mix[FLIGHT_CONTROLLER_NUM_MOTORS][FLIGHT_CONTROLLER_NUM_AXES] = {
+    /* roll, pitch, yaw */
+    { -1.0f, -1.0f, -1.0f }, /* Front right */
+    { -1.0f,  1.0f,  1.0f }, /* Rear right */
+    {  1.0f,  1.0f, -1.0f }, /* Rear left */
+    {  1.0f, -1.0f,  1.0f }, /* Front left */
+};
+
+
+const struct flight_controller_config flight_controller_profile_default = {
+    .attitude = {
+        /* Roll and pitch angle to rate, at most ~200 degrees/s */
+        { .kp = 4.0f, .ki = 0.0f, .kd = 0.0f, .kff = 0.0f, \
+            .integral_limit = 0.0f, .output_limit = 3.5f, .d_lpf = {} },
+        { .kp = 4.0f, .ki = 0.0f, .kd = 0.0f, .kff = 0.0f, \
+            .integral_limit = 0.0f, .output_limit = 3.5f, .d_lpf = {} },
+    },
+    /* Roll, pitch and yaw rate to torque, as fractions of full throttle */
+    .rate = {
+        { .kp = 0.05f, .ki = 0.1f, .kd = 0.001f, .kff = 0.01f, \
+            .integral_limit = 0.2f, .output_limit = 0.5f, .d_lpf = { FILTER_PT1, 80.0f, 0.0f } },
+        { .kp = 0.05f, .ki = 0.1f, .kd = 0.001f, .kff = 0.01f, \
+            .integral_limit = 0.2f, .output_limit = 0.5f, .d_lpf = { FILTER_PT1, 80.0f, 0.0f } },
+        { .kp = 0.1f, .ki = 0.05f, .kd = 0.0f, .kff = 0.0f, \
+            .integral_limit = 0.2f, .output_limit = 0.3f, .d_lpf = {} },
+    },
+    .rate_sample_period_s = 0.0f,
+    .attitude_loop_divider = 4,
+};
+
+
+static inline float clampf(float x, float limit) {
+    if (x > limit) return limit;
+    if (x < -limit) return -limit;
+    return x;
+}
+
+
+/** Takes a struct pid and sets it up with the gains and limits in 'config',
+ * to be updated about once every 'sample_period_s' seconds. */
+void pid_init(struct pid *pid, const struct pid_config *config, float sample_period_s) {
+    pid->config = *config;
+    pid->sample_period_s = sample_period_s;
+    filter_init(&pid->d_lpf, &config->d_lpf, sample_period_s);
+
+    pid_reset(pid);
+}
+
+
+/** Clears the integrator and the derivative history of 'pid'. */
+void pid_reset(struct pid *pid) {
+    pid->integral = 0.0f;
+    pid->prev_measurement = 0.0f;
+    pid->primed = false;
+    filter_reset(&pid->d_lpf);
+}
+
+
+/** Retunes the D-term filter of 'pid' for updates 'sample_period_s' apart,
+ * without clearing its state. */
+void pid_set_sample_period(struct pid *pid, float sample_period_s) {
+    pid->sample_period_s = sample_period_s;
+    filter_set_sample_period(&pid->d_lpf, &pid->config.d_lpf, sample_period_s);
+}
+
+
+/** Runs one iteration of 'pid', 'dt_s' seconds after the last one, and
+ * returns its output.
+ *
+ * The D-term acts on the measurement rather than the error, so a step in the
+ * setpoint does not produce a spike in the output, and is low-pass filtered
+ * since differentiating a noisy gyroscope signal amplifies its noise. The
+ * integrator is clamped, and is also not allowed to grow any further in the
+ * direction in which the output is already saturated, which keeps it from
+ * winding up while the output is limited.
+ *
+ * The cost of an iteration does not depend on its inputs.
+ */
+float pid_update(struct pid *pid, float setpoint, float measurement, float dt_s) {
+    const struct pid_config *c = &pid->config;
+    float error = setpoint - measurement;
+
+    /* 1. D-term, on the filtered derivative of the measurement, which is 0
+     * on the first update after a reset */
+    float prev_measurement = pid->primed ? pid->prev_measurement : measurement;
+    float derivative = -(measurement - prev_measurement) / dt_s;
+    pid->prev_measurement = measurement;
+    pid->primed = true;
+    derivative = filter_apply(&pid->d_lpf, derivative);
+
+    /* 2. Everything but the I-term */
+    float output = c->kp * error + c->kd * derivative + c->kff * setpoint;
+
+    /* 3. I-term, only integrating if that would not push an already saturated
+     * output further into saturation */
+    float integral = pid->integral + c->ki * error * dt_s;
+    integral = clampf(integral, c->integral_limit);
+    float unsaturated = output + integral;
+    if ((unsaturated <= c->output_limit || integral < pid->integral) \
+        && (unsaturated >= -c->output_limit || integral > pid->integral)) {
+
+        pid->integral = integral;
+    }
+
+    return clampf(output + pid->integral, c->output_limit);
+}
+
+
+/** Takes a struct flight_controller and sets up both loops as described by
+ * 'config'. */
+void flight_controller_init(struct flight_controller *fc, \
+    const struct flight_controller_config *config) {
+
+    float attitude_sample_period_s = \
+        config->rate_sample_period_s * (float) config->attitude_loop_divider;
+
+    for (int i = 0; i < 2; i++) {
+        pid_init(&fc->attitude[i], &config->attitude[i], attitude_sample_period_s);
+    }
+    for (int i = 0; i < FLIGHT_CONTROLLER_NUM_AXES; i++) {
+        pid_init(&fc->rate[i], &config->rate[i], config->rate_sample_period_s);
+    }
+    fc->attitude_loop_divider = config->attitude_loop_divider;
+
+    flight_controller_reset(fc);
+}
+
+
+/** Clears the state of both loops, e.g. on disarming. */
+void flight_controller_reset(struct flight_controller *fc) {
+    for (int i = 0; i < 2; i++) {
+        pid_reset(&fc->attitude[i]);
+    }
+    for (int i = 0; i < FLIGHT_CONTROLLER_NUM_AXES; i++) {
+        pid_reset(&fc->rate[i]);
+    }
+    fc->iteration = 0;
+    memset(fc->rate_setpoint, 0, sizeof(fc->rate_setpoint));
+    memset(fc->torque, 0, sizeof(fc->torque));
+    fc->attitude_dt_s = 0.0f;
+}
+
+
+/** Retunes both loops' D-term filters for inner loop iterations
+ * 'rate_sample_period_s' apart, without clearing their state. For when the
+ * gyroscope's real sample rate turns out to be off from the configured
+ * one. */
+void flight_controller_set_sample_period(struct flight_controller *fc, \
+    float rate_sample_period_s) {
+
+    for (int i = 0; i < 2; i++) {
+        pid_set_sample_period(&fc->attitude[i], \
+            rate_sample_period_s * (float) fc->attitude_loop_divider);
+    }
+    for (int i = 0; i < FLIGHT_CONTROLLER_NUM_AXES; i++) {
+        pid_set_sample_period(&fc->rate[i], rate_sample_period_s);
+    }
+}
+
+
+/** Returns non-zero if the outer loop is due to run before the next inner
+ * loop iteration. Lets the caller skip working out the roll and pitch angles
+ * on iterations where they will not be used. */
+int flight_controller_attitude_due(const struct flight_controller *fc) {
+    return (fc->iteration % fc->attitude_loop_divider) == 0;
+}
+
+
+/** Runs one iteration of the outer loop, turning the roll and pitch angle
+ * errors into rate setpoints for the inner loop. The yaw rate setpoint is
+ * passed straight through. 'roll' and 'pitch' are the current angles in
+ * radians.
+ *
+ * The time since the last iteration is taken to be the time the inner loop
+ * iterations in between covered, or the nominal period if there were none
+ * (straight after a reset). */
+void flight_controller_update_attitude(struct flight_controller *fc, \
+    const struct flight_controller_setpoint *setpoint, float roll, float pitch) {
+
+    float dt_s = fc->attitude_dt_s;
+    if (dt_s <= 0.0f) {
+        dt_s = fc->attitude[FLIGHT_CONTROLLER_AXIS_ROLL].sample_period_s;
+    }
+    fc->attitude_dt_s = 0.0f;
+
+    fc->rate_setpoint[FLIGHT_CONTROLLER_AXIS_ROLL] = \
+        pid_update(&fc->attitude[FLIGHT_CONTROLLER_AXIS_ROLL], setpoint->roll, roll, dt_s);
+    fc->rate_setpoint[FLIGHT_CONTROLLER_AXIS_PITCH] = \
+        pid_update(&fc->attitude[FLIGHT_CONTROLLER_AXIS_PITCH], setpoint->pitch, pitch, dt_s);
+    fc->rate_setpoint[FLIGHT_CONTROLLER_AXIS_YAW] = setpoint->yaw_rate;
+}
+
+
+/** Runs one iteration of the inner loop on one gyroscope sample 'g_xyz' (in
+ * rad/s), taken 'dt_s' seconds after the last one, and writes the resulting
+ * FLIGHT_CONTROLLER_NUM_MOTORS motor commands, each from 0 to 1, to
+ * 'motor'. */
+void flight_controller_update_rate(struct flight_controller *fc, \
+    const struct flight_controller_setpoint *setpoint, const float *g_xyz, float dt_s, \
+    float *motor) {
+
+    fc->iteration++;
+    fc->attitude_dt_s += dt_s;
+
+    if (!setpoint->armed) {
+        flight_controller_reset(fc);
+        memset(motor, 0, sizeof(float) * FLIGHT_CONTROLLER_NUM_MOTORS);
+        return;
+    }
+
+    for (int i = 0; i < FLIGHT_CONTROLLER_NUM_AXES; i++) {
+        fc->torque[i] = pid_update(&fc->rate[i], fc->rate_setpoint[i], g_xyz[i], dt_s);
+    }
+
+    flight_controller_mix(setpoint->throttle, fc->torque, motor);
+}
+
+
+/** Mixes a collective 'throttle' (0 to 1) and roll/pitch/yaw 'torque'
+ * commands into FLIGHT_CONTROLLER_NUM_MOTORS motor commands, each from 0 to
+ * 1.
+ *
+ * If the mix would push a motor outside of 0 to 1, every motor is shifted by
+ * the same amount to bring it back in, sacrificing throttle to keep the
+ * torque differences (and so control authority) intact. Only if the torque
+ * differences alone do not fit are the commands clipped.
+ */
+void flight_controller_mix(float throttle, const float *torque, float *motor) {
+    float min = 0.0f;
+    float max = 0.0f;
+
+    for (int i = 0; i < FLIGHT_CONTROLLER_NUM_MOTORS; i++) {
+        motor[i] = throttle \
+            + quad_x_mix[i][FLIGHT_CONTROLLER_AXIS_ROLL] * torque[FLIGHT_CONTROLLER_AXIS_ROLL] \
+            + quad_x_mix[i][FLIGHT_CONTROLLER_AXIS_PITCH] * torque[FLIGHT_CONTROLLER_AXIS_PITCH] \
+            + quad_x_mix[i][FLIGHT_CONTROLLER_AXIS_YAW] * torque[FLIGHT_CONTROLLER_AXIS_YAW];
+        if (i == 0 || motor[i] < min) min = motor[i];
+        if (i == 0 || motor[i] > max) max = motor[i];
+    }
+
+    float shift = 0.0f;
+    if (max > 1.0f) shift = 1.0f - max;
+    if (min + shift < 0.0f) shift = -min;
+
+    for (int i = 0; i < FLIGHT_CONTROLLER_NUM_MOTORS; i++) {
+        float m = motor[i] + shift;
+        if (m < 0.0f) m = 0.0f;
+        if (m > 1.0f) m = 1.0f;
+        motor[i] = m;
+    }
+}
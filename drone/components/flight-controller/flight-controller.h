@@ -0,0 +1,138 @@
+#ifndef __FLIGHT_CONTROLLER_H_
+#define __FLIGHT_CONTROLLER_H_
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "filter.h"
+
+/* A cascaded attitude/rate controller with a quad-X motor mixer.
+ *
+ * The outer (attitude) loop turns roll/pitch angle errors into rate
+ * setpoints. The inner (rate) loop turns rate errors, measured straight from
+ * the gyroscope, into roll/pitch/yaw torque commands, which the mixer turns
+ * into four motor commands. The inner loop is meant to be run once per
+ * gyroscope sample, and the outer loop once every 'attitude_loop_divider'
+ * inner loop iterations. Each inner loop iteration is given the real time
+ * since the last one, and the outer loop works out its own from those, so
+ * the sample periods in the configuration only set up the D-term filters.
+ *
+ * Axes follow the sensor frame used by the attitude estimator: x forward, y
+ * left, z up. So a positive roll lowers the right side, a positive pitch
+ * lowers the nose and a positive yaw turns the nose left. */
+
+
+#define FLIGHT_CONTROLLER_AXIS_ROLL  0
+#define FLIGHT_CONTROLLER_AXIS_PITCH 1
+#define FLIGHT_CONTROLLER_AXIS_YAW   2
+#define FLIGHT_CONTROLLER_NUM_AXES   3
+
+/* Motor numbering, looking down on the drone. Diagonally opposite motors spin
+ * the same way */
+#define FLIGHT_CONTROLLER_MOTOR_FRONT_RIGHT 0 /* Spins counter-clockwise */
+#define FLIGHT_CONTROLLER_MOTOR_REAR_RIGHT  1 /* Spins clockwise */
+#define FLIGHT_CONTROLLER_MOTOR_REAR_LEFT   2 /* Spins counter-clockwise */
+#define FLIGHT_CONTROLLER_MOTOR_FRONT_LEFT  3 /* Spins clockwise */
+#define FLIGHT_CONTROLLER_NUM_MOTORS        4
+
+
+struct pid_config {
+    float kp;
+    float ki;
+    float kd;
+    /* Feed-forward gain, applied to the setpoint directly */
+    float kff;
+    /* The integral term is kept within +-'integral_limit' */
+    float integral_limit;
+    /* The output is kept within +-'output_limit' */
+    float output_limit;
+    /* The low-pass filter on the D-term. A cutoff of 0 disables it */
+    struct filter_config d_lpf;
+};
+
+struct pid {
+    struct pid_config config;
+    /* The nominal time between two updates, which 'd_lpf' is tuned for */
+    float sample_period_s;
+    float integral;
+    float prev_measurement;
+    /* Whether 'prev_measurement' holds a measurement yet. The first update
+     * after a reset takes its own measurement as the previous one, so the
+     * D-term starts from zero rather than kicking on whatever the drone was
+     * doing when it armed */
+    bool primed;
+    struct filter d_lpf;
+};
+
+
+struct flight_controller_config {
+    /* Outer loop, roll and pitch angle (rad) to rate (rad/s). The output
+     * limit is the largest rate the outer loop will ask for */
+    struct pid_config attitude[2];
+    /* Inner loop, roll, pitch and yaw rate (rad/s) to torque command */
+    struct pid_config rate[FLIGHT_CONTROLLER_NUM_AXES];
+    /* The nominal time between two inner loop iterations, in seconds */
+    float rate_sample_period_s;
+    /* The outer loop runs once every this many inner loop iterations */
+    uint32_t attitude_loop_divider;
+};
+
+/* What the pilot (or autopilot) is asking for */
+struct flight_controller_setpoint {
+    float roll; /* rad */
+    float pitch; /* rad */
+    float yaw_rate; /* rad/s */
+    float throttle; /* 0 to 1 */
+    /* If 0, every motor command is 0 and the integrators are held at 0 */
+    uint8_t armed;
+};
+
+struct flight_controller {
+    struct pid attitude[2];
+    struct pid rate[FLIGHT_CONTROLLER_NUM_AXES];
+    uint32_t attitude_loop_divider;
+    uint32_t iteration;
+    /* The latest rate setpoints from the outer loop, in rad/s */
+    float rate_setpoint[FLIGHT_CONTROLLER_NUM_AXES];
+    /* The latest torque commands from the inner loop */
+    float torque[FLIGHT_CONTROLLER_NUM_AXES];
+    /* The time the inner loop iterations since the last outer loop one
+     * covered, in seconds */
+    float attitude_dt_s;
+};
+
+
+/* Gains for a ~500g quad-X with 2:1 thrust to weight. 'rate_sample_period_s'
+ * is left at 0 for the caller to fill in */
+extern const struct flight_controller_config flight_controller_profile_default;
+
+
+void pid_init(struct pid *pid, const struct pid_config *config, float sample_period_s);
+
+void pid_reset(struct pid *pid);
+
+float pid_update(struct pid *pid, float setpoint, float measurement, float dt_s);
+
+void pid_set_sample_period(struct pid *pid, float sample_period_s);
+
+void flight_controller_init(struct flight_controller *fc, \
+    const struct flight_controller_config *config);
+
+void flight_controller_reset(struct flight_controller *fc);
+
+void flight_controller_set_sample_period(struct flight_controller *fc, \
+    float rate_sample_period_s);
+
+int flight_controller_attitude_due(const struct flight_controller *fc);
+
+void flight_controller_update_attitude(struct flight_controller *fc, \
+    const struct flight_controller_setpoint *setpoint, float roll, float pitch);
+
+void flight_controller_update_rate(struct flight_controller *fc, \
+    const struct flight_controller_setpoint *setpoint, const float *g_xyz, float dt_s, \
+    float *motor);
+
+void flight_controller_mix(float throttle, const float *torque, float *motor);
+
+
+#endif
@@ -0,0 +1,207 @@
+#include <math.h>
+#include <string.h>
+
+#include "filter.h"
+
+#if FILTER_ESP_DSP
+#include "dsps_biquad.h"
+#include "dsps_fft2r.h"
+#endif
+
+
+/* How much of a sine at the cutoff each of a PT2's two stages passes, as a
+ * fraction of its power: 1.5dB down each, so the pair is 3dB down */
+#define FILTER_PT2_STAGE_POWER 0.7071068f
+
+
+/* The gain k of a first order low-pass, y += k * (x - y), run every
+ * 'sample_period_s', that passes 'power' of a sine at 'cutoff_hz' (0.5 for
+ * 3dB down). It is solved for from the sampled filter's own response rather
+ * than that of the RC circuit it stands in for, which at a 100Hz cutoff and
+ * 1.667kHz would put the filter nearly 4dB down there instead of 3 */
+static float filter_pt1_gain(float cutoff_hz, float sample_period_s, float power) {
+    /* |H|^2 = k^2 / (k^2 + 2 (1 - k) (1 - cos w)) = power, written in terms
+     * of sin^2(w / 2) so that low cutoffs do not lose everything to
+     * cancellation */
+    float half_sine = sinf((float) M_PI * cutoff_hz * sample_period_s);
+    float e = 2.0f * power * half_sine * half_sine;
+    float d = 1.0f - power;
+    return (sqrtf(e * (2.0f * d + e)) - e) / d;
+}
+
+
+/* Works out the coefficients of a biquad low-pass or notch, from the Audio EQ
+ * Cookbook */
+static void filter_biquad_coeffs(struct filter *f, float cutoff_hz, float q, \
+    float sample_period_s) {
+
+    float omega = 2.0f * (float) M_PI * cutoff_hz * sample_period_s;
+    float sn = sinf(omega);
+    float cs = cosf(omega);
+    float alpha = sn / (2.0f * q);
+    float b0, b1, b2;
+    if (f->type == FILTER_NOTCH) {
+        b0 = 1.0f;
+        b1 = -2.0f * cs;
+        b2 = 1.0f;
+    } else {
+        b0 = (1.0f - cs) / 2.0f;
+        b1 = 1.0f - cs;
+        b2 = b0;
+    }
+    float a0 = 1.0f + alpha;
+    f->coeffs[0] = b0 / a0;
+    f->coeffs[1] = b1 / a0;
+    f->coeffs[2] = b2 / a0;
+    f->coeffs[3] = -2.0f * cs / a0;
+    f->coeffs[4] = (1.0f - alpha) / a0;
+}
+
+
+/** Sets 'f' up as described by 'config', to be run once every
+ * 'sample_period_s'. A filter with no cutoff, or a cutoff at or above the
+ * Nyquist frequency, passes its input straight through. */
+void filter_init(struct filter *f, const struct filter_config *config, float sample_period_s) {
+    memset(f, 0, sizeof(*f));
+    f->type = config->type;
+    float nyquist_hz = 0.5f / sample_period_s;
+
+    if (config->cutoff_hz <= 0.0f || config->cutoff_hz >= nyquist_hz) {
+        f->type = FILTER_NONE;
+    }
+    switch (f->type) {
+        case FILTER_PT1:
+            f->k = filter_pt1_gain(config->cutoff_hz, sample_period_s, 0.5f);
+            break;
+        case FILTER_PT2:
+            f->k = filter_pt1_gain(config->cutoff_hz, sample_period_s, \
+                FILTER_PT2_STAGE_POWER);
+            break;
+        case FILTER_BIQUAD_LPF:
+        case FILTER_NOTCH:
+            filter_biquad_coeffs(f, config->cutoff_hz, (config->q > 0.0f) ? config->q \
+                : FILTER_BUTTERWORTH_Q, sample_period_s);
+            break;
+        default:
+            f->type = FILTER_NONE;
+            break;
+    }
+}
+
+
+/** Clears the state of 'f', as if it had only ever seen zeros. */
+void filter_reset(struct filter *f) {
+    f->state[0] = 0.0f;
+    f->state[1] = 0.0f;
+}
+
+
+/** Sets 'f' up again as described by 'config', for samples
+ * 'sample_period_s' apart, without clearing its state. For when the sample
+ * rate turns out to be a little off from what 'f' was set up for. */
+void filter_set_sample_period(struct filter *f, const struct filter_config *config, \
+    float sample_period_s) {
+
+    const float state[2] = { f->state[0], f->state[1] };
+    filter_init(f, config, sample_period_s);
+    f->state[0] = state[0];
+    f->state[1] = state[1];
+}
+
+
+/** Moves the centre of notch 'f' to 'centre_hz' with quality 'q', without
+ * clearing its state, so that it can follow a moving peak. */
+void filter_notch_retune(struct filter *f, float centre_hz, float q, float sample_period_s) {
+    if (f->type != FILTER_NOTCH) {
+        return;
+    }
+    filter_biquad_coeffs(f, centre_hz, q, sample_period_s);
+}
+
+
+/** Runs the 'len' samples at 'samples' through 'f', in place. */
+void filter_apply_block(struct filter *f, float *samples, int len) {
+#if FILTER_ESP_DSP
+    if (f->type == FILTER_BIQUAD_LPF || f->type == FILTER_NOTCH) {
+        dsps_biquad_f32(samples, samples, len, f->coeffs, f->state);
+        return;
+    }
+#endif
+    switch (f->type) {
+        case FILTER_NONE:
+            return;
+        case FILTER_PT1: {
+            /* Kept in a local so that the compiler need not store it back
+             * every sample */
+            float y = f->state[0];
+            for (int i = 0; i < len; i++) {
+                y += f->k * (samples[i] - y);
+                samples[i] = y;
+            }
+            f->state[0] = y;
+            return;
+        }
+        default:
+            for (int i = 0; i < len; i++) {
+                samples[i] = filter_apply(f, samples[i]);
+            }
+            return;
+    }
+}
+
+
+/** Gets whatever 'filter_fft()' needs ready for transforms of up to 'len'
+ * points. */
+void filter_fft_init(int len) {
+#if FILTER_ESP_DSP
+    /* Fails harmlessly if some other component already set the tables up */
+    dsps_fft2r_init_fc32(NULL, len);
+#else
+    (void) len;
+#endif
+}
+
+
+/** Replaces the 'len' complex samples at 'samples', stored as real and
+ * imaginary pairs, with their discrete Fourier transform, in natural order.
+ * 'len' must be a power of two. */
+void filter_fft(float *samples, int len) {
+#if FILTER_ESP_DSP
+    dsps_fft2r_fc32(samples, len);
+    dsps_bit_rev_fc32(samples, len);
+#else
+    /* Iterative radix-2 decimation in time: bit reverse, then butterflies */
+    for (int i = 1, j = 0; i < len; i++) {
+        int bit = len >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            float re = samples[2 * i];
+            float im = samples[2 * i + 1];
+            samples[2 * i] = samples[2 * j];
+            samples[2 * i + 1] = samples[2 * j + 1];
+            samples[2 * j] = re;
+            samples[2 * j + 1] = im;
+        }
+    }
+    for (int span = 2; span <= len; span <<= 1) {
+        float angle = -2.0f * (float) M_PI / span;
+        for (int k = 0; k < span / 2; k++) {
+            float w_re = cosf(angle * k);
+            float w_im = sinf(angle * k);
+            for (int i = k; i < len; i += span) {
+                float *a = &samples[2 * i];
+                float *b = &samples[2 * (i + span / 2)];
+                float t_re = w_re * b[0] - w_im * b[1];
+                float t_im = w_re * b[1] + w_im * b[0];
+                b[0] = a[0] - t_re;
+                b[1] = a[1] - t_im;
+                a[0] += t_re;
+                a[1] += t_im;
+            }
+        }
+    }
+#endif
+}
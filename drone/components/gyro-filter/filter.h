@@ -0,0 +1,104 @@
+#ifndef __FILTER_H_
+#define __FILTER_H_
+
+#include <inttypes.h>
+
+/* Single channel low-pass and notch filters, for the gyroscope and the
+ * D-term:
+ *
+ *   FILTER_PT1         first order low-pass, one multiply-add a sample
+ *   FILTER_PT2         two PT1s in series, with their cutoff moved up so that
+ *                      the pair is 3dB down at 'cutoff_hz'
+ *   FILTER_BIQUAD_LPF  second order low-pass (Butterworth unless 'q' says
+ *                      otherwise)
+ *   FILTER_NOTCH       second order notch centred on 'cutoff_hz', 'q' being
+ *                      the centre frequency over the width of the notch
+ *
+ * Filters can be run a sample at a time with 'filter_apply()', or over a
+ * whole block of samples with 'filter_apply_block()', which is cheaper per
+ * sample and uses esp-dsp's optimised biquad kernel when it is available.
+ * The biquads are direct form II with their coefficients in esp-dsp's order,
+ * so both ways give the same results. Without esp-dsp, on the host for one,
+ * the block is run through the same biquads in plain C. */
+
+
+#if defined(ESP_PLATFORM) && __has_include("dsps_biquad.h")
+#define FILTER_ESP_DSP 1
+#else
+#define FILTER_ESP_DSP 0
+#endif
+
+/* The Q of a Butterworth biquad, used when a biquad low-pass's 'q' is 0 */
+#define FILTER_BUTTERWORTH_Q 0.7071068f
+
+
+enum filter_type {
+    FILTER_NONE,
+    FILTER_PT1,
+    FILTER_PT2,
+    FILTER_BIQUAD_LPF,
+    FILTER_NOTCH,
+};
+
+struct filter_config {
+    enum filter_type type;
+    /* The low-pass cutoff, or the notch centre, in Hz. 0 disables the
+     * filter */
+    float cutoff_hz;
+    /* Biquads only */
+    float q;
+};
+
+struct filter {
+    enum filter_type type;
+    /* PT1 and PT2 gain */
+    float k;
+    /* Biquads: b0, b1, b2, a1, a2, with a0 normalised to 1 */
+    float coeffs[5];
+    /* The PT2's two stages, or the biquad's two delays */
+    float state[2];
+};
+
+
+void filter_init(struct filter *f, const struct filter_config *config, float sample_period_s);
+
+void filter_reset(struct filter *f);
+
+void filter_set_sample_period(struct filter *f, const struct filter_config *config, \
+    float sample_period_s);
+
+void filter_notch_retune(struct filter *f, float centre_hz, float q, float sample_period_s);
+
+void filter_apply_block(struct filter *f, float *samples, int len);
+
+void filter_fft_init(int len);
+
+void filter_fft(float *samples, int len);
+
+
+/** Runs one sample, 'x', through 'f' and returns the output. */
+static inline float filter_apply(struct filter *f, float x) {
+    switch (f->type) {
+        case FILTER_PT1:
+            f->state[0] += f->k * (x - f->state[0]);
+            return f->state[0];
+        case FILTER_PT2:
+            f->state[0] += f->k * (x - f->state[0]);
+            f->state[1] += f->k * (f->state[0] - f->state[1]);
+            return f->state[1];
+        case FILTER_BIQUAD_LPF:
+        case FILTER_NOTCH: {
+            const float *c = f->coeffs;
+            float w = x - c[3] * f->state[0] - c[4] * f->state[1];
+            float y = c[0] * w + c[1] * f->state[0] + c[2] * f->state[1];
+            f->state[1] = f->state[0];
+            f->state[0] = w;
+            return y;
+        }
+        default:
+            return x;
+    }
+}
+
+
+#endif
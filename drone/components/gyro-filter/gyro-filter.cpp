@@ -0,0 +1,197 @@
+#include <math.h>
+#include <string.h>
+
+#include "filter.h"
+#include "gyro-filter.h"
+
+
+/** Sets 'gf' up as described by 'config', for gyroscope samples
+ * 'sample_period_s' apart. The dynamic notch's range is cut down to what the
+ * FFT can see, and the notch starts off at the top of it. */
+void gyro_filter_init(struct gyro_filter *gf, const struct gyro_filter_config *config, \
+    float sample_period_s) {
+
+    memset(gf, 0, sizeof(*gf));
+    gf->config = *config;
+    gf->sample_period_s = sample_period_s;
+
+    for (int i = 0; i < GYRO_FILTER_MAX_STAGES && config->stages[i].type != FILTER_NONE; i++) {
+        for (int axis = 0; axis < GYRO_FILTER_NUM_AXES; axis++) {
+            filter_init(&gf->stages[i][axis], &config->stages[i], sample_period_s);
+        }
+        gf->num_stages++;
+    }
+
+    /* Bin 0 is the average and the top bin is the Nyquist frequency, and
+     * the peak needs a bin either side of it to be interpolated */
+    float bin_hz = 1.0f / (GYRO_FILTER_FFT_LEN * sample_period_s);
+    gf->min_bin = (int) ceilf(config->dyn_notch_min_hz / bin_hz);
+    gf->max_bin = (int) floorf(config->dyn_notch_max_hz / bin_hz);
+    if (gf->min_bin < 2) gf->min_bin = 2;
+    if (gf->max_bin > GYRO_FILTER_FFT_LEN / 2 - 2) gf->max_bin = GYRO_FILTER_FFT_LEN / 2 - 2;
+    gf->dyn_notch_enabled = config->dyn_notch_max_hz > 0.0f && gf->min_bin < gf->max_bin;
+    if (gf->dyn_notch_enabled) {
+        struct filter_config notch = {
+            .type = FILTER_NOTCH,
+            .cutoff_hz = gf->max_bin * bin_hz,
+            .q = config->dyn_notch_q,
+        };
+        for (int axis = 0; axis < GYRO_FILTER_NUM_AXES; axis++) {
+            filter_init(&gf->dyn_notch[axis], &notch, sample_period_s);
+            gf->dyn_notch_hz[axis] = notch.cutoff_hz;
+        }
+        for (int i = 0; i < GYRO_FILTER_FFT_LEN; i++) {
+            gf->hann[i] = 0.5f - 0.5f * cosf(2.0f * (float) M_PI * i / GYRO_FILTER_FFT_LEN);
+        }
+        filter_fft_init(GYRO_FILTER_FFT_LEN);
+    }
+}
+
+
+/** Clears every filter's state, and forgets the samples collected for the
+ * next FFT, but leaves the dynamic notch where it is. */
+void gyro_filter_reset(struct gyro_filter *gf) {
+    for (int axis = 0; axis < GYRO_FILTER_NUM_AXES; axis++) {
+        for (int i = 0; i < gf->num_stages; i++) {
+            filter_reset(&gf->stages[i][axis]);
+        }
+        filter_reset(&gf->dyn_notch[axis]);
+    }
+    gf->window_len = 0;
+    gf->axes_to_analyse = 0;
+}
+
+
+/** Retunes every filter in 'gf' for gyroscope samples 'sample_period_s'
+ * apart, e.g. once the real sample rate is known, without clearing their
+ * state or moving the dynamic notch (unless the FFT can no longer see where
+ * it is). */
+void gyro_filter_set_sample_period(struct gyro_filter *gf, float sample_period_s) {
+    gf->sample_period_s = sample_period_s;
+
+    for (int i = 0; i < gf->num_stages; i++) {
+        for (int axis = 0; axis < GYRO_FILTER_NUM_AXES; axis++) {
+            filter_set_sample_period(&gf->stages[i][axis], &gf->config.stages[i], \
+                sample_period_s);
+        }
+    }
+
+    if (!gf->dyn_notch_enabled) {
+        return;
+    }
+    float bin_hz = 1.0f / (GYRO_FILTER_FFT_LEN * sample_period_s);
+    int min_bin = (int) ceilf(gf->config.dyn_notch_min_hz / bin_hz);
+    int max_bin = (int) floorf(gf->config.dyn_notch_max_hz / bin_hz);
+    if (min_bin < 2) min_bin = 2;
+    if (max_bin > GYRO_FILTER_FFT_LEN / 2 - 2) max_bin = GYRO_FILTER_FFT_LEN / 2 - 2;
+    if (min_bin < max_bin) {
+        gf->min_bin = min_bin;
+        gf->max_bin = max_bin;
+    }
+    for (int axis = 0; axis < GYRO_FILTER_NUM_AXES; axis++) {
+        float notch_hz = gf->dyn_notch_hz[axis];
+        if (notch_hz < gf->min_bin * bin_hz) notch_hz = gf->min_bin * bin_hz;
+        if (notch_hz > gf->max_bin * bin_hz) notch_hz = gf->max_bin * bin_hz;
+        gf->dyn_notch_hz[axis] = notch_hz;
+        filter_notch_retune(&gf->dyn_notch[axis], notch_hz, gf->config.dyn_notch_q, \
+            sample_period_s);
+    }
+}
+
+
+/* Finds the strongest peak in 'axis's last window and moves its notch
+ * towards it */
+static void gyro_filter_analyse(struct gyro_filter *gf, int axis) {
+    const float *x = gf->analysis[axis];
+    float mean = 0.0f;
+    for (int i = 0; i < GYRO_FILTER_FFT_LEN; i++) {
+        mean += x[i];
+    }
+    mean /= GYRO_FILTER_FFT_LEN;
+    for (int i = 0; i < GYRO_FILTER_FFT_LEN; i++) {
+        gf->fft[2 * i] = (x[i] - mean) * gf->hann[i];
+        gf->fft[2 * i + 1] = 0.0f;
+    }
+    filter_fft(gf->fft, GYRO_FILTER_FFT_LEN);
+
+    /* The power in each bin is only needed up to half the FFT length, and
+     * written back over the first half of 'fft' */
+    float *power = gf->fft;
+    for (int i = 0; i <= GYRO_FILTER_FFT_LEN / 2; i++) {
+        power[i] = gf->fft[2 * i] * gf->fft[2 * i] + gf->fft[2 * i + 1] * gf->fft[2 * i + 1];
+    }
+    int peak = gf->min_bin;
+    float total = 0.0f;
+    for (int i = gf->min_bin; i <= gf->max_bin; i++) {
+        total += power[i];
+        if (power[i] > power[peak]) {
+            peak = i;
+        }
+    }
+    float average = total / (gf->max_bin - gf->min_bin + 1);
+    if (power[peak] <= GYRO_FILTER_DYN_NOTCH_PROMINENCE * average) {
+        return;
+    }
+    /* The strongest bin in range is only a peak if it stands above its
+     * neighbours. At the edge of the range, it is more likely the skirt of
+     * the drone's own (much slower, much larger) movement */
+    if (power[peak] <= power[peak - 1] || power[peak] < power[peak + 1]) {
+        return;
+    }
+
+    /* Fit a parabola through the peak and its neighbours to get between
+     * bins */
+    float left = power[peak - 1];
+    float right = power[peak + 1];
+    float curvature = left - 2.0f * power[peak] + right;
+    float offset = (curvature < 0.0f) ? 0.5f * (left - right) / curvature : 0.0f;
+    float bin_hz = 1.0f / (GYRO_FILTER_FFT_LEN * gf->sample_period_s);
+    float peak_hz = (peak + offset) * bin_hz;
+
+    gf->dyn_notch_hz[axis] += GYRO_FILTER_DYN_NOTCH_SMOOTHING * (peak_hz - gf->dyn_notch_hz[axis]);
+    filter_notch_retune(&gf->dyn_notch[axis], gf->dyn_notch_hz[axis], gf->config.dyn_notch_q, \
+        gf->sample_period_s);
+}
+
+
+/* Adds 'len' samples from 'axes' to the window, handing it over for
+ * analysis whenever it fills up */
+static void gyro_filter_collect(struct gyro_filter *gf, float *const *axes, int len) {
+    for (int done = 0; done < len; ) {
+        int n = GYRO_FILTER_FFT_LEN - gf->window_len;
+        if (n > len - done) n = len - done;
+        for (int axis = 0; axis < GYRO_FILTER_NUM_AXES; axis++) {
+            memcpy(&gf->window[axis][gf->window_len], &axes[axis][done], n * sizeof(float));
+        }
+        gf->window_len += n;
+        done += n;
+
+        if (gf->window_len == GYRO_FILTER_FFT_LEN) {
+            memcpy(gf->analysis, gf->window, sizeof(gf->analysis));
+            gf->axes_to_analyse = GYRO_FILTER_NUM_AXES;
+            gf->window_len = 0;
+        }
+    }
+}
+
+
+/** Filters a block of 'len' consecutive samples in place. 'axes' points at
+ * the x, y and z samples, each 'len' long. */
+void gyro_filter_apply(struct gyro_filter *gf, float *const *axes, int len) {
+    if (gf->dyn_notch_enabled) {
+        if (gf->axes_to_analyse > 0) {
+            gyro_filter_analyse(gf, GYRO_FILTER_NUM_AXES - gf->axes_to_analyse);
+            gf->axes_to_analyse--;
+        }
+        gyro_filter_collect(gf, axes, len);
+    }
+
+    for (int axis = 0; axis < GYRO_FILTER_NUM_AXES; axis++) {
+        if (gf->dyn_notch_enabled) {
+            filter_apply_block(&gf->dyn_notch[axis], axes[axis], len);
+        }
+        for (int i = 0; i < gf->num_stages; i++) {
+            filter_apply_block(&gf->stages[i][axis], axes[axis], len);
+        }
+    }
+}
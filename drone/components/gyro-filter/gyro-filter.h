@@ -0,0 +1,82 @@
+#ifndef __GYRO_FILTER_H_
+#define __GYRO_FILTER_H_
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "filter.h"
+
+/* The gyroscope's filter bank: a notch that follows the strongest vibration
+ * peak, then a chain of fixed low-pass (or notch) stages, on each of the
+ * three axes.
+ *
+ * The dynamic notch finds its peak with an FFT of the last
+ * GYRO_FILTER_FFT_LEN samples on each axis. Working one out takes a lot
+ * longer than filtering a sample, so each call to 'gyro_filter_apply()'
+ * analyses at most one axis, and a fresh window is only analysed once it has
+ * filled up. The notch is moved towards each new peak rather than onto it,
+ * so one noisy estimate cannot throw it far.
+ *
+ * Samples are filtered a block at a time, one axis after the other, so a
+ * whole FIFO burst goes through each stage in one tight loop. */
+
+
+#define GYRO_FILTER_NUM_AXES 3
+#define GYRO_FILTER_MAX_STAGES 4
+/* The dynamic notch's FFT length. Its bins are the sample rate over this
+ * wide: 26Hz at 1.667kHz, 6.5Hz at 417Hz */
+#define GYRO_FILTER_FFT_LEN 64
+/* A peak has to have this many times the average power between
+ * 'dyn_notch_min_hz' and 'dyn_notch_max_hz' for the notch to move to it */
+#define GYRO_FILTER_DYN_NOTCH_PROMINENCE 4.0f
+/* How far the notch moves towards each new peak */
+#define GYRO_FILTER_DYN_NOTCH_SMOOTHING 0.3f
+
+
+struct gyro_filter_config {
+    /* Run in order after the dynamic notch, up to the first FILTER_NONE */
+    struct filter_config stages[GYRO_FILTER_MAX_STAGES];
+    /* Where the dynamic notch looks for its peak, and how narrow it is. A
+     * 'dyn_notch_max_hz' of 0 disables it */
+    float dyn_notch_min_hz;
+    float dyn_notch_max_hz;
+    float dyn_notch_q;
+};
+
+struct gyro_filter {
+    struct gyro_filter_config config;
+    float sample_period_s;
+    int num_stages;
+    struct filter stages[GYRO_FILTER_MAX_STAGES][GYRO_FILTER_NUM_AXES];
+
+    bool dyn_notch_enabled;
+    struct filter dyn_notch[GYRO_FILTER_NUM_AXES];
+    /* Where each axis's notch is, in Hz */
+    float dyn_notch_hz[GYRO_FILTER_NUM_AXES];
+    /* The FFT bins the peak is looked for in */
+    int min_bin;
+    int max_bin;
+    /* The latest samples on each axis, until there are GYRO_FILTER_FFT_LEN
+     * of them */
+    float window[GYRO_FILTER_NUM_AXES][GYRO_FILTER_FFT_LEN];
+    int window_len;
+    /* The last full window, and how many of its axes are still to be
+     * analysed */
+    float analysis[GYRO_FILTER_NUM_AXES][GYRO_FILTER_FFT_LEN];
+    int axes_to_analyse;
+    float hann[GYRO_FILTER_FFT_LEN];
+    float fft[2 * GYRO_FILTER_FFT_LEN];
+};
+
+
+void gyro_filter_init(struct gyro_filter *gf, const struct gyro_filter_config *config, \
+    float sample_period_s);
+
+void gyro_filter_reset(struct gyro_filter *gf);
+
+void gyro_filter_set_sample_period(struct gyro_filter *gf, float sample_period_s);
+
+void gyro_filter_apply(struct gyro_filter *gf, float *const *axes, int len);
+
+
+#endif
@@ -0,0 +1,154 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "loop-profiler.h"
+
+
+/** Gets 'lp' ready to profile a loop made up of 'num_stages' stages (at most
+ * LOOP_PROFILER_MAX_STAGES), called 'stage_names' in dumps. 'cycles_per_us'
+ * is how fast the cycle counter runs, and is only used for printing. The
+ * profiler starts off switched off. */
+void loop_profiler_init(struct loop_profiler *lp, const char *const *stage_names, \
+    int num_stages, uint32_t cycles_per_us) {
+
+    memset(lp, 0, sizeof(*lp));
+    lp->stage_names = stage_names;
+    lp->num_stages = (num_stages > LOOP_PROFILER_MAX_STAGES) ? LOOP_PROFILER_MAX_STAGES \
+        : num_stages;
+    lp->cycles_per_us = (cycles_per_us > 0) ? cycles_per_us : 1;
+    loop_profiler_reset(lp);
+}
+
+
+/** Switches profiling on or off. Can be called from any task. */
+void loop_profiler_enable(struct loop_profiler *lp, bool enabled) {
+    __atomic_store_n(&lp->enabled, enabled ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+
+/** Has every record of 'stage' longer than 'budget_cycles' counted as an
+ * overrun (0, the default, turns this off). */
+void loop_profiler_set_budget(struct loop_profiler *lp, int stage, uint32_t budget_cycles) {
+    if (stage >= 0 && stage < lp->num_stages) {
+        lp->budget_cycles[stage] = budget_cycles;
+    }
+}
+
+
+/* Which histogram bucket 'cycles' falls in. Values below
+ * 2^LOOP_PROFILER_SUB_BUCKET_BITS get a bucket each; above that, each power
+ * of two is split evenly into 2^LOOP_PROFILER_SUB_BUCKET_BITS buckets */
+static int loop_profiler_bucket(uint32_t cycles) {
+    const uint32_t sub_buckets = 1u << LOOP_PROFILER_SUB_BUCKET_BITS;
+    if (cycles < sub_buckets) {
+        return (int) cycles;
+    }
+
+    int msb = 31 - __builtin_clz(cycles);
+    int shift = msb - LOOP_PROFILER_SUB_BUCKET_BITS;
+    return (shift + 1) * (int) sub_buckets + (int) ((cycles >> shift) - sub_buckets);
+}
+
+
+/* The largest value that falls in histogram bucket 'bucket' */
+static uint32_t loop_profiler_bucket_max(int bucket) {
+    const int sub_buckets = 1 << LOOP_PROFILER_SUB_BUCKET_BITS;
+    if (bucket < sub_buckets) {
+        return (uint32_t) bucket;
+    }
+
+    int shift = bucket / sub_buckets - 1;
+    uint64_t mantissa = (uint64_t) (bucket % sub_buckets + sub_buckets);
+    uint64_t max = ((mantissa + 1) << shift) - 1;
+    return (max > UINT32_MAX) ? UINT32_MAX : (uint32_t) max;
+}
+
+
+/** Moves every record waiting in the ring into the per-stage statistics.
+ * Must only ever be called by one task, which is the only one allowed to
+ * call 'loop_profiler_reset()' and 'loop_profiler_dump()' too. This should be
+ * done often enough that the ring does not fill up (see the dropped count in
+ * the dump). */
+void loop_profiler_collect(struct loop_profiler *lp) {
+    uint32_t head = __atomic_load_n(&lp->head, __ATOMIC_ACQUIRE);
+    uint32_t tail = __atomic_load_n(&lp->tail, __ATOMIC_RELAXED);
+
+    for (; tail != head; tail++) {
+        const struct loop_profiler_record *record = \
+            &lp->ring[tail & (LOOP_PROFILER_RING_LEN - 1)];
+        if (record->stage >= (uint32_t) lp->num_stages) {
+            continue;
+        }
+
+        struct loop_profiler_stats *stats = &lp->stats[record->stage];
+        uint32_t cycles = record->cycles;
+        stats->count++;
+        stats->sum += cycles;
+        if (cycles < stats->min) stats->min = cycles;
+        if (cycles > stats->max) stats->max = cycles;
+        stats->buckets[loop_profiler_bucket(cycles)]++;
+        if (lp->budget_cycles[record->stage] && cycles > lp->budget_cycles[record->stage]) {
+            stats->overruns++;
+        }
+    }
+
+    /* Hand the slots back to the loop once they have been read */
+    __atomic_store_n(&lp->tail, tail, __ATOMIC_RELEASE);
+}
+
+
+/** Forgets everything collected so far, including the dropped count. */
+void loop_profiler_reset(struct loop_profiler *lp) {
+    for (int i = 0; i < LOOP_PROFILER_MAX_STAGES; i++) {
+        memset(&lp->stats[i], 0, sizeof(lp->stats[i]));
+        lp->stats[i].min = UINT32_MAX;
+    }
+    __atomic_store_n(&lp->dropped, 0, __ATOMIC_RELAXED);
+}
+
+
+/** Returns a value which 'percentile' percent of the records in 'stats' are
+ * at or below, rounded up to the top of its histogram bucket (but never past
+ * the largest record). Returns 0 if there are no records. */
+uint32_t loop_profiler_percentile(const struct loop_profiler_stats *stats, float percentile) {
+    if (stats->count == 0) {
+        return 0;
+    }
+
+    uint64_t wanted = (uint64_t) ((double) stats->count * percentile / 100.0 + 0.5);
+    if (wanted < 1) wanted = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < LOOP_PROFILER_NUM_BUCKETS; i++) {
+        seen += stats->buckets[i];
+        if (seen >= wanted) {
+            uint32_t max = loop_profiler_bucket_max(i);
+            return (max < stats->max) ? max : stats->max;
+        }
+    }
+
+    return stats->max;
+}
+
+
+/** Prints a table of every stage's statistics to 'out', in microseconds,
+ * followed by how many records were dropped because the ring was full. */
+void loop_profiler_dump(const struct loop_profiler *lp, FILE *out) {
+    const double us_per_cycle = 1.0 / lp->cycles_per_us;
+
+    fprintf(out, "%-10s %8s %9s %9s %9s %9s %8s\n", "stage", "count", "min us", "mean us", \
+        "p99 us", "max us", "overrun");
+    for (int i = 0; i < lp->num_stages; i++) {
+        const struct loop_profiler_stats *stats = &lp->stats[i];
+        if (stats->count == 0) {
+            fprintf(out, "%-10s %8d\n", lp->stage_names[i], 0);
+            continue;
+        }
+        fprintf(out, "%-10s %8" PRIu32 " %9.1f %9.1f %9.1f %9.1f %8" PRIu32 "\n", \
+            lp->stage_names[i], stats->count, stats->min * us_per_cycle, \
+            (double) stats->sum / stats->count * us_per_cycle, \
+            loop_profiler_percentile(stats, 99.0f) * us_per_cycle, \
+            stats->max * us_per_cycle, stats->overruns);
+    }
+    fprintf(out, "dropped: %" PRIu32 "\n", __atomic_load_n(&lp->dropped, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,176 @@
+#ifndef __LOOP_PROFILER_H_
+#define __LOOP_PROFILER_H_
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#ifdef ESP_PLATFORM
+#include "esp_cpu.h"
+#else
+#include <time.h>
+#endif
+
+/* Times the stages of a real-time loop in CPU cycles, without getting in the
+ * loop's way.
+ *
+ * The loop calls 'loop_profiler_lap()' at the end of each stage, which reads
+ * the cycle counter and pushes the stage's time into a single producer,
+ * single consumer ring buffer. Some other, less urgent task calls
+ * 'loop_profiler_collect()' every so often to drain the ring into per-stage
+ * statistics (min, mean, max and a histogram for percentiles), and
+ * 'loop_profiler_dump()' to print them. Neither side ever blocks the other:
+ * if the ring is full, the record is dropped and counted instead.
+ *
+ * While profiling is switched off with 'loop_profiler_enable()', a lap costs
+ * one load and a branch. Building with LOOP_PROFILER_ENABLED set to 0 takes
+ * even that away.
+ *
+ * The profiled loop must stick to one core, since the cycle counter is per
+ * core. On the host the "cycles" are nanoseconds. */
+
+
+/* Set to 0 to compile every lap out */
+#ifndef LOOP_PROFILER_ENABLED
+#define LOOP_PROFILER_ENABLED 1
+#endif
+
+#define LOOP_PROFILER_MAX_STAGES 8
+/* How many records can be waiting to be collected. Must be a power of two */
+#define LOOP_PROFILER_RING_LEN 1024
+/* The histogram splits every power of two into 2^this buckets, so a
+ * percentile is good to within 25% */
+#define LOOP_PROFILER_SUB_BUCKET_BITS 2
+#define LOOP_PROFILER_NUM_BUCKETS (32 << LOOP_PROFILER_SUB_BUCKET_BITS)
+
+
+struct loop_profiler_record {
+    uint32_t stage;
+    uint32_t cycles;
+};
+
+struct loop_profiler_stats {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    /* Records longer than the stage's budget */
+    uint32_t overruns;
+    uint32_t buckets[LOOP_PROFILER_NUM_BUCKETS];
+};
+
+struct loop_profiler {
+    /* Shared between the loop and the collector */
+    uint32_t enabled;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t dropped;
+    struct loop_profiler_record ring[LOOP_PROFILER_RING_LEN];
+
+    /* Only touched by the collector */
+    const char *const *stage_names;
+    int num_stages;
+    uint32_t cycles_per_us;
+    uint32_t budget_cycles[LOOP_PROFILER_MAX_STAGES];
+    struct loop_profiler_stats stats[LOOP_PROFILER_MAX_STAGES];
+};
+
+
+/** Returns the current value of the cycle counter. */
+static inline uint32_t loop_profiler_now(void) {
+#ifdef ESP_PLATFORM
+    return esp_cpu_get_cycle_count();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) ((uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec);
+#endif
+}
+
+
+/** Returns the cycle count to time the first stage of an iteration from,
+ * or 0 if profiling is off. */
+static inline uint32_t loop_profiler_start(const struct loop_profiler *lp) {
+#if LOOP_PROFILER_ENABLED
+    if (!__atomic_load_n(&lp->enabled, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    return loop_profiler_now();
+#else
+    (void) lp;
+    return 0;
+#endif
+}
+
+
+/** Records 'cycles' as one run of 'stage'. For measurements the loop takes
+ * itself rather than with 'loop_profiler_lap()', in whatever unit the
+ * profiler was set up with (see 'loop_profiler_init()'). Only one task may
+ * ever record to a given profiler. */
+static inline void loop_profiler_record(struct loop_profiler *lp, int stage, uint32_t cycles) {
+#if LOOP_PROFILER_ENABLED
+    if (!__atomic_load_n(&lp->enabled, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    /* Only this task writes 'head', and the acquire on 'tail' keeps it from
+     * reusing a slot before the collector is done reading it */
+    uint32_t head = __atomic_load_n(&lp->head, __ATOMIC_RELAXED);
+    uint32_t tail = __atomic_load_n(&lp->tail, __ATOMIC_ACQUIRE);
+    if (head - tail >= LOOP_PROFILER_RING_LEN) {
+        __atomic_store_n(&lp->dropped, lp->dropped + 1, __ATOMIC_RELAXED);
+        return;
+    }
+    struct loop_profiler_record *record = &lp->ring[head & (LOOP_PROFILER_RING_LEN - 1)];
+    record->stage = (uint32_t) stage;
+    record->cycles = cycles;
+    __atomic_store_n(&lp->head, head + 1, __ATOMIC_RELEASE);
+#else
+    (void) lp;
+    (void) stage;
+    (void) cycles;
+#endif
+}
+
+
+/** Records that 'stage' ran from 'start' (as returned by
+ * 'loop_profiler_start()' or the previous lap) until now, and returns now so
+ * that the next stage can be timed from it. A 'start' of 0 means there is
+ * nothing to time from (profiling was off when it was taken), so nothing is
+ * recorded. Only one task may ever lap a given profiler. */
+static inline uint32_t loop_profiler_lap(struct loop_profiler *lp, int stage, uint32_t start) {
+#if LOOP_PROFILER_ENABLED
+    if (!__atomic_load_n(&lp->enabled, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+
+    uint32_t now = loop_profiler_now();
+    if (start != 0) {
+        loop_profiler_record(lp, stage, now - start);
+    }
+    return now;
+#else
+    (void) lp;
+    (void) stage;
+    (void) start;
+    return 0;
+#endif
+}
+
+
+void loop_profiler_init(struct loop_profiler *lp, const char *const *stage_names, \
+    int num_stages, uint32_t cycles_per_us);
+
+void loop_profiler_enable(struct loop_profiler *lp, bool enabled);
+
+void loop_profiler_set_budget(struct loop_profiler *lp, int stage, uint32_t budget_cycles);
+
+void loop_profiler_collect(struct loop_profiler *lp);
+
+void loop_profiler_reset(struct loop_profiler *lp);
+
+uint32_t loop_profiler_percentile(const struct loop_profiler_stats *stats, float percentile);
+
+void loop_profiler_dump(const struct loop_profiler *lp, FILE *out);
+
+
+#endif
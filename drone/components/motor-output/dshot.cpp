@@ -0,0 +1,37 @@
+#include <inttypes.h>
+
+#include "dshot.h"
+
+
+/** Takes a 'throttle' from 0 to 1 and returns the DShot value for it. Anything
+ * at or below 0 stops the motor, everything else is spread over the throttle
+ * range. */
+uint16_t dshot_throttle_to_value(float throttle) {
+    if (throttle <= 0.0f) {
+        return DSHOT_VALUE_MOTOR_STOP;
+    }
+    if (throttle >= 1.0f) {
+        return DSHOT_VALUE_THROTTLE_MAX;
+    }
+
+    return DSHOT_VALUE_THROTTLE_MIN + (uint16_t) (throttle \
+        * (float) (DSHOT_VALUE_THROTTLE_MAX - DSHOT_VALUE_THROTTLE_MIN) + 0.5f);
+}
+
+
+/** Returns the 4 bit checksum of the 12 bit 'value_and_telemetry' (the value
+ * shifted left by one with the telemetry bit in the bottom bit): the XOR of
+ * its three nibbles. */
+uint8_t dshot_checksum(uint16_t value_and_telemetry) {
+    return (value_and_telemetry ^ (value_and_telemetry >> 4) \
+        ^ (value_and_telemetry >> 8)) & 0x0F;
+}
+
+
+/** Returns the 16 bit DShot frame carrying the 11 bit 'value', with the
+ * telemetry request bit set if 'telemetry' is non-zero. */
+uint16_t dshot_encode_frame(uint16_t value, uint8_t telemetry) {
+    uint16_t value_and_telemetry = ((value & 0x07FF) << 1) | (telemetry ? 1 : 0);
+
+    return (value_and_telemetry << 4) | dshot_checksum(value_and_telemetry);
+}
@@ -0,0 +1,32 @@
+#ifndef __DSHOT_H_
+#define __DSHOT_H_
+
+#include <inttypes.h>
+
+/* DShot frame encoding. A DShot frame is 16 bits sent MSB first: an 11 bit
+ * value, a telemetry request bit and a 4 bit checksum. Values 1 to 47 are
+ * special commands, 48 to 2047 are throttle and 0 stops the motor. */
+
+
+#define DSHOT_VALUE_MOTOR_STOP 0
+#define DSHOT_VALUE_THROTTLE_MIN 48
+#define DSHOT_VALUE_THROTTLE_MAX 2047
+#define DSHOT_FRAME_BITS 16
+
+/* DShot600 bit timing in ticks of a 40MHz clock. A bit lasts 1.67us, with the
+ * line held high for 0.625us for a 0 and 1.25us for a 1 */
+#define DSHOT600_RESOLUTION_HZ 40000000
+#define DSHOT600_T0H_TICKS 25
+#define DSHOT600_T0L_TICKS 42
+#define DSHOT600_T1H_TICKS 50
+#define DSHOT600_T1L_TICKS 17
+
+
+uint16_t dshot_throttle_to_value(float throttle);
+
+uint8_t dshot_checksum(uint16_t value_and_telemetry);
+
+uint16_t dshot_encode_frame(uint16_t value, uint8_t telemetry);
+
+
+#endif
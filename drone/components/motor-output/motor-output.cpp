@@ -0,0 +1,215 @@
+#include <inttypes.h>
+#include <string.h>
+
+#include "driver/gpio.h"
+#include "driver/ledc.h"
+#include "driver/rmt_tx.h"
+#include "esp_err.h"
+#include "soc/soc_caps.h"
+
+#include "motor-output.h"
+
+
+/* Pins which are free on the Adafruit ESP32 Feather with the 9 DOF sensors
+ * attached */
+#define MOTOR_OUTPUT_PINS { GPIO_NUM_25, GPIO_NUM_26, GPIO_NUM_4, GPIO_NUM_21 }
+
+const struct motor_output_config motor_output_pwm_400hz = {
+    .protocol = MOTOR_PROTOCOL_PWM,
+    .pins = MOTOR_OUTPUT_PINS,
+    .pwm_frequency_hz = 400,
+    .pwm_min_us = 1000,
+    .pwm_max_us = 2000,
+};
+
+const struct motor_output_config motor_output_dshot600 = {
+    .protocol = MOTOR_PROTOCOL_DSHOT600,
+    .pins = MOTOR_OUTPUT_PINS,
+    .pwm_frequency_hz = 0,
+    .pwm_min_us = 0,
+    .pwm_max_us = 0,
+};
+
+
+static esp_err_t motor_output_pwm_begin(struct motor_output *mo) {
+    const struct motor_output_config *config = &mo->config;
+
+    /* The longest pulse has to fit in a period */
+    if (config->pwm_frequency_hz == 0 || config->pwm_min_us > config->pwm_max_us \
+        || (uint64_t) config->pwm_max_us * config->pwm_frequency_hz >= 1000000) {
+
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    ledc_timer_config_t timer_config = {};
+    timer_config.speed_mode = MOTOR_OUTPUT_LEDC_MODE;
+    timer_config.duty_resolution = MOTOR_OUTPUT_LEDC_RESOLUTION;
+    timer_config.timer_num = MOTOR_OUTPUT_LEDC_TIMER;
+    timer_config.freq_hz = config->pwm_frequency_hz;
+    timer_config.clk_cfg = LEDC_AUTO_CLK;
+    ESP_ERROR_CHECK(ledc_timer_config(&timer_config));
+
+    for (int i = 0; i < MOTOR_OUTPUT_NUM_MOTORS; i++) {
+        ledc_channel_config_t channel_config = {};
+        channel_config.gpio_num = config->pins[i];
+        channel_config.speed_mode = MOTOR_OUTPUT_LEDC_MODE;
+        channel_config.channel = (ledc_channel_t) (MOTOR_OUTPUT_LEDC_FIRST_CHANNEL + i);
+        channel_config.intr_type = LEDC_INTR_DISABLE;
+        channel_config.timer_sel = MOTOR_OUTPUT_LEDC_TIMER;
+        channel_config.duty = 0;
+        channel_config.hpoint = 0;
+        ESP_ERROR_CHECK(ledc_channel_config(&channel_config));
+    }
+
+    return ESP_OK;
+}
+
+
+static esp_err_t motor_output_dshot_begin(struct motor_output *mo) {
+    /* Each bit is one RMT symbol: high then low, with the high time telling a
+     * 0 from a 1 */
+    rmt_bytes_encoder_config_t encoder_config = {};
+    encoder_config.bit0.level0 = 1;
+    encoder_config.bit0.duration0 = DSHOT600_T0H_TICKS;
+    encoder_config.bit0.level1 = 0;
+    encoder_config.bit0.duration1 = DSHOT600_T0L_TICKS;
+    encoder_config.bit1.level0 = 1;
+    encoder_config.bit1.duration0 = DSHOT600_T1H_TICKS;
+    encoder_config.bit1.level1 = 0;
+    encoder_config.bit1.duration1 = DSHOT600_T1L_TICKS;
+    encoder_config.flags.msb_first = 1;
+
+    for (int i = 0; i < MOTOR_OUTPUT_NUM_MOTORS; i++) {
+        rmt_tx_channel_config_t channel_config = {};
+        channel_config.gpio_num = mo->config.pins[i];
+        channel_config.clk_src = RMT_CLK_SRC_DEFAULT;
+        channel_config.resolution_hz = DSHOT600_RESOLUTION_HZ;
+        /* A whole frame fits in one memory block, so the RMT never has to be
+         * refilled mid-frame */
+        channel_config.mem_block_symbols = 64;
+        channel_config.trans_queue_depth = 1;
+        ESP_ERROR_CHECK(rmt_new_tx_channel(&channel_config, &mo->rmt_channels[i]));
+        ESP_ERROR_CHECK(rmt_new_bytes_encoder(&encoder_config, &mo->rmt_encoders[i]));
+        ESP_ERROR_CHECK(rmt_enable(mo->rmt_channels[i]));
+    }
+
+#if SOC_RMT_SUPPORT_TX_SYNCHRO
+    rmt_sync_manager_config_t sync_config = {};
+    sync_config.tx_channel_array = mo->rmt_channels;
+    sync_config.array_size = MOTOR_OUTPUT_NUM_MOTORS;
+    ESP_ERROR_CHECK(rmt_new_sync_manager(&sync_config, &mo->rmt_sync));
+#endif
+
+    return ESP_OK;
+}
+
+
+/** Takes a struct motor_output and sets up the peripheral chosen by
+ * 'config->protocol' to drive the motors on 'config->pins', then stops all of
+ * them.
+ *
+ * Returns ESP_ERR_INVALID_ARG if the PWM timings do not fit in a period.
+ */
+esp_err_t motor_output_begin(struct motor_output *mo, \
+    const struct motor_output_config *config) {
+
+    memset(mo, 0, sizeof(*mo));
+    mo->config = *config;
+
+    esp_err_t err;
+    if (config->protocol == MOTOR_PROTOCOL_DSHOT600) {
+        err = motor_output_dshot_begin(mo);
+    } else {
+        err = motor_output_pwm_begin(mo);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    return motor_output_stop(mo);
+}
+
+
+/** Sends one command, from 0 to 1, to each motor. 'command' holds
+ * MOTOR_OUTPUT_NUM_MOTORS values.
+ *
+ * With PWM the new pulse widths take effect from the next period. With DShot
+ * the four frames are started together by the RMT where it supports it; if the previous frames are
+ * somehow still going out after MOTOR_OUTPUT_DSHOT_WAIT_MS the write is
+ * dropped, counted in 'dshot_busy', and ESP_ERR_TIMEOUT is returned.
+ */
+esp_err_t motor_output_write(struct motor_output *mo, const float *command) {
+    if (mo->config.protocol == MOTOR_PROTOCOL_PWM) {
+        const struct motor_output_config *config = &mo->config;
+        for (int i = 0; i < MOTOR_OUTPUT_NUM_MOTORS; i++) {
+            float c = command[i];
+            if (c < 0.0f) c = 0.0f;
+            if (c > 1.0f) c = 1.0f;
+
+            uint32_t pulse_us = config->pwm_min_us \
+                + (uint32_t) (c * (float) (config->pwm_max_us - config->pwm_min_us));
+            uint32_t duty = (uint32_t) ((uint64_t) pulse_us * config->pwm_frequency_hz \
+                * MOTOR_OUTPUT_LEDC_DUTY_MAX / 1000000);
+
+            ledc_channel_t channel = (ledc_channel_t) (MOTOR_OUTPUT_LEDC_FIRST_CHANNEL + i);
+            esp_err_t err = ledc_set_duty(MOTOR_OUTPUT_LEDC_MODE, channel, duty);
+            if (err == ESP_OK) {
+                err = ledc_update_duty(MOTOR_OUTPUT_LEDC_MODE, channel);
+            }
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+        return ESP_OK;
+    }
+
+    /* 1. Make sure the frames from the last write are out, since their
+     * buffers are about to be overwritten */
+    for (int i = 0; i < MOTOR_OUTPUT_NUM_MOTORS; i++) {
+        if (rmt_tx_wait_all_done(mo->rmt_channels[i], MOTOR_OUTPUT_DSHOT_WAIT_MS) != ESP_OK) {
+            mo->dshot_busy++;
+            return ESP_ERR_TIMEOUT;
+        }
+    }
+
+    /* 2. Queue one frame per channel. Where the RMT can, the sync manager
+     * holds them all back until the last one is queued. Elsewhere (the plain
+     * ESP32) each one starts as soon as it is queued, a few microseconds
+     * after the one before */
+#if SOC_RMT_SUPPORT_TX_SYNCHRO
+    esp_err_t err = rmt_sync_reset(mo->rmt_sync);
+    if (err != ESP_OK) {
+        return err;
+    }
+#else
+    esp_err_t err;
+#endif
+    rmt_transmit_config_t transmit_config = {};
+    transmit_config.loop_count = 0;
+    for (int i = 0; i < MOTOR_OUTPUT_NUM_MOTORS; i++) {
+        uint16_t frame = dshot_encode_frame(dshot_throttle_to_value(command[i]), 0);
+        mo->dshot_frames[i][0] = frame >> 8;
+        mo->dshot_frames[i][1] = frame & 0xFF;
+
+        err = rmt_transmit(mo->rmt_channels[i], mo->rmt_encoders[i], \
+            mo->dshot_frames[i], sizeof(mo->dshot_frames[i]), &transmit_config);
+        if (err != ESP_OK) {
+#if SOC_RMT_SUPPORT_TX_SYNCHRO
+            /* Don't leave the frames already queued waiting on this one */
+            rmt_sync_reset(mo->rmt_sync);
+#endif
+            return err;
+        }
+    }
+
+    return ESP_OK;
+}
+
+
+/** Stops every motor: a minimum width pulse with PWM, the motor stop value
+ * with DShot. */
+esp_err_t motor_output_stop(struct motor_output *mo) {
+    const float stop[MOTOR_OUTPUT_NUM_MOTORS] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+    return motor_output_write(mo, stop);
+}
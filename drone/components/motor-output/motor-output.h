@@ -0,0 +1,77 @@
+#ifndef __MOTOR_OUTPUT_H_
+#define __MOTOR_OUTPUT_H_
+
+#include <inttypes.h>
+
+#include "driver/gpio.h"
+#include "driver/ledc.h"
+#include "driver/rmt_tx.h"
+#include "esp_err.h"
+
+#include "dshot.h"
+
+
+#define MOTOR_OUTPUT_NUM_MOTORS 4
+
+/* The LEDC timer and channels used for PWM output. Channel i drives motor i */
+#define MOTOR_OUTPUT_LEDC_MODE LEDC_HIGH_SPEED_MODE
+#define MOTOR_OUTPUT_LEDC_TIMER LEDC_TIMER_0
+#define MOTOR_OUTPUT_LEDC_FIRST_CHANNEL LEDC_CHANNEL_0
+/* At 16 bits the LEDC can go up to ~1.2kHz off the 80MHz APB clock, which
+ * gives ~0.04us steps at 400Hz */
+#define MOTOR_OUTPUT_LEDC_RESOLUTION LEDC_TIMER_16_BIT
+#define MOTOR_OUTPUT_LEDC_DUTY_MAX ((1 << 16) - 1)
+
+/* How long 'motor_output_write()' waits for the previous DShot frames to go
+ * out before giving up. A frame takes ~27us */
+#define MOTOR_OUTPUT_DSHOT_WAIT_MS 1
+
+
+enum motor_protocol {
+    /* Standard servo style PWM, a 'pwm_min_us' to 'pwm_max_us' pulse every
+     * 1 / 'pwm_frequency_hz' seconds, generated by the LEDC */
+    MOTOR_PROTOCOL_PWM,
+    /* Digital DShot600 frames, generated by the RMT */
+    MOTOR_PROTOCOL_DSHOT600,
+};
+
+struct motor_output_config {
+    enum motor_protocol protocol;
+    /* The pin driving each motor's ESC, indexed like the motor commands */
+    gpio_num_t pins[MOTOR_OUTPUT_NUM_MOTORS];
+    /* Only used with MOTOR_PROTOCOL_PWM */
+    uint32_t pwm_frequency_hz;
+    uint16_t pwm_min_us;
+    uint16_t pwm_max_us;
+};
+
+struct motor_output {
+    struct motor_output_config config;
+    /* MOTOR_PROTOCOL_DSHOT600 only. One RMT channel and encoder per motor,
+     * with a sync manager so that all four frames start together on chips
+     * with SOC_RMT_SUPPORT_TX_SYNCHRO (NULL elsewhere) */
+    rmt_channel_handle_t rmt_channels[MOTOR_OUTPUT_NUM_MOTORS];
+    rmt_encoder_handle_t rmt_encoders[MOTOR_OUTPUT_NUM_MOTORS];
+    rmt_sync_manager_handle_t rmt_sync;
+    /* The frames being sent, big endian. They have to stay put until the RMT
+     * is done with them */
+    uint8_t dshot_frames[MOTOR_OUTPUT_NUM_MOTORS][2];
+    /* The number of writes where the previous frames had not gone out yet */
+    uint32_t dshot_busy;
+};
+
+
+/* The two protocols, on the drone's motor pins */
+extern const struct motor_output_config motor_output_pwm_400hz;
+extern const struct motor_output_config motor_output_dshot600;
+
+
+esp_err_t motor_output_begin(struct motor_output *mo, \
+    const struct motor_output_config *config);
+
+esp_err_t motor_output_write(struct motor_output *mo, const float *command);
+
+esp_err_t motor_output_stop(struct motor_output *mo);
+
+
+#endif
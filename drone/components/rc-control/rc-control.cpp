@@ -0,0 +1,82 @@
+#include <string.h>
+
+#include "rc-control.h"
+
+
+/** Starts 'rc' disarmed, with the arm switch not yet seen off. */
+void rc_control_init(struct rc_control *rc) {
+    memset(rc, 0, sizeof(*rc));
+    rc->state = RC_CONTROL_DISARMED;
+}
+
+
+/** Works out 'setpoint' from the remote's latest command, 'command', which
+ * arrived at 'received_us' (0 if none has yet), arming, disarming and failing
+ * safe as need be. 'now_us' is the time now, on the same clock. 'can_arm'
+ * is false while anything else that gets in the way of flying is going on,
+ * and only stops the drone arming, not one that already is. 'setpoint' has
+ * to be the one returned last time, since a failsafe starts from its
+ * throttle.
+ *
+ * The link counts as lost if the command is older than
+ * RC_FAILSAFE_TIMEOUT_MS, or the remote flagged it failsafe. A drone that
+ * loses the link while armed levels out and sinks (RC_CONTROL_FAILSAFE), and
+ * the pilot gets it back as soon as the link does. If the link is not back
+ * within RC_FAILSAFE_LAND_MS, it disarms. */
+void rc_control_update(struct rc_control *rc, const struct rc_link_command *command, \
+    int64_t received_us, int64_t now_us, bool can_arm, \
+    struct flight_controller_setpoint *setpoint) {
+
+    bool link_ok = received_us != 0 && now_us - received_us <= RC_FAILSAFE_TIMEOUT_MS * 1000 \
+        && !(command->flags & RC_LINK_FLAG_FAILSAFE);
+    bool arm_switch = link_ok && (command->flags & RC_LINK_FLAG_ARMED);
+
+    if (link_ok && !arm_switch) {
+        rc->arm_switch_seen_off = true;
+    }
+
+    uint32_t state = rc->state;
+    switch (state) {
+        case RC_CONTROL_DISARMED:
+            if (arm_switch && rc->arm_switch_seen_off \
+                && command->throttle < RC_ARM_THROTTLE_MAX && can_arm) {
+
+                state = RC_CONTROL_ARMED;
+            }
+            break;
+        case RC_CONTROL_ARMED:
+            if (!link_ok) {
+                state = RC_CONTROL_FAILSAFE;
+                rc->failsafe_since_us = now_us;
+                rc->failsafe_throttle = setpoint->throttle * RC_FAILSAFE_THROTTLE_SCALE;
+                __atomic_store_n(&rc->failsafes, rc->failsafes + 1, __ATOMIC_RELAXED);
+            } else if (!arm_switch) {
+                state = RC_CONTROL_DISARMED;
+            }
+            break;
+        case RC_CONTROL_FAILSAFE:
+            if (link_ok) {
+                state = arm_switch ? RC_CONTROL_ARMED : RC_CONTROL_DISARMED;
+            } else if (now_us - rc->failsafe_since_us > RC_FAILSAFE_LAND_MS * 1000) {
+                state = RC_CONTROL_DISARMED;
+            }
+            break;
+    }
+    if (state == RC_CONTROL_DISARMED && rc->state != RC_CONTROL_DISARMED) {
+        rc->arm_switch_seen_off = false;
+    }
+    __atomic_store_n(&rc->state, state, __ATOMIC_RELAXED);
+
+    if (state == RC_CONTROL_ARMED) {
+        setpoint->roll = command->roll * RC_MAX_ANGLE_RAD;
+        setpoint->pitch = command->pitch * RC_MAX_ANGLE_RAD;
+        setpoint->yaw_rate = command->yaw * RC_MAX_YAW_RATE_RAD_S;
+        setpoint->throttle = command->throttle;
+    } else {
+        setpoint->roll = 0.0f;
+        setpoint->pitch = 0.0f;
+        setpoint->yaw_rate = 0.0f;
+        setpoint->throttle = (state == RC_CONTROL_FAILSAFE) ? rc->failsafe_throttle : 0.0f;
+    }
+    setpoint->armed = (state != RC_CONTROL_DISARMED);
+}
@@ -0,0 +1,67 @@
+#ifndef __RC_CONTROL_H_
+#define __RC_CONTROL_H_
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "rc-link.h"
+#include "flight-controller.h"
+
+/* What the drone does with the remote's commands: when it arms and disarms,
+ * what it flies while armed and how it fails safe when the link is lost.
+ *
+ * Only the state machine is in here. Where the commands come from and when
+ * is up to the caller, which hands every update the latest command and the
+ * time it arrived. Only the drone flies this, so it is kept out of the rc-link
+ * component, which the remote control builds too. */
+
+
+/* How the remote's sticks map onto the setpoint: full roll or pitch stick
+ * asks for this much tilt (30 degrees), and full yaw stick for this fast a
+ * turn (200 degrees/s) */
+#define RC_MAX_ANGLE_RAD 0.5236f
+#define RC_MAX_YAW_RATE_RAD_S 3.491f
+/* The throttle stick has to be below this for the drone to arm */
+#define RC_ARM_THROTTLE_MAX 0.05f
+/* A command older than this means the link is lost: 20 frame periods */
+#define RC_FAILSAFE_TIMEOUT_MS 100
+/* Once the link is lost, the drone levels out with its throttle at this
+ * fraction of the last command's, so that it sinks rather than climbs or
+ * drops, and disarms after this long unless the link comes back */
+#define RC_FAILSAFE_THROTTLE_SCALE 0.85f
+#define RC_FAILSAFE_LAND_MS 2000
+
+
+/* The drone only arms from RC_CONTROL_DISARMED, and only once the arm switch
+ * has been seen off since it last disarmed, so it never arms straight off the
+ * back of a boot or a failsafe with the switch left on */
+enum rc_control_state {
+    RC_CONTROL_DISARMED,
+    /* Flying the remote's commands */
+    RC_CONTROL_ARMED,
+    /* Armed, but the link was lost, so levelling out and sinking until it
+     * comes back or RC_FAILSAFE_LAND_MS is up */
+    RC_CONTROL_FAILSAFE,
+};
+
+struct rc_control {
+    /* An enum rc_control_state, and the number of times the link was lost
+     * while armed. Only 'rc_control_update()' writes these, atomically, so
+     * other tasks can read them with __atomic_load_n() */
+    uint32_t state;
+    uint32_t failsafes;
+    bool arm_switch_seen_off;
+    /* When the current failsafe started, and the throttle it is flying */
+    int64_t failsafe_since_us;
+    float failsafe_throttle;
+};
+
+
+void rc_control_init(struct rc_control *rc);
+
+void rc_control_update(struct rc_control *rc, const struct rc_link_command *command, \
+    int64_t received_us, int64_t now_us, bool can_arm, \
+    struct flight_controller_setpoint *setpoint);
+
+
+#endif
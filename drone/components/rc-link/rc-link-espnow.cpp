@@ -0,0 +1,284 @@
+#include <string.h>
+
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "esp_now.h"
+#include "esp_wifi.h"
+#include "nvs.h"
+
+#include "rc-link.h"
+#include "rc-link-espnow.h"
+
+
+enum rc_link_espnow_pair_type {
+    /* Sent by a remote that wants to be paired */
+    RC_LINK_ESPNOW_PAIR_REQUEST,
+    /* Sent by a drone that has paired with the remote whose address follows */
+    RC_LINK_ESPNOW_PAIR_ACK,
+};
+
+#define RC_LINK_ESPNOW_PAIR_REQUEST_LEN 3
+#define RC_LINK_ESPNOW_PAIR_ACK_LEN (3 + ESP_NOW_ETH_ALEN)
+
+static const uint8_t rc_link_espnow_broadcast[ESP_NOW_ETH_ALEN] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+static const uint8_t rc_link_espnow_no_peer[ESP_NOW_ETH_ALEN] = {};
+
+/* ESP-NOW's callbacks take no argument, so there can only be one link */
+static struct rc_link_espnow *rc_link_espnow_instance;
+
+
+/* Adds 'mac' as an ESP-NOW peer, encrypted unless it is the broadcast
+ * address */
+static esp_err_t rc_link_espnow_add_peer(const uint8_t *mac) {
+    esp_now_peer_info_t peer;
+    memset(&peer, 0, sizeof(peer));
+    memcpy(peer.peer_addr, mac, ESP_NOW_ETH_ALEN);
+    peer.channel = RC_LINK_ESPNOW_CHANNEL;
+    peer.ifidx = WIFI_IF_STA;
+    peer.encrypt = memcmp(mac, rc_link_espnow_broadcast, ESP_NOW_ETH_ALEN) != 0;
+    if (peer.encrypt) {
+        memcpy(peer.lmk, RC_LINK_ESPNOW_LMK, ESP_NOW_KEY_LEN);
+    }
+
+    if (esp_now_is_peer_exist(mac)) {
+        return esp_now_mod_peer(&peer);
+    }
+    return esp_now_add_peer(&peer);
+}
+
+
+/* Makes 'mac' the peer, forgetting the old one. This runs in the Wi-Fi task,
+ * which must not wait on the flash, so the peer is only marked to be stored,
+ * see 'rc_link_espnow_save_peer()' */
+static esp_err_t rc_link_espnow_set_peer(struct rc_link_espnow *link, const uint8_t *mac) {
+    /* A remote that is pairing again has already stopped sending to its old
+     * peer */
+    if (memcmp(link->peer, rc_link_espnow_no_peer, ESP_NOW_ETH_ALEN) != 0 \
+        && memcmp(link->peer, mac, ESP_NOW_ETH_ALEN) != 0) {
+        esp_now_del_peer(link->peer);
+    }
+    esp_err_t err = rc_link_espnow_add_peer(mac);
+    if (err != ESP_OK) {
+        return err;
+    }
+    memcpy(link->peer, mac, ESP_NOW_ETH_ALEN);
+    __atomic_store_n(&link->peer_unsaved, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&link->paired, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&link->pairing, 0, __ATOMIC_RELEASE);
+
+    return ESP_OK;
+}
+
+
+/* Loads the peer stored by 'rc_link_espnow_save_peer()', if there is one */
+static esp_err_t rc_link_espnow_load_peer(struct rc_link_espnow *link) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(RC_LINK_ESPNOW_NVS_NAMESPACE, NVS_READONLY, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    uint8_t mac[ESP_NOW_ETH_ALEN];
+    size_t length = sizeof(mac);
+    err = nvs_get_blob(handle, RC_LINK_ESPNOW_NVS_PEER_KEY, mac, &length);
+    nvs_close(handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    if ((err = rc_link_espnow_add_peer(mac)) != ESP_OK) {
+        return err;
+    }
+    memcpy(link->peer, mac, ESP_NOW_ETH_ALEN);
+    __atomic_store_n(&link->paired, 1, __ATOMIC_RELEASE);
+
+    return ESP_OK;
+}
+
+
+/* Answers a pairing request from 'mac' with a broadcast acknowledgement
+ * naming it */
+static void rc_link_espnow_send_ack(const uint8_t *mac) {
+    uint8_t ack[RC_LINK_ESPNOW_PAIR_ACK_LEN] = {
+        RC_LINK_ESPNOW_PAIR_SYNC, RC_LINK_VERSION, RC_LINK_ESPNOW_PAIR_ACK
+    };
+    memcpy(&ack[3], mac, ESP_NOW_ETH_ALEN);
+    esp_now_send(rc_link_espnow_broadcast, ack, sizeof(ack));
+}
+
+
+/* Handles a pairing message from 'mac' */
+static void rc_link_espnow_receive_pairing(struct rc_link_espnow *link, const uint8_t *mac, \
+    const uint8_t *data, int len) {
+
+    bool from_peer = rc_link_espnow_paired(link) \
+        && memcmp(mac, link->peer, ESP_NOW_ETH_ALEN) == 0;
+
+    if (link->role == RC_LINK_ESPNOW_DRONE && len == RC_LINK_ESPNOW_PAIR_REQUEST_LEN \
+        && data[2] == RC_LINK_ESPNOW_PAIR_REQUEST) {
+
+        /* The peer asking again means it never got the acknowledgement, so
+         * it gets another one whether or not this end is still pairing */
+        if (rc_link_espnow_pairing(link)) {
+            rc_link_espnow_set_peer(link, mac);
+            rc_link_espnow_send_ack(mac);
+        } else if (from_peer) {
+            rc_link_espnow_send_ack(mac);
+        } else {
+            link->ignored++;
+        }
+    } else if (link->role == RC_LINK_ESPNOW_REMOTE && len == RC_LINK_ESPNOW_PAIR_ACK_LEN \
+        && data[2] == RC_LINK_ESPNOW_PAIR_ACK && rc_link_espnow_pairing(link)) {
+
+        uint8_t own_mac[ESP_NOW_ETH_ALEN];
+        esp_wifi_get_mac(WIFI_IF_STA, own_mac);
+        if (memcmp(&data[3], own_mac, ESP_NOW_ETH_ALEN) == 0) {
+            rc_link_espnow_set_peer(link, mac);
+        }
+    } else {
+        link->ignored++;
+    }
+}
+
+
+static void rc_link_espnow_receive_cb(const esp_now_recv_info_t *info, const uint8_t *data, \
+    int len) {
+
+    struct rc_link_espnow *link = rc_link_espnow_instance;
+    if (len >= 3 && data[0] == RC_LINK_ESPNOW_PAIR_SYNC && data[1] == RC_LINK_VERSION) {
+        rc_link_espnow_receive_pairing(link, info->src_addr, data, len);
+    } else if (rc_link_espnow_paired(link) \
+        && memcmp(info->src_addr, link->peer, ESP_NOW_ETH_ALEN) == 0) {
+        link->on_receive(data, (size_t) len, link->arg);
+    } else {
+        link->ignored++;
+    }
+}
+
+
+static void rc_link_espnow_send_cb(const uint8_t *mac, esp_now_send_status_t status) {
+    struct rc_link_espnow *link = rc_link_espnow_instance;
+    /* Only sends to the peer are acknowledged, so only they can fail */
+    if (status != ESP_NOW_SEND_SUCCESS) {
+        link->send_failures++;
+    }
+}
+
+
+/** Brings up Wi-Fi and ESP-NOW for 'link', as the 'role' end of it, and
+ * loads the peer it was last paired with. 'on_receive' is called with every
+ * message from the peer. Wi-Fi is started in station mode without
+ * connecting to anything and with power saving off, so the radio is always
+ * listening. NVS must have been initialised with 'nvs_flash_init()', and
+ * there can only be one link. */
+esp_err_t rc_link_espnow_begin(struct rc_link_espnow *link, enum rc_link_espnow_role role, \
+    rc_link_espnow_receive_cb_t on_receive, void *arg) {
+
+    memset(link, 0, sizeof(*link));
+    link->role = role;
+    link->on_receive = on_receive;
+    link->arg = arg;
+    rc_link_espnow_instance = link;
+
+    esp_err_t err = esp_netif_init();
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = esp_event_loop_create_default();
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        return err;
+    }
+
+    wifi_init_config_t wifi_config = WIFI_INIT_CONFIG_DEFAULT();
+    if ((err = esp_wifi_init(&wifi_config)) != ESP_OK \
+        || (err = esp_wifi_set_storage(WIFI_STORAGE_RAM)) != ESP_OK \
+        || (err = esp_wifi_set_mode(WIFI_MODE_STA)) != ESP_OK \
+        || (err = esp_wifi_start()) != ESP_OK \
+        || (err = esp_wifi_set_ps(WIFI_PS_NONE)) != ESP_OK \
+        || (err = esp_wifi_set_channel(RC_LINK_ESPNOW_CHANNEL, WIFI_SECOND_CHAN_NONE)) != ESP_OK) {
+        return err;
+    }
+
+    if ((err = esp_now_init()) != ESP_OK \
+        || (err = esp_now_register_recv_cb(rc_link_espnow_receive_cb)) != ESP_OK \
+        || (err = esp_now_register_send_cb(rc_link_espnow_send_cb)) != ESP_OK \
+        || (err = esp_now_set_pmk((const uint8_t *) RC_LINK_ESPNOW_PMK)) != ESP_OK \
+        || (err = rc_link_espnow_add_peer(rc_link_espnow_broadcast)) != ESP_OK) {
+        return err;
+    }
+
+    err = rc_link_espnow_load_peer(link);
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+        return err;
+    }
+
+    return ESP_OK;
+}
+
+
+/** Puts 'link' into pairing mode until it pairs, or until
+ * 'rc_link_espnow_stop_pairing()'. A drone pairs with the first remote that
+ * asks. A remote has to ask with 'rc_link_espnow_request_pairing()', and
+ * stops sending frames to its old peer straight away. */
+void rc_link_espnow_start_pairing(struct rc_link_espnow *link) {
+    if (link->role == RC_LINK_ESPNOW_REMOTE) {
+        __atomic_store_n(&link->paired, 0, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&link->pairing, 1, __ATOMIC_RELEASE);
+}
+
+
+void rc_link_espnow_stop_pairing(struct rc_link_espnow *link) {
+    __atomic_store_n(&link->pairing, 0, __ATOMIC_RELEASE);
+}
+
+
+/** Stores the peer in NVS if it has changed since it was last stored, so
+ * that the link comes back up paired with it. Pairing only changes the peer
+ * in memory, since it happens in the Wi-Fi task, so this has to be called
+ * every so often from a task that can wait on the flash. */
+esp_err_t rc_link_espnow_save_peer(struct rc_link_espnow *link) {
+    if (!__atomic_exchange_n(&link->peer_unsaved, 0, __ATOMIC_ACQ_REL)) {
+        return ESP_OK;
+    }
+    /* If the peer changes again while it is being copied, it is marked
+     * unsaved again, and the next call stores the new one */
+    uint8_t mac[ESP_NOW_ETH_ALEN];
+    memcpy(mac, link->peer, ESP_NOW_ETH_ALEN);
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(RC_LINK_ESPNOW_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_blob(handle, RC_LINK_ESPNOW_NVS_PEER_KEY, mac, ESP_NOW_ETH_ALEN);
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+
+    return err;
+}
+
+
+/** Broadcasts a request to be paired. A remote in pairing mode should send
+ * one every so often until it is paired. */
+esp_err_t rc_link_espnow_request_pairing(struct rc_link_espnow *link) {
+    const uint8_t request[RC_LINK_ESPNOW_PAIR_REQUEST_LEN] = {
+        RC_LINK_ESPNOW_PAIR_SYNC, RC_LINK_VERSION, RC_LINK_ESPNOW_PAIR_REQUEST
+    };
+    return esp_now_send(rc_link_espnow_broadcast, request, sizeof(request));
+}
+
+
+/** Sends the 'len' bytes at 'data' to the peer. ESP-NOW copies them before
+ * this returns, and whether they arrived is only known later, so this never
+ * blocks. Returns ESP_ERR_INVALID_STATE if there is no peer. */
+esp_err_t rc_link_espnow_send(struct rc_link_espnow *link, const uint8_t *data, size_t len) {
+    if (!rc_link_espnow_paired(link)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return esp_now_send(link->peer, data, len);
+}
@@ -0,0 +1,107 @@
+#ifndef __RC_LINK_ESPNOW_H_
+#define __RC_LINK_ESPNOW_H_
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+#include "esp_now.h"
+
+#include "rc-link.h"
+
+/* Carries rc-link frames over ESP-NOW: connectionless, a few hundred
+ * microseconds from one end to the other, and without the Bluetooth stack's
+ * RAM.
+ *
+ * The remote and the drone only talk to the one peer they were paired with,
+ * and encrypt everything they send it. Pairing just tells each end the other's
+ * MAC address. The remote broadcasts pairing requests, and a drone that has
+ * been put into pairing mode answers the first one with a broadcast
+ * acknowledgement naming that remote. Each end then stores the other's
+ * address in NVS (from its own task, with 'rc_link_espnow_save_peer()'), so
+ * pairing only has to be done once.
+ *
+ * The keys are built into both firmwares (see RC_LINK_ESPNOW_PMK and
+ * RC_LINK_ESPNOW_LMK), so change them before flying anywhere someone else
+ * might be building this project. */
+
+
+/* The Wi-Fi channel both ends sit on */
+#define RC_LINK_ESPNOW_CHANNEL 1
+/* The primary key, which encrypts the local keys, and the local key, which
+ * encrypts the frames. Both exactly ESP_NOW_KEY_LEN (16) bytes */
+#define RC_LINK_ESPNOW_PMK "rc-link pmk 0001"
+#define RC_LINK_ESPNOW_LMK "rc-link lmk 0001"
+
+/* Where the peer's address is stored */
+#define RC_LINK_ESPNOW_NVS_NAMESPACE "rc-link"
+#define RC_LINK_ESPNOW_NVS_PEER_KEY "peer"
+
+/* The first byte of a pairing message, which tells it apart from an rc-link
+ * frame */
+#define RC_LINK_ESPNOW_PAIR_SYNC 0xC6
+
+
+enum rc_link_espnow_role {
+    /* Sends frames, and asks to be paired */
+    RC_LINK_ESPNOW_REMOTE,
+    /* Receives frames, and answers requests to be paired */
+    RC_LINK_ESPNOW_DRONE,
+};
+
+/* Called from the Wi-Fi task with each message from the paired peer that is
+ * not a pairing message, which should be an rc-link frame. Must not block */
+typedef void (*rc_link_espnow_receive_cb_t)(const uint8_t *data, size_t len, void *arg);
+
+struct rc_link_espnow {
+    enum rc_link_espnow_role role;
+    rc_link_espnow_receive_cb_t on_receive;
+    void *arg;
+
+    /* The paired peer's address, all zeros until there is one, and only
+     * used once 'paired' is set. Only changed by the Wi-Fi task while
+     * pairing */
+    uint8_t peer[ESP_NOW_ETH_ALEN];
+    uint32_t paired;
+    /* Set by the Wi-Fi task when it pairs, cleared once the new peer has
+     * been stored, see 'rc_link_espnow_save_peer()' */
+    uint32_t peer_unsaved;
+    /* Set by 'rc_link_espnow_start_pairing()', cleared once paired */
+    uint32_t pairing;
+
+    /* Counters, written by the Wi-Fi task */
+    /* Sends that were never acknowledged by the peer */
+    uint32_t send_failures;
+    /* Messages from anyone but the peer */
+    uint32_t ignored;
+};
+
+
+esp_err_t rc_link_espnow_begin(struct rc_link_espnow *link, enum rc_link_espnow_role role, \
+    rc_link_espnow_receive_cb_t on_receive, void *arg);
+
+void rc_link_espnow_start_pairing(struct rc_link_espnow *link);
+
+void rc_link_espnow_stop_pairing(struct rc_link_espnow *link);
+
+esp_err_t rc_link_espnow_save_peer(struct rc_link_espnow *link);
+
+esp_err_t rc_link_espnow_request_pairing(struct rc_link_espnow *link);
+
+esp_err_t rc_link_espnow_send(struct rc_link_espnow *link, const uint8_t *data, size_t len);
+
+
+/** Whether 'link' has a peer to send frames to. */
+static inline bool rc_link_espnow_paired(const struct rc_link_espnow *link) {
+    return __atomic_load_n(&link->paired, __ATOMIC_ACQUIRE);
+}
+
+
+/** Whether 'link' is waiting to be paired. */
+static inline bool rc_link_espnow_pairing(const struct rc_link_espnow *link) {
+    return __atomic_load_n(&link->pairing, __ATOMIC_ACQUIRE);
+}
+
+
+#endif
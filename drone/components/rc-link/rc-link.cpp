@@ -0,0 +1,130 @@
+#include <math.h>
+#include <string.h>
+
+#include "rc-link.h"
+
+
+/* A sequence number gap bigger than this is taken as the remote having
+ * restarted (or the link having been down for minutes) rather than as that
+ * many lost frames, and the receiver starts counting from the new one */
+#define RC_LINK_MAX_SEQUENCE_GAP 0x4000
+/* This many stale frames in a row is taken as the remote having restarted
+ * with a lower sequence number, rather than as a run of late frames */
+#define RC_LINK_MAX_STALE_RUN 8
+
+
+/* CRC-16/CCITT-FALSE: polynomial 0x1021, starting from 0xFFFF */
+static uint16_t rc_link_crc16(const uint8_t *data, size_t len) {
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t) data[i] << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (uint16_t) ((crc << 1) ^ 0x1021) : (uint16_t) (crc << 1);
+        }
+    }
+    return crc;
+}
+
+
+static void rc_link_put_u16(uint8_t *out, uint16_t value) {
+    out[0] = (uint8_t) value;
+    out[1] = (uint8_t) (value >> 8);
+}
+
+
+static uint16_t rc_link_get_u16(const uint8_t *in) {
+    return (uint16_t) (in[0] | (in[1] << 8));
+}
+
+
+/* Scales 'value', clamped to 'min' to 1, to a stick channel */
+static int16_t rc_link_stick_to_channel(float value, float min) {
+    if (!(value >= min)) value = min;
+    if (value > 1.0f) value = 1.0f;
+    return (int16_t) lroundf(value * RC_LINK_STICK_MAX);
+}
+
+
+static float rc_link_channel_to_stick(int16_t channel, float min) {
+    float value = channel / (float) RC_LINK_STICK_MAX;
+    if (value < min) value = min;
+    return value;
+}
+
+
+/** Codes 'command' into the RC_LINK_FRAME_LEN bytes at 'out', as the frame
+ * with sequence number 'sequence'. Sticks outside their range are clamped to
+ * it. */
+void rc_link_encode(const struct rc_link_command *command, uint16_t sequence, uint8_t *out) {
+    out[0] = RC_LINK_SYNC;
+    out[1] = RC_LINK_VERSION;
+    rc_link_put_u16(&out[2], sequence);
+    out[4] = command->flags;
+    rc_link_put_u16(&out[5], (uint16_t) rc_link_stick_to_channel(command->roll, -1.0f));
+    rc_link_put_u16(&out[7], (uint16_t) rc_link_stick_to_channel(command->pitch, -1.0f));
+    rc_link_put_u16(&out[9], (uint16_t) rc_link_stick_to_channel(command->yaw, -1.0f));
+    rc_link_put_u16(&out[11], (uint16_t) rc_link_stick_to_channel(command->throttle, 0.0f));
+    rc_link_put_u16(&out[13], rc_link_crc16(out, RC_LINK_FRAME_LEN - 2));
+}
+
+
+/** Decodes the 'len' byte frame at 'in' into 'command' and 'sequence'.
+ * Returns RC_LINK_CORRUPT, and leaves both alone, if it is not a valid
+ * frame. */
+enum rc_link_result rc_link_decode(const uint8_t *in, size_t len, \
+    struct rc_link_command *command, uint16_t *sequence) {
+
+    if (len != RC_LINK_FRAME_LEN || in[0] != RC_LINK_SYNC || in[1] != RC_LINK_VERSION \
+        || rc_link_get_u16(&in[13]) != rc_link_crc16(in, RC_LINK_FRAME_LEN - 2)) {
+        return RC_LINK_CORRUPT;
+    }
+
+    *sequence = rc_link_get_u16(&in[2]);
+    command->flags = in[4];
+    command->roll = rc_link_channel_to_stick((int16_t) rc_link_get_u16(&in[5]), -1.0f);
+    command->pitch = rc_link_channel_to_stick((int16_t) rc_link_get_u16(&in[7]), -1.0f);
+    command->yaw = rc_link_channel_to_stick((int16_t) rc_link_get_u16(&in[9]), -1.0f);
+    command->throttle = rc_link_channel_to_stick((int16_t) rc_link_get_u16(&in[11]), 0.0f);
+    return RC_LINK_OK;
+}
+
+
+void rc_link_receiver_init(struct rc_link_receiver *rx) {
+    memset(rx, 0, sizeof(*rx));
+}
+
+
+/** Decodes the 'len' byte frame at 'in' into 'command' if it is valid and
+ * newer than every frame 'rx' has accepted so far, and counts it in 'rx'.
+ * 'command' is only written to if RC_LINK_OK is returned. */
+enum rc_link_result rc_link_receive(struct rc_link_receiver *rx, const uint8_t *in, \
+    size_t len, struct rc_link_command *command) {
+
+    struct rc_link_command decoded;
+    uint16_t sequence;
+    if (rc_link_decode(in, len, &decoded, &sequence) != RC_LINK_OK) {
+        rx->corrupt++;
+        return RC_LINK_CORRUPT;
+    }
+
+    if (rx->synced) {
+        /* How far ahead of the last accepted frame this one is, wrapping
+         * around */
+        uint16_t ahead = (uint16_t) (sequence - rx->sequence);
+        if ((ahead == 0 || ahead >= (uint16_t) -RC_LINK_MAX_SEQUENCE_GAP) \
+            && ++rx->stale_run < RC_LINK_MAX_STALE_RUN) {
+            rx->stale++;
+            return RC_LINK_STALE;
+        }
+        if (ahead != 0 && ahead <= RC_LINK_MAX_SEQUENCE_GAP) {
+            rx->lost += ahead - 1;
+        }
+    }
+
+    rx->synced = true;
+    rx->sequence = sequence;
+    rx->stale_run = 0;
+    rx->frames++;
+    *command = decoded;
+    return RC_LINK_OK;
+}
@@ -0,0 +1,100 @@
+#ifndef __RC_LINK_H_
+#define __RC_LINK_H_
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* The protocol the remote control and the drone talk over whatever link
+ * carries it. The remote sends one frame every RC_LINK_PERIOD_US, each one a
+ * complete, absolute snapshot of its sticks and switches, so a frame that
+ * never arrives is simply superseded by the next one and nothing ever needs
+ * resending or acknowledging.
+ *
+ * A frame is RC_LINK_FRAME_LEN bytes, little endian:
+ *
+ *   0      RC_LINK_SYNC
+ *   1      RC_LINK_VERSION
+ *   2-3    sequence number, one more than the previous frame's
+ *   4      flags (RC_LINK_FLAG_*)
+ *   5-12   roll, pitch, yaw and throttle sticks, as int16_t
+ *   13-14  CRC-16/CCITT of bytes 0-12
+ *
+ * The sequence number lets the receiver throw away frames that arrive late
+ * or twice, and count the ones that never arrived.
+ *
+ * Both ends of the link share this header, the remote control as well as the
+ * drone. */
+
+
+#define RC_LINK_SYNC 0xC5
+/* Bumped whenever the frame layout changes */
+#define RC_LINK_VERSION 1
+#define RC_LINK_FRAME_LEN 15
+
+/* How often the remote sends a frame: 200Hz */
+#define RC_LINK_PERIOD_US 5000
+
+/* The stick channels are sent as int16_t with this as full scale, so
+ * -RC_LINK_STICK_MAX to RC_LINK_STICK_MAX for roll, pitch and yaw, and 0 to
+ * RC_LINK_STICK_MAX for throttle */
+#define RC_LINK_STICK_MAX 32767
+
+/* The pilot wants the motors armed */
+#define RC_LINK_FLAG_ARMED (1 << 0)
+/* The remote cannot vouch for its sticks (reading them failed), so the drone
+ * should treat the frame the same as a lost link */
+#define RC_LINK_FLAG_FAILSAFE (1 << 1)
+
+
+/* One command from the remote */
+struct rc_link_command {
+    /* -1 to 1, positive rolling right, pitching nose up and yawing
+     * clockwise seen from above */
+    float roll;
+    float pitch;
+    float yaw;
+    /* 0 to 1 */
+    float throttle;
+    uint8_t flags;
+};
+
+/* Keeps track of the frames coming in over a link */
+struct rc_link_receiver {
+    /* Whether 'sequence' holds the sequence number of a frame yet */
+    bool synced;
+    uint16_t sequence;
+    /* Stale frames since the last one accepted */
+    uint32_t stale_run;
+
+    /* Frames accepted */
+    uint32_t frames;
+    /* Frames the sequence numbers say were sent but never arrived */
+    uint32_t lost;
+    /* Frames that arrived after a newer one, or more than once */
+    uint32_t stale;
+    /* Frames that were the wrong length, version or failed their CRC */
+    uint32_t corrupt;
+};
+
+enum rc_link_result {
+    RC_LINK_OK,
+    /* The frame is not a valid frame */
+    RC_LINK_CORRUPT,
+    /* The frame is valid, but older than one already accepted */
+    RC_LINK_STALE,
+};
+
+
+void rc_link_encode(const struct rc_link_command *command, uint16_t sequence, uint8_t *out);
+
+enum rc_link_result rc_link_decode(const uint8_t *in, size_t len, \
+    struct rc_link_command *command, uint16_t *sequence);
+
+void rc_link_receiver_init(struct rc_link_receiver *rx);
+
+enum rc_link_result rc_link_receive(struct rc_link_receiver *rx, const uint8_t *in, \
+    size_t len, struct rc_link_command *command);
+
+
+#endif
@@ -0,0 +1,190 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "scheduler.h"
+
+
+/* Releases a job. Runs in the esp_timer task, so it must not block */
+static void scheduler_release(void *arg) {
+    struct scheduler_job *job = (struct scheduler_job *) arg;
+    xTaskNotifyGive(job->task);
+}
+
+
+static void scheduler_job_task(void *arg) {
+    struct scheduler_job *job = (struct scheduler_job *) arg;
+    const struct scheduler_job_config *config = &job->config;
+
+    if (config->begin != NULL) {
+        config->begin(config->arg);
+    }
+    /* The timer's alarms fall at whole periods from when it is started, so
+     * every release time can be worked out from the first */
+    job->first_release_us = esp_timer_get_time() + config->period_us;
+    ESP_ERROR_CHECK(esp_timer_start_periodic(job->timer, config->period_us));
+
+    while (1) {
+        uint32_t released = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        job->releases += released;
+        if (released > 1) {
+            __atomic_store_n(&job->stats.skipped, job->stats.skipped + released - 1, \
+                __ATOMIC_RELAXED);
+        }
+        int64_t release_us = job->first_release_us \
+            + (int64_t) (job->releases - 1) * config->period_us;
+
+        config->run(config->arg);
+
+        uint32_t response_us = (uint32_t) (esp_timer_get_time() - release_us);
+        __atomic_store_n(&job->stats.runs, job->stats.runs + 1, __ATOMIC_RELAXED);
+        if (response_us > config->period_us) {
+            __atomic_store_n(&job->stats.misses, job->stats.misses + 1, __ATOMIC_RELAXED);
+        }
+        if (response_us > job->stats.max_response_us) {
+            __atomic_store_n(&job->stats.max_response_us, response_us, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+
+/* Returns how many distinct periods in 's' are shorter than 'period_us' */
+static UBaseType_t scheduler_rank(const struct scheduler *s, uint32_t period_us) {
+    UBaseType_t rank = 0;
+    for (int i = 0; i < s->num_jobs; i++) {
+        uint32_t other_us = s->jobs[i].config.period_us;
+        if (other_us >= period_us) {
+            continue;
+        }
+        /* Each period is only counted at the first job that has it */
+        bool first = true;
+        for (int j = 0; j < i; j++) {
+            first = first && s->jobs[j].config.period_us != other_us;
+        }
+        if (first) {
+            rank++;
+        }
+    }
+    return rank;
+}
+
+
+/** Gets 's' ready to have jobs added to it. The jobs are given priorities
+ * from 'lowest_priority' up to 'highest_priority', which should be below
+ * anything that must never wait for them. */
+void scheduler_init(struct scheduler *s, UBaseType_t lowest_priority, \
+    UBaseType_t highest_priority) {
+
+    memset(s, 0, sizeof(*s));
+    s->lowest_priority = lowest_priority;
+    s->highest_priority = highest_priority;
+}
+
+
+/** Adds a job to 's', to be started by 'scheduler_start()'. Returns
+ * ESP_ERR_NO_MEM if 's' already has SCHEDULER_MAX_JOBS jobs,
+ * ESP_ERR_INVALID_STATE if it has already been started, and
+ * ESP_ERR_INVALID_ARG if the job has no period, 'run()' or stack. */
+esp_err_t scheduler_add(struct scheduler *s, const struct scheduler_job_config *config) {
+    if (s->started) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (s->num_jobs == SCHEDULER_MAX_JOBS) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (config->period_us == 0 || config->run == NULL || config->stack == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    struct scheduler_job *job = &s->jobs[s->num_jobs];
+    memset(job, 0, sizeof(*job));
+    job->config = *config;
+    s->num_jobs++;
+
+    return ESP_OK;
+}
+
+
+/** Gives every job in 's' its priority, rate monotonically, and starts them.
+ * Jobs with the same period get the same priority, and if there are more
+ * distinct periods than priorities in the band, the slowest ones share its
+ * lowest priority. */
+esp_err_t scheduler_start(struct scheduler *s) {
+    if (s->started) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    UBaseType_t band = s->highest_priority - s->lowest_priority;
+    for (int i = 0; i < s->num_jobs; i++) {
+        UBaseType_t rank = scheduler_rank(s, s->jobs[i].config.period_us);
+        s->jobs[i].priority = s->highest_priority - (rank < band ? rank : band);
+    }
+
+    s->started = true;
+    for (int i = 0; i < s->num_jobs; i++) {
+        struct scheduler_job *job = &s->jobs[i];
+        esp_timer_create_args_t timer_args = {};
+        timer_args.callback = scheduler_release;
+        timer_args.arg = job;
+        timer_args.dispatch_method = ESP_TIMER_TASK;
+        timer_args.name = job->config.name;
+        esp_err_t err = esp_timer_create(&timer_args, &job->timer);
+        if (err != ESP_OK) {
+            return err;
+        }
+        /* The task starts the timer itself, once it has run the job's
+         * 'begin()' */
+        job->task = xTaskCreateStaticPinnedToCore(scheduler_job_task, job->config.name, \
+            job->config.stack_size, job, job->priority, job->config.stack, \
+            &job->task_buffer, job->config.core);
+        if (job->task == NULL) {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    return ESP_OK;
+}
+
+
+/** Copies the statistics of the 'job'th job added to 's' into 'out'. Can be
+ * called from any task. */
+void scheduler_get_stats(const struct scheduler *s, int job, struct scheduler_job_stats *out) {
+    const struct scheduler_job_stats *stats = &s->jobs[job].stats;
+    out->runs = __atomic_load_n(&stats->runs, __ATOMIC_RELAXED);
+    out->misses = __atomic_load_n(&stats->misses, __ATOMIC_RELAXED);
+    out->skipped = __atomic_load_n(&stats->skipped, __ATOMIC_RELAXED);
+    out->max_response_us = __atomic_load_n(&stats->max_response_us, __ATOMIC_RELAXED);
+}
+
+
+/** Clears every job's statistics. A job that is running at the time may
+ * put back a count it had already read. */
+void scheduler_reset_stats(struct scheduler *s) {
+    for (int i = 0; i < s->num_jobs; i++) {
+        struct scheduler_job_stats *stats = &s->jobs[i].stats;
+        __atomic_store_n(&stats->runs, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&stats->misses, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&stats->skipped, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&stats->max_response_us, 0, __ATOMIC_RELAXED);
+    }
+}
+
+
+/** Prints every job's period, priority and statistics to 'out'. */
+void scheduler_dump(const struct scheduler *s, FILE *out) {
+    fprintf(out, "%-10s %9s %4s %8s %8s %8s %9s\n", "job", "period us", "prio", "runs", \
+        "misses", "skipped", "max resp");
+    for (int i = 0; i < s->num_jobs; i++) {
+        struct scheduler_job_stats stats;
+        scheduler_get_stats(s, i, &stats);
+        fprintf(out, "%-10s %9" PRIu32 " %4u %8" PRIu32 " %8" PRIu32 " %8" PRIu32 " %9" \
+            PRIu32 "\n", s->jobs[i].config.name, s->jobs[i].config.period_us, \
+            (unsigned) s->jobs[i].priority, stats.runs, stats.misses, stats.skipped, \
+            stats.max_response_us);
+    }
+}
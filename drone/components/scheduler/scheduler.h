@@ -0,0 +1,101 @@
+#ifndef __SCHEDULER_H_
+#define __SCHEDULER_H_
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/* Runs periodic jobs at fixed rates, each in its own task, with priorities
+ * given out rate monotonically: the shorter a job's period, the higher its
+ * priority. So long as the jobs on a core fit in its time at all, that
+ * keeps every one of them on schedule, and a fast job is never held up by a
+ * slower one.
+ *
+ * Each job is released by a periodic esp_timer rather than the RTOS tick,
+ * so periods can be anything down to a few tens of microseconds instead of a
+ * whole number of ticks. The timer callback only notifies the job's task,
+ * which then runs the job. A job's deadline is its next release. Finishing
+ * after it counts as a miss, and releases that came and went while the job
+ * was still running are skipped (and counted), not queued up.
+ *
+ * Jobs are added with 'scheduler_add()' and all started together by
+ * 'scheduler_start()', which is when the priorities are given out. */
+
+
+#define SCHEDULER_MAX_JOBS 8
+
+
+struct scheduler_job_config {
+    /* The job's task's name, and its name in dumps */
+    const char *name;
+    uint32_t period_us;
+    /* The core the job runs on, or tskNO_AFFINITY */
+    BaseType_t core;
+    /* The job's task's stack, 'stack_size' bytes of it. Usually a static
+     * array, so that starting the job allocates nothing */
+    StackType_t *stack;
+    uint32_t stack_size;
+    /* Called once in the job's own task before its first release, so that
+     * anything it sets up (an interrupt, say) belongs to the job's core. May
+     * be NULL */
+    void (*begin)(void *arg);
+    /* Called at every release */
+    void (*run)(void *arg);
+    void *arg;
+};
+
+struct scheduler_job_stats {
+    /* Releases the job ran for */
+    uint32_t runs;
+    /* Runs that finished after the next release was due */
+    uint32_t misses;
+    /* Releases that were never run, because the job was still busy */
+    uint32_t skipped;
+    /* The longest time from a release to the end of its run */
+    uint32_t max_response_us;
+};
+
+struct scheduler_job {
+    struct scheduler_job_config config;
+    UBaseType_t priority;
+    TaskHandle_t task;
+    StaticTask_t task_buffer;
+    esp_timer_handle_t timer;
+
+    /* Only touched by the job's task */
+    int64_t first_release_us;
+    uint32_t releases;
+    /* Written by the job's task, read by anyone */
+    struct scheduler_job_stats stats;
+};
+
+struct scheduler {
+    /* The band of priorities the jobs are given */
+    UBaseType_t lowest_priority;
+    UBaseType_t highest_priority;
+    bool started;
+    int num_jobs;
+    struct scheduler_job jobs[SCHEDULER_MAX_JOBS];
+};
+
+
+void scheduler_init(struct scheduler *s, UBaseType_t lowest_priority, \
+    UBaseType_t highest_priority);
+
+esp_err_t scheduler_add(struct scheduler *s, const struct scheduler_job_config *config);
+
+esp_err_t scheduler_start(struct scheduler *s);
+
+void scheduler_get_stats(const struct scheduler *s, int job, struct scheduler_job_stats *out);
+
+void scheduler_reset_stats(struct scheduler *s);
+
+void scheduler_dump(const struct scheduler *s, FILE *out);
+
+
+#endif
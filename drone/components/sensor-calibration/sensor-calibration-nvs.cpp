@@ -0,0 +1,69 @@
+#include <string.h>
+
+#include "esp_err.h"
+#include "nvs.h"
+
+#include "sensor-calibration.h"
+
+
+/* What is actually stored under each key */
+struct sensor_calibration_record {
+    uint32_t version;
+    struct sensor_calibration cal;
+};
+
+
+/** Loads the calibration stored under 'key' into 'cal'. Returns
+ * ESP_ERR_NVS_NOT_FOUND if there is none, or if what is there was written by
+ * a different version of this code or does not make sense, in which case
+ * 'cal' is left alone. NVS must have been initialised with
+ * 'nvs_flash_init()'. */
+esp_err_t sensor_calibration_load(const char *key, struct sensor_calibration *cal) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(SENSOR_CALIBRATION_NVS_NAMESPACE, NVS_READONLY, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    struct sensor_calibration_record record;
+    size_t length = sizeof(record);
+    err = nvs_get_blob(handle, key, &record, &length);
+    nvs_close(handle);
+    if (err == ESP_ERR_NVS_INVALID_LENGTH || (err == ESP_OK && (length != sizeof(record) \
+        || record.version != SENSOR_CALIBRATION_NVS_VERSION \
+        || !sensor_calibration_is_valid(&record.cal)))) {
+
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    *cal = record.cal;
+
+    return ESP_OK;
+}
+
+
+/** Stores 'cal' under 'key', replacing whatever was there. This writes to
+ * flash, which stalls both cores while it happens, so it should not be done
+ * in flight. */
+esp_err_t sensor_calibration_save(const char *key, const struct sensor_calibration *cal) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(SENSOR_CALIBRATION_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    struct sensor_calibration_record record;
+    memset(&record, 0, sizeof(record));
+    record.version = SENSOR_CALIBRATION_NVS_VERSION;
+    record.cal = *cal;
+    err = nvs_set_blob(handle, key, &record, sizeof(record));
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+
+    return err;
+}
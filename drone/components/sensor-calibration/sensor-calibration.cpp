@@ -0,0 +1,478 @@
+#include <math.h>
+#include <string.h>
+
+#include "sensor-calibration.h"
+
+
+/** Sets 'cal' to the calibration that leaves readings as they are. */
+void sensor_calibration_identity(struct sensor_calibration *cal) {
+    memset(cal, 0, sizeof(*cal));
+    for (int i = 0; i < 3; i++) {
+        cal->matrix[i][i] = 1.0f;
+    }
+}
+
+
+/** Folds a sensor's 'scale' (SI units per LSB) into 'cal', putting the
+ * result in 'out', so that 'sensor_calibration_apply_raw()' can take raw
+ * samples from that sensor. 'out' may be 'cal'. */
+void sensor_calibration_fold_scale(const struct sensor_calibration *cal, float scale, \
+    struct sensor_calibration *out) {
+
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            out->matrix[i][j] = cal->matrix[i][j] * scale;
+        }
+        out->offset[i] = cal->offset[i];
+    }
+}
+
+
+/** Whether every number in 'cal' is finite, and its matrix does not throw
+ * away (or flip) any axis. Anything loaded from storage is checked with this
+ * before it is used. */
+bool sensor_calibration_is_valid(const struct sensor_calibration *cal) {
+    for (int i = 0; i < 3; i++) {
+        if (!isfinite(cal->offset[i])) {
+            return false;
+        }
+        for (int j = 0; j < 3; j++) {
+            if (!isfinite(cal->matrix[i][j])) {
+                return false;
+            }
+        }
+    }
+
+    const float (*m)[3] = cal->matrix;
+    float det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) \
+        - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) \
+        + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    return det > 0.0f;
+}
+
+
+void sensor_calibration_stats_reset(struct sensor_calibration_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+}
+
+
+void sensor_calibration_stats_add(struct sensor_calibration_stats *stats, const float *xyz) {
+    stats->count++;
+    for (int i = 0; i < 3; i++) {
+        stats->sum[i] += xyz[i];
+        stats->sum_squares[i] += (double) xyz[i] * xyz[i];
+    }
+}
+
+
+void sensor_calibration_stats_mean(const struct sensor_calibration_stats *stats, float *mean) {
+    for (int i = 0; i < 3; i++) {
+        mean[i] = (stats->count > 0) ? (float) (stats->sum[i] / stats->count) : 0.0f;
+    }
+}
+
+
+/** Returns the standard deviation of the readings along whichever axis they
+ * vary the most on. */
+float sensor_calibration_stats_max_stddev(const struct sensor_calibration_stats *stats) {
+    if (stats->count == 0) {
+        return 0.0f;
+    }
+
+    double max_variance = 0.0;
+    for (int i = 0; i < 3; i++) {
+        double mean = stats->sum[i] / stats->count;
+        double variance = stats->sum_squares[i] / stats->count - mean * mean;
+        if (variance > max_variance) max_variance = variance;
+    }
+
+    return (float) sqrt(max_variance);
+}
+
+
+/** Works out the gyroscope calibration from 'stats', a run of gyroscope
+ * readings (in rad/s) taken while the drone was sitting still: the bias is
+ * the mean reading, and the calibration subtracts it. */
+enum sensor_calibration_result sensor_calibration_gyro_bias( \
+    const struct sensor_calibration_stats *stats, struct sensor_calibration *cal) {
+
+    if (stats->count == 0) {
+        return SENSOR_CALIBRATION_INCOMPLETE;
+    }
+    if (sensor_calibration_stats_max_stddev(stats) > SENSOR_CALIBRATION_GYRO_MAX_STDDEV_RAD_S) {
+        return SENSOR_CALIBRATION_MOVED;
+    }
+
+    float bias[3];
+    sensor_calibration_stats_mean(stats, bias);
+    sensor_calibration_identity(cal);
+    for (int i = 0; i < 3; i++) {
+        cal->offset[i] = -bias[i];
+    }
+
+    return SENSOR_CALIBRATION_OK;
+}
+
+
+void sensor_calibration_accel_reset(struct sensor_calibration_accel *accel) {
+    memset(accel, 0, sizeof(*accel));
+}
+
+
+/** Takes 'stats', a run of accelerometer readings (in m/s^2) taken while the
+ * drone sat still with one of its axes pointing straight up or down, as the
+ * reading for that position. Which position it was is worked out from the
+ * readings, and taking one again replaces the old reading. */
+enum sensor_calibration_result sensor_calibration_accel_add_position( \
+    struct sensor_calibration_accel *accel, const struct sensor_calibration_stats *stats) {
+
+    if (stats->count == 0) {
+        return SENSOR_CALIBRATION_INCOMPLETE;
+    }
+    if (sensor_calibration_stats_max_stddev(stats) > SENSOR_CALIBRATION_ACCEL_MAX_STDDEV_M_S2) {
+        return SENSOR_CALIBRATION_MOVED;
+    }
+
+    float mean[3];
+    sensor_calibration_stats_mean(stats, mean);
+
+    /* The axis gravity is (mostly) along, and how much of it is along the
+     * other two */
+    int axis = 0;
+    for (int i = 1; i < 3; i++) {
+        if (fabsf(mean[i]) > fabsf(mean[axis])) axis = i;
+    }
+    float off_axis = sqrtf(mean[(axis + 1) % 3] * mean[(axis + 1) % 3] \
+        + mean[(axis + 2) % 3] * mean[(axis + 2) % 3]);
+    if (fabsf(mean[axis]) < 0.5f * SENSOR_CALIBRATION_STANDARD_GRAVITY \
+        || off_axis > SENSOR_CALIBRATION_ACCEL_MAX_TILT * SENSOR_CALIBRATION_STANDARD_GRAVITY) {
+        return SENSOR_CALIBRATION_BAD_POSITION;
+    }
+
+    /* At rest, the accelerometer reads +1g along whichever axis points up */
+    int position = axis * 2 + (mean[axis] < 0.0f ? 1 : 0);
+    memcpy(accel->means[position], mean, sizeof(mean));
+    accel->taken |= 1 << position;
+
+    return SENSOR_CALIBRATION_OK;
+}
+
+
+bool sensor_calibration_accel_complete(const struct sensor_calibration_accel *accel) {
+    return accel->taken == (1 << SENSOR_CALIBRATION_ACCEL_POSITIONS) - 1;
+}
+
+
+/* Solves the n x n system 'a' * x = 'b' in place by Gaussian elimination
+ * with partial pivoting, leaving x in 'b'. 'a' is row major. Returns false if
+ * the system is (numerically) singular */
+static bool sensor_calibration_solve(int n, double *a, double *b) {
+    double largest = 0.0;
+    for (int i = 0; i < n * n; i++) {
+        if (fabs(a[i]) > largest) largest = fabs(a[i]);
+    }
+    if (largest == 0.0) {
+        return false;
+    }
+
+    for (int col = 0; col < n; col++) {
+        int pivot = col;
+        for (int row = col + 1; row < n; row++) {
+            if (fabs(a[row * n + col]) > fabs(a[pivot * n + col])) pivot = row;
+        }
+        if (fabs(a[pivot * n + col]) < 1e-12 * largest) {
+            return false;
+        }
+        if (pivot != col) {
+            for (int k = 0; k < n; k++) {
+                double tmp = a[col * n + k];
+                a[col * n + k] = a[pivot * n + k];
+                a[pivot * n + k] = tmp;
+            }
+            double tmp = b[col];
+            b[col] = b[pivot];
+            b[pivot] = tmp;
+        }
+
+        for (int row = col + 1; row < n; row++) {
+            double factor = a[row * n + col] / a[col * n + col];
+            for (int k = col; k < n; k++) {
+                a[row * n + k] -= factor * a[col * n + k];
+            }
+            b[row] -= factor * b[col];
+        }
+    }
+
+    for (int row = n - 1; row >= 0; row--) {
+        double sum = b[row];
+        for (int k = row + 1; k < n; k++) {
+            sum -= a[row * n + k] * b[k];
+        }
+        b[row] = sum / a[row * n + row];
+    }
+
+    return true;
+}
+
+
+/** Works out the accelerometer calibration from the six positions in
+ * 'accel'. Each row of the matrix and its offset are the least squares fit
+ * of that axis's true reading (+1g, -1g or 0 in each position) to the six
+ * mean readings, which takes out the bias, scale and misalignment of every
+ * axis together. */
+enum sensor_calibration_result sensor_calibration_accel_solve( \
+    const struct sensor_calibration_accel *accel, struct sensor_calibration *cal) {
+
+    if (!sensor_calibration_accel_complete(accel)) {
+        return SENSOR_CALIBRATION_INCOMPLETE;
+    }
+
+    /* Every axis is fitted against the same readings, so they share the
+     * normal equations and only the right hand side differs */
+    double ata[4][4] = {};
+    double atb[3][4] = {};
+    for (int p = 0; p < SENSOR_CALIBRATION_ACCEL_POSITIONS; p++) {
+        const double row[4] = { accel->means[p][0], accel->means[p][1], accel->means[p][2], \
+            1.0 };
+        int up_axis = p / 2;
+        double g = (p % 2 == 0) ? SENSOR_CALIBRATION_STANDARD_GRAVITY \
+            : -SENSOR_CALIBRATION_STANDARD_GRAVITY;
+        for (int i = 0; i < 4; i++) {
+            for (int j = 0; j < 4; j++) {
+                ata[i][j] += row[i] * row[j];
+            }
+            atb[up_axis][i] += row[i] * g;
+        }
+    }
+
+    for (int axis = 0; axis < 3; axis++) {
+        double a[4][4];
+        memcpy(a, ata, sizeof(a));
+        if (!sensor_calibration_solve(4, &a[0][0], atb[axis])) {
+            return SENSOR_CALIBRATION_BAD_FIT;
+        }
+        for (int j = 0; j < 3; j++) {
+            cal->matrix[axis][j] = (float) atb[axis][j];
+        }
+        cal->offset[axis] = (float) atb[axis][3];
+    }
+
+    return sensor_calibration_is_valid(cal) ? SENSOR_CALIBRATION_OK : SENSOR_CALIBRATION_BAD_FIT;
+}
+
+
+void sensor_calibration_mag_reset(struct sensor_calibration_mag *mag) {
+    memset(mag, 0, sizeof(*mag));
+    for (int i = 0; i < 3; i++) {
+        mag->min[i] = INFINITY;
+        mag->max[i] = -INFINITY;
+    }
+}
+
+
+/** Adds one magnetometer reading (in uT) to the ellipsoid fit. The readings
+ * should be taken while the drone is turned through as many orientations as
+ * possible, well away from anything magnetic that is not part of it.
+ *
+ * Each reading is one row of the least squares problem
+ *
+ *   A x^2 + B y^2 + C z^2 + 2D xy + 2E xz + 2F yz + 2G x + 2H y + 2I z = 1
+ *
+ * and only that problem's normal equations are kept. */
+void sensor_calibration_mag_add(struct sensor_calibration_mag *mag, const float *m_xyz) {
+    double x = m_xyz[0];
+    double y = m_xyz[1];
+    double z = m_xyz[2];
+    const double row[9] = { x * x, y * y, z * z, 2 * x * y, 2 * x * z, 2 * y * z, \
+        2 * x, 2 * y, 2 * z };
+
+    for (int i = 0; i < 9; i++) {
+        for (int j = i; j < 9; j++) {
+            mag->ata[i][j] += row[i] * row[j];
+        }
+        mag->atb[i] += row[i];
+    }
+    for (int i = 0; i < 3; i++) {
+        if (m_xyz[i] < mag->min[i]) mag->min[i] = m_xyz[i];
+        if (m_xyz[i] > mag->max[i]) mag->max[i] = m_xyz[i];
+    }
+    mag->count++;
+}
+
+
+/* Finds the eigenvalues and eigenvectors (the columns of 'vectors') of the
+ * symmetric matrix 'a' with Jacobi rotations, destroying 'a' */
+static void sensor_calibration_eigen(double a[3][3], double values[3], double vectors[3][3]) {
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            vectors[i][j] = (i == j) ? 1.0 : 0.0;
+        }
+    }
+
+    for (int sweep = 0; sweep < 50; sweep++) {
+        double off = a[0][1] * a[0][1] + a[0][2] * a[0][2] + a[1][2] * a[1][2];
+        double on = a[0][0] * a[0][0] + a[1][1] * a[1][1] + a[2][2] * a[2][2];
+        if (off <= 1e-30 * on) {
+            break;
+        }
+
+        for (int p = 0; p < 2; p++) {
+            for (int q = p + 1; q < 3; q++) {
+                if (a[p][q] == 0.0) {
+                    continue;
+                }
+                /* The rotation in the p-q plane that zeroes a[p][q] */
+                double theta = (a[q][q] - a[p][p]) / (2.0 * a[p][q]);
+                double t = ((theta >= 0.0) ? 1.0 : -1.0) \
+                    / (fabs(theta) + sqrt(theta * theta + 1.0));
+                double c = 1.0 / sqrt(t * t + 1.0);
+                double s = t * c;
+
+                for (int k = 0; k < 3; k++) {
+                    double akp = a[k][p];
+                    double akq = a[k][q];
+                    a[k][p] = c * akp - s * akq;
+                    a[k][q] = s * akp + c * akq;
+                }
+                for (int k = 0; k < 3; k++) {
+                    double apk = a[p][k];
+                    double aqk = a[q][k];
+                    a[p][k] = c * apk - s * aqk;
+                    a[q][k] = s * apk + c * aqk;
+                }
+                for (int k = 0; k < 3; k++) {
+                    double vkp = vectors[k][p];
+                    double vkq = vectors[k][q];
+                    vectors[k][p] = c * vkp - s * vkq;
+                    vectors[k][q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < 3; i++) {
+        values[i] = a[i][i];
+    }
+}
+
+
+/** Fits an ellipsoid to the readings fed to 'mag' and works out the
+ * calibration that maps it back onto a sphere: the offset takes out the
+ * ellipsoid's centre (hard iron), and the matrix squashes its axes back to
+ * the same length (soft iron) without rotating it. The sphere's radius is the
+ * geometric mean of the ellipsoid's, so the corrected readings stay in uT. */
+enum sensor_calibration_result sensor_calibration_mag_solve( \
+    const struct sensor_calibration_mag *mag, struct sensor_calibration *cal) {
+
+    if (mag->count < SENSOR_CALIBRATION_MAG_MIN_SAMPLES) {
+        return SENSOR_CALIBRATION_INCOMPLETE;
+    }
+
+    /* 1. Solve for the ellipsoid's coefficients. Only the upper triangle of
+     * the normal equations was summed */
+    double a[9][9];
+    double p[9];
+    for (int i = 0; i < 9; i++) {
+        for (int j = 0; j < 9; j++) {
+            a[i][j] = (j >= i) ? mag->ata[i][j] : mag->ata[j][i];
+        }
+        p[i] = mag->atb[i];
+    }
+    if (!sensor_calibration_solve(9, &a[0][0], p)) {
+        return SENSOR_CALIBRATION_BAD_FIT;
+    }
+
+    /* 2. Find its centre c. With Q the quadratic part and v the linear part,
+     * x'Qx + 2v'x = 1 is (x - c)'Q(x - c) = 1 + c'Qc for c = -Q^-1 v */
+    const double q[3][3] = {
+        { p[0], p[3], p[4] },
+        { p[3], p[1], p[5] },
+        { p[4], p[5], p[2] },
+    };
+    double qc[3][3];
+    memcpy(qc, q, sizeof(qc));
+    double centre[3] = { -p[6], -p[7], -p[8] };
+    if (!sensor_calibration_solve(3, &qc[0][0], centre)) {
+        return SENSOR_CALIBRATION_BAD_FIT;
+    }
+    double k = 1.0;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            k += centre[i] * q[i][j] * centre[j];
+        }
+    }
+    if (!(fabs(k) > 0.0)) {
+        return SENSOR_CALIBRATION_BAD_FIT;
+    }
+
+    /* 3. Normalise to (x - c)'Q(x - c) = 1. The eigenvalues of Q are then
+     * 1 / radius^2 along each of the ellipsoid's axes, and all of them must
+     * be positive for it to be an ellipsoid at all. Q and k are both
+     * negative when the hard iron is stronger than the earth's field, which
+     * leaves zero outside the ellipsoid, so k only has to be nonzero */
+    double qn[3][3];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            qn[i][j] = q[i][j] / k;
+        }
+    }
+    double values[3];
+    double vectors[3][3];
+    sensor_calibration_eigen(qn, values, vectors);
+    if (!(values[0] > 0.0 && values[1] > 0.0 && values[2] > 0.0)) {
+        return SENSOR_CALIBRATION_BAD_FIT;
+    }
+    double radius = pow(values[0] * values[1] * values[2], -1.0 / 6.0);
+
+    /* 4. A sensor which was not turned far enough along every axis leaves
+     * the fit guessing at the rest of the ellipsoid */
+    for (int i = 0; i < 3; i++) {
+        if (mag->max[i] - mag->min[i] < SENSOR_CALIBRATION_MAG_MIN_SPREAD * radius) {
+            return SENSOR_CALIBRATION_INCOMPLETE;
+        }
+    }
+
+    /* 5. The matrix is radius * sqrt(Q), which scales each of the ellipsoid's
+     * axes to 'radius' in place */
+    double scales[3];
+    for (int i = 0; i < 3; i++) {
+        scales[i] = radius * sqrt(values[i]);
+    }
+    double matrix[3][3];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            matrix[i][j] = 0.0;
+            for (int e = 0; e < 3; e++) {
+                matrix[i][j] += vectors[i][e] * scales[e] * vectors[j][e];
+            }
+            cal->matrix[i][j] = (float) matrix[i][j];
+        }
+    }
+    for (int i = 0; i < 3; i++) {
+        double sum = 0.0;
+        for (int j = 0; j < 3; j++) {
+            sum += matrix[i][j] * centre[j];
+        }
+        cal->offset[i] = (float) -sum;
+    }
+
+    return sensor_calibration_is_valid(cal) ? SENSOR_CALIBRATION_OK : SENSOR_CALIBRATION_BAD_FIT;
+}
+
+
+const char *sensor_calibration_result_str(enum sensor_calibration_result result) {
+    switch (result) {
+        case SENSOR_CALIBRATION_OK:
+            return "ok";
+        case SENSOR_CALIBRATION_MOVED:
+            return "moved while measuring";
+        case SENSOR_CALIBRATION_INCOMPLETE:
+            return "not enough data";
+        case SENSOR_CALIBRATION_BAD_POSITION:
+            return "not lined up with an axis";
+        case SENSOR_CALIBRATION_BAD_FIT:
+            return "data does not fit";
+    }
+
+    return "unknown";
+}
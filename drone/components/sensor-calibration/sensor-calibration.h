@@ -0,0 +1,178 @@
+#ifndef __SENSOR_CALIBRATION_H_
+#define __SENSOR_CALIBRATION_H_
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#ifdef ESP_PLATFORM
+#include "esp_err.h"
+#endif
+
+/* Works out and applies corrections for the gyroscope's bias, the
+ * accelerometer's bias, scale and axis misalignment, and the magnetometer's
+ * hard and soft iron distortion.
+ *
+ * Every correction has the same form, a 3x3 matrix and an offset:
+ *
+ *   corrected = matrix * reading + offset
+ *
+ * Calibrations are worked out (and stored) against readings already in SI
+ * units, so they do not depend on the full scale range the sensor happens to
+ * be set to. 'sensor_calibration_fold_scale()' then folds a sensor's scale
+ * into the matrix, so that 'sensor_calibration_apply_raw()' goes straight
+ * from raw samples to corrected SI units in 9 multiply-adds per sample, the
+ * same as the uncorrected conversion plus two adds per axis.
+ *
+ * The NVS storage is kept apart, in sensor-calibration-nvs.cpp. The fits are
+ * done in double precision: they only run while calibrating, and the
+ * sums of squares (and, for the magnetometer, fourth powers) they work on
+ * lose too much in single precision. */
+
+
+/* How still the drone has to be while the gyroscope bias or an accelerometer
+ * position is being measured: the largest standard deviation allowed on any
+ * axis */
+#define SENSOR_CALIBRATION_GYRO_MAX_STDDEV_RAD_S 0.02f
+#define SENSOR_CALIBRATION_ACCEL_MAX_STDDEV_M_S2 0.2f
+/* How far (as a fraction of gravity) the accelerometer may be from pointing
+ * straight along one of its axes for a reading to count as one of the six
+ * positions */
+#define SENSOR_CALIBRATION_ACCEL_MAX_TILT 0.25f
+/* The fewest magnetometer samples, and the smallest spread of them along
+ * each axis (as a fraction of the field strength), that an ellipsoid is
+ * fitted to. Too few, or a sensor that was barely turned, gives a fit that
+ * fits the noise */
+#define SENSOR_CALIBRATION_MAG_MIN_SAMPLES 200
+#define SENSOR_CALIBRATION_MAG_MIN_SPREAD 1.0f
+
+#define SENSOR_CALIBRATION_STANDARD_GRAVITY 9.80665f
+
+
+/* Namespace the calibrations are kept under in NVS */
+#define SENSOR_CALIBRATION_NVS_NAMESPACE "calibration"
+/* Bumped whenever the layout of a stored struct sensor_calibration changes,
+ * so that an old one is ignored rather than misread */
+#define SENSOR_CALIBRATION_NVS_VERSION 1
+
+
+enum sensor_calibration_result {
+    SENSOR_CALIBRATION_OK = 0,
+    /* The sensor was not held still enough */
+    SENSOR_CALIBRATION_MOVED,
+    /* Not enough samples, positions or movement to work anything out from */
+    SENSOR_CALIBRATION_INCOMPLETE,
+    /* The accelerometer was not pointing along one of its axes */
+    SENSOR_CALIBRATION_BAD_POSITION,
+    /* The samples do not fit the model (for the magnetometer, they do not lie
+     * on an ellipsoid) */
+    SENSOR_CALIBRATION_BAD_FIT,
+};
+
+/* corrected = matrix * reading + offset */
+struct sensor_calibration {
+    float matrix[3][3];
+    float offset[3];
+};
+
+/* Mean and spread of a run of readings */
+struct sensor_calibration_stats {
+    uint32_t count;
+    double sum[3];
+    double sum_squares[3];
+};
+
+/* The six accelerometer positions: each axis pointing up, then down */
+#define SENSOR_CALIBRATION_ACCEL_POSITIONS 6
+
+struct sensor_calibration_accel {
+    /* The mean reading in each position, and which ones have been taken */
+    float means[SENSOR_CALIBRATION_ACCEL_POSITIONS][3];
+    uint8_t taken;
+};
+
+/* The sums a least squares ellipsoid fit needs. The samples themselves are
+ * not kept, so any number of them can be fed in */
+struct sensor_calibration_mag {
+    uint32_t count;
+    double min[3];
+    double max[3];
+    /* Normal equations of the fit, see sensor-calibration.cpp */
+    double ata[9][9];
+    double atb[9];
+};
+
+
+/** Applies 'cal' to 'in', which may be the same array as 'out'. */
+static inline void sensor_calibration_apply(const struct sensor_calibration *cal, \
+    const float *in, float *out) {
+
+    float x = in[0];
+    float y = in[1];
+    float z = in[2];
+    for (int i = 0; i < 3; i++) {
+        out[i] = cal->matrix[i][0] * x + cal->matrix[i][1] * y + cal->matrix[i][2] * z \
+            + cal->offset[i];
+    }
+}
+
+
+/** Applies a calibration that has had a sensor's scale folded into it with
+ * 'sensor_calibration_fold_scale()' to a raw sample from that sensor. */
+static inline void sensor_calibration_apply_raw(const struct sensor_calibration *cal, \
+    const int16_t *raw, float *out) {
+
+    float x = (float) raw[0];
+    float y = (float) raw[1];
+    float z = (float) raw[2];
+    for (int i = 0; i < 3; i++) {
+        out[i] = cal->matrix[i][0] * x + cal->matrix[i][1] * y + cal->matrix[i][2] * z \
+            + cal->offset[i];
+    }
+}
+
+
+void sensor_calibration_identity(struct sensor_calibration *cal);
+
+void sensor_calibration_fold_scale(const struct sensor_calibration *cal, float scale, \
+    struct sensor_calibration *out);
+
+bool sensor_calibration_is_valid(const struct sensor_calibration *cal);
+
+void sensor_calibration_stats_reset(struct sensor_calibration_stats *stats);
+
+void sensor_calibration_stats_add(struct sensor_calibration_stats *stats, const float *xyz);
+
+void sensor_calibration_stats_mean(const struct sensor_calibration_stats *stats, float *mean);
+
+float sensor_calibration_stats_max_stddev(const struct sensor_calibration_stats *stats);
+
+enum sensor_calibration_result sensor_calibration_gyro_bias( \
+    const struct sensor_calibration_stats *stats, struct sensor_calibration *cal);
+
+void sensor_calibration_accel_reset(struct sensor_calibration_accel *accel);
+
+enum sensor_calibration_result sensor_calibration_accel_add_position( \
+    struct sensor_calibration_accel *accel, const struct sensor_calibration_stats *stats);
+
+bool sensor_calibration_accel_complete(const struct sensor_calibration_accel *accel);
+
+enum sensor_calibration_result sensor_calibration_accel_solve( \
+    const struct sensor_calibration_accel *accel, struct sensor_calibration *cal);
+
+void sensor_calibration_mag_reset(struct sensor_calibration_mag *mag);
+
+void sensor_calibration_mag_add(struct sensor_calibration_mag *mag, const float *m_xyz);
+
+enum sensor_calibration_result sensor_calibration_mag_solve( \
+    const struct sensor_calibration_mag *mag, struct sensor_calibration *cal);
+
+const char *sensor_calibration_result_str(enum sensor_calibration_result result);
+
+#ifdef ESP_PLATFORM
+esp_err_t sensor_calibration_load(const char *key, struct sensor_calibration *cal);
+
+esp_err_t sensor_calibration_save(const char *key, const struct sensor_calibration *cal);
+#endif
+
+
+#endif
@@ -0,0 +1,655 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_cpu.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "sensor-task.h"
+
+
+/* The FIFO settings the drone flies with. The batch data rates can be at most
+ * the ODRs of 'lsm6dsox_profile_flight_1k6hz'. On I2C they are kept below the
+ * 1.667kHz ODR because at a 100kHz SCL the bus cannot move 1.667k gyroscope
+ * + accelerometer word pairs a second. At 10MHz, SPI can move them with time
+ * to spare. The watermark counts those pairs; the odd timestamp or sensor
+ * hub word among them only brings a wake up a little early, which
+ * 'sensor_task_loop_period_s()' allows for */
+const struct lsm6dsox_fifo_config sensor_task_fifo_i2c = {
+    .bdr_xl = LSM6DSOX_BDR_XL_417Hz,
+    .bdr_gy = LSM6DSOX_BDR_GY_417Hz,
+    .watermark = 2 * SENSOR_TASK_FIFO_WATERMARK_SAMPLES,
+    .mode = LSM6DSOX_FIFO_MODE_STREAM,
+    .ts_batch = LSM6DSOX_DEC_TS_32,
+};
+const struct lsm6dsox_fifo_config sensor_task_fifo_spi = {
+    .bdr_xl = LSM6DSOX_BDR_XL_1667Hz,
+    .bdr_gy = LSM6DSOX_BDR_GY_1667Hz,
+    .watermark = 2 * SENSOR_TASK_FIFO_WATERMARK_SAMPLES,
+    .mode = LSM6DSOX_FIFO_MODE_STREAM,
+    .ts_batch = LSM6DSOX_DEC_TS_32,
+};
+
+/* What the sensor hub reads from the LIS3MDL: its output registers, at the
+ * hub's fastest rate (a little under the LIS3MDL's 155Hz), into the FIFO */
+const struct lsm6dsox_shub_config sensor_task_shub_lis3mdl = {
+    .reg = OUTX_L | LIS3MDL_I2C_AUTO_INCREMENT,
+    .len = 6,
+    .odr = LSM6DSOX_SHUB_ODR_104Hz,
+    .batch = 1,
+};
+
+/* The rate loop sees the gyroscope through a dynamic notch, which follows the
+ * strongest vibration peak between 60 and 600Hz (as aliased by the sample
+ * rate), and then a 100Hz low-pass. The attitude estimator integrates the
+ * gyroscope, which averages vibration out by itself, so only the rate loop
+ * gets the filtered samples, and the estimator is spared their lag */
+const struct gyro_filter_config sensor_task_gyro_filter_default = {
+    .stages = {
+        { .type = FILTER_PT1, .cutoff_hz = 100.0f, .q = 0.0f },
+    },
+    .dyn_notch_min_hz = 60.0f,
+    .dyn_notch_max_hz = 600.0f,
+    .dyn_notch_q = 3.0f,
+};
+
+/* How the drone flies with its sensors on I2C: the IMU drained from its FIFO
+ * whenever the watermark interrupt fires, and the LIS3MDL on the main bus
+ * (where the Adafruit breakouts have it) read on its own DRDY interrupt. On
+ * SPI, the same but with the FIFO batching at the full ODR */
+const struct sensor_task_config sensor_task_profile_i2c = {
+    .acquisition_mode = IMU_ACQUISITION_FIFO,
+    .sampling_mode = IMU_SAMPLING_INTERRUPT,
+    .magnetometer_enabled = true,
+    .magnetometer_link = MAGNETOMETER_DIRECT,
+    .lsm6dsox = &lsm6dsox_profile_flight_1k6hz,
+    .lis3mdl = &lis3mdl_profile_flight_155hz,
+    .fifo = &sensor_task_fifo_i2c,
+    .shub = &sensor_task_shub_lis3mdl,
+    .shub_lis3mdl_address = 0x1E,
+    /* Only needed if the board has no pull-ups of its own on SDx/SCx */
+    .shub_pull_up = true,
+    .lsm6dsox_int1_pin = GPIO_NUM_32,
+    .lis3mdl_drdy_pin = GPIO_NUM_33,
+    .estimator_kp = 2.0f,
+    .estimator_ki = 0.05f,
+    .controller = &flight_controller_profile_default,
+    .gyro_filter = &sensor_task_gyro_filter_default,
+    .blocking = false,
+};
+const struct sensor_task_config sensor_task_profile_spi = {
+    .acquisition_mode = IMU_ACQUISITION_FIFO,
+    .sampling_mode = IMU_SAMPLING_INTERRUPT,
+    .magnetometer_enabled = true,
+    .magnetometer_link = MAGNETOMETER_DIRECT,
+    .lsm6dsox = &lsm6dsox_profile_flight_1k6hz,
+    .lis3mdl = &lis3mdl_profile_flight_155hz,
+    .fifo = &sensor_task_fifo_spi,
+    .shub = &sensor_task_shub_lis3mdl,
+    .shub_lis3mdl_address = 0x1E,
+    .shub_pull_up = true,
+    .lsm6dsox_int1_pin = GPIO_NUM_32,
+    .lis3mdl_drdy_pin = GPIO_NUM_33,
+    .estimator_kp = 2.0f,
+    .estimator_ki = 0.05f,
+    .controller = &flight_controller_profile_default,
+    .gyro_filter = &sensor_task_gyro_filter_default,
+    .blocking = false,
+};
+
+
+static inline void stage_done(struct sensor_task *t, enum sensor_task_stage stage) {
+    if (t->hooks.stage_done) {
+        t->hooks.stage_done(t->hooks.ctx, stage);
+    }
+}
+
+
+static inline void read_started(struct sensor_task *t, enum sensor_task_sensor sensor) {
+    if (t->hooks.read_started) {
+        t->hooks.read_started(t->hooks.ctx, sensor);
+    }
+}
+
+
+static inline void read_finished(struct sensor_task *t, enum sensor_task_sensor sensor) {
+    if (t->hooks.read_finished) {
+        t->hooks.read_finished(t->hooks.ctx, sensor);
+    }
+}
+
+
+/* Takes a magnetometer sample as it came off the LIS3MDL, has the caller
+ * correct it, and makes it the one the IMU samples are fused with */
+static void take_magnetometer_sample(struct sensor_task *t, float *m_xyz) {
+    if (t->hooks.magnetometer_sample) {
+        t->hooks.magnetometer_sample(t->hooks.ctx, m_xyz);
+    }
+    memcpy(t->m_xyz, m_xyz, sizeof(t->m_xyz));
+}
+
+
+/** Sets up a sensor task to run with 'config', reaching the world through
+ * 'hooks' (which can be NULL), on the drivers 'lsm6dsox' and 'lis3mdl'. Their
+ * buses have to be set up before 'sensor_task_begin_sensors()' is called,
+ * except for the LIS3MDL's behind the sensor hub. Until
+ * 'sensor_task_set_imu_calibration()' is called, the IMU is uncalibrated. */
+void sensor_task_init(struct sensor_task *t, const struct sensor_task_config *config, \
+    const struct sensor_task_hooks *hooks, struct i2c_lsm6dsox *lsm6dsox, \
+    struct i2c_lis3mdl *lis3mdl) {
+
+    memset(t, 0, sizeof(*t));
+    t->config = *config;
+    if (hooks) {
+        t->hooks = *hooks;
+    }
+    t->lsm6dsox = lsm6dsox;
+    t->lis3mdl = lis3mdl;
+    sensor_calibration_identity(&t->gyro_calibration_raw);
+    sensor_calibration_identity(&t->accel_calibration_raw);
+    for (int axis = 0; axis < GYRO_FILTER_NUM_AXES; axis++) {
+        t->batch_g_filtered_axes[axis] = t->batch_g_filtered[axis];
+    }
+}
+
+
+/** Brings up both sensors and starts them sampling. Behind the sensor hub,
+ * the LIS3MDL's driver is pointed at the hub, the LIS3MDL is set up through
+ * it, and the hub is left reading it into the FIFO, which it can only do
+ * with the FIFO on. If the task is interrupt driven, both sensors are set to
+ * wake the calling task up whenever they have new data for it. */
+esp_err_t sensor_task_begin_sensors(struct sensor_task *t) {
+    const struct sensor_task_config *config = &t->config;
+    bool shub = config->magnetometer_enabled \
+        && config->magnetometer_link == MAGNETOMETER_SENSOR_HUB;
+    esp_err_t err;
+
+    if (shub && config->acquisition_mode != IMU_ACQUISITION_FIFO) {
+        printf("the sensor hub needs IMU_ACQUISITION_FIFO\n");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    /* 1. Turn on and set operation control for accelerometer and gyro */
+    err = esp_i2c_lsm6dsox_begin(t->lsm6dsox, config->lsm6dsox);
+    if (err != ESP_OK) {
+        return err;
+    }
+    sensor_task_set_imu_calibration(t, NULL, NULL);
+
+    /* 2. Turn on and set operation control for magnetometer */
+    if (shub) {
+        esp_i2c_lsm6dsox_shub_init_bus(t->lsm6dsox, config->shub_lis3mdl_address, \
+            config->shub_pull_up, &t->lis3mdl->bus);
+        uint8_t who_am_i = 0;
+        err = sensor_bus_read(&t->lis3mdl->bus, LIS3MDL_WHO_AM_I, &who_am_i, 1);
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (who_am_i != LIS3MDL_WHO_AM_I_VALUE) {
+            printf("lis3mdl behind the sensor hub answered %#x\n", who_am_i);
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+    }
+    if (config->magnetometer_enabled) {
+        err = esp_i2c_lis3mdl_begin(t->lis3mdl, config->lis3mdl);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    if (shub) {
+        err = esp_i2c_lsm6dsox_shub_begin(t->lsm6dsox, config->shub);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    /* 3. Start batching, now that everything going into the FIFO is
+     * running */
+    if (config->acquisition_mode == IMU_ACQUISITION_FIFO) {
+        esp_i2c_lsm6dsox_fifo_begin(t->lsm6dsox, config->fifo);
+        err = esp_i2c_lsm6dsox_clock_sync(t->lsm6dsox);
+        if (err != ESP_OK) {
+            return err;
+        }
+        t->clock_synced_us = esp_timer_get_time();
+    }
+
+    /* 4. With the FIFO, only wake up once a watermark's worth is ready */
+    if (config->sampling_mode == IMU_SAMPLING_INTERRUPT) {
+        struct lsm6dsox_int1_ctrl int1_ctrl = {};
+        if (config->acquisition_mode == IMU_ACQUISITION_FIFO) {
+            int1_ctrl.int1_fifo_th = 1;
+        } else {
+            int1_ctrl.int1_drdy_g = 1;
+        }
+        t->lsm6dsox->int1.pin = config->lsm6dsox_int1_pin;
+        t->lsm6dsox->int1.task = xTaskGetCurrentTaskHandle();
+        t->lsm6dsox->int1.notify_bits = SENSOR_TASK_LSM6DSOX_NOTIFY_BIT;
+        esp_i2c_lsm6dsox_int1_begin(t->lsm6dsox, int1_ctrl);
+
+        if (config->magnetometer_enabled && !shub) {
+            t->lis3mdl->drdy.pin = config->lis3mdl_drdy_pin;
+            t->lis3mdl->drdy.task = xTaskGetCurrentTaskHandle();
+            t->lis3mdl->drdy.notify_bits = SENSOR_TASK_LIS3MDL_NOTIFY_BIT;
+            esp_i2c_lis3mdl_drdy_begin(t->lis3mdl);
+        }
+    }
+
+    return ESP_OK;
+}
+
+
+/** Has raw IMU samples decoded with the gyroscope and accelerometer
+ * calibrations 'gyro' and 'accel' (in SI units, NULL for none), by folding
+ * the LSM6DSOX's scales into them. Must be called after the LSM6DSOX is up,
+ * and whenever either calibration changes, by whoever runs the task. */
+void sensor_task_set_imu_calibration(struct sensor_task *t, \
+    const struct sensor_calibration *gyro, const struct sensor_calibration *accel) {
+
+    struct sensor_calibration identity;
+    sensor_calibration_identity(&identity);
+    sensor_calibration_fold_scale(gyro ? gyro : &identity, \
+        t->lsm6dsox->gyroscope_scale_rad_s, &t->gyro_calibration_raw);
+    sensor_calibration_fold_scale(accel ? accel : &identity, \
+        t->lsm6dsox->accelerometer_scale_m_s2, &t->accel_calibration_raw);
+}
+
+
+/** Sets up the attitude estimator, the control loops and the gyroscope's
+ * filters at the rate samples will be coming in, and starts the estimator
+ * off at the orientation given by one sample, so it does not have to
+ * converge from level. Must be called after 'sensor_task_begin_sensors()',
+ * with the calibrations in place. */
+esp_err_t sensor_task_begin_loops(struct sensor_task *t) {
+    const struct sensor_task_config *config = &t->config;
+    esp_err_t err;
+
+    /* 1. Every sample is fused, so the estimator's rate is the sensor's, or
+     * the polling rate if that is slower */
+    struct attitude_estimator_config estimator_config = {
+        .sample_period_s = 0.0f,
+        .kp = config->estimator_kp,
+        .ki = config->estimator_ki,
+    };
+    if (config->acquisition_mode == IMU_ACQUISITION_FIFO) {
+        estimator_config.sample_period_s = \
+            1.0f / esp_i2c_lsm6dsox_bdr_gy_to_hz(config->fifo->bdr_gy);
+    } else if (config->sampling_mode == IMU_SAMPLING_INTERRUPT) {
+        estimator_config.sample_period_s = \
+            1.0f / esp_i2c_lsm6dsox_odr_g_to_hz(config->lsm6dsox->odr_g);
+    } else {
+        estimator_config.sample_period_s = SENSOR_TASK_POLL_PERIOD_US / 1e6f;
+    }
+    attitude_estimator_init(&t->estimator, &estimator_config);
+
+    /* 2. The rate loop runs once per gyroscope sample, so at the same rate
+     * as the estimator */
+    t->controller_config = *config->controller;
+    t->controller_config.rate_sample_period_s = estimator_config.sample_period_s;
+    flight_controller_init(&t->controller, &t->controller_config);
+    if (config->gyro_filter) {
+        gyro_filter_init(&t->gyro_filter, config->gyro_filter, \
+            estimator_config.sample_period_s);
+    }
+    t->sample_period_s = estimator_config.sample_period_s;
+    t->tuned_sample_period_s = estimator_config.sample_period_s;
+
+    /* 3. Align the estimator with one calibrated sample from each sensor */
+    int16_t g_raw[3];
+    int16_t a_raw[3];
+    err = esp_i2c_lsm6dsox_get_gyro_accel_data_start(t->lsm6dsox);
+    if (err == ESP_OK) {
+        err = esp_i2c_lsm6dsox_get_gyro_accel_data_finish(t->lsm6dsox, g_raw, a_raw);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    sensor_calibration_apply_raw(&t->gyro_calibration_raw, g_raw, t->g_xyz);
+    sensor_calibration_apply_raw(&t->accel_calibration_raw, a_raw, t->a_xyz);
+
+    float m_xyz[3];
+    if (config->magnetometer_enabled && config->magnetometer_link == MAGNETOMETER_SENSOR_HUB) {
+        union threeaxes m_raw;
+        err = esp_i2c_lsm6dsox_shub_get_data(t->lsm6dsox, (uint8_t *) m_raw.u16, \
+            sizeof(m_raw.u16));
+        if (err != ESP_OK) {
+            return err;
+        }
+        esp_i2c_lis3mdl_convert(t->lis3mdl, m_raw.i16, m_xyz);
+        take_magnetometer_sample(t, m_xyz);
+    } else if (config->magnetometer_enabled) {
+        err = esp_i2c_lis3mdl_get_data(t->lis3mdl, m_xyz);
+        if (err != ESP_OK) {
+            return err;
+        }
+        take_magnetometer_sample(t, m_xyz);
+    }
+    attitude_estimator_align(&t->estimator, t->a_xyz, \
+        config->magnetometer_enabled ? t->m_xyz : NULL);
+    attitude_estimator_get_euler(&t->estimator, &t->roll, &t->pitch, &t->yaw);
+
+    return ESP_OK;
+}
+
+
+/** Returns how long the task should go between wake ups, in seconds. With the
+ * FIFO, a wake up comes every watermark's worth of words, however many of
+ * them the batch data rates, timestamps and sensor hub put in per sample. */
+float sensor_task_loop_period_s(const struct sensor_task *t) {
+    const struct sensor_task_config *config = &t->config;
+
+    if (config->sampling_mode == IMU_SAMPLING_POLLED) {
+        return SENSOR_TASK_POLL_PERIOD_US / 1e6f;
+    } else if (config->acquisition_mode == IMU_ACQUISITION_FIFO) {
+        bool shub = config->magnetometer_enabled \
+            && config->magnetometer_link == MAGNETOMETER_SENSOR_HUB;
+        float words_per_sample = esp_i2c_lsm6dsox_fifo_words_per_sample(config->fifo, \
+            shub ? config->shub : NULL);
+        return t->estimator.config.sample_period_s * config->fifo->watermark / words_per_sample;
+    }
+    return t->estimator.config.sample_period_s;
+}
+
+
+/* Returns the time between the IMU sample taken at 'time_us' (by esp_timer, 0
+ * if not known) and the one before it, in seconds, for the estimator and
+ * control loops to step by. Falls back to the nominal sample period if
+ * either time is not known, or they are too far apart to make sense.
+ *
+ * Also keeps an average of the time between samples, and retunes the
+ * gyroscope filters and the D-terms if it wanders far from what they were
+ * set up for, e.g. when the output registers are polled more slowly than the
+ * gyroscope's ODR */
+static float sample_dt(struct sensor_task *t, int64_t time_us) {
+    const float nominal_s = t->estimator.config.sample_period_s;
+    float dt_s = nominal_s;
+
+    if (time_us != 0 && t->last_time_us != 0) {
+        float measured_s = (float) (time_us - t->last_time_us) * 1e-6f;
+        if (measured_s > 0.0f && measured_s < SENSOR_TASK_MAX_DT_S) {
+            dt_s = measured_s;
+            t->sample_period_s += SENSOR_TASK_SAMPLE_PERIOD_SMOOTHING \
+                * (measured_s - t->sample_period_s);
+            if (fabsf(t->sample_period_s - t->tuned_sample_period_s) \
+                > SENSOR_TASK_SAMPLE_PERIOD_RETUNE * t->tuned_sample_period_s) {
+
+                t->tuned_sample_period_s = t->sample_period_s;
+                if (t->config.gyro_filter) {
+                    gyro_filter_set_sample_period(&t->gyro_filter, t->tuned_sample_period_s);
+                }
+                flight_controller_set_sample_period(&t->controller, t->tuned_sample_period_s);
+            }
+        }
+    }
+
+    /* An untimed sample is taken to be one nominal period after the last,
+     * so the log's timestamps keep moving */
+    if (time_us == 0) {
+        time_us = (t->last_time_us != 0) \
+            ? t->last_time_us + (int64_t) (nominal_s * 1e6f) : esp_timer_get_time();
+    }
+    t->last_time_us = time_us;
+
+    return dt_s;
+}
+
+
+/* Takes the 'i'th sample of the batch being processed, as decoded by
+ * 'process_batch()', and advances the attitude estimate with it, along with
+ * the most recent magnetometer sample (which comes with it when the sensor
+ * hub reads the LIS3MDL), then runs the rate loop on the filtered gyroscope
+ * sample (and the attitude loop, if it is due) */
+static void process_sample(struct sensor_task *t, int i) {
+    const struct lsm6dsox_fifo_sample *sample = &t->batch[i];
+    const float dt_s = sample_dt(t, sample->time_us);
+    if (sample->m_new) {
+        float m_xyz[3];
+        esp_i2c_lis3mdl_convert(t->lis3mdl, sample->m_raw, m_xyz);
+        take_magnetometer_sample(t, m_xyz);
+    }
+
+    uint32_t start_cycles = esp_cpu_get_cycle_count();
+    attitude_estimator_update(&t->estimator, t->batch_g_xyz[i], t->batch_a_xyz[i], \
+        t->config.magnetometer_enabled ? t->m_xyz : NULL, dt_s);
+    if (esp_cpu_get_cycle_count() - start_cycles > ATTITUDE_ESTIMATOR_UPDATE_BUDGET_CYCLES) {
+        t->estimator_overruns++;
+    }
+    stage_done(t, SENSOR_STAGE_FUSION);
+
+    /* The rate loop runs off the gyroscope sample rather than anything
+     * derived from the estimate, so its latency is just the sensor's and its
+     * filters' */
+    if (flight_controller_attitude_due(&t->controller)) {
+        float roll, pitch, yaw;
+        attitude_estimator_get_euler(&t->estimator, &roll, &pitch, &yaw);
+        flight_controller_update_attitude(&t->controller, &t->setpoint, roll, pitch);
+    }
+    const float g_filtered[3] = {
+        t->batch_g_filtered[0][i], t->batch_g_filtered[1][i], t->batch_g_filtered[2][i],
+    };
+    flight_controller_update_rate(&t->controller, &t->setpoint, g_filtered, dt_s, t->motor);
+    stage_done(t, SENSOR_STAGE_CONTROL);
+
+    if (t->hooks.imu_sample) {
+        t->hooks.imu_sample(t->hooks.ctx, sample);
+    }
+}
+
+
+/* Takes the first 'num_samples' samples in 'batch', drained from the
+ * LSM6DSOX's FIFO or read from its output registers, decodes them to
+ * calibrated SI units, filters their gyroscope samples, and then flies them,
+ * oldest first */
+static void process_batch(struct sensor_task *t, int num_samples) {
+    if (num_samples <= 0) {
+        return;
+    }
+
+    /* Decode the whole batch first, so that the gyroscope's filters can run
+     * over each axis in one go */
+    for (int i = 0; i < num_samples; i++) {
+        sensor_calibration_apply_raw(&t->gyro_calibration_raw, t->batch[i].g_raw, \
+            t->batch_g_xyz[i]);
+        sensor_calibration_apply_raw(&t->accel_calibration_raw, t->batch[i].a_raw, \
+            t->batch_a_xyz[i]);
+        for (int axis = 0; axis < GYRO_FILTER_NUM_AXES; axis++) {
+            t->batch_g_filtered[axis][i] = t->batch_g_xyz[i][axis];
+        }
+    }
+    stage_done(t, SENSOR_STAGE_DECODE);
+    if (t->config.gyro_filter) {
+        gyro_filter_apply(&t->gyro_filter, t->batch_g_filtered_axes, num_samples);
+    }
+    stage_done(t, SENSOR_STAGE_FILTER);
+
+    for (int i = 0; i < num_samples; i++) {
+        process_sample(t, i);
+    }
+    memcpy(t->g_xyz, t->batch_g_xyz[num_samples - 1], sizeof(t->g_xyz));
+    memcpy(t->a_xyz, t->batch_a_xyz[num_samples - 1], sizeof(t->a_xyz));
+}
+
+
+/* Drains the LSM6DSOX's FIFO and flies the samples. The batch is read in
+ * bursts of SENSOR_TASK_BURST_WORDS words, each processed while the next one
+ * is on the bus, and the magnetometer read (if 'read_magnetometer') goes out
+ * behind the last of them. Returns the number of samples flown, and sets
+ * '*magnetometer_started' if it started the magnetometer read */
+static int service_fifo(struct sensor_task *t, bool read_magnetometer, \
+    bool *magnetometer_started) {
+
+    int total_samples = 0;
+
+    if (t->config.blocking) {
+        read_started(t, SENSOR_TASK_LSM6DSOX);
+        total_samples = esp_i2c_lsm6dsox_fifo_read(t->lsm6dsox, t->batch, \
+            SENSOR_TASK_BATCH_LEN);
+        read_finished(t, SENSOR_TASK_LSM6DSOX);
+        stage_done(t, SENSOR_STAGE_BUS);
+        process_batch(t, total_samples);
+        return total_samples;
+    }
+
+    read_started(t, SENSOR_TASK_LSM6DSOX);
+    int num_words = esp_i2c_lsm6dsox_fifo_get_level(t->lsm6dsox);
+    read_finished(t, SENSOR_TASK_LSM6DSOX);
+    if (num_words > SENSOR_TASK_BATCH_LEN) num_words = SENSOR_TASK_BATCH_LEN;
+    int burst_words = esp_i2c_lsm6dsox_fifo_read_start(t->lsm6dsox, \
+        num_words < SENSOR_TASK_BURST_WORDS ? num_words : SENSOR_TASK_BURST_WORDS);
+    if (burst_words > 0) {
+        read_started(t, SENSOR_TASK_LSM6DSOX);
+    }
+    stage_done(t, SENSOR_STAGE_BUS);
+
+    while (burst_words > 0) {
+        int num_samples = esp_i2c_lsm6dsox_fifo_read_finish(t->lsm6dsox, t->batch);
+        read_finished(t, SENSOR_TASK_LSM6DSOX);
+        num_words -= burst_words;
+        burst_words = esp_i2c_lsm6dsox_fifo_read_start(t->lsm6dsox, \
+            num_words < SENSOR_TASK_BURST_WORDS ? num_words : SENSOR_TASK_BURST_WORDS);
+        if (burst_words > 0) {
+            read_started(t, SENSOR_TASK_LSM6DSOX);
+        } else if (read_magnetometer) {
+            esp_i2c_lis3mdl_get_data_start(t->lis3mdl);
+            read_started(t, SENSOR_TASK_LIS3MDL);
+            *magnetometer_started = true;
+        }
+        stage_done(t, SENSOR_STAGE_BUS);
+
+        process_batch(t, num_samples);
+        total_samples += num_samples;
+    }
+
+    return total_samples;
+}
+
+
+/* Reads the gyroscope and accelerometer output registers in one burst and
+ * flies them as a batch of one, with the magnetometer read (if
+ * 'read_magnetometer') queued behind it. Returns the number of samples flown,
+ * and sets '*magnetometer_started' if it started the magnetometer read */
+static int service_registers(struct sensor_task *t, bool read_magnetometer, \
+    bool *magnetometer_started) {
+
+    struct lsm6dsox_fifo_sample *sample = &t->batch[0];
+    memset(sample, 0, sizeof(*sample));
+
+    esp_i2c_lsm6dsox_get_gyro_accel_data_start(t->lsm6dsox);
+    read_started(t, SENSOR_TASK_LSM6DSOX);
+    if (read_magnetometer && !t->config.blocking) {
+        esp_i2c_lis3mdl_get_data_start(t->lis3mdl);
+        read_started(t, SENSOR_TASK_LIS3MDL);
+        *magnetometer_started = true;
+    }
+    /* A read which failed even after the bus manager's retries is skipped
+     * rather than fed in as a stale sample */
+    esp_err_t err = esp_i2c_lsm6dsox_get_gyro_accel_data_finish(t->lsm6dsox, \
+        sample->g_raw, sample->a_raw);
+    read_finished(t, SENSOR_TASK_LSM6DSOX);
+    sample->time_us = t->lsm6dsox->time_us;
+    stage_done(t, SENSOR_STAGE_BUS);
+    if (err != ESP_OK) {
+        return 0;
+    }
+
+    process_batch(t, 1);
+    return 1;
+}
+
+
+/** Runs one wake up of the sensor task: reads whatever new data the sensors
+ * in 'notified' (SENSOR_TASK_LSM6DSOX_NOTIFY_BIT and/or
+ * SENSOR_TASK_LIS3MDL_NOTIFY_BIT) have, flies the IMU samples to 'setpoint'
+ * and hands the motor commands from the newest one to the motor output
+ * hook, then rearms the sensors' interrupts and keeps the FIFO's timestamps
+ * lined up with esp_timer. Returns the number of IMU samples flown.
+ *
+ * The reads are queued on the bus rather than waited on, so that the CPU gets
+ * on with processing one lot of data while the next is being transferred.
+ * When the sensor hub reads the magnetometer, its samples come in the FIFO
+ * batch instead. */
+int sensor_task_service(struct sensor_task *t, uint32_t notified, \
+    const struct flight_controller_setpoint *setpoint) {
+
+    const struct sensor_task_config *config = &t->config;
+    bool read_magnetometer = config->magnetometer_enabled \
+        && config->magnetometer_link == MAGNETOMETER_DIRECT \
+        && (notified & SENSOR_TASK_LIS3MDL_NOTIFY_BIT);
+    bool magnetometer_started = false;
+    int num_samples = 0;
+
+    t->setpoint = *setpoint;
+
+    if (notified & SENSOR_TASK_LSM6DSOX_NOTIFY_BIT) {
+        if (config->acquisition_mode == IMU_ACQUISITION_FIFO) {
+            num_samples = service_fifo(t, read_magnetometer, &magnetometer_started);
+        } else {
+            num_samples = service_registers(t, read_magnetometer, &magnetometer_started);
+        }
+
+        /* The Euler angles are only worked out once per wake up since they
+         * are relatively expensive */
+        if (num_samples > 0) {
+            attitude_estimator_get_euler(&t->estimator, &t->roll, &t->pitch, &t->yaw);
+            stage_done(t, SENSOR_STAGE_FUSION);
+        }
+
+        /* Only the command from the newest sample is worth sending. With the
+         * FIFO, the older ones in the batch are already out of date */
+        if (t->hooks.motor_output) {
+            t->hooks.motor_output(t->hooks.ctx, t->motor);
+        }
+        stage_done(t, SENSOR_STAGE_OUTPUT);
+    }
+
+    if (read_magnetometer) {
+        if (!magnetometer_started) {
+            esp_i2c_lis3mdl_get_data_start(t->lis3mdl);
+            read_started(t, SENSOR_TASK_LIS3MDL);
+        }
+        /* If this fails, the estimator carries on with the last heading */
+        float m_xyz[3];
+        esp_err_t err = esp_i2c_lis3mdl_get_data_finish(t->lis3mdl, m_xyz);
+        read_finished(t, SENSOR_TASK_LIS3MDL);
+        if (err == ESP_OK) {
+            take_magnetometer_sample(t, m_xyz);
+        }
+        stage_done(t, SENSOR_STAGE_BUS);
+    }
+
+    if (config->sampling_mode == IMU_SAMPLING_INTERRUPT) {
+        if (notified & SENSOR_TASK_LSM6DSOX_NOTIFY_BIT) {
+            esp_i2c_lsm6dsox_int1_rearm(t->lsm6dsox);
+        }
+        if (read_magnetometer) {
+            esp_i2c_lis3mdl_drdy_rearm(t->lis3mdl);
+        }
+    }
+
+    /* If a check fails it is just tried again next time round */
+    if (config->acquisition_mode == IMU_ACQUISITION_FIFO \
+        && esp_timer_get_time() - t->clock_synced_us >= SENSOR_TASK_CLOCK_SYNC_PERIOD_US) {
+
+        read_started(t, SENSOR_TASK_LSM6DSOX);
+        esp_i2c_lsm6dsox_clock_sync(t->lsm6dsox);
+        read_finished(t, SENSOR_TASK_LSM6DSOX);
+        t->clock_synced_us = esp_timer_get_time();
+        stage_done(t, SENSOR_STAGE_BUS);
+    }
+
+    return num_samples;
+}
+
+
+/** Packs the IMU sample 'sample', just flown, into a blackbox record along
+ * with the state it left the task in, timed from 'start_time_us' (the log's
+ * 'start_time_us'). Meant to be called from the IMU sample hook. */
+void sensor_task_pack_record(const struct sensor_task *t, \
+    const struct lsm6dsox_fifo_sample *sample, int64_t start_time_us, \
+    struct blackbox_record *record) {
+
+    blackbox_record_pack(record, (uint32_t) (t->last_time_us - start_time_us), \
+        sample->g_raw, sample->a_raw, t->m_xyz, t->estimator.q, t->motor);
+}
@@ -0,0 +1,262 @@
+#ifndef __SENSOR_TASK_H_
+#define __SENSOR_TASK_H_
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "driver/gpio.h"
+#include "esp_err.h"
+
+#include "esp32-i2c-lsm6dsox.h"
+#include "esp32-i2c-lis3mdl.h"
+#include "attitude-estimator.h"
+#include "flight-controller.h"
+#include "gyro-filter.h"
+#include "sensor-calibration.h"
+#include "blackbox-format.h"
+
+/* The drone's sensor loop: reads the LSM6DSOX and the LIS3MDL, decodes,
+ * calibrates and filters their samples, and feeds them one at a time to the
+ * attitude estimator and the control loops.
+ *
+ * Only the loop itself is in here. What wakes it, what it is asked to fly,
+ * where its motor commands and log records go and how its stages are timed
+ * are up to the caller, through 'struct sensor_task_hooks'. That way the
+ * firmware (main/drone.cpp) and the SIL (sil/sil.cpp) run the very same code,
+ * the SIL with the drivers on mock buses. */
+
+
+/* The task notification bits set by each sensor's interrupt */
+#define SENSOR_TASK_LSM6DSOX_NOTIFY_BIT (1 << 0)
+#define SENSOR_TASK_LIS3MDL_NOTIFY_BIT (1 << 1)
+#define SENSOR_TASK_NOTIFY_ALL (SENSOR_TASK_LSM6DSOX_NOTIFY_BIT | SENSOR_TASK_LIS3MDL_NOTIFY_BIT)
+/* How long an interrupt driven sensor task waits for an interrupt before
+ * assuming one was missed and servicing both sensors anyway */
+#define SENSOR_TASK_INTERRUPT_TIMEOUT_MS 100
+/* How often a polled sensor task is woken: 400Hz */
+#define SENSOR_TASK_POLL_PERIOD_US 2500
+/* How many samples the FIFO holds before it wakes the task up. This is what
+ * sets how often the motors and the setpoint are updated, so it is kept small:
+ * at 417Hz, two samples are 4.8ms */
+#define SENSOR_TASK_FIFO_WATERMARK_SAMPLES 2
+/* The most FIFO words drained in one wake up, and so the size of the batch
+ * buffers. It only matters when the task has fallen behind the watermark, and
+ * bounds how much it catches up on in one go */
+#define SENSOR_TASK_BATCH_LEN 32
+/* A batch is read in bursts of at most this many words, and each burst is
+ * processed while the next one is on the bus */
+#define SENSOR_TASK_BURST_WORDS 8
+/* How often the LSM6DSOX's timestamp counter is checked against esp_timer,
+ * so that FIFO samples can be given esp_timer times */
+#define SENSOR_TASK_CLOCK_SYNC_PERIOD_US 1000000
+/* A gap between two IMU samples longer than this (the task was held up, or
+ * the sensor stopped) is not integrated over, the nominal sample period is
+ * used instead */
+#define SENSOR_TASK_MAX_DT_S 0.05f
+/* How quickly the average time between IMU samples follows the real one,
+ * and how far it has to be from what the gyroscope filters and the D-terms
+ * are tuned for before they are retuned */
+#define SENSOR_TASK_SAMPLE_PERIOD_SMOOTHING 0.01f
+#define SENSOR_TASK_SAMPLE_PERIOD_RETUNE 0.1f
+
+
+/* How the sensor task gets its samples from the LSM6DSOX */
+enum imu_acquisition_mode {
+    /* Read the output registers once per wake up. Anything the sensor
+     * produced between two wake ups is lost */
+    IMU_ACQUISITION_REGISTERS,
+    /* Batch samples in the sensor's FIFO and drain all of them every wake
+     * up */
+    IMU_ACQUISITION_FIFO,
+};
+
+
+/* What wakes the sensor task up */
+enum imu_sampling_mode {
+    /* Wake up every SENSOR_TASK_POLL_PERIOD_US, whether or not there is new
+     * data */
+    IMU_SAMPLING_POLLED,
+    /* Wake up when the sensors raise their data-ready (or FIFO threshold)
+     * interrupts, so latency is bounded by the sensor ODR rather than the
+     * RTOS tick */
+    IMU_SAMPLING_INTERRUPT,
+};
+
+
+/* How the LIS3MDL is wired up */
+enum magnetometer_link {
+    /* On the ESP32's bus alongside the LSM6DSOX, read by the ESP32 whenever
+     * its DRDY line says it has a new sample */
+    MAGNETOMETER_DIRECT,
+    /* On the LSM6DSOX's auxiliary bus (SDx/SCx), read by the LSM6DSOX's
+     * sensor hub and batched into its FIFO, so it arrives in the same burst
+     * as the gyroscope and accelerometer samples. Needs
+     * IMU_ACQUISITION_FIFO */
+    MAGNETOMETER_SENSOR_HUB,
+};
+
+
+/* The stages of a wake up, as reported to 'sensor_task_hooks.stage_done'.
+ * The task itself only ends the ones from SENSOR_STAGE_BUS on: 'period' (from
+ * one wake up to the next) and 'loop' (the time spent awake) are there for
+ * the caller to time with the rest */
+enum sensor_task_stage {
+    SENSOR_STAGE_PERIOD,
+    SENSOR_STAGE_LOOP,
+    SENSOR_STAGE_BUS,
+    SENSOR_STAGE_DECODE,
+    SENSOR_STAGE_FILTER,
+    SENSOR_STAGE_FUSION,
+    SENSOR_STAGE_CONTROL,
+    SENSOR_STAGE_OUTPUT,
+    SENSOR_STAGE_COUNT,
+};
+
+
+/* Which sensor a bus read is for */
+enum sensor_task_sensor {
+    SENSOR_TASK_LSM6DSOX,
+    SENSOR_TASK_LIS3MDL,
+};
+
+
+struct sensor_task_config {
+    enum imu_acquisition_mode acquisition_mode;
+    enum imu_sampling_mode sampling_mode;
+    bool magnetometer_enabled;
+    enum magnetometer_link magnetometer_link;
+    /* The configuration profiles the sensors are brought up with */
+    const struct lsm6dsox_config *lsm6dsox;
+    const struct lis3mdl_config *lis3mdl;
+    /* The FIFO settings, with IMU_ACQUISITION_FIFO. The watermark sets how
+     * many words wake the task up */
+    const struct lsm6dsox_fifo_config *fifo;
+    /* What the sensor hub reads from the LIS3MDL, where the LIS3MDL is on
+     * the hub's bus and whether the LSM6DSOX has to pull that bus up, with
+     * MAGNETOMETER_SENSOR_HUB */
+    const struct lsm6dsox_shub_config *shub;
+    uint8_t shub_lis3mdl_address;
+    bool shub_pull_up;
+    /* The sensors' interrupt lines, with IMU_SAMPLING_INTERRUPT */
+    gpio_num_t lsm6dsox_int1_pin;
+    gpio_num_t lis3mdl_drdy_pin;
+    /* The attitude estimator's gains */
+    float estimator_kp;
+    float estimator_ki;
+    /* The control loops' gains and limits. Their sample period is filled in
+     * from the sensors' */
+    const struct flight_controller_config *controller;
+    /* The filters the rate loop's gyroscope samples go through, or NULL to
+     * run it on the unfiltered ones */
+    const struct gyro_filter_config *gyro_filter;
+    /* Wait on every read before doing anything else, rather than processing
+     * one burst while the next is on the bus. Only there to measure what the
+     * overlap is worth */
+    bool blocking;
+};
+
+
+/* How the sensor task reaches the world around it. 'ctx' is handed to every
+ * call, and any hook can be NULL */
+struct sensor_task_hooks {
+    void *ctx;
+    /* The stage the task was in has ended */
+    void (*stage_done)(void *ctx, enum sensor_task_stage stage);
+    /* A read from 'sensor' has been put on its bus, and then waited for.
+     * Reads which are not queued are reported started then finished */
+    void (*read_started)(void *ctx, enum sensor_task_sensor sensor);
+    void (*read_finished)(void *ctx, enum sensor_task_sensor sensor);
+    /* A magnetometer sample in uT, as it came off the LIS3MDL, to be
+     * corrected in place before anything uses it */
+    void (*magnetometer_sample)(void *ctx, float *m_xyz);
+    /* An IMU sample has been flown: the estimator and the control loops have
+     * been advanced with it (see 'sensor_task_pack_record()' to log it) */
+    void (*imu_sample)(void *ctx, const struct lsm6dsox_fifo_sample *sample);
+    /* The newest motor commands, once per wake up with new IMU samples */
+    void (*motor_output)(void *ctx, const float *motor);
+};
+
+
+struct sensor_task {
+    struct sensor_task_config config;
+    struct sensor_task_hooks hooks;
+    struct i2c_lsm6dsox *lsm6dsox;
+    struct i2c_lis3mdl *lis3mdl;
+
+    struct attitude_estimator estimator;
+    struct flight_controller_config controller_config;
+    struct flight_controller controller;
+    struct gyro_filter gyro_filter;
+    /* The gyroscope's and accelerometer's calibrations with the LSM6DSOX's
+     * scales folded in, which is what raw samples are decoded with. See
+     * 'sensor_task_set_imu_calibration()' */
+    struct sensor_calibration gyro_calibration_raw;
+    struct sensor_calibration accel_calibration_raw;
+    /* What the control loops are flying to, as of the latest wake up */
+    struct flight_controller_setpoint setpoint;
+
+    /* The latest sensor data, calibrated. The magnetometer's is the latest
+     * one the IMU samples were fused with */
+    float g_xyz[3]; /* In rad/s */
+    float a_xyz[3]; /* In m/s^2 */
+    float m_xyz[3]; /* In uT */
+    /* The estimate as Euler angles, in radians, updated once per wake up */
+    float roll;
+    float pitch;
+    float yaw;
+    /* The latest motor commands, from 0 to 1 */
+    float motor[FLIGHT_CONTROLLER_NUM_MOTORS];
+    /* The number of estimator updates which went over
+     * ATTITUDE_ESTIMATOR_UPDATE_BUDGET_CYCLES */
+    uint32_t estimator_overruns;
+
+    /* When the last IMU sample was taken, by esp_timer, which is what the
+     * estimator and control loops' time steps and the log's timestamps are
+     * worked out from. Also the average time between samples, what the
+     * gyroscope filters and D-terms are currently tuned for, and when the
+     * LSM6DSOX's clock was last checked */
+    int64_t last_time_us;
+    float sample_period_s;
+    float tuned_sample_period_s;
+    int64_t clock_synced_us;
+
+    /* The batch being processed, decoded to SI units, and its gyroscope
+     * samples again, one row per axis, for the filters to run over as
+     * blocks */
+    struct lsm6dsox_fifo_sample batch[SENSOR_TASK_BATCH_LEN];
+    float batch_g_xyz[SENSOR_TASK_BATCH_LEN][3];
+    float batch_a_xyz[SENSOR_TASK_BATCH_LEN][3];
+    float batch_g_filtered[GYRO_FILTER_NUM_AXES][SENSOR_TASK_BATCH_LEN];
+    float *batch_g_filtered_axes[GYRO_FILTER_NUM_AXES];
+};
+
+
+extern const struct lsm6dsox_fifo_config sensor_task_fifo_i2c;
+extern const struct lsm6dsox_fifo_config sensor_task_fifo_spi;
+extern const struct lsm6dsox_shub_config sensor_task_shub_lis3mdl;
+extern const struct gyro_filter_config sensor_task_gyro_filter_default;
+extern const struct sensor_task_config sensor_task_profile_i2c;
+extern const struct sensor_task_config sensor_task_profile_spi;
+
+
+void sensor_task_init(struct sensor_task *t, const struct sensor_task_config *config, \
+    const struct sensor_task_hooks *hooks, struct i2c_lsm6dsox *lsm6dsox, \
+    struct i2c_lis3mdl *lis3mdl);
+
+esp_err_t sensor_task_begin_sensors(struct sensor_task *t);
+
+void sensor_task_set_imu_calibration(struct sensor_task *t, \
+    const struct sensor_calibration *gyro, const struct sensor_calibration *accel);
+
+esp_err_t sensor_task_begin_loops(struct sensor_task *t);
+
+float sensor_task_loop_period_s(const struct sensor_task *t);
+
+int sensor_task_service(struct sensor_task *t, uint32_t notified, \
+    const struct flight_controller_setpoint *setpoint);
+
+void sensor_task_pack_record(const struct sensor_task *t, \
+    const struct lsm6dsox_fifo_sample *sample, int64_t start_time_us, \
+    struct blackbox_record *record);
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef __SEQLOCK_H_
+#define __SEQLOCK_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+
+/* A sequence lock for sharing a small struct between one writer and any
+ * number of readers, possibly running on different cores, without either side
+ * ever blocking.
+ *
+ * The writer bumps 'sequence' to an odd value, copies the new data in and
+ * bumps it back to an even value. A reader copies the data out and only
+ * accepts the copy if 'sequence' was even and unchanged across the copy,
+ * otherwise it tries again. The writer therefore always runs in constant
+ * time, and a reader only ever repeats its copy if it raced with a write.
+ *
+ * Both copies are done a 32 bit word at a time with relaxed atomic accesses,
+ * so the data must be 4 byte aligned and a multiple of 4 bytes long.
+ *
+ * Note: a reader spins while a write is in progress, so a reader must never
+ * be able to preempt the writer on the writer's own core. Either keep the two
+ * on different cores or give the writer the higher priority. */
+
+
+struct seqlock {
+    uint32_t sequence;
+};
+
+#define SEQLOCK_INITIALIZER { .sequence = 0 }
+
+
+/** Copies 'size' bytes from 'src' into 'shared', which is protected by 'sl'.
+ * Only one task may ever write through a given seqlock. */
+static inline void seqlock_write(struct seqlock *sl, void *shared, \
+    const void *src, size_t size) {
+
+    uint32_t *dst_words = (uint32_t *) shared;
+    const uint32_t *src_words = (const uint32_t *) src;
+    uint32_t seq = __atomic_load_n(&sl->sequence, __ATOMIC_RELAXED);
+
+    /* 1. Mark the data as being written. The fence keeps the stores to the
+     * data from being seen before this one */
+    __atomic_store_n(&sl->sequence, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    /* 2. Copy the new data in */
+    for (size_t i = 0; i < size / sizeof(uint32_t); i++) {
+        __atomic_store_n(&dst_words[i], src_words[i], __ATOMIC_RELAXED);
+    }
+
+    /* 3. Mark the data as consistent again, making sure the stores to the
+     * data are seen before this one */
+    __atomic_store_n(&sl->sequence, seq + 2, __ATOMIC_RELEASE);
+}
+
+
+/** Copies 'size' bytes from 'shared', which is protected by 'sl', into 'dst'.
+ * The copy is guaranteed to be a consistent snapshot of one write. Returns
+ * the number of times the copy had to be retried because it raced with the
+ * writer. */
+static inline uint32_t seqlock_read(const struct seqlock *sl, void *dst, \
+    const void *shared, size_t size) {
+
+    uint32_t *dst_words = (uint32_t *) dst;
+    const uint32_t *src_words = (const uint32_t *) shared;
+    uint32_t retries = 0;
+
+    while (1) {
+        /* 1. Note where the writer is at. The acquire keeps the loads of the
+         * data from being done before this one */
+        uint32_t seq_before = __atomic_load_n(&sl->sequence, __ATOMIC_ACQUIRE);
+
+        /* 2. Copy the data out */
+        if ((seq_before & 1) == 0) {
+            for (size_t i = 0; i < size / sizeof(uint32_t); i++) {
+                dst_words[i] = __atomic_load_n(&src_words[i], __ATOMIC_RELAXED);
+            }
+
+            /* 3. If the writer did not touch the data while we were copying
+             * it, the copy is good. The fence keeps the loads of the data
+             * from being done after this one */
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            uint32_t seq_after = __atomic_load_n(&sl->sequence, __ATOMIC_RELAXED);
+            if (seq_after == seq_before) {
+                return retries;
+            }
+        }
+
+        retries++;
+    }
+}
+
+
+#endif
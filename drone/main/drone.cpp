@@ -3,20 +3,36 @@
 #include <string.h>
 #include <inttypes.h>
 
-#include "esp_hidh_api.h"
 #include "driver/gpio.h"
 #include "driver/i2c_master.h"
 #include "driver/spi_master.h"
+#include "esp_attr.h"
+#include "esp_err.h"
+#include "esp_heap_caps.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
-#include "freertos/semphr.h"
 #include "freertos/task.h"
+#include "nvs_flash.h"
 
 #include "drone.h"
 
 /* Component includes */
 #include "esp32-i2c-lsm6dsox.h"
 #include "esp32-i2c-lis3mdl.h"
+#include "i2c-bus-manager.h"
+#include "attitude-estimator.h"
+#include "flight-controller.h"
+#include "motor-output.h"
+#include "seqlock.h"
+#include "loop-profiler.h"
+#include "sensor-calibration.h"
+#include "blackbox.h"
+#include "rc-link.h"
+#include "rc-control.h"
+#include "rc-link-espnow.h"
+#include "scheduler.h"
+#include "sensor-task.h"
 
 
 /* I2C Defines {{{ */
@@ -24,56 +40,807 @@
 /* Going off  https://learn.adafruit.com/assets/111179 */
 #define I2C_SDA_PIN_NUM 23
 #define I2C_SCL_PIN_NUM 22
+#define I2C_LSM6DSOX_ADDRESS 0x6A
+#define I2C_LIS3MDL_ADDRESS 0x1E
+/* How many transactions can be queued on the bus at once. Anything non-zero
+ * puts the bus in asynchronous mode, which the sensor buses rely on */
+#define I2C_TRANS_QUEUE_DEPTH 4
 /* }}} */
 
+/* SCL speeds to try each sensor at, fastest first. Each runs at the fastest
+ * one it answers reliably at on this airframe's wiring, and drops down the
+ * list if it starts failing in flight. The LSM6DSOX does fast mode plus, the
+ * LIS3MDL tops out at fast mode */
+const uint32_t i2c_lsm6dsox_speeds_hz[] = { 1000000, 400000, 100000 };
+const uint32_t i2c_lis3mdl_speeds_hz[] = { 400000, 100000 };
 
-SemaphoreHandle_t dof_data_semaphore = NULL;
-i2c_master_dev_handle_t *magnetometer_handle;
-i2c_master_dev_handle_t *accelgyro_handle;
-struct i2c_lsm6dsox *i2c_lsm6dsox;
-struct i2c_lis3mdl *i2c_lis3mdl;
-struct dof_data dof_data;
+/* SPI Defines {{{ */
+#define SPI_BUS_HOST SPI2_HOST
+/* SCK and SDI reuse the I2C SCL and SDA wires, since both breakouts take
+ * SPI on the same pins */
+#define SPI_SCLK_PIN_NUM 22
+#define SPI_MOSI_PIN_NUM 23
+#define SPI_MISO_PIN_NUM 19
+#define SPI_LSM6DSOX_CS_PIN_NUM 5
+#define SPI_LIS3MDL_CS_PIN_NUM 18
+/* The fastest clock both sensors support */
+#define SPI_CLOCK_SPEED_HZ 10000000
+/* Both sensors sample on the rising edge of a clock that idles high */
+#define SPI_CLOCK_MODE 3
+/* The longest transaction either driver makes is a full FIFO burst */
+#define SPI_MAX_TRANSFER_LEN (LSM6DSOX_FIFO_MAX_BURST_WORDS * LSM6DSOX_FIFO_WORD_LEN)
+/* }}} */
+
+/* Task Defines {{{ */
+/* When it is interrupt driven, the sensor task runs whenever the sensors
+ * have data, and outranks every scheduled job so that housekeeping can
+ * never hold up the control loop. When it is polled, it is a scheduled job
+ * with a period of SENSOR_TASK_POLL_PERIOD_US instead */
+#define SENSOR_TASK_PRIORITY 10
+#define SENSOR_TASK_STACK_SIZE 20480
+#define SENSOR_TASK_CORE 1
+/* The scheduled jobs are given priorities in this band, rate monotonically */
+#define SCHEDULER_LOWEST_PRIORITY 2
+#define SCHEDULER_HIGHEST_PRIORITY 8
+#define CONSOLE_STACK_SIZE 4096
+/* }}} */
+
+/* Profiling Defines {{{ */
+/* How often the console task moves the sensor task's timings out of the
+ * profiler's ring and checks for commands. The ring holds a little over
+ * LOOP_PROFILER_RING_LEN / 4 samples' worth of timings, so at 1.667kHz this
+ * has to be well under 150ms */
+#define CONSOLE_PERIOD_MS 50
+/* }}} */
+
+/* Calibration Defines {{{ */
+/* How long the drone has to sit still to measure the gyroscope bias, and
+ * in each of the accelerometer's six positions */
+#define CALIBRATION_GYRO_TIME_S 2.0f
+#define CALIBRATION_ACCEL_TIME_S 1.0f
+/* The NVS keys each sensor's calibration is stored under */
+#define CALIBRATION_GYRO_KEY "gyro"
+#define CALIBRATION_ACCEL_KEY "accel"
+#define CALIBRATION_MAG_KEY "mag"
+/* }}} */
+
+/* RC Link Defines {{{ */
+/* How long the drone listens for a remote asking to be paired */
+#define RC_LINK_PAIRING_TIME_S 30
+/* }}} */
+
+/* Blackbox Defines {{{ */
+/* The data partition flight logs are written to (see partitions.csv) */
+#define BLACKBOX_PARTITION_LABEL "blackbox"
+#define BLACKBOX_WRITER_PRIORITY 1
+/* }}} */
+
+/* Which bus the sensors are wired to. Either SENSOR_BUS_I2C or
+ * SENSOR_BUS_SPI */
+const enum sensor_bus_type imu_bus_type = SENSOR_BUS_I2C;
+/* How the sensor task gets its samples, and what it flies with. See
+ * components/sensor-task for the choices. On I2C the FIFO batches at a rate
+ * the bus can keep up with, on SPI at the full ODR */
+const struct sensor_task_config *const sensor_task_config = \
+    (imu_bus_type == SENSOR_BUS_SPI) ? &sensor_task_profile_spi : &sensor_task_profile_i2c;
 
-struct drone_state drone_state = {
-    .pitch = 0.0,
-    .roll = 0.0,
+/* Only used when the sensors are on I2C. The counters in these are the
+ * place to look for a flaky bus */
+struct i2c_bus_manager i2c_bus_manager;
+struct i2c_bus_manager_device i2c_lsm6dsox_device = {
+    .address = I2C_LSM6DSOX_ADDRESS,
+    .speeds_hz = i2c_lsm6dsox_speeds_hz,
+    .num_speeds = sizeof(i2c_lsm6dsox_speeds_hz) / sizeof(i2c_lsm6dsox_speeds_hz[0]),
+    .who_am_i_reg = LSM6DSOX_WHO_AM_I,
+    .who_am_i = LSM6DSOX_WHO_AM_I_VALUE,
 };
-double tick_period_s;
+struct i2c_bus_manager_device i2c_lis3mdl_device = {
+    .address = I2C_LIS3MDL_ADDRESS,
+    .speeds_hz = i2c_lis3mdl_speeds_hz,
+    .num_speeds = sizeof(i2c_lis3mdl_speeds_hz) / sizeof(i2c_lis3mdl_speeds_hz[0]),
+    .who_am_i_reg = LIS3MDL_WHO_AM_I,
+    .who_am_i = LIS3MDL_WHO_AM_I_VALUE,
+};
+/* The drivers' state lives here rather than on the heap, so that nothing the
+ * sensor task touches is allocated at run time */
+struct i2c_lsm6dsox i2c_lsm6dsox;
+struct i2c_lis3mdl i2c_lis3mdl;
+/* Only used when the sensors are on SPI. Each bus builds its transactions in
+ * these, and the SPI DMA reads and writes them directly */
+DMA_ATTR uint8_t lsm6dsox_spi_tx[SENSOR_BUS_SPI_BUFFER_LEN(SPI_MAX_TRANSFER_LEN)];
+DMA_ATTR uint8_t lsm6dsox_spi_rx[SENSOR_BUS_SPI_BUFFER_LEN(SPI_MAX_TRANSFER_LEN)];
+DMA_ATTR uint8_t lis3mdl_spi_tx[SENSOR_BUS_SPI_BUFFER_LEN(SPI_MAX_TRANSFER_LEN)];
+DMA_ATTR uint8_t lis3mdl_spi_rx[SENSOR_BUS_SPI_BUFFER_LEN(SPI_MAX_TRANSFER_LEN)];
+/* The sensor task's loop, and with it the estimator and the control loops.
+ * Only the sensor task touches this */
+struct sensor_task sensor_task;
+/* How much heap was free once the sensor task had finished setting up (0
+ * until then). Everything is allocated by then, so anything taken from the
+ * heap later is a leak or a task allocating in flight */
+size_t heap_free_after_init = 0;
+
+/* The sensor task's stages (see 'enum sensor_task_stage'), as timed by
+ * 'sensor_task_profiler'. 'period' is from one wake up to the next (so its
+ * spread is the jitter), and 'loop' is the time spent awake, which counts as
+ * an overrun if it is longer than the period should be. The others add up to
+ * roughly 'loop' */
+const char *const sensor_task_stage_names[SENSOR_STAGE_COUNT] = {
+    "period", "loop", "bus read", "decode", "filter", "fusion", "control", "output",
+};
+struct loop_profiler sensor_task_profiler;
 
+/* Runs everything that happens at a fixed rate. See the Task Defines */
+struct scheduler scheduler;
+/* The tasks' stacks. The sensor task's is used whether it is a scheduled job
+ * or a task of its own */
+StackType_t sensor_task_stack[SENSOR_TASK_STACK_SIZE];
+StaticTask_t sensor_task_buffer;
+StackType_t console_stack[CONSOLE_STACK_SIZE];
 
-void get_rc_data(void *arg) {
+/* How stale the remote's commands are by the time the sensor task flies
+ * them, recorded in microseconds rather than cycles: the age of each new
+ * command when it is first used, which counts as an overrun if it is older
+ * than a frame period, and the gap since the one before it, which counts as
+ * an overrun if a frame went missing in between */
+enum rc_latency_stage {
+    RC_LATENCY_AGE,
+    RC_LATENCY_GAP,
+    RC_LATENCY_COUNT,
+};
+const char *const rc_latency_stage_names[RC_LATENCY_COUNT] = {
+    "cmd age", "frame gap",
+};
+struct loop_profiler rc_latency_profiler;
 
-    /* Set the frequency of the loop in this function to 3 ticks */
-    const TickType_t taskFrequency = 3;
-    TickType_t lastWakeTime;
+/* The sensors' calibrations in SI units, as stored in NVS. The sensor task
+ * decodes raw samples with the gyroscope's and accelerometer's, with the
+ * sensor's scales folded in */
+struct sensor_calibration gyro_calibration;
+struct sensor_calibration accel_calibration;
+struct sensor_calibration mag_calibration;
 
-    while (1) {
-        /* Update the lastWakeTime variable to have the current time */
-        lastWakeTime = xTaskGetTickCount();
+/* Calibrations are run by the sensor task at the console's request. The
+ * console moves 'calibration_state' on from CALIBRATION_IDLE to one of the
+ * *_REQUESTED states (or from CALIBRATION_MAG_RUNNING to
+ * CALIBRATION_MAG_FINISH), then the sensor task takes it to the matching
+ * *_DONE state, and the console reports and stores the result and puts it
+ * back to idle. Everything below (and the calibrations above) belongs to
+ * whichever of the two is due to move the state on next */
+enum calibration_state {
+    CALIBRATION_IDLE,
+    CALIBRATION_GYRO_REQUESTED,
+    CALIBRATION_GYRO_RUNNING,
+    CALIBRATION_GYRO_DONE,
+    CALIBRATION_ACCEL_REQUESTED,
+    CALIBRATION_ACCEL_RUNNING,
+    CALIBRATION_ACCEL_DONE,
+    CALIBRATION_MAG_REQUESTED,
+    CALIBRATION_MAG_RUNNING,
+    CALIBRATION_MAG_FINISH,
+    CALIBRATION_MAG_DONE,
+};
+uint32_t calibration_state = CALIBRATION_IDLE;
+enum sensor_calibration_result calibration_result;
+/* IMU samples still to be added to 'calibration_stats' */
+uint32_t calibration_samples_left = 0;
+struct sensor_calibration_stats calibration_stats;
+/* The accelerometer positions taken so far */
+struct sensor_calibration_accel accel_positions;
+struct sensor_calibration_mag mag_fit;
+
+/* The flight log. Every IMU sample is logged while it is running */
+struct blackbox blackbox;
+bool blackbox_available = false;
+/* When the sensor task last woke up, and when its last timed stage ended.
+ * Only the sensor task touches these */
+uint32_t sensor_task_wake_cycles = 0;
+uint32_t sensor_task_lap;
+
+/* How the motor commands get to the ESCs */
+const struct motor_output_config *const motor_output_config = &motor_output_dshot600;
+struct motor_output motor_output;
+/* What the flight controller is asked to do. Only the sensor task touches
+ * this, working it out from the remote's commands with
+ * 'update_flight_setpoint()'. Other tasks ask 'drone_armed()' instead */
+struct flight_controller_setpoint flight_setpoint = {
+    .roll = 0.0f,
+    .pitch = 0.0f,
+    .yaw_rate = 0.0f,
+    .throttle = 0.0f,
+    .armed = 0,
+};
+
+/* The copies of the sensor data and drone state that other tasks (and cores)
+ * see. The sensor task is the only writer and publishes to these with
+ * 'publish_sensor_task_state()'; everyone else takes consistent snapshots of
+ * them with 'read_dof_data()' and 'read_drone_state()', without ever
+ * blocking the sensor task */
+struct seqlock shared_dof_data_seqlock = SEQLOCK_INITIALIZER;
+struct dof_data shared_dof_data;
+struct seqlock shared_drone_state_seqlock = SEQLOCK_INITIALIZER;
+struct drone_state shared_drone_state = {
+    .q = { 1.0f, 0.0f, 0.0f, 0.0f },
+    .roll = 0.0f,
+    .pitch = 0.0f,
+    .yaw = 0.0f,
+    .motor = { 0.0f, 0.0f, 0.0f, 0.0f },
+};
+
+/* The link to the remote control. Its frames are checked as they come in,
+ * in the Wi-Fi task, and the latest one is published to 'shared_rc_input'
+ * for the control loop to pick up, so the Wi-Fi task never waits on the
+ * control loop or the other way round */
+struct rc_link_espnow rc_link;
+bool rc_link_available = false;
+/* Only the Wi-Fi task touches this */
+struct rc_link_receiver rc_receiver;
+struct seqlock shared_rc_input_seqlock = SEQLOCK_INITIALIZER;
+struct rc_input shared_rc_input;
+/* When the console stops the drone pairing, in console ticks */
+uint32_t rc_link_pairing_ticks_left = 0;
+
+/* Where the sensor task is with the remote's commands. Its state and
+ * failsafe count are read by the console, the rest only the sensor task
+ * touches */
+struct rc_control rc_control;
+/* When the latest command the sensor task picked up arrived, to time the
+ * gaps between them */
+int64_t rc_last_received_us = 0;
+
+
+/** Whether the drone is armed, or failing safe, as of the sensor task's
+ * latest loop. Can be called from any task. */
+bool drone_armed(void) {
+    return __atomic_load_n(&rc_control.state, __ATOMIC_RELAXED) != RC_CONTROL_DISARMED;
+}
+
+
+/** Copies a consistent snapshot of the latest sensor data into 'out'. Never
+ * blocks, and can be called from any task on either core. */
+void read_dof_data(struct dof_data *out) {
+    seqlock_read(&shared_dof_data_seqlock, out, &shared_dof_data, sizeof(*out));
+}
+
+
+/** Copies a consistent snapshot of the latest drone state into 'out'. Never
+ * blocks, and can be called from any task on either core. */
+void read_drone_state(struct drone_state *out) {
+    seqlock_read(&shared_drone_state_seqlock, out, &shared_drone_state, sizeof(*out));
+}
+
+
+/** Copies a consistent snapshot of the latest command from the remote
+ * control into 'out', and returns how old it is in microseconds, or
+ * INT64_MAX if nothing has arrived yet. Never blocks, and can be called from
+ * any task on either core. */
+int64_t read_rc_input(struct rc_input *out) {
+    seqlock_read(&shared_rc_input_seqlock, out, &shared_rc_input, sizeof(*out));
+    if (out->received_us == 0) {
+        return INT64_MAX;
+    }
+    return esp_timer_get_time() - out->received_us;
+}
+
+
+/* Called from the Wi-Fi task with every message from the paired remote.
+ * Frames that are corrupt, or older than one already published, are counted
+ * and dropped */
+static void receive_rc_frame(const uint8_t *data, size_t len, void *arg) {
+    struct rc_input input;
+    if (rc_link_receive(&rc_receiver, data, len, &input.command) != RC_LINK_OK) {
+        return;
+    }
+    input.received_us = esp_timer_get_time();
+    seqlock_write(&shared_rc_input_seqlock, &shared_rc_input, &input, sizeof(input));
+}
+
+
+/** Publishes the sensor task's latest sensor data and drone state so that the
+ * other tasks can read them. Must only be called by the sensor task. */
+void publish_sensor_task_state(void) {
+    struct dof_data dof_data;
+    memcpy(dof_data.g_xyz, sensor_task.g_xyz, sizeof(dof_data.g_xyz));
+    memcpy(dof_data.a_xyz, sensor_task.a_xyz, sizeof(dof_data.a_xyz));
+    memcpy(dof_data.m_xyz, sensor_task.m_xyz, sizeof(dof_data.m_xyz));
+    seqlock_write(&shared_dof_data_seqlock, &shared_dof_data, &dof_data, sizeof(dof_data));
+
+    struct drone_state drone_state;
+    memcpy(drone_state.q, sensor_task.estimator.q, sizeof(drone_state.q));
+    drone_state.roll = sensor_task.roll;
+    drone_state.pitch = sensor_task.pitch;
+    drone_state.yaw = sensor_task.yaw;
+    memcpy(drone_state.motor, sensor_task.motor, sizeof(drone_state.motor));
+    seqlock_write(&shared_drone_state_seqlock, &shared_drone_state, &drone_state, \
+        sizeof(drone_state));
+}
 
-        /* Update the stored location of the ball */
-        if (xSemaphoreTake(dof_data_semaphore, portMAX_DELAY) == pdTRUE) {
-            ball_p_x = drone_state.ball_p_x;
-            ball_p_y = drone_state.ball_p_y;
 
-            xSemaphoreGive(dof_data_semaphore);
+/** Ends the sensor task's current stage, putting the time since the last
+ * one ended down to 'stage'. Must only be called by the sensor task. */
+static inline void profile_sensor_task(enum sensor_task_stage stage) {
+    sensor_task_lap = loop_profiler_lap(&sensor_task_profiler, stage, sensor_task_lap);
+}
+
+
+/** Has the sensor task decode raw samples with the current gyroscope and
+ * accelerometer calibrations. Must be done whenever either changes. */
+void fold_imu_calibrations(void) {
+    sensor_task_set_imu_calibration(&sensor_task, &gyro_calibration, &accel_calibration);
+}
+
+
+/** Loads every sensor's calibration from NVS. A sensor that has never been
+ * calibrated is left uncorrected. */
+void load_calibrations(void) {
+    const struct {
+        const char *key;
+        struct sensor_calibration *cal;
+    } calibrations[] = {
+        { CALIBRATION_GYRO_KEY, &gyro_calibration },
+        { CALIBRATION_ACCEL_KEY, &accel_calibration },
+        { CALIBRATION_MAG_KEY, &mag_calibration },
+    };
+
+    for (size_t i = 0; i < sizeof(calibrations) / sizeof(calibrations[0]); i++) {
+        sensor_calibration_identity(calibrations[i].cal);
+        esp_err_t err = sensor_calibration_load(calibrations[i].key, calibrations[i].cal);
+        if (err != ESP_OK) {
+            printf("%s not calibrated (%s)\n", calibrations[i].key, esp_err_to_name(err));
         }
+    }
+    fold_imu_calibrations();
+}
 
-        /* Delay such that this loop executes every 'taskFrequency' ticks */
-        vTaskDelayUntil(&lastWakeTime, taskFrequency);
+
+/** Adds one raw IMU sample to the gyroscope or accelerometer calibration
+ * that is running. Must only be called by the sensor task, while
+ * 'calibration_samples_left' is non-zero. */
+void add_calibration_sample(const int16_t *g_raw, const int16_t *a_raw) {
+    /* Calibrations are worked out from the uncorrected readings */
+    float g_rad_s[3];
+    float a_m_s2[3];
+    esp_i2c_lsm6dsox_to_si(&i2c_lsm6dsox, g_raw, a_raw, g_rad_s, a_m_s2);
+
+    if (__atomic_load_n(&calibration_state, __ATOMIC_RELAXED) == CALIBRATION_GYRO_RUNNING) {
+        sensor_calibration_stats_add(&calibration_stats, g_rad_s);
+    } else {
+        sensor_calibration_stats_add(&calibration_stats, a_m_s2);
     }
+    calibration_samples_left--;
 }
 
 
-/** Take a struct containing both pointers to where the 9 DOF sensor data
- * is stored (so it can update it) and game state data so it can adjust
- * it as well */
-void get_9dof_data(void *arg) {
-    /* Set the frequency of the loop in this function to 2 ticks */
-    const TickType_t taskFrequency = 3;
-    TickType_t lastWakeTime;
+/** Starts whichever calibration the console has asked for, and finishes the
+ * running one once it has all the samples it needs, putting it into use
+ * straight away if it worked. Must only be called by the sensor task. */
+void service_calibration(void) {
+    uint32_t state = __atomic_load_n(&calibration_state, __ATOMIC_ACQUIRE);
+    struct sensor_calibration cal;
+
+    switch (state) {
+        case CALIBRATION_GYRO_REQUESTED:
+        case CALIBRATION_ACCEL_REQUESTED: {
+            float time_s = (state == CALIBRATION_GYRO_REQUESTED) ? CALIBRATION_GYRO_TIME_S \
+                : CALIBRATION_ACCEL_TIME_S;
+            sensor_calibration_stats_reset(&calibration_stats);
+            calibration_samples_left = \
+                (uint32_t) (time_s / sensor_task.estimator.config.sample_period_s);
+            __atomic_store_n(&calibration_state, state + 1, __ATOMIC_RELEASE);
+            break;
+        }
+        case CALIBRATION_GYRO_RUNNING:
+            if (calibration_samples_left > 0) {
+                break;
+            }
+            calibration_result = sensor_calibration_gyro_bias(&calibration_stats, &cal);
+            if (calibration_result == SENSOR_CALIBRATION_OK) {
+                gyro_calibration = cal;
+                fold_imu_calibrations();
+            }
+            __atomic_store_n(&calibration_state, CALIBRATION_GYRO_DONE, __ATOMIC_RELEASE);
+            break;
+        case CALIBRATION_ACCEL_RUNNING:
+            if (calibration_samples_left > 0) {
+                break;
+            }
+            calibration_result = sensor_calibration_accel_add_position(&accel_positions, \
+                &calibration_stats);
+            if (calibration_result == SENSOR_CALIBRATION_OK \
+                && sensor_calibration_accel_complete(&accel_positions)) {
+
+                calibration_result = sensor_calibration_accel_solve(&accel_positions, &cal);
+                if (calibration_result == SENSOR_CALIBRATION_OK) {
+                    accel_calibration = cal;
+                    fold_imu_calibrations();
+                }
+            }
+            __atomic_store_n(&calibration_state, CALIBRATION_ACCEL_DONE, __ATOMIC_RELEASE);
+            break;
+        case CALIBRATION_MAG_REQUESTED:
+            sensor_calibration_mag_reset(&mag_fit);
+            __atomic_store_n(&calibration_state, CALIBRATION_MAG_RUNNING, __ATOMIC_RELEASE);
+            break;
+        case CALIBRATION_MAG_FINISH:
+            calibration_result = sensor_calibration_mag_solve(&mag_fit, &cal);
+            if (calibration_result == SENSOR_CALIBRATION_OK) {
+                mag_calibration = cal;
+            }
+            __atomic_store_n(&calibration_state, CALIBRATION_MAG_DONE, __ATOMIC_RELEASE);
+            break;
+        default:
+            break;
+    }
+}
+
+
+/* Moves 'calibration_state' from 'from' to 'to' on the console's behalf,
+ * returning false if it was not in 'from' */
+static bool request_calibration(uint32_t from, uint32_t to) {
+    return __atomic_compare_exchange_n(&calibration_state, &from, to, false, \
+        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+
+static void save_calibration(const char *key, const struct sensor_calibration *cal) {
+    esp_err_t err = sensor_calibration_save(key, cal);
+    if (err != ESP_OK) {
+        printf("could not store %s calibration: %s\n", key, esp_err_to_name(err));
+    }
+}
 
-	/* I2C 9 DOF Initialization {{{ */
+
+/** Reports (and stores) the result of a calibration the sensor task has
+ * finished, if there is one. Must only be called by the console task. */
+void report_calibration(void) {
+    uint32_t state = __atomic_load_n(&calibration_state, __ATOMIC_ACQUIRE);
+    if (state != CALIBRATION_GYRO_DONE && state != CALIBRATION_ACCEL_DONE \
+        && state != CALIBRATION_MAG_DONE) {
+        return;
+    }
+
+    bool ok = calibration_result == SENSOR_CALIBRATION_OK;
+    switch (state) {
+        case CALIBRATION_GYRO_DONE:
+            printf("gyro calibration: %s\n", sensor_calibration_result_str(calibration_result));
+            if (ok) {
+                save_calibration(CALIBRATION_GYRO_KEY, &gyro_calibration);
+            }
+            break;
+        case CALIBRATION_ACCEL_DONE:
+            printf("accel position: %s, %d of %d taken\n", \
+                sensor_calibration_result_str(calibration_result), \
+                __builtin_popcount(accel_positions.taken), SENSOR_CALIBRATION_ACCEL_POSITIONS);
+            if (sensor_calibration_accel_complete(&accel_positions)) {
+                if (ok) {
+                    printf("accel calibration: ok\n");
+                    save_calibration(CALIBRATION_ACCEL_KEY, &accel_calibration);
+                }
+                sensor_calibration_accel_reset(&accel_positions);
+            }
+            break;
+        case CALIBRATION_MAG_DONE:
+            printf("mag calibration: %s (%" PRIu32 " samples)\n", \
+                sensor_calibration_result_str(calibration_result), mag_fit.count);
+            if (ok) {
+                save_calibration(CALIBRATION_MAG_KEY, &mag_calibration);
+            }
+            break;
+    }
+
+    __atomic_store_n(&calibration_state, CALIBRATION_IDLE, __ATOMIC_RELEASE);
+}
+
+
+/** Starts a new flight log, or stops the one being written. Must only be
+ * called by the console task. */
+void toggle_blackbox(void) {
+    if (!blackbox_available) {
+        printf("no blackbox partition\n");
+        return;
+    }
+
+    if (blackbox_stop(&blackbox) == ESP_OK) {
+        printf("blackbox stopped: %" PRIu32 " records, %" PRIu32 " dropped, %" PRIu32 \
+            " bytes\n", blackbox.records, blackbox.dropped, blackbox.bytes);
+        return;
+    }
+    if (drone_armed()) {
+        printf("disarm before starting a log\n");
+        return;
+    }
+
+    struct blackbox_header header;
+    blackbox_header_init(&header, esp_timer_get_time(), \
+        sensor_task.estimator.config.sample_period_s, \
+        sensor_task.estimator.config.kp, sensor_task.estimator.config.ki, \
+        &sensor_task.gyro_calibration_raw, &sensor_task.accel_calibration_raw);
+    esp_err_t err = blackbox_start(&blackbox, &header);
+    if (err == ESP_OK) {
+        printf("blackbox erasing, logging starts once it is done\n");
+    } else {
+        printf("blackbox busy (state %d)\n", (int) blackbox_get_state(&blackbox));
+    }
+}
+
+
+/** Starts listening for a remote asking to be paired, for
+ * RC_LINK_PAIRING_TIME_S, or stops listening early. Must only be called by
+ * the console task. */
+void toggle_rc_link_pairing(void) {
+    if (!rc_link_available) {
+        printf("no rc link\n");
+        return;
+    }
+
+    if (rc_link_espnow_pairing(&rc_link)) {
+        rc_link_espnow_stop_pairing(&rc_link);
+        rc_link_pairing_ticks_left = 0;
+        printf("pairing stopped\n");
+        return;
+    }
+    if (drone_armed()) {
+        printf("disarm before pairing\n");
+        return;
+    }
+
+    rc_link_espnow_start_pairing(&rc_link);
+    rc_link_pairing_ticks_left = RC_LINK_PAIRING_TIME_S * 1000 / CONSOLE_PERIOD_MS;
+    printf("pairing, switch the remote on with its arm switch on\n");
+}
+
+
+/** Stores the remote's address once it has paired, and reports when pairing
+ * succeeds or times out. Must only be called by the console task, every
+ * CONSOLE_PERIOD_MS. */
+void service_rc_link_pairing(void) {
+    if (!rc_link_available) {
+        return;
+    }
+    esp_err_t err = rc_link_espnow_save_peer(&rc_link);
+    if (err != ESP_OK) {
+        printf("storing the remote's address failed: %s\n", esp_err_to_name(err));
+    }
+    if (rc_link_pairing_ticks_left == 0) {
+        return;
+    }
+
+    if (!rc_link_espnow_pairing(&rc_link)) {
+        rc_link_pairing_ticks_left = 0;
+        printf("paired with %02x:%02x:%02x:%02x:%02x:%02x\n", rc_link.peer[0], \
+            rc_link.peer[1], rc_link.peer[2], rc_link.peer[3], rc_link.peer[4], \
+            rc_link.peer[5]);
+    } else if (--rc_link_pairing_ticks_left == 0) {
+        rc_link_espnow_stop_pairing(&rc_link);
+        printf("no remote asked to pair\n");
+    }
+}
+
+
+/** Prints the state of the link to the remote control. Must only be called
+ * by the console task. */
+void print_rc_link(void) {
+    if (!rc_link_available) {
+        printf("no rc link\n");
+        return;
+    }
+    if (!rc_link_espnow_paired(&rc_link)) {
+        printf("rc link not paired\n");
+        return;
+    }
+
+    static const char *const state_names[] = { "disarmed", "armed", "failsafe" };
+    struct rc_input input;
+    int64_t age_us = read_rc_input(&input);
+    printf("rc link: %" PRIu32 " frames, %" PRIu32 " lost, %" PRIu32 " stale, %" PRIu32 \
+        " corrupt, %" PRIu32 " ignored\n", rc_receiver.frames, rc_receiver.lost, \
+        rc_receiver.stale, rc_receiver.corrupt, rc_link.ignored);
+    printf("%s, %" PRIu32 " failsafes\n", \
+        state_names[__atomic_load_n(&rc_control.state, __ATOMIC_RELAXED)], \
+        __atomic_load_n(&rc_control.failsafes, __ATOMIC_RELAXED));
+    if (age_us != INT64_MAX) {
+        printf("last frame %" PRId64 "ms ago: roll %.2f pitch %.2f yaw %.2f throttle %.2f" \
+            " flags 0x%02x\n", age_us / 1000, input.command.roll, input.command.pitch, \
+            input.command.yaw, input.command.throttle, input.command.flags);
+    }
+    loop_profiler_dump(&rc_latency_profiler, stdout);
+}
+
+
+/** Prints how much heap is free, and how much less that is than once the
+ * sensor task was set up. The sensor state, buffers and task stacks are all
+ * static, so this should stay at 0 bar what the Wi-Fi driver takes and gives
+ * back for its frames. Must only be called by the console task. */
+void print_heap(void) {
+    size_t free_now = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    size_t free_after_init = __atomic_load_n(&heap_free_after_init, __ATOMIC_ACQUIRE);
+    printf("heap: %u bytes free, %u at worst\n", (unsigned) free_now, \
+        (unsigned) heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT));
+    if (free_after_init == 0) {
+        printf("sensor task still setting up\n");
+    } else {
+        printf("taken since setup: %d bytes\n", (int) free_after_init - (int) free_now);
+    }
+}
+
+
+/** Looks after the console. Runs as a scheduled job every CONSOLE_PERIOD_MS,
+ * collecting the sensor task's timings and reporting finished calibrations,
+ * and acts on single key commands:
+ *
+ *   e/d  start/stop timing the sensor task
+ *   p    print the timings so far, and the scheduled jobs' deadline misses
+ *   r    forget the timings so far
+ *   g    measure the gyroscope bias (keep the drone still)
+ *   a    take one of the accelerometer's six positions (each axis straight
+ *        up, then straight down, held still)
+ *   m    start fitting the magnetometer (turn the drone every which way),
+ *        then m again to finish
+ *   l    start a new flight log (erasing the old one), or stop the one
+ *        being written
+ *   b    listen for a remote asking to be paired, or stop listening
+ *   i    print the state of the link to the remote, and how stale its
+ *        commands are by the time they are flown
+ *   h    print how much heap has been taken since the sensor task was set
+ *        up (see 'print_heap()')
+ *
+ * Calibrations are only run while disarmed, and are stored in NVS as soon as
+ * they succeed. Flight logs can only be started while disarmed too, since
+ * erasing the flash stalls both cores.
+ */
+void console(void *arg) {
+    loop_profiler_collect(&sensor_task_profiler);
+    loop_profiler_collect(&rc_latency_profiler);
+    report_calibration();
+    service_rc_link_pairing();
+
+    int c = getchar();
+    if (c == EOF) {
+        clearerr(stdin);
+        return;
+    }
+    switch (c) {
+        case 'e':
+            loop_profiler_enable(&sensor_task_profiler, true);
+            printf("profiling on\n");
+            break;
+        case 'd':
+            loop_profiler_enable(&sensor_task_profiler, false);
+            printf("profiling off\n");
+            break;
+        case 'p':
+            loop_profiler_dump(&sensor_task_profiler, stdout);
+            printf("estimator overruns: %" PRIu32 "\n", sensor_task.estimator_overruns);
+            printf("gyro notch: %.0f %.0f %.0f Hz\n", sensor_task.gyro_filter.dyn_notch_hz[0], \
+                sensor_task.gyro_filter.dyn_notch_hz[1], sensor_task.gyro_filter.dyn_notch_hz[2]);
+            scheduler_dump(&scheduler, stdout);
+            break;
+        case 'r':
+            loop_profiler_reset(&sensor_task_profiler);
+            scheduler_reset_stats(&scheduler);
+            printf("profile reset\n");
+            break;
+        case 'g':
+        case 'a':
+        case 'm':
+            if (drone_armed()) {
+                printf("disarm before calibrating\n");
+            } else if (c == 'g' && request_calibration(CALIBRATION_IDLE, \
+                CALIBRATION_GYRO_REQUESTED)) {
+                printf("measuring gyro bias, keep still\n");
+            } else if (c == 'a' && request_calibration(CALIBRATION_IDLE, \
+                CALIBRATION_ACCEL_REQUESTED)) {
+                printf("measuring accel position, keep still\n");
+            } else if (c == 'm' && request_calibration(CALIBRATION_IDLE, \
+                CALIBRATION_MAG_REQUESTED)) {
+                printf("turn the drone every which way, then press m again\n");
+            } else if (c == 'm' && request_calibration(CALIBRATION_MAG_RUNNING, \
+                CALIBRATION_MAG_FINISH)) {
+                printf("fitting mag\n");
+            } else {
+                printf("calibration already running\n");
+            }
+            break;
+        case 'l':
+            toggle_blackbox();
+            break;
+        case 'b':
+            toggle_rc_link_pairing();
+            break;
+        case 'i':
+            print_rc_link();
+            break;
+        case 'h':
+            print_heap();
+            break;
+        default:
+            break;
+    }
+}
+
+
+/** Picks up the remote's latest command and works out the setpoint from it
+ * with 'rc_control_update()'. Runs once per sensor task loop, so a command is
+ * flown at most one loop period after it arrives. */
+void update_flight_setpoint(void) {
+    struct rc_input input;
+    read_rc_input(&input);
+    int64_t now_us = esp_timer_get_time();
+
+    if (input.received_us != 0 && input.received_us != rc_last_received_us) {
+        loop_profiler_record(&rc_latency_profiler, RC_LATENCY_AGE, \
+            (uint32_t) (now_us - input.received_us));
+        if (rc_last_received_us != 0) {
+            loop_profiler_record(&rc_latency_profiler, RC_LATENCY_GAP, \
+                (uint32_t) (input.received_us - rc_last_received_us));
+        }
+        rc_last_received_us = input.received_us;
+    }
+
+    /* Calibrating, erasing the flash for a log and pairing all get in the
+     * way of flying, so none of them can be running for the drone to arm */
+    bool can_arm = __atomic_load_n(&calibration_state, __ATOMIC_RELAXED) == CALIBRATION_IDLE \
+        && !(blackbox_available && blackbox_get_state(&blackbox) == BLACKBOX_ERASING) \
+        && !(rc_link_available && rc_link_espnow_pairing(&rc_link));
+    rc_control_update(&rc_control, &input.command, input.received_us, now_us, can_arm, \
+        &flight_setpoint);
+}
+
+
+/* The sensor task's hooks. Takes a magnetometer sample as it came off the
+ * LIS3MDL, adds it to the fit if the magnetometer is being calibrated and
+ * corrects it */
+static void sensor_task_magnetometer_sample(void *arg, float *m_xyz) {
+    uint32_t state = __atomic_load_n(&calibration_state, __ATOMIC_RELAXED);
+    if (state == CALIBRATION_MAG_RUNNING || state == CALIBRATION_MAG_FINISH) {
+        sensor_calibration_mag_add(&mag_fit, m_xyz);
+    }
+    sensor_calibration_apply(&mag_calibration, m_xyz, m_xyz);
+}
+
+
+/* Adds an IMU sample the sensor task has just flown to the calibration that
+ * is running, and logs it */
+static void sensor_task_imu_sample(void *arg, const struct lsm6dsox_fifo_sample *sample) {
+    if (calibration_samples_left > 0) {
+        add_calibration_sample(sample->g_raw, sample->a_raw);
+    }
+    if (blackbox_wants_records(&blackbox)) {
+        struct blackbox_record record;
+        sensor_task_pack_record(&sensor_task, sample, blackbox_start_time_us(&blackbox), \
+            &record);
+        blackbox_log(&blackbox, &record);
+        profile_sensor_task(SENSOR_STAGE_OUTPUT);
+    }
+}
+
+
+static void sensor_task_motor_output(void *arg, const float *motor) {
+    motor_output_write(&motor_output, motor);
+}
+
+
+static void sensor_task_stage_done(void *arg, enum sensor_task_stage stage) {
+    profile_sensor_task(stage);
+}
+
+
+const struct sensor_task_hooks sensor_task_hooks = {
+    .ctx = NULL,
+    .stage_done = sensor_task_stage_done,
+    .read_started = NULL,
+    .read_finished = NULL,
+    .magnetometer_sample = sensor_task_magnetometer_sample,
+    .imu_sample = sensor_task_imu_sample,
+    .motor_output = sensor_task_motor_output,
+};
+
+
+/** Brings up the I2C master bus, adds both sensors to it at their I2C
+ * addresses and the fastest speeds they work at, and points their drivers'
+ * buses at them. From here on, a failed transaction clears the bus and is
+ * retried rather than being handed to the drivers. The LIS3MDL is left out
+ * if it is behind the sensor hub. */
+void init_i2c_sensor_buses(void) {
     /* 1. Configure the i2c master bus */
 	i2c_master_bus_config_t i2c_mst_config = {
 		.clk_source = I2C_CLK_SRC_DEFAULT,
@@ -81,141 +848,239 @@ void get_9dof_data(void *arg) {
 		.scl_io_num = I2C_SCL_PIN_NUM,
 		.sda_io_num = I2C_SDA_PIN_NUM,
 		.glitch_ignore_cnt = 7,
+		.trans_queue_depth = I2C_TRANS_QUEUE_DEPTH,
 		.flags.enable_internal_pullup = false
 	};
 
-	i2c_master_bus_handle_t bus_handle;
-	ESP_ERROR_CHECK(i2c_new_master_bus(&i2c_mst_config, &bus_handle));
+	ESP_ERROR_CHECK(i2c_bus_manager_init(&i2c_bus_manager, &i2c_mst_config, \
+        I2C_BUS_MANAGER_DEFAULT_RETRIES, SENSOR_BUS_DEFAULT_TIMEOUT_MS));
 
-	/* 2. Configure the LIS3MDL (magnetometer) */
-	i2c_device_config_t magnetometer_cfg = {
-		.dev_addr_length = I2C_ADDR_BIT_LEN_7,
-		.device_address = 0x1E,
-		.scl_speed_hz = 100000,
-	};
+	/* 2. Add the LSM6DSOX (accelerometer + gyroscope) */
+	ESP_ERROR_CHECK(i2c_bus_manager_add_device(&i2c_bus_manager, &i2c_lsm6dsox_device, \
+        &i2c_lsm6dsox.bus));
+    printf("lsm6dsox at %" PRIu32 "Hz\n", i2c_bus_manager_speed_hz(&i2c_lsm6dsox_device));
 
-	magnetometer_handle = malloc(sizeof(i2c_master_dev_handle_t));
-	ESP_ERROR_CHECK(i2c_master_bus_add_device(bus_handle, &magnetometer_cfg, \
-        magnetometer_handle));
+	/* 3. Add the LIS3MDL (magnetometer) */
+    if (sensor_task_config->magnetometer_link == MAGNETOMETER_DIRECT) {
+        ESP_ERROR_CHECK(i2c_bus_manager_add_device(&i2c_bus_manager, &i2c_lis3mdl_device, \
+            &i2c_lis3mdl.bus));
+        printf("lis3mdl at %" PRIu32 "Hz\n", i2c_bus_manager_speed_hz(&i2c_lis3mdl_device));
+    }
+}
 
-	/* 3. Configure the LSM6DSOX (accelerometer + gyroscope) */
-	i2c_device_config_t accelgyro_cfg = {
-		.dev_addr_length = I2C_ADDR_BIT_LEN_7,
-		.device_address = 0x6A,
-		.scl_speed_hz = 100000,
-	};
 
-	accelgyro_handle = malloc(sizeof(i2c_master_dev_handle_t));
-	ESP_ERROR_CHECK(i2c_master_bus_add_device(bus_handle, &accelgyro_cfg, \
-        accelgyro_handle));
-    printf("about to initialize i2c devs\n");
-
-    /* 4a. Turn on and set operation control for accelerometer and gyro */
-    i2c_lsm6dsox = malloc(sizeof(struct i2c_lsm6dsox));
-    i2c_lsm6dsox->i2c_handle = accelgyro_handle;
-    esp_i2c_lsm6dsox_begin(i2c_lsm6dsox);
-    printf("I2C lsm6dsox initialized\n");
-    /* 4b. Turn on and set operation control for magnetometer */
-    i2c_lis3mdl = malloc(sizeof(struct i2c_lis3mdl));
-    i2c_lis3mdl->i2c_handle = magnetometer_handle;
-    /* esp_i2c_lis3mdl_begin(i2c_lis3mdl); */
-    printf("I2C lis3mdl initialized\n");
-    /* }}} */
+/** Brings up the SPI bus, adds both sensors to it on their own chip select
+ * lines and points their drivers' buses at them. Transactions are queued and
+ * moved by DMA, so a whole FIFO burst costs the CPU almost nothing. The
+ * LIS3MDL is left out if it is behind the sensor hub. */
+void init_spi_sensor_buses(void) {
+    /* 1. Configure the SPI bus */
+    spi_bus_config_t spi_bus_config = {
+        .mosi_io_num = SPI_MOSI_PIN_NUM,
+        .miso_io_num = SPI_MISO_PIN_NUM,
+        .sclk_io_num = SPI_SCLK_PIN_NUM,
+        .quadwp_io_num = -1,
+        .quadhd_io_num = -1,
+        .max_transfer_sz = SENSOR_BUS_SPI_BUFFER_LEN(SPI_MAX_TRANSFER_LEN),
+    };
+    ESP_ERROR_CHECK(spi_bus_initialize(SPI_BUS_HOST, &spi_bus_config, SPI_DMA_CH_AUTO));
+
+    /* 2. Configure the LIS3MDL (magnetometer) and hand it to its driver. It
+     * has to be asked to auto-increment in every address */
+    if (sensor_task_config->magnetometer_link == MAGNETOMETER_DIRECT) {
+        spi_device_interface_config_t magnetometer_cfg = {
+            .mode = SPI_CLOCK_MODE,
+            .clock_speed_hz = SPI_CLOCK_SPEED_HZ,
+            .spics_io_num = SPI_LIS3MDL_CS_PIN_NUM,
+            .queue_size = 1,
+            .post_cb = sensor_bus_spi_post_cb,
+        };
+        spi_device_handle_t magnetometer_spi_handle;
+        ESP_ERROR_CHECK(spi_bus_add_device(SPI_BUS_HOST, &magnetometer_cfg, \
+            &magnetometer_spi_handle));
+        ESP_ERROR_CHECK(sensor_bus_init_spi(&i2c_lis3mdl.bus, magnetometer_spi_handle, \
+            LIS3MDL_SPI_AUTO_INCREMENT, lis3mdl_spi_tx, lis3mdl_spi_rx, SPI_MAX_TRANSFER_LEN, \
+            SENSOR_BUS_DEFAULT_TIMEOUT_MS));
+    }
+
+    /* 3. Configure the LSM6DSOX (accelerometer + gyroscope) */
+    spi_device_interface_config_t accelgyro_cfg = {
+        .mode = SPI_CLOCK_MODE,
+        .clock_speed_hz = SPI_CLOCK_SPEED_HZ,
+        .spics_io_num = SPI_LSM6DSOX_CS_PIN_NUM,
+        .queue_size = 1,
+        .post_cb = sensor_bus_spi_post_cb,
+    };
+    spi_device_handle_t accelgyro_spi_handle;
+    ESP_ERROR_CHECK(spi_bus_add_device(SPI_BUS_HOST, &accelgyro_cfg, \
+        &accelgyro_spi_handle));
 
+    /* 4. Hand it to its driver. The LSM6DSOX auto-increments by itself
+     * (IF_INC) */
+    ESP_ERROR_CHECK(sensor_bus_init_spi(&i2c_lsm6dsox.bus, accelgyro_spi_handle, 0, \
+        lsm6dsox_spi_tx, lsm6dsox_spi_rx, SPI_MAX_TRANSFER_LEN, SENSOR_BUS_DEFAULT_TIMEOUT_MS));
+}
+
+
+/** Brings up the sensors, the attitude estimator and the flight controller.
+ * Runs in the sensor task before its first iteration, so that the buses'
+ * and sensors' interrupts are handled on the sensor task's core. */
+void sensor_task_begin(void *arg) {
+    sensor_task_init(&sensor_task, sensor_task_config, &sensor_task_hooks, &i2c_lsm6dsox, \
+        &i2c_lis3mdl);
+
+    /* 1. Set up the bus the sensors are on and point their drivers at it */
+    if (imu_bus_type == SENSOR_BUS_SPI) {
+        init_spi_sensor_buses();
+    } else {
+        init_i2c_sensor_buses();
+    }
+
+    /* 2. Bring the sensors up, and have them wake this task */
+    ESP_ERROR_CHECK(sensor_task_begin_sensors(&sensor_task));
+    printf("9 dof devs initialized\n");
+
+    /* 3. Correct the sensors with whatever calibrations were stored the last
+     * time they were calibrated, including the samples the estimator is
+     * aligned with */
+    load_calibrations();
+    ESP_ERROR_CHECK(sensor_task_begin_loops(&sensor_task));
+    publish_sensor_task_state();
+
+    /* 4. Anything longer than the time between wake ups counts as a loop
+     * overrun */
+    loop_profiler_set_budget(&sensor_task_profiler, SENSOR_STAGE_LOOP, \
+        (uint32_t) (sensor_task_loop_period_s(&sensor_task) \
+            * CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ * 1e6f));
+    __atomic_store_n(&heap_free_after_init, heap_caps_get_free_size(MALLOC_CAP_DEFAULT), \
+        __ATOMIC_RELEASE);
     printf("About to start data loop\n");
+}
+
+
+/** Runs one iteration of the sensor task: picks up the remote's latest
+ * command, services whichever sensors are set in 'notified', and publishes
+ * the results. */
+void sensor_task_iterate(uint32_t notified) {
+    sensor_task_wake_cycles = loop_profiler_lap(&sensor_task_profiler, SENSOR_STAGE_PERIOD, \
+        sensor_task_wake_cycles);
+    sensor_task_lap = sensor_task_wake_cycles;
+    update_flight_setpoint();
+    sensor_task_service(&sensor_task, notified, &flight_setpoint);
+
+    /* Let the other tasks see the new data */
+    publish_sensor_task_state();
+    profile_sensor_task(SENSOR_STAGE_OUTPUT);
+    service_calibration();
+    loop_profiler_lap(&sensor_task_profiler, SENSOR_STAGE_LOOP, sensor_task_wake_cycles);
+}
+
+
+/** The sensor task's scheduled job when the sensors are polled: reads
+ * whatever they have every SENSOR_TASK_POLL_PERIOD_US. */
+void poll_sensors(void *arg) {
+    sensor_task_iterate(SENSOR_TASK_NOTIFY_ALL);
+}
+
+
+/** The sensor task when the sensors are interrupt driven: sleeps until one
+ * of them says it has new data, so the sensors' own clocks set the pace
+ * rather than any timer. */
+void get_9dof_data(void *arg) {
+    sensor_task_begin(arg);
 
     while (1) {
-        /* Update the lastWakeTime variable to have the current time */
-        lastWakeTime = xTaskGetTickCount();
-
-        /* esp_i2c_lsm6dsox_get_gyro_data(i2c_lsm6dsox, dof_data.g_xyz); */
-        /* /1* float g_x = esp_i2c_lsm6dsox_get_gyro_x(i2c_lsm6dsox); *1/ */
-        /* /1* float g_y = esp_i2c_lsm6dsox_get_gyro_y(i2c_lsm6dsox); *1/ */
-        /* /1* float g_z = esp_i2c_lsm6dsox_get_gyro_z(i2c_lsm6dsox); *1/ */
-        /* /1* Convert from mdps (millidegrees per second) to dps (degrees per second) *1/ */
-        /* dof_data.g_xyz[0] /= 1000; */
-        /* dof_data.g_xyz[1] /= 1000; */
-        /* dof_data.g_xyz[2] /= 1000; */
-
-        esp_i2c_lsm6dsox_get_accel_data(i2c_lsm6dsox, dof_data.a_xyz);
-        /* Convert from mg (milligravity, not milligrams) to g (gravity)
-            * -> /= 1000
-            * Convert from g to m/s^2 (on earth at sea leavel)
-            * -> *= 9.81
-            * Combining both operations
-            * -> /= (1000 / 9.81) -> /= 101.94 */
-        drone_state.ball_a_x = dof_data.a_xyz[0] / 101.94;
-        drone_state.ball_a_y = dof_data.a_xyz[1] / 101.94;
-        drone_state.ball_a_z = dof_data.a_xyz[2] / 101.94;
-        /* double acc_z = dof_data.a_xyz[2] / 101.94; */
-
-        /* esp_i2c_lis3mdl_get_data(i2c_lis3mdl, t->dof_data.m_xyz); */
-
-
-        /* For my scenario I decided that:
-            * pitch = rotation around the x axis (will affect the y coord)
-            * roll = rotation around the y axis (will affect the x coord)
-            */
-
-        // TODO: problem?: these calculations don't generate NaN's for the
-        // pitch and roll, but they don't differentiate between 85 deg and
-        // what would be 95 deg - they both just end up as 85
-        drone_state.pitch = \
-            atan(drone_state.ball_a_y / sqrt(drone_state.ball_a_x * drone_state.ball_a_x + acc_z * acc_z));
-        drone_state.roll = \
-            atan(drone_state.ball_a_x / sqrt(drone_state.ball_a_y * drone_state.ball_a_y + acc_z * acc_z));
-		// TODO: there's a problem with these derivations: one of them gives
-		// NaN when the IMU is close to 90 degrees rotated around one axis
-        /* drone_state.pitch = atan2(drone_state.ball_a_y, acc_z); */
-        /* drone_state.roll = asin(drone_state.ball_a_x / gravity_constant); */
-
-        /* printf("pitch: (% #3.2lf°)    roll: (% #3.2lf°)\n", \ */
-        /*     drone_state.pitch * 57.2958, drone_state.roll * 57.2958); */
-
-        if (xSemaphoreTake(dof_data_semaphore, portMAX_DELAY) == pdTRUE) {
-            drone_state.ball_p_x += drone_state.ball_v_x / pixel_width;
-            drone_state.ball_p_y += drone_state.ball_v_y / pixel_width;
-
-            xSemaphoreGive(dof_data_semaphore);
-        }
+        uint32_t notified = 0;
+        if (xTaskNotifyWait(0, UINT32_MAX, &notified, \
+            pdMS_TO_TICKS(SENSOR_TASK_INTERRUPT_TIMEOUT_MS)) == pdFALSE) {
 
-        /* Delay such that this loop executes every 'taskFrequency' ticks */
-        vTaskDelayUntil(&lastWakeTime, taskFrequency);
+            /* Nothing arrived in time. Service both sensors anyway, which
+             * also clears their interrupt lines if we somehow got out of
+             * step with them */
+            notified = SENSOR_TASK_NOTIFY_ALL;
+        }
+        sensor_task_iterate(notified);
     }
 }
 
 
+const struct scheduler_job_config sensor_job_config = {
+    .name = "get_9dof_data",
+    .period_us = SENSOR_TASK_POLL_PERIOD_US,
+    .core = SENSOR_TASK_CORE,
+    .stack = sensor_task_stack,
+    .stack_size = SENSOR_TASK_STACK_SIZE,
+    .begin = sensor_task_begin,
+    .run = poll_sensors,
+    .arg = NULL,
+};
+const struct scheduler_job_config console_job_config = {
+    .name = "console",
+    .period_us = CONSOLE_PERIOD_MS * 1000,
+    .core = 0,
+    .stack = console_stack,
+    .stack_size = CONSOLE_STACK_SIZE,
+    .begin = NULL,
+    .run = console,
+    .arg = NULL,
+};
+
+
 void app_main(void) {
-    /* This is used to adjust physics calculations performed using m/s or m/s^2
-     * for our data which will be tied to the tick rate of the ESP32 and
-     * the frequency of the task in ticks */
-    tick_period_s = portTICK_PERIOD_MS / 1000.0;
-
-    dof_data.g_xyz = malloc(sizeof(float) * 3);
-    dof_data.g_xyz[0] = 0.0f;
-    dof_data.g_xyz[1] = 0.0f;
-    dof_data.g_xyz[2] = 0.0f;
-
-    dof_data.a_xyz = malloc(sizeof(float) * 3);
-    dof_data.a_xyz[0] = 0.0f;
-    dof_data.a_xyz[1] = 0.0f;
-    dof_data.a_xyz[2] = 0.0f;
-
-    dof_data.m_xyz = malloc(sizeof(float) * 3);
-    dof_data.m_xyz[0] = 0.0f;
-    dof_data.m_xyz[1] = 0.0f;
-    dof_data.m_xyz[2] = 0.0f;
-
-    vSemaphoreCreateBinary(dof_data_semaphore);
-    if (dof_data_semaphore == NULL) {
-        printf("ERROR: creating semaphore!\n");
-    }
-
-    TaskHandle_t get_rc_data_task;
-    TaskHandle_t get_9dof_data_task;
-
-    xTaskCreatePinnedToCore(get_rc_data, "get_rc_data", 20480, \
-        (void *)NULL, 10, &get_rc_data_task, 0);
-    xTaskCreatePinnedToCore(get_9dof_data, "get_9dof_data", 20480, \
-        (void *)NULL, 10, &get_9dof_data_task, 1);
+    /* The sensor calibrations are kept in NVS. If the partition is full or
+     * was written by a different version of the ESP-IDF, start it over (the
+     * sensors then just need calibrating again) */
+    esp_err_t err = nvs_flash_init();
+    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        err = nvs_flash_init();
+    }
+    ESP_ERROR_CHECK(err);
+
+    /* Flight logs are started from the console */
+    err = blackbox_init(&blackbox, BLACKBOX_PARTITION_LABEL, BLACKBOX_WRITER_PRIORITY, 0);
+    if (err == ESP_OK) {
+        blackbox_available = true;
+    } else {
+        printf("blackbox unavailable: %s\n", esp_err_to_name(err));
+    }
+
+    /* The remote control's frames come in over ESP-NOW, from the remote
+     * it was last paired with */
+    rc_link_receiver_init(&rc_receiver);
+    rc_control_init(&rc_control);
+    err = rc_link_espnow_begin(&rc_link, RC_LINK_ESPNOW_DRONE, receive_rc_frame, NULL);
+    if (err == ESP_OK) {
+        rc_link_available = true;
+    } else {
+        printf("rc link unavailable: %s\n", esp_err_to_name(err));
+    }
+
+    /* The sensor task's timings are there to be switched on from the
+     * console, and cost next to nothing until then */
+    loop_profiler_init(&sensor_task_profiler, sensor_task_stage_names, SENSOR_STAGE_COUNT, \
+        CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ);
+    /* The remote's latency is always measured, so it can be checked before
+     * flying without having to remember to switch it on */
+    loop_profiler_init(&rc_latency_profiler, rc_latency_stage_names, RC_LATENCY_COUNT, 1);
+    loop_profiler_set_budget(&rc_latency_profiler, RC_LATENCY_AGE, RC_LINK_PERIOD_US);
+    loop_profiler_set_budget(&rc_latency_profiler, RC_LATENCY_GAP, RC_LINK_PERIOD_US * 3 / 2);
+    loop_profiler_enable(&rc_latency_profiler, true);
+
+    /* Get the ESCs a stop command before anything else, so they arm at zero
+     * throttle rather than seeing a floating pin */
+    ESP_ERROR_CHECK(motor_output_begin(&motor_output, motor_output_config));
+
+    /* The sensor task either paces itself off the sensors' interrupts, or
+     * is polled alongside the other scheduled jobs */
+    scheduler_init(&scheduler, SCHEDULER_LOWEST_PRIORITY, SCHEDULER_HIGHEST_PRIORITY);
+    if (sensor_task_config->sampling_mode == IMU_SAMPLING_POLLED) {
+        ESP_ERROR_CHECK(scheduler_add(&scheduler, &sensor_job_config));
+    } else {
+        xTaskCreateStaticPinnedToCore(get_9dof_data, "get_9dof_data", SENSOR_TASK_STACK_SIZE, \
+            (void *)NULL, SENSOR_TASK_PRIORITY, sensor_task_stack, &sensor_task_buffer, \
+            SENSOR_TASK_CORE);
+    }
+    ESP_ERROR_CHECK(scheduler_add(&scheduler, &console_job_config));
+    ESP_ERROR_CHECK(scheduler_start(&scheduler));
 }
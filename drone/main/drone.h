@@ -3,22 +3,51 @@
 
 #include <inttypes.h>
 
-#include "freertos/semphr.h"
-
 #include "esp32-i2c-lsm6dsox.h"
 #include "esp32-i2c-lis3mdl.h"
+#include "attitude-estimator.h"
+#include "flight-controller.h"
+#include "motor-output.h"
+#include "seqlock.h"
+#include "rc-link.h"
 
 
 struct dof_data {
-	float *g_xyz;
-	float *a_xyz;
-	float *m_xyz;
+	float g_xyz[3]; /* In rad/s */
+	float a_xyz[3]; /* In m/s^2 */
+	float m_xyz[3]; /* In uT */
 };
 
 struct drone_state {
-	double pitch; /* These are stored in Radians */
-	double roll;
+    /* The orientation from the attitude estimator, as a quaternion rotating
+     * body frame vectors into the earth frame */
+    float q[4];
+    /* The same orientation as Euler angles. These are stored in Radians */
+	float roll; /* Rotation around the x axis */
+	float pitch; /* Rotation around the y axis */
+	float yaw; /* Rotation around the z axis */
+    /* The latest motor commands from the flight controller, from 0 to 1,
+     * indexed by FLIGHT_CONTROLLER_MOTOR_* */
+    float motor[FLIGHT_CONTROLLER_NUM_MOTORS];
 };
 
 
+/* The latest command from the remote control */
+struct rc_input {
+    struct rc_link_command command;
+    /* When it arrived, in microseconds since boot ('esp_timer_get_time()').
+     * 0 if nothing has arrived yet */
+    int64_t received_us;
+};
+
+
+bool drone_armed(void);
+
+void read_dof_data(struct dof_data *out);
+
+void read_drone_state(struct drone_state *out);
+
+int64_t read_rc_input(struct rc_input *out);
+
+
 #endif
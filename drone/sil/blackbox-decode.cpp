@@ -0,0 +1,183 @@
+/* Decodes a blackbox log (see components/blackbox/blackbox-format.h) into a
+ * CSV file, one line per logged sample. With --replay, the logged IMU samples
+ * are also fed back through the attitude estimator, set up from the log's
+ * header, and the replayed attitude is compared against the logged one:
+ *
+ *   ./build-sil/blackbox-decode flight.bbx > flight.csv
+ *   ./build-sil/blackbox-decode --replay flight.bbx > replay.csv */
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "attitude-estimator.h"
+#include "blackbox-format.h"
+#include "sensor-calibration.h"
+
+
+static void usage(const char *argv0) {
+    fprintf(stderr, \
+        "Usage: %s [--replay] LOG\n" \
+        "  --replay         run the logged samples back through the attitude estimator\n", argv0);
+    exit(1);
+}
+
+
+/* Reads all of 'path' into memory */
+static uint8_t *read_file(const char *path, size_t *len) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        perror(path);
+        return NULL;
+    }
+    size_t capacity = 1 << 16;
+    uint8_t *data = (uint8_t *) malloc(capacity);
+    *len = 0;
+    size_t n;
+    while ((n = fread(&data[*len], 1, capacity - *len, file)) > 0) {
+        *len += n;
+        if (*len == capacity) {
+            capacity *= 2;
+            data = (uint8_t *) realloc(data, capacity);
+        }
+    }
+    fclose(file);
+    return data;
+}
+
+
+/* The angle between two attitude quaternions, in radians. A logged one is
+ * rounded to Q14, so neither is assumed to be of unit length, and the angle
+ * is worked out with atan2 since acos loses all precision near 0 */
+static double quaternion_angle(const float *p, const float *q) {
+    /* The rotation from one to the other is conj(q) * p */
+    double w = (double) q[0] * p[0] + (double) q[1] * p[1] + (double) q[2] * p[2] \
+        + (double) q[3] * p[3];
+    double x = (double) q[0] * p[1] - (double) q[1] * p[0] - (double) q[2] * p[3] \
+        + (double) q[3] * p[2];
+    double y = (double) q[0] * p[2] + (double) q[1] * p[3] - (double) q[2] * p[0] \
+        - (double) q[3] * p[1];
+    double z = (double) q[0] * p[3] - (double) q[1] * p[2] + (double) q[2] * p[1] \
+        - (double) q[3] * p[0];
+    return 2.0 * atan2(sqrt(x * x + y * y + z * z), fabs(w));
+}
+
+
+int main(int argc, char **argv) {
+    int replay = 0;
+    const char *path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--replay") == 0) {
+            replay = 1;
+        } else if (argv[i][0] != '-' && !path) {
+            path = argv[i];
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (!path) {
+        usage(argv[0]);
+    }
+
+    size_t len;
+    uint8_t *log = read_file(path, &len);
+    if (!log) {
+        return 1;
+    }
+    struct blackbox_header header;
+    if (len < sizeof(header)) {
+        fprintf(stderr, "%s: too short for a blackbox log\n", path);
+        return 1;
+    }
+    memcpy(&header, log, sizeof(header));
+    if (!blackbox_header_check(&header)) {
+        fprintf(stderr, "%s: not a version %d blackbox log\n", path, BLACKBOX_VERSION);
+        return 1;
+    }
+
+    /* The estimator starts from the first logged attitude, with no gyroscope
+     * bias estimate, so a log started in flight takes a while (about 1 / ki
+     * seconds) for its bias estimate to catch up with the one that was
+     * flown. Each record is integrated over the time since the one before
+     * it. The estimator starts again from the logged attitude after any gap
+     * in the log (a step well over the usual one, which is tracked in case
+     * the drone sampled at other than its nominal rate), since the motion in
+     * the missing samples is lost */
+    struct attitude_estimator_config estimator_config = {};
+    estimator_config.sample_period_s = header.sample_period_s;
+    estimator_config.kp = header.estimator_kp;
+    estimator_config.ki = header.estimator_ki;
+    struct attitude_estimator estimator;
+    attitude_estimator_init(&estimator, &estimator_config);
+
+    printf("time_s,g_raw_x,g_raw_y,g_raw_z,a_raw_x,a_raw_y,a_raw_z,m_x,m_y,m_z," \
+        "qw,qx,qy,qz,m0,m1,m2,m3%s\n", replay ? ",replay_qw,replay_qx,replay_qy,replay_qz" : "");
+
+    struct blackbox_decoder decoder;
+    blackbox_decoder_init(&decoder);
+    size_t pos = sizeof(header);
+    uint32_t records = 0;
+    uint32_t gaps = 0;
+    uint32_t previous_time_us = 0;
+    float usual_step_us = header.sample_period_s * 1e6f;
+    double angle_error_sq = 0.0;
+    double max_angle_error = 0.0;
+    enum blackbox_decode_result result;
+    struct blackbox_record record;
+    size_t consumed;
+    while ((result = blackbox_decode(&decoder, &log[pos], len - pos, &consumed, &record)) \
+        == BLACKBOX_DECODE_OK) {
+
+        pos += consumed;
+        records++;
+
+        float q[4];
+        float m_ut[3];
+        for (int i = 0; i < 4; i++) q[i] = record.q[i] / BLACKBOX_QUATERNION_SCALE;
+        for (int i = 0; i < 3; i++) m_ut[i] = record.m[i] / BLACKBOX_MAG_SCALE;
+        printf("%.6f,%d,%d,%d,%d,%d,%d,%.1f,%.1f,%.1f,%.5f,%.5f,%.5f,%.5f,%.4f,%.4f,%.4f,%.4f", \
+            record.time_us * 1e-6, record.g_raw[0], record.g_raw[1], record.g_raw[2], \
+            record.a_raw[0], record.a_raw[1], record.a_raw[2], m_ut[0], m_ut[1], m_ut[2], \
+            q[0], q[1], q[2], q[3], record.motor[0] / BLACKBOX_MOTOR_SCALE, \
+            record.motor[1] / BLACKBOX_MOTOR_SCALE, record.motor[2] / BLACKBOX_MOTOR_SCALE, \
+            record.motor[3] / BLACKBOX_MOTOR_SCALE);
+
+        if (replay) {
+            uint32_t step_us = record.time_us - previous_time_us;
+            if (records > 1 && step_us < 4.0f * usual_step_us) {
+                usual_step_us += 0.1f * ((float) step_us - usual_step_us);
+            }
+            if (records == 1 || step_us > 1.5f * usual_step_us) {
+                gaps += (records > 1);
+                memcpy(estimator.q, q, sizeof(estimator.q));
+            } else {
+                float g_rad_s[3];
+                float a_xyz[3];
+                sensor_calibration_apply_raw(&header.gyro_calibration_raw, record.g_raw, g_rad_s);
+                sensor_calibration_apply_raw(&header.accel_calibration_raw, record.a_raw, a_xyz);
+                attitude_estimator_update(&estimator, g_rad_s, a_xyz, m_ut, step_us * 1e-6f);
+            }
+            double angle_error = quaternion_angle(estimator.q, q);
+            angle_error_sq += angle_error * angle_error;
+            if (angle_error > max_angle_error) max_angle_error = angle_error;
+            printf(",%.5f,%.5f,%.5f,%.5f", estimator.q[0], estimator.q[1], estimator.q[2], \
+                estimator.q[3]);
+        }
+        printf("\n");
+        previous_time_us = record.time_us;
+    }
+
+    fprintf(stderr, "%" PRIu32 " records in %zu bytes (%.1f bytes each), %" PRIu32 \
+        " bytes skipped%s\n", records, pos - sizeof(header), \
+        records ? (double) (pos - sizeof(header)) / records : 0.0, decoder.skipped, \
+        result == BLACKBOX_DECODE_MORE && pos < len ? ", log cut off mid-frame" : "");
+    if (replay && records) {
+        fprintf(stderr, "replayed attitude vs logged: rms %.4f°, max %.4f° (%" PRIu32 \
+            " gaps)\n", sqrt(angle_error_sq / records) * 180.0 / M_PI, \
+            max_angle_error * 180.0 / M_PI, gaps);
+    }
+
+    free(log);
+    return 0;
+}
@@ -0,0 +1,226 @@
+/* Host micro-benchmark for turning raw sensor samples into SI units. It
+ * times the conversion the firmware does now against the ones it has done or
+ * could do instead, over the same block of samples:
+ *
+ *   per-stage float  what the firmware used to do: the gyroscope scaled to
+ *                    mdps and then to rad/s, the accelerometer to mg, and
+ *                    the magnetometer divided by its sensitivity
+ *   fused float      one multiply per axis by a scale worked out when the
+ *                    sensor is configured ('esp_i2c_lsm6dsox_to_si()')
+ *   Q16 integer      the same fused scales held in Q2.30 fixed point, giving
+ *                    Q16.16 results without leaving integers
+ *
+ * The absolute numbers are for the host, not the ESP32. The ESP32 has no
+ * SIMD for any of this, so the benchmark is built without auto-vectorisation
+ * (see CMakeLists.txt) to keep the host doing one sample at a time too. If
+ * anything the gap is wider on the ESP32, whose FPU has no divide
+ * instruction.
+ *
+ *   ./build-sil/decode-bench [samples] [rounds]
+ */
+#include <chrono>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "esp32-i2c-lis3mdl.h"
+#include "esp32-i2c-lsm6dsox.h"
+
+
+/* The scales for the flight profiles' full scale ranges */
+#define BENCH_GYRO_SENSITIVITY LSM6DSOX_GYRO_SENSITIVITY_FS_2000DPS
+#define BENCH_ACCEL_SENSITIVITY LSM6DSOX_ACC_SENSITIVITY_FS_16G
+#define BENCH_MAG_SENSITIVITY LIS3MDL_SENSITIVITY_FS_4GAUSS
+
+#define MDPS_TO_RAD_PER_S ((float) M_PI / 180000.0f)
+
+
+/* One IMU sample plus the magnetometer sample that goes with it */
+struct raw_sample {
+    int16_t g[3];
+    int16_t a[3];
+    int16_t m[3];
+};
+
+struct si_sample {
+    float g[3];
+    float a[3];
+    float m[3];
+};
+
+struct q16_sample {
+    int32_t g[3];
+    int32_t a[3];
+    int32_t m[3];
+};
+
+
+static __attribute__((noinline)) void convert_per_stage(const struct i2c_lsm6dsox *imu, \
+    const struct i2c_lis3mdl *mag, const struct raw_sample *in, struct si_sample *out, int n) {
+
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < 3; j++) {
+            float g_mdps = ((float) in[i].g[j]) * imu->gyroscope_sensitivity;
+            out[i].g[j] = g_mdps * MDPS_TO_RAD_PER_S;
+            out[i].a[j] = ((float) in[i].a[j]) * imu->accelerometer_sensitivity;
+            out[i].m[j] = ((float) in[i].m[j]) / mag->sensitivity;
+        }
+    }
+}
+
+
+static __attribute__((noinline)) void convert_fused(const struct i2c_lsm6dsox *imu, \
+    const struct i2c_lis3mdl *mag, const struct raw_sample *in, struct si_sample *out, int n) {
+
+    for (int i = 0; i < n; i++) {
+        esp_i2c_lsm6dsox_to_si(imu, in[i].g, in[i].a, out[i].g, out[i].a);
+        for (int j = 0; j < 3; j++) {
+            out[i].m[j] = ((float) in[i].m[j]) * mag->scale_ut;
+        }
+    }
+}
+
+
+/* The scales are all well under 1, so Q2.30 keeps plenty of their bits;
+ * shifting the product down by 14 leaves a Q16.16 result */
+static __attribute__((noinline)) void convert_q16(const int32_t *scales_q30, \
+    const struct raw_sample *in, struct q16_sample *out, int n) {
+
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < 3; j++) {
+            out[i].g[j] = (int32_t) (((int64_t) in[i].g[j] * scales_q30[0]) >> 14);
+            out[i].a[j] = (int32_t) (((int64_t) in[i].a[j] * scales_q30[1]) >> 14);
+            out[i].m[j] = (int32_t) (((int64_t) in[i].m[j] * scales_q30[2]) >> 14);
+        }
+    }
+}
+
+
+static uint64_t cycles_now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+
+struct timing {
+    double ns_per_sample;
+    double cycles_per_sample;
+};
+
+/* Runs 'convert' 'rounds' times over the block and keeps the fastest, which
+ * is the one least disturbed by everything else the host is doing */
+template <typename F>
+static struct timing time_best(F convert, int samples, int rounds) {
+    struct timing best = { 1e30, 1e30 };
+    for (int r = 0; r < rounds; r++) {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t start_cycles = cycles_now();
+        convert();
+        uint64_t cycles = cycles_now() - start_cycles;
+        double ns = std::chrono::duration<double, std::nano>( \
+            std::chrono::steady_clock::now() - start).count();
+        if (ns / samples < best.ns_per_sample) {
+            best.ns_per_sample = ns / samples;
+            best.cycles_per_sample = (double) cycles / samples;
+        }
+    }
+    return best;
+}
+
+
+static void report(const char *name, struct timing t) {
+    if (cycles_now() != 0) {
+        printf("%-18s %8.2f ns/sample %8.1f cycles/sample\n", name, t.ns_per_sample, \
+            t.cycles_per_sample);
+    } else {
+        printf("%-18s %8.2f ns/sample\n", name, t.ns_per_sample);
+    }
+}
+
+
+int main(int argc, char **argv) {
+    int samples = (argc > 1) ? atoi(argv[1]) : 4096;
+    int rounds = (argc > 2) ? atoi(argv[2]) : 200;
+    if (samples <= 0 || rounds <= 0) {
+        fprintf(stderr, "usage: %s [samples] [rounds]\n", argv[0]);
+        return 1;
+    }
+
+    struct i2c_lsm6dsox imu;
+    memset(&imu, 0, sizeof(imu));
+    imu.gyroscope_sensitivity = BENCH_GYRO_SENSITIVITY;
+    imu.accelerometer_sensitivity = BENCH_ACCEL_SENSITIVITY;
+    imu.gyroscope_scale_rad_s = BENCH_GYRO_SENSITIVITY * LSM6DSOX_MDPS_TO_RAD_PER_S;
+    imu.accelerometer_scale_m_s2 = BENCH_ACCEL_SENSITIVITY * LSM6DSOX_MG_TO_M_PER_S2;
+    struct i2c_lis3mdl mag;
+    memset(&mag, 0, sizeof(mag));
+    mag.sensitivity = BENCH_MAG_SENSITIVITY;
+    mag.scale_ut = LIS3MDL_GAUSS_TO_UT / BENCH_MAG_SENSITIVITY;
+    const float scales[3] = {
+        imu.gyroscope_scale_rad_s, imu.accelerometer_scale_m_s2, mag.scale_ut,
+    };
+    int32_t scales_q30[3];
+    for (int k = 0; k < 3; k++) {
+        scales_q30[k] = (int32_t) lround(scales[k] * 1073741824.0);
+    }
+
+    struct raw_sample *in = (struct raw_sample *) malloc(samples * sizeof(*in));
+    struct si_sample *out = (struct si_sample *) malloc(samples * sizeof(*out));
+    struct si_sample *reference = (struct si_sample *) malloc(samples * sizeof(*reference));
+    struct q16_sample *out_q16 = (struct q16_sample *) malloc(samples * sizeof(*out_q16));
+    srand(1);
+    for (int i = 0; i < samples; i++) {
+        for (int j = 0; j < 3; j++) {
+            in[i].g[j] = (int16_t) (rand() - RAND_MAX / 2);
+            in[i].a[j] = (int16_t) (rand() - RAND_MAX / 2);
+            in[i].m[j] = (int16_t) (rand() - RAND_MAX / 2);
+        }
+    }
+
+    printf("%d samples (gyroscope + accelerometer + magnetometer), best of %d rounds\n", \
+        samples, rounds);
+    report("per-stage float", time_best([&] { \
+        convert_per_stage(&imu, &mag, in, reference, samples); }, samples, rounds));
+    report("fused float", time_best([&] { \
+        convert_fused(&imu, &mag, in, out, samples); }, samples, rounds));
+    report("Q16 integer", time_best([&] { \
+        convert_q16(scales_q30, in, out_q16, samples); }, samples, rounds));
+
+    /* Make sure the faster paths still give the same answers, to well
+     * within one LSB of the sensor */
+    double worst_fused = 0.0;
+    double worst_q16 = 0.0;
+    for (int i = 0; i < samples; i++) {
+        for (int j = 0; j < 3; j++) {
+            /* The per-stage path left the accelerometer in mg and the
+             * magnetometer in gauss */
+            const double ref[3] = { reference[i].g[j], \
+                reference[i].a[j] * LSM6DSOX_MG_TO_M_PER_S2, \
+                reference[i].m[j] * LIS3MDL_GAUSS_TO_UT };
+            const float fused[3] = { out[i].g[j], out[i].a[j], out[i].m[j] };
+            const int32_t q16[3] = { out_q16[i].g[j], out_q16[i].a[j], out_q16[i].m[j] };
+            for (int k = 0; k < 3; k++) {
+                double err_fused = fabs(fused[k] - ref[k]) / scales[k];
+                double err_q16 = fabs(q16[k] / 65536.0 - ref[k]) / scales[k];
+                if (err_fused > worst_fused) worst_fused = err_fused;
+                if (err_q16 > worst_q16) worst_q16 = err_q16;
+            }
+        }
+    }
+    printf("worst error vs per-stage: fused %.2g LSB, Q16 %.2g LSB\n", worst_fused, worst_q16);
+
+    free(in);
+    free(out);
+    free(reference);
+    free(out_q16);
+
+    return 0;
+}
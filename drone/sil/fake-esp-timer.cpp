@@ -0,0 +1,23 @@
+#include <inttypes.h>
+#include <math.h>
+
+#include "esp_timer.h"
+
+#include "fake-esp-timer.h"
+
+
+static int64_t now_us;
+
+
+/** Returns the simulated time, in microseconds. */
+int64_t esp_timer_get_time(void) {
+    return now_us;
+}
+
+
+/** Moves esp_timer on to 'time_s' seconds into the simulation. Called after
+ * every step of the quad model, before the sensor models see it, so that
+ * their interrupts are timed when they are raised. */
+void fake_esp_timer_set(double time_s) {
+    now_us = (int64_t) llround(time_s * 1e6);
+}
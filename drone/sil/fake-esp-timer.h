@@ -0,0 +1,8 @@
+#ifndef __FAKE_ESP_TIMER_H_
+#define __FAKE_ESP_TIMER_H_
+
+
+void fake_esp_timer_set(double time_s);
+
+
+#endif
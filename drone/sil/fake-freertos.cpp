@@ -0,0 +1,118 @@
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "fake-freertos.h"
+
+
+/* The SIL only has the one task, the simulated sensor task */
+struct sil_task {
+    uint32_t notification;
+};
+
+static struct sil_task sensor_task;
+/* Simulated ticks only go by while the task waits on a semaphore that is
+ * never given */
+static TickType_t tick_count = 0;
+/* What runs while the task is blocked, see 'fake_freertos_on_block()' */
+static void (*block_run)(void *ctx) = NULL;
+static void *block_ctx;
+
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    return &sensor_task;
+}
+
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action) {
+    if (action == eSetBits) {
+        task->notification |= value;
+    } else {
+        task->notification = value;
+    }
+
+    return pdTRUE;
+}
+
+
+BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value, \
+    eNotifyAction action, BaseType_t *higher_priority_task_woken) {
+
+    xTaskNotify(task, value, action);
+    if (higher_priority_task_woken) {
+        *higher_priority_task_woken = pdTRUE;
+    }
+
+    return pdTRUE;
+}
+
+
+/** Returns straight away. Simulated time only moves on between iterations of
+ * the sensor task, so anything waited on (like the sensor hub running a
+ * cycle) has to already be done by the time the wait starts. */
+void vTaskDelay(TickType_t ticks) {
+    (void) ticks;
+}
+
+
+TickType_t xTaskGetTickCount(void) {
+    return tick_count;
+}
+
+
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t *buffer) {
+    buffer->count = 0;
+
+    return buffer;
+}
+
+
+/** Takes 'semaphore' if it has been given. If it has not and the task is
+ * prepared to wait, whatever it is waiting on gets to run once (see
+ * 'fake_freertos_on_block()'), and if that does not give it either, the
+ * whole wait goes by and pdFALSE is returned. */
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait) {
+    if (semaphore->count == 0 && ticks_to_wait > 0 && block_run) {
+        block_run(block_ctx);
+    }
+    if (semaphore->count == 0) {
+        tick_count += ticks_to_wait;
+        return pdFALSE;
+    }
+    semaphore->count = 0;
+
+    return pdTRUE;
+}
+
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, \
+    BaseType_t *higher_priority_task_woken) {
+
+    semaphore->count = 1;
+    if (higher_priority_task_woken) {
+        *higher_priority_task_woken = pdTRUE;
+    }
+
+    return pdTRUE;
+}
+
+
+/** Has 'run' called with 'ctx' whenever the task blocks on a semaphore. This
+ * is where the simulated peripherals it waits on get their work done. */
+void fake_freertos_on_block(void (*run)(void *ctx), void *ctx) {
+    block_run = run;
+    block_ctx = ctx;
+}
+
+
+/** Returns and clears the sensor task's notification value, like
+ * 'xTaskNotifyWait(0, UINT32_MAX, ...)' does on the target. */
+uint32_t fake_freertos_take_notification(void) {
+    uint32_t notification = sensor_task.notification;
+    sensor_task.notification = 0;
+
+    return notification;
+}
@@ -0,0 +1,12 @@
+#ifndef __FAKE_FREERTOS_H_
+#define __FAKE_FREERTOS_H_
+
+#include <inttypes.h>
+
+
+uint32_t fake_freertos_take_notification(void);
+
+void fake_freertos_on_block(void (*run)(void *ctx), void *ctx);
+
+
+#endif
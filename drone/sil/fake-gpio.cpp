@@ -0,0 +1,94 @@
+#include <inttypes.h>
+
+#include "driver/gpio.h"
+#include "esp_err.h"
+
+#include "fake-gpio.h"
+
+
+static struct {
+    gpio_int_type_t intr_type;
+    gpio_isr_t isr;
+    void *isr_arg;
+    int intr_enabled;
+    int level;
+} pins[GPIO_NUM_MAX];
+
+
+/* Runs the pin's handler if its interrupt is enabled and its level (or edge)
+ * calls for it. Level triggered handlers mask the pin themselves, which is
+ * what stops this from firing again on every call */
+static void fake_gpio_check(gpio_num_t pin, int prev_level) {
+    if (!pins[pin].isr || !pins[pin].intr_enabled) {
+        return;
+    }
+
+    int level = pins[pin].level;
+    int fire = 0;
+    switch (pins[pin].intr_type) {
+        case GPIO_INTR_HIGH_LEVEL: fire = level; break;
+        case GPIO_INTR_LOW_LEVEL: fire = !level; break;
+        case GPIO_INTR_POSEDGE: fire = level && !prev_level; break;
+        case GPIO_INTR_NEGEDGE: fire = !level && prev_level; break;
+        case GPIO_INTR_ANYEDGE: fire = level != prev_level; break;
+        default: break;
+    }
+    if (fire) {
+        pins[pin].isr(pins[pin].isr_arg);
+    }
+}
+
+
+/** Drives 'pin' to 'level', as a simulated sensor's interrupt line would. */
+void fake_gpio_set_level(gpio_num_t pin, int level) {
+    int prev_level = pins[pin].level;
+    pins[pin].level = level ? 1 : 0;
+    fake_gpio_check(pin, prev_level);
+}
+
+
+esp_err_t gpio_config(const gpio_config_t *config) {
+    for (int i = 0; i < GPIO_NUM_MAX; i++) {
+        if (config->pin_bit_mask & (1ULL << i)) {
+            pins[i].intr_type = config->intr_type;
+            pins[i].intr_enabled = config->intr_type != GPIO_INTR_DISABLE;
+        }
+    }
+
+    return ESP_OK;
+}
+
+
+esp_err_t gpio_install_isr_service(int intr_alloc_flags) {
+    static int installed = 0;
+    if (installed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    installed = 1;
+
+    return ESP_OK;
+}
+
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler, void *args) {
+    pins[gpio_num].isr = isr_handler;
+    pins[gpio_num].isr_arg = args;
+
+    return ESP_OK;
+}
+
+
+esp_err_t gpio_intr_enable(gpio_num_t gpio_num) {
+    pins[gpio_num].intr_enabled = 1;
+    /* A level triggered line that is still asserted fires straight away */
+    fake_gpio_check(gpio_num, pins[gpio_num].level);
+
+    return ESP_OK;
+}
+
+
+esp_err_t gpio_intr_disable(gpio_num_t gpio_num) {
+    pins[gpio_num].intr_enabled = 0;
+
+    return ESP_OK;
+}
@@ -0,0 +1,10 @@
+#ifndef __FAKE_GPIO_H_
+#define __FAKE_GPIO_H_
+
+#include "driver/gpio.h"
+
+
+void fake_gpio_set_level(gpio_num_t pin, int level);
+
+
+#endif
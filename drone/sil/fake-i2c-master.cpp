@@ -0,0 +1,247 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "driver/i2c_master.h"
+#include "esp_err.h"
+
+#include "fake-freertos.h"
+#include "fake-i2c-master.h"
+
+
+#define FAKE_I2C_MAX_TARGETS 4
+#define FAKE_I2C_MAX_DEVICES 8
+#define FAKE_I2C_QUEUE_LEN 16
+
+
+struct fake_i2c_device {
+    bool in_use;
+    uint16_t address;
+    uint32_t scl_speed_hz;
+    i2c_master_callback_t on_trans_done;
+    void *user_data;
+};
+
+/* A transaction in the queue. Like the real driver's, it only points at the
+ * caller's buffers, which are not read or written until it goes out */
+struct fake_i2c_transaction {
+    struct fake_i2c_device *device;
+    const uint8_t *write_buffer;
+    size_t write_size;
+    uint8_t *read_buffer;
+    size_t read_size;
+};
+
+struct fake_i2c_bus {
+    struct fake_i2c_target *targets[FAKE_I2C_MAX_TARGETS];
+    size_t num_targets;
+    struct fake_i2c_device devices[FAKE_I2C_MAX_DEVICES];
+    struct fake_i2c_transaction queue[FAKE_I2C_QUEUE_LEN];
+    size_t queue_head;
+    size_t queue_len;
+    /* While stalled, nothing on the queue goes out */
+    bool stalled;
+    struct fake_i2c_master_stats stats;
+};
+
+static struct fake_i2c_bus bus;
+
+
+static struct fake_i2c_target *fake_i2c_find_target(uint16_t address) {
+    for (size_t i = 0; i < bus.num_targets; i++) {
+        if (bus.targets[i]->address == address) {
+            return bus.targets[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/* Puts the transaction at the head of the queue on the bus and tells its
+ * device how it went */
+static void fake_i2c_run_one(void) {
+    struct fake_i2c_transaction *t = &bus.queue[bus.queue_head];
+    bus.queue_head = (bus.queue_head + 1) % FAKE_I2C_QUEUE_LEN;
+    bus.queue_len--;
+    bus.stats.transactions++;
+
+    struct fake_i2c_device *device = t->device;
+    struct fake_i2c_target *target = fake_i2c_find_target(device->address);
+    bool ok = target && device->scl_speed_hz <= target->max_speed_hz;
+    if (target && target->fail_next > 0) {
+        target->fail_next--;
+        ok = false;
+    }
+    i2c_master_event_data_t event = {};
+    event.event = I2C_EVENT_NACK;
+    if (ok) {
+        uint8_t reg = t->write_buffer[0];
+        if (t->read_size > 0) {
+            for (size_t i = 0; i < t->read_size; i++) {
+                t->read_buffer[i] = target->regs[(uint8_t) (reg + i)];
+            }
+        } else {
+            for (size_t i = 1; i < t->write_size; i++) {
+                target->regs[(uint8_t) (reg + i - 1)] = t->write_buffer[i];
+            }
+        }
+        event.event = I2C_EVENT_DONE;
+    }
+
+    if (device->on_trans_done) {
+        device->on_trans_done(device, &event, device->user_data);
+    }
+}
+
+
+/* What goes on while the task is blocked: the next transaction goes out,
+ * unless the bus is stalled */
+static void fake_i2c_on_block(void *ctx) {
+    if (!bus.stalled && bus.queue_len > 0) {
+        fake_i2c_run_one();
+    }
+}
+
+
+static esp_err_t fake_i2c_queue(i2c_master_dev_handle_t i2c_dev, const uint8_t *write_buffer, \
+    size_t write_size, uint8_t *read_buffer, size_t read_size) {
+
+    if (!i2c_dev || !i2c_dev->in_use || write_size == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (bus.queue_len == FAKE_I2C_QUEUE_LEN) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    struct fake_i2c_transaction *t = \
+        &bus.queue[(bus.queue_head + bus.queue_len) % FAKE_I2C_QUEUE_LEN];
+    t->device = i2c_dev;
+    t->write_buffer = write_buffer;
+    t->write_size = write_size;
+    t->read_buffer = read_buffer;
+    t->read_size = read_size;
+    bus.queue_len++;
+
+    return ESP_OK;
+}
+
+
+/** Empties the bus, forgetting every target, and has it run whenever the
+ * task blocks. */
+void fake_i2c_master_init(void) {
+    memset(&bus, 0, sizeof(bus));
+    fake_freertos_on_block(fake_i2c_on_block, NULL);
+}
+
+
+/** Puts 'target' on the bus. It has to outlive the bus. */
+void fake_i2c_master_add_target(struct fake_i2c_target *target) {
+    if (bus.num_targets < FAKE_I2C_MAX_TARGETS) {
+        bus.targets[bus.num_targets++] = target;
+    }
+}
+
+
+/** Stops anything queued from going out, the way a device holding the bus
+ * would, until called again with 'stalled' false. */
+void fake_i2c_master_stall(bool stalled) {
+    bus.stalled = stalled;
+}
+
+
+const struct fake_i2c_master_stats *fake_i2c_master_get_stats(void) {
+    return &bus.stats;
+}
+
+
+esp_err_t i2c_new_master_bus(const i2c_master_bus_config_t *config, \
+    i2c_master_bus_handle_t *ret_bus_handle) {
+
+    *ret_bus_handle = &bus;
+
+    return ESP_OK;
+}
+
+
+esp_err_t i2c_master_bus_add_device(i2c_master_bus_handle_t bus_handle, \
+    const i2c_device_config_t *dev_config, i2c_master_dev_handle_t *ret_handle) {
+
+    for (size_t i = 0; i < FAKE_I2C_MAX_DEVICES; i++) {
+        struct fake_i2c_device *device = &bus_handle->devices[i];
+        if (!device->in_use) {
+            memset(device, 0, sizeof(*device));
+            device->in_use = true;
+            device->address = dev_config->device_address;
+            device->scl_speed_hz = dev_config->scl_speed_hz;
+            bus_handle->stats.devices++;
+            *ret_handle = device;
+            return ESP_OK;
+        }
+    }
+
+    return ESP_ERR_NO_MEM;
+}
+
+
+esp_err_t i2c_master_bus_rm_device(i2c_master_dev_handle_t handle) {
+    for (size_t i = 0; i < bus.queue_len; i++) {
+        if (bus.queue[(bus.queue_head + i) % FAKE_I2C_QUEUE_LEN].device == handle) {
+            bus.stats.removed_while_busy++;
+            break;
+        }
+    }
+    handle->in_use = false;
+    bus.stats.devices--;
+
+    return ESP_OK;
+}
+
+
+esp_err_t i2c_master_register_event_callbacks(i2c_master_dev_handle_t i2c_dev, \
+    const i2c_master_event_callbacks_t *cbs, void *user_data) {
+
+    i2c_dev->on_trans_done = cbs->on_trans_done;
+    i2c_dev->user_data = user_data;
+
+    return ESP_OK;
+}
+
+
+esp_err_t i2c_master_transmit(i2c_master_dev_handle_t i2c_dev, const uint8_t *write_buffer, \
+    size_t write_size, int xfer_timeout_ms) {
+
+    return fake_i2c_queue(i2c_dev, write_buffer, write_size, NULL, 0);
+}
+
+
+esp_err_t i2c_master_transmit_receive(i2c_master_dev_handle_t i2c_dev, \
+    const uint8_t *write_buffer, size_t write_size, uint8_t *read_buffer, size_t read_size, \
+    int xfer_timeout_ms) {
+
+    return fake_i2c_queue(i2c_dev, write_buffer, write_size, read_buffer, read_size);
+}
+
+
+/** Runs everything queued, or returns ESP_ERR_TIMEOUT if the bus is
+ * stalled. */
+esp_err_t i2c_master_bus_wait_all_done(i2c_master_bus_handle_t bus_handle, int timeout_ms) {
+    if (bus_handle->stalled && bus_handle->queue_len > 0) {
+        return ESP_ERR_TIMEOUT;
+    }
+    while (bus_handle->queue_len > 0) {
+        fake_i2c_run_one();
+    }
+
+    return ESP_OK;
+}
+
+
+esp_err_t i2c_master_bus_reset(i2c_master_bus_handle_t bus_handle) {
+    if (bus_handle->queue_len > 0) {
+        bus_handle->stats.resets_while_busy++;
+    }
+    bus_handle->stats.resets++;
+
+    return ESP_OK;
+}
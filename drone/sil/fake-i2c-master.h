@@ -0,0 +1,43 @@
+#ifndef __FAKE_I2C_MASTER_H_
+#define __FAKE_I2C_MASTER_H_
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "driver/i2c_master.h"
+
+
+/* A device on the fake bus: a register file whose address auto-increments
+ * through multi-byte transactions. It only answers reliably at up to
+ * 'max_speed_hz', and NACKs anything faster */
+struct fake_i2c_target {
+    uint16_t address;
+    uint32_t max_speed_hz;
+    /* How many more transactions it NACKs whatever the speed */
+    int fail_next;
+    uint8_t regs[256];
+};
+
+/* What has been done to the bus */
+struct fake_i2c_master_stats {
+    uint32_t transactions;
+    uint32_t resets;
+    /* Devices added and not removed */
+    uint32_t devices;
+    /* Things the real driver would have gone wrong on: the bus reset, or a
+     * device removed, with transactions still queued */
+    uint32_t resets_while_busy;
+    uint32_t removed_while_busy;
+};
+
+
+void fake_i2c_master_init(void);
+
+void fake_i2c_master_add_target(struct fake_i2c_target *target);
+
+void fake_i2c_master_stall(bool stalled);
+
+const struct fake_i2c_master_stats *fake_i2c_master_get_stats(void);
+
+
+#endif
@@ -0,0 +1,263 @@
+#include <inttypes.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "fake-esp-timer.h"
+#include "fake-tasks.h"
+
+
+/* FreeRTOS tasks and periodic esp_timers on one simulated core, for the
+ * scheduler's test.
+ *
+ * Each task is a thread, but only one thread runs at a time: whichever holds
+ * 'lock', handed on with 'cpu_changed'. 'running' says which task has the
+ * core, or NULL for the test itself, which hands it to the highest priority
+ * ready task in 'fake_tasks_run()' and moves time on to the next timer
+ * whenever none is ready. Time only passes while the test waits, and while
+ * a task does work with 'fake_tasks_work()'. A timer that fires meanwhile
+ * and readies a higher priority task preempts the one doing the work, as
+ * the target would.
+ *
+ * Timer callbacks run as soon as their timer fires and take no time, as if
+ * the esp_timer task were above every other. */
+
+
+#define FAKE_TASKS_MAX 16
+#define FAKE_TASKS_MAX_TIMERS 16
+
+
+struct sil_task {
+    void (*fn)(void *arg);
+    void *arg;
+    UBaseType_t priority;
+    uint32_t notifications;
+    /* Waiting for a notification */
+    bool blocked;
+    pthread_t thread;
+};
+
+struct sil_esp_timer {
+    esp_timer_create_args_t args;
+    bool started;
+    uint64_t period_us;
+    int64_t next_us;
+};
+
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cpu_changed = PTHREAD_COND_INITIALIZER;
+static struct sil_task *running;
+static int64_t now_us;
+
+static struct sil_task tasks[FAKE_TASKS_MAX];
+static int num_tasks;
+static struct sil_esp_timer timers[FAKE_TASKS_MAX_TIMERS];
+static int num_timers;
+
+
+static void fake_tasks_set_time(int64_t time_us) {
+    now_us = time_us;
+    fake_esp_timer_set(time_us / 1e6);
+}
+
+
+/* The highest priority task that is not blocked, the first added winning a
+ * tie, or NULL */
+static struct sil_task *fake_tasks_ready(void) {
+    struct sil_task *best = NULL;
+    for (int i = 0; i < num_tasks; i++) {
+        if (!tasks[i].blocked && (best == NULL || tasks[i].priority > best->priority)) {
+            best = &tasks[i];
+        }
+    }
+    return best;
+}
+
+
+/* When the next timer is due, or INT64_MAX if none is started */
+static int64_t fake_tasks_next_timer_us(void) {
+    int64_t next_us = INT64_MAX;
+    for (int i = 0; i < num_timers; i++) {
+        if (timers[i].started && timers[i].next_us < next_us) {
+            next_us = timers[i].next_us;
+        }
+    }
+    return next_us;
+}
+
+
+/* Fires every timer due by now */
+static void fake_tasks_fire_timers(void) {
+    for (int i = 0; i < num_timers; i++) {
+        struct sil_esp_timer *timer = &timers[i];
+        while (timer->started && timer->next_us <= now_us) {
+            timer->next_us += timer->period_us;
+            timer->args.callback(timer->args.arg);
+        }
+    }
+}
+
+
+/* Hands the core back to the test, and waits for it to come back to 'self' */
+static void fake_tasks_yield(struct sil_task *self) {
+    running = NULL;
+    pthread_cond_broadcast(&cpu_changed);
+    while (running != self) {
+        pthread_cond_wait(&cpu_changed, &lock);
+    }
+}
+
+
+static void *fake_tasks_thread(void *arg) {
+    struct sil_task *self = (struct sil_task *) arg;
+    pthread_mutex_lock(&lock);
+    while (running != self) {
+        pthread_cond_wait(&cpu_changed, &lock);
+    }
+    self->fn(self->arg);
+    /* FreeRTOS tasks never return */
+    return NULL;
+}
+
+
+/** Starts the simulation at time 0. The test holds the core, and 'lock',
+ * from then on, except while it runs the tasks with 'fake_tasks_run()'. */
+void fake_tasks_init(void) {
+    pthread_mutex_lock(&lock);
+    fake_tasks_set_time(0);
+}
+
+
+/** Runs the tasks for 'duration_us' of simulated time. */
+void fake_tasks_run(int64_t duration_us) {
+    int64_t end_us = now_us + duration_us;
+    while (now_us < end_us) {
+        struct sil_task *next = fake_tasks_ready();
+        if (next != NULL) {
+            running = next;
+            pthread_cond_broadcast(&cpu_changed);
+            while (running != NULL) {
+                pthread_cond_wait(&cpu_changed, &lock);
+            }
+            continue;
+        }
+
+        int64_t next_us = fake_tasks_next_timer_us();
+        if (next_us > end_us) {
+            fake_tasks_set_time(end_us);
+            return;
+        }
+        fake_tasks_set_time(next_us);
+        fake_tasks_fire_timers();
+    }
+}
+
+
+/** Called by the running task to take 'duration_us' of the core's time. The
+ * task may be preempted along the way, in which case it takes longer. */
+void fake_tasks_work(uint32_t duration_us) {
+    struct sil_task *self = running;
+    int64_t left_us = duration_us;
+    while (left_us > 0) {
+        int64_t next_us = fake_tasks_next_timer_us();
+        if (next_us - now_us >= left_us) {
+            fake_tasks_set_time(now_us + left_us);
+            return;
+        }
+        left_us -= next_us - now_us;
+        fake_tasks_set_time(next_us);
+        fake_tasks_fire_timers();
+
+        if (fake_tasks_ready()->priority > self->priority) {
+            fake_tasks_yield(self);
+        }
+    }
+}
+
+
+TaskHandle_t xTaskCreateStaticPinnedToCore(void (*fn)(void *arg), const char *name, \
+    uint32_t stack_size, void *arg, UBaseType_t priority, StackType_t *stack, \
+    StaticTask_t *buffer, BaseType_t core) {
+
+    (void) name;
+    (void) stack_size;
+    (void) stack;
+    (void) core;
+    if (num_tasks == FAKE_TASKS_MAX) {
+        return NULL;
+    }
+
+    struct sil_task *task = &tasks[num_tasks];
+    memset(task, 0, sizeof(*task));
+    task->fn = fn;
+    task->arg = arg;
+    task->priority = priority;
+    if (pthread_create(&task->thread, NULL, fake_tasks_thread, task) != 0) {
+        return NULL;
+    }
+    num_tasks++;
+    buffer->task = task;
+
+    return task;
+}
+
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    return running;
+}
+
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    task->notifications++;
+    task->blocked = false;
+
+    return pdTRUE;
+}
+
+
+/** Waits for a notification without ever timing out, whatever
+ * 'ticks_to_wait' is: nothing in the scheduler waits any other way. */
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait) {
+    (void) ticks_to_wait;
+    struct sil_task *self = running;
+    while (self->notifications == 0) {
+        self->blocked = true;
+        fake_tasks_yield(self);
+    }
+
+    uint32_t notifications = self->notifications;
+    self->notifications = clear_on_exit ? 0 : notifications - 1;
+    return notifications;
+}
+
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *out) {
+    if (num_timers == FAKE_TASKS_MAX_TIMERS) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    struct sil_esp_timer *timer = &timers[num_timers++];
+    memset(timer, 0, sizeof(*timer));
+    timer->args = *args;
+    *out = timer;
+
+    return ESP_OK;
+}
+
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us) {
+    if (timer->started) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->started = true;
+    timer->period_us = period_us;
+    timer->next_us = now_us + (int64_t) period_us;
+
+    return ESP_OK;
+}
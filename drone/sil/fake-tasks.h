@@ -0,0 +1,14 @@
+#ifndef __FAKE_TASKS_H_
+#define __FAKE_TASKS_H_
+
+#include <inttypes.h>
+
+
+void fake_tasks_init(void);
+
+void fake_tasks_run(int64_t duration_us);
+
+void fake_tasks_work(uint32_t duration_us);
+
+
+#endif
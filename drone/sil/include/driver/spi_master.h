@@ -0,0 +1,36 @@
+#ifndef __SIL_DRIVER_SPI_MASTER_H_
+#define __SIL_DRIVER_SPI_MASTER_H_
+
+/* Just enough of the ESP-IDF's SPI master driver API for 'sensor-bus.cpp' to
+ * build with its target backends. The host has no SPI bus, so nothing can be
+ * queued on one */
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+typedef struct fake_spi_device *spi_device_handle_t;
+
+typedef struct {
+    size_t length;
+    const void *tx_buffer;
+    void *rx_buffer;
+    void *user;
+} spi_transaction_t;
+
+
+static inline esp_err_t spi_device_queue_trans(spi_device_handle_t handle, \
+    spi_transaction_t *trans_desc, TickType_t ticks_to_wait) {
+
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+static inline esp_err_t spi_device_get_trans_result(spi_device_handle_t handle, \
+    spi_transaction_t **trans_desc, TickType_t ticks_to_wait) {
+
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif
@@ -0,0 +1,7 @@
+#ifndef __SIL_ESP_ATTR_H_
+#define __SIL_ESP_ATTR_H_
+
+/* There is no IRAM on the host */
+#define IRAM_ATTR
+
+#endif
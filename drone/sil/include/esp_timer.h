@@ -0,0 +1,34 @@
+#ifndef __SIL_ESP_TIMER_H_
+#define __SIL_ESP_TIMER_H_
+
+/* The calls into esp_timer that the components make. The time is kept by
+ * 'fake-esp-timer.cpp', and runs on simulated time. Only the scheduler uses
+ * the timers, which 'fake-tasks.cpp' runs on its own simulated time */
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+
+typedef struct sil_esp_timer *esp_timer_handle_t;
+
+typedef enum {
+    ESP_TIMER_TASK,
+} esp_timer_dispatch_t;
+
+typedef struct {
+    void (*callback)(void *arg);
+    void *arg;
+    esp_timer_dispatch_t dispatch_method;
+    const char *name;
+    bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+
+int64_t esp_timer_get_time(void);
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *out);
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef __SIL_FREERTOS_FREERTOS_H_
+#define __SIL_FREERTOS_FREERTOS_H_
+
+/* Just enough of FreeRTOS for the drone's components to build on a host. The
+ * SIL has a single simulated task, see 'fake-freertos.cpp'. The scheduler's
+ * test has several, on one simulated core, see 'fake-tasks.cpp' */
+
+#include <inttypes.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef uint8_t StackType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+
+#define portMAX_DELAY ((TickType_t) 0xFFFFFFFF)
+
+#define portYIELD_FROM_ISR()
+
+/* The target's tick is 100Hz */
+#define portTICK_PERIOD_MS 10
+#define pdMS_TO_TICKS(ms) ((TickType_t) ((ms) / portTICK_PERIOD_MS))
+
+#endif
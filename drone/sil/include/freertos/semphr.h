@@ -0,0 +1,24 @@
+#ifndef __SIL_FREERTOS_SEMPHR_H_
+#define __SIL_FREERTOS_SEMPHR_H_
+
+/* Binary semaphores, see 'fake-freertos.cpp' */
+
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct {
+    uint32_t count;
+} StaticSemaphore_t;
+
+typedef StaticSemaphore_t *SemaphoreHandle_t;
+
+
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t *buffer);
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait);
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, \
+    BaseType_t *higher_priority_task_woken);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef __SIL_FREERTOS_TASK_H_
+#define __SIL_FREERTOS_TASK_H_
+
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct sil_task *TaskHandle_t;
+
+typedef struct {
+    TaskHandle_t task;
+} StaticTask_t;
+
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+typedef enum {
+    eNoAction,
+    eSetBits,
+    eIncrement,
+    eSetValueWithOverwrite,
+    eSetValueWithoutOverwrite,
+} eNotifyAction;
+
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action);
+
+BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value, \
+    eNotifyAction action, BaseType_t *higher_priority_task_woken);
+
+void vTaskDelay(TickType_t ticks);
+
+TickType_t xTaskGetTickCount(void);
+
+TaskHandle_t xTaskCreateStaticPinnedToCore(void (*fn)(void *arg), const char *name, \
+    uint32_t stack_size, void *arg, UBaseType_t priority, StackType_t *stack, \
+    StaticTask_t *buffer, BaseType_t core);
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait);
+
+#endif
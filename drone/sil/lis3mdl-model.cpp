@@ -0,0 +1,159 @@
+#include <inttypes.h>
+#include <math.h>
+#include <string.h>
+
+#include "driver/gpio.h"
+
+#include "esp32-i2c-lis3mdl.h"
+
+#include "fake-gpio.h"
+#include "lis3mdl-model.h"
+#include "quad-model.h"
+#include "sim-random.h"
+
+
+#define WHO_AM_I 0x0F
+#define STATUS_REG 0x27
+/* STATUS_REG's ZYXDA bit */
+#define STATUS_ZYXDA 0x08
+
+
+static void lis3mdl_model_write(void *ctx, uint8_t reg, const uint8_t *data, size_t len);
+static void lis3mdl_model_read(void *ctx, uint8_t reg, uint8_t *data, size_t len);
+
+
+/* The ODR selected by CTRL_REG1 and CTRL_REG3, or 0 if the sensor is not
+ * converting continuously */
+static double lis3mdl_model_odr_hz(const struct lis3mdl_model *model) {
+    static const double do_hz[] = { 0.625, 1.25, 2.5, 5.0, 10.0, 20.0, 40.0, 80.0 };
+    static const double fast_odr_hz[] = { 1000.0, 560.0, 300.0, 155.0 };
+    struct lis3mdl_ctrl_reg1 ctrl_reg1;
+    struct lis3mdl_ctrl_reg3 ctrl_reg3;
+    memcpy(&ctrl_reg1, &model->regs[CTRL_REG1], 1);
+    memcpy(&ctrl_reg3, &model->regs[CTRL_REG3], 1);
+
+    if (ctrl_reg3.md != LIS3MDL_MD_CONTINUOUSCONVERSION) {
+        return 0.0;
+    }
+
+    return ctrl_reg1.fast_odr ? fast_odr_hz[ctrl_reg1.om] : do_hz[ctrl_reg1.do_bits];
+}
+
+
+static float lis3mdl_model_sensitivity(const struct lis3mdl_model *model) {
+    struct lis3mdl_ctrl_reg2 ctrl_reg2;
+    memcpy(&ctrl_reg2, &model->regs[CTRL_REG2], 1);
+
+    switch (ctrl_reg2.fs) {
+        case LIS3MDL_FS_8GAUSS: return LIS3MDL_SENSITIVITY_FS_8GAUSS;
+        case LIS3MDL_FS_12GAUSS: return LIS3MDL_SENSITIVITY_FS_12GAUSS;
+        case LIS3MDL_FS_16GAUSS: return LIS3MDL_SENSITIVITY_FS_16GAUSS;
+        default: return LIS3MDL_SENSITIVITY_FS_4GAUSS;
+    }
+}
+
+
+static void lis3mdl_model_update_drdy(struct lis3mdl_model *model) {
+    if (model->drdy_pin != GPIO_NUM_NC) {
+        fake_gpio_set_level(model->drdy_pin, model->drdy);
+    }
+}
+
+
+/** Takes a struct lis3mdl_model and powers it up, sensing 'quad', with its
+ * registers at their reset values (so powered down) and DRDY wired to
+ * 'drdy_pin' (which can be GPIO_NUM_NC). 'seed' seeds the sensor noise. */
+void lis3mdl_model_init(struct lis3mdl_model *model, const struct quad_model *quad, \
+    gpio_num_t drdy_pin, uint64_t seed) {
+
+    memset(model, 0, sizeof(*model));
+    model->quad = quad;
+    model->drdy_pin = drdy_pin;
+    sim_random_seed(&model->random, seed);
+
+    /* Something like the field at mid-northern latitudes, pointing north and
+     * down */
+    model->field_gauss[0] = 0.2;
+    model->field_gauss[1] = 0.0;
+    model->field_gauss[2] = -0.45;
+    model->noise_gauss = 0.003;
+
+    /* Power-down is the reset state */
+    model->regs[CTRL_REG3] = LIS3MDL_MD_POWERDOWN2;
+
+    model->mock.ctx = model;
+    model->mock.write = lis3mdl_model_write;
+    model->mock.read = lis3mdl_model_read;
+}
+
+
+/** Moves the sensor's clock on to 'time_s', taking a new sample from the
+ * quad's current orientation if one is due, and updates DRDY. */
+void lis3mdl_model_update(struct lis3mdl_model *model, double time_s) {
+    model->time_s = time_s;
+
+    double odr_hz = lis3mdl_model_odr_hz(model);
+    if (odr_hz > 0.0 && model->next_odr_s <= time_s) {
+        double m[3];
+        quad_model_earth_to_body(model->quad, model->field_gauss, m);
+        float sensitivity = lis3mdl_model_sensitivity(model);
+        for (int i = 0; i < 3; i++) {
+            double raw = round((m[i] + sim_random_gaussian(&model->random, model->noise_gauss)) \
+                * sensitivity);
+            if (raw > INT16_MAX) raw = INT16_MAX;
+            if (raw < INT16_MIN) raw = INT16_MIN;
+            int16_t r = (int16_t) raw;
+            model->regs[OUTX_L + 2 * i] = (uint16_t) r & 0xFF;
+            model->regs[OUTX_L + 2 * i + 1] = (uint16_t) r >> 8;
+        }
+        model->drdy = 1;
+        while (model->next_odr_s <= time_s) model->next_odr_s += 1.0 / odr_hz;
+    }
+
+    lis3mdl_model_update_drdy(model);
+}
+
+
+static void lis3mdl_model_read(void *ctx, uint8_t reg, uint8_t *data, size_t len) {
+    struct lis3mdl_model *model = (struct lis3mdl_model *) ctx;
+    /* The MSB of the sub-address asks for auto-increment */
+    int increment = reg & LIS3MDL_I2C_AUTO_INCREMENT;
+    reg &= 0x3F;
+
+    for (size_t i = 0; i < len; i++) {
+        if (reg == WHO_AM_I) {
+            data[i] = LIS3MDL_MODEL_WHO_AM_I;
+        } else if (reg == STATUS_REG) {
+            data[i] = model->drdy ? STATUS_ZYXDA : 0;
+        } else {
+            data[i] = model->regs[reg];
+        }
+        if (reg >= OUTX_L && reg <= OUTZ_H) {
+            model->drdy = 0;
+        }
+        if (increment) {
+            reg = (reg + 1) & 0x3F;
+        }
+    }
+
+    lis3mdl_model_update_drdy(model);
+}
+
+
+static void lis3mdl_model_write(void *ctx, uint8_t reg, const uint8_t *data, size_t len) {
+    struct lis3mdl_model *model = (struct lis3mdl_model *) ctx;
+    int increment = reg & LIS3MDL_I2C_AUTO_INCREMENT;
+    reg &= 0x3F;
+
+    for (size_t i = 0; i < len; i++) {
+        if (reg != WHO_AM_I && reg != STATUS_REG) {
+            model->regs[reg] = data[i];
+        }
+        if (reg == CTRL_REG1 || reg == CTRL_REG3) {
+            model->next_odr_s = model->time_s;
+        }
+        if (increment) {
+            reg = (reg + 1) & 0x3F;
+        }
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef __LIS3MDL_MODEL_H_
+#define __LIS3MDL_MODEL_H_
+
+#include <inttypes.h>
+
+#include "driver/gpio.h"
+
+#include "sensor-bus.h"
+
+#include "quad-model.h"
+#include "sim-random.h"
+
+
+#define LIS3MDL_MODEL_WHO_AM_I 0x3D
+
+
+/* A LIS3MDL, as seen over I2C: the control registers, the output registers
+ * and the DRDY line, fed from a struct quad_model */
+struct lis3mdl_model {
+    const struct quad_model *quad;
+    struct sim_random random;
+    gpio_num_t drdy_pin;
+    /* The earth's field in the earth frame, and the sensor noise, in gauss */
+    double field_gauss[3];
+    double noise_gauss;
+
+    uint8_t regs[64];
+    double time_s;
+    double next_odr_s;
+    uint8_t drdy;
+
+    /* What the driver's struct sensor_bus is pointed at */
+    struct sensor_bus_mock mock;
+};
+
+
+void lis3mdl_model_init(struct lis3mdl_model *model, const struct quad_model *quad, \
+    gpio_num_t drdy_pin, uint64_t seed);
+
+void lis3mdl_model_update(struct lis3mdl_model *model, double time_s);
+
+
+#endif
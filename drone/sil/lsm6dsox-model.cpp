@@ -0,0 +1,507 @@
+#include <inttypes.h>
+#include <math.h>
+#include <string.h>
+
+#include "driver/gpio.h"
+
+#include "esp32-i2c-lsm6dsox.h"
+
+#include "fake-gpio.h"
+#include "lsm6dsox-model.h"
+#include "quad-model.h"
+#include "sim-random.h"
+
+
+#define WHO_AM_I 0x0F
+#define FIFO_DATA_OUT_Z_H 0x7E
+
+
+static void lsm6dsox_model_write(void *ctx, uint8_t reg, const uint8_t *data, size_t len);
+static void lsm6dsox_model_read(void *ctx, uint8_t reg, uint8_t *data, size_t len);
+
+
+/* The accelerometer ODR and batch rate codes mean the same rates as the
+ * gyroscope ones, other than the low-power-only code 11 */
+static double lsm6dsox_model_odr_xl_hz(uint8_t odr_xl) {
+    return odr_xl == LSM6DSOX_XL_ODR_1Hz6 ? 1.6 \
+        : esp_i2c_lsm6dsox_odr_g_to_hz((lsm6dsox_odr_g_t) odr_xl);
+}
+
+static double lsm6dsox_model_bdr_xl_hz(uint8_t bdr_xl) {
+    return bdr_xl == LSM6DSOX_BDR_XL_1Hz6 ? 1.6 \
+        : esp_i2c_lsm6dsox_bdr_gy_to_hz((lsm6dsox_bdr_gy_t) bdr_xl);
+}
+
+
+/* The full scales selected by the control registers, in mg/LSB and
+ * mdps/LSB */
+static float lsm6dsox_model_accel_sensitivity(const struct lsm6dsox_model *model) {
+    struct lsm6dsox_ctrl1_xl ctrl1_xl;
+    struct lsm6dsox_ctrl8_xl ctrl8_xl;
+    memcpy(&ctrl1_xl, &model->regs[CTRL1_XL], 1);
+    memcpy(&ctrl8_xl, &model->regs[CTRL8_XL], 1);
+
+    switch (ctrl1_xl.fs_xl) {
+        case LSM6DSOX_FS_XL_01:
+            return ctrl8_xl.xl_fs_mode ? LSM6DSOX_ACC_SENSITIVITY_FS_2G \
+                : LSM6DSOX_ACC_SENSITIVITY_FS_16G;
+        case LSM6DSOX_FS_XL_10: return LSM6DSOX_ACC_SENSITIVITY_FS_4G;
+        case LSM6DSOX_FS_XL_11: return LSM6DSOX_ACC_SENSITIVITY_FS_8G;
+        default: return LSM6DSOX_ACC_SENSITIVITY_FS_2G;
+    }
+}
+
+static float lsm6dsox_model_gyro_sensitivity(const struct lsm6dsox_model *model) {
+    struct lsm6dsox_ctrl2_g ctrl2_g;
+    memcpy(&ctrl2_g, &model->regs[CTRL2_G], 1);
+
+    if (ctrl2_g.fs_125) {
+        return LSM6DSOX_GYRO_SENSITIVITY_FS_125DPS;
+    }
+    switch (ctrl2_g.fs_g) {
+        case LSM6DSOX_FS_G_01: return LSM6DSOX_GYRO_SENSITIVITY_FS_500DPS;
+        case LSM6DSOX_FS_G_10: return LSM6DSOX_GYRO_SENSITIVITY_FS_1000DPS;
+        case LSM6DSOX_FS_G_11: return LSM6DSOX_GYRO_SENSITIVITY_FS_2000DPS;
+        default: return LSM6DSOX_GYRO_SENSITIVITY_FS_250DPS;
+    }
+}
+
+
+static int16_t lsm6dsox_model_quantize(double value, double sensitivity) {
+    double raw = round(value / sensitivity);
+    if (raw > INT16_MAX) raw = INT16_MAX;
+    if (raw < INT16_MIN) raw = INT16_MIN;
+
+    return (int16_t) raw;
+}
+
+
+static uint16_t lsm6dsox_model_watermark(const struct lsm6dsox_model *model) {
+    return model->regs[FIFO_CTRL1] | ((model->regs[FIFO_CTRL2] & 0x1) << 8);
+}
+
+
+/* Everything on the device runs off its internal oscillator, so is this
+ * much faster than nominal */
+static double lsm6dsox_model_clock_rate(const struct lsm6dsox_model *model) {
+    return 1.0 + model->clock_error;
+}
+
+
+static uint32_t lsm6dsox_model_timestamp(const struct lsm6dsox_model *model) {
+    return (uint32_t) (model->time_s * lsm6dsox_model_clock_rate(model) * 1e6 \
+        / LSM6DSOX_TIMESTAMP_LSB_US);
+}
+
+
+/* Drives INT1 from whichever events are routed to it */
+static void lsm6dsox_model_update_int1(struct lsm6dsox_model *model) {
+    if (model->int1_pin == GPIO_NUM_NC) {
+        return;
+    }
+
+    struct lsm6dsox_int1_ctrl int1_ctrl;
+    memcpy(&int1_ctrl, &model->regs[INT1_CTRL], 1);
+    uint16_t watermark = lsm6dsox_model_watermark(model);
+    int level = (int1_ctrl.int1_drdy_g && model->drdy_g) \
+        || (int1_ctrl.int1_drdy_xl && model->drdy_xl) \
+        || (int1_ctrl.int1_fifo_th && watermark > 0 && model->fifo_level >= watermark) \
+        || (int1_ctrl.int1_fifo_ovr && model->fifo_ovr) \
+        || (int1_ctrl.int1_fifo_full && model->fifo_level == LSM6DSOX_MODEL_FIFO_WORDS);
+
+    fake_gpio_set_level(model->int1_pin, level);
+}
+
+
+static void lsm6dsox_model_fifo_flush(struct lsm6dsox_model *model) {
+    model->fifo_head = 0;
+    model->fifo_level = 0;
+    model->fifo_ovr = 0;
+}
+
+
+static void lsm6dsox_model_fifo_push(struct lsm6dsox_model *model, uint8_t tag_sensor, \
+    const uint8_t *data) {
+
+    struct lsm6dsox_fifo_ctrl4 fifo_ctrl4;
+    memcpy(&fifo_ctrl4, &model->regs[FIFO_CTRL4], 1);
+
+    if (model->fifo_level == LSM6DSOX_MODEL_FIFO_WORDS) {
+        model->fifo_ovr = 1;
+        model->fifo_overruns++;
+        /* FIFO mode stops when full, the stream modes drop the oldest word */
+        if (fifo_ctrl4.fifo_mode == LSM6DSOX_FIFO_MODE_FIFO) {
+            return;
+        }
+        model->fifo_head = (model->fifo_head + 1) % LSM6DSOX_MODEL_FIFO_WORDS;
+        model->fifo_level--;
+    }
+
+    int tail = (model->fifo_head + model->fifo_level) % LSM6DSOX_MODEL_FIFO_WORDS;
+    uint8_t *word = model->fifo[tail];
+    word[0] = (tag_sensor << 3) | ((model->fifo_tag_cnt & 0x3) << 1);
+    memcpy(&word[1], data, 6);
+    model->fifo_level++;
+    if (model->fifo_level > model->fifo_max_level) {
+        model->fifo_max_level = model->fifo_level;
+    }
+}
+
+
+static void lsm6dsox_model_fifo_push_triplet(struct lsm6dsox_model *model, \
+    uint8_t tag_sensor, const int16_t *raw) {
+
+    uint8_t data[6];
+    for (int i = 0; i < 3; i++) {
+        data[2 * i] = (uint16_t) raw[i] & 0xFF;
+        data[2 * i + 1] = (uint16_t) raw[i] >> 8;
+    }
+    lsm6dsox_model_fifo_push(model, tag_sensor, data);
+}
+
+
+/* The rates selected by SHUB_ODR, in Hz */
+static const double lsm6dsox_model_shub_odr_hz[] = { 104.0, 52.0, 26.0, 12.5 };
+
+
+/* Whether 'reg' is one of the sensor hub's registers right now */
+static bool lsm6dsox_model_shub_reg(const struct lsm6dsox_model *model, uint8_t reg) {
+    struct lsm6dsox_func_cfg_access func_cfg_access;
+    memcpy(&func_cfg_access, &model->regs[FUNC_CFG_ACCESS], 1);
+
+    return func_cfg_access.shub_reg_access && reg >= SENSOR_HUB_1 && reg <= STATUS_MASTER;
+}
+
+
+/* Runs one sensor hub cycle: slave 0's read or write on the auxiliary bus,
+ * then the FIFO word for it if it is batched */
+static void lsm6dsox_model_shub_cycle(struct lsm6dsox_model *model) {
+    struct lsm6dsox_master_config master_config;
+    struct lsm6dsox_slv0_add slv0_add;
+    struct lsm6dsox_slv0_config slv0_config;
+    struct lsm6dsox_fifo_ctrl4 fifo_ctrl4;
+    memcpy(&master_config, &model->shub_regs[MASTER_CONFIG], 1);
+    memcpy(&slv0_add, &model->shub_regs[SLV0_ADD], 1);
+    memcpy(&slv0_config, &model->shub_regs[SLV0_CONFIG], 1);
+    memcpy(&fifo_ctrl4, &model->regs[FIFO_CTRL4], 1);
+    uint8_t subadd = model->shub_regs[SLV0_SUBADD];
+
+    struct lsm6dsox_status_master status_master = {};
+    status_master.sens_hub_endop = 1;
+    if (model->aux == NULL || slv0_add.slave0_add != model->aux_address) {
+        status_master.slave0_nack = 1;
+    } else if (slv0_add.rw_0) {
+        model->aux->read(model->aux->ctx, subadd, &model->shub_regs[SENSOR_HUB_1], \
+            slv0_config.slave0_numop);
+    } else if (!master_config.write_once || !model->shub_written) {
+        model->aux->write(model->aux->ctx, subadd, &model->shub_regs[DATAWRITE_SLV0], 1);
+        model->shub_written = 1;
+        status_master.wr_once_done = master_config.write_once;
+    }
+    memcpy(&model->shub_regs[STATUS_MASTER], &status_master, 1);
+    model->shub_cycles++;
+
+    if (slv0_config.batch_ext_sens_0_en && fifo_ctrl4.fifo_mode != LSM6DSOX_FIFO_MODE_BYPASS) {
+        lsm6dsox_model_fifo_push(model, status_master.slave0_nack \
+            ? LSM6DSOX_TAG_SHUB_NACK : LSM6DSOX_TAG_SHUB_SLAVE0, \
+            &model->shub_regs[SENSOR_HUB_1]);
+    }
+}
+
+
+/* Starts or stops the sensor hub after MASTER_CONFIG has been written. A
+ * cycle is run as soon as it starts, as if an accelerometer sample was due
+ * straight away */
+static void lsm6dsox_model_shub_master_written(struct lsm6dsox_model *model, uint8_t was) {
+    struct lsm6dsox_master_config before;
+    struct lsm6dsox_master_config after;
+    memcpy(&before, &was, 1);
+    memcpy(&after, &model->shub_regs[MASTER_CONFIG], 1);
+
+    if (after.master_on && !before.master_on) {
+        model->shub_written = 0;
+        model->shub_regs[STATUS_MASTER] = 0;
+        lsm6dsox_model_shub_cycle(model);
+        model->next_shub_s = model->time_s;
+    }
+}
+
+
+/** Takes a struct lsm6dsox_model and powers it up, sensing 'quad', with its
+ * registers at their reset values and INT1 wired to 'int1_pin' (which can be
+ * GPIO_NUM_NC). 'seed' seeds the sensor noise. */
+void lsm6dsox_model_init(struct lsm6dsox_model *model, const struct quad_model *quad, \
+    gpio_num_t int1_pin, uint64_t seed) {
+
+    memset(model, 0, sizeof(*model));
+    model->quad = quad;
+    model->int1_pin = int1_pin;
+    sim_random_seed(&model->random, seed);
+
+    /* Roughly the datasheet's noise figures at the flight profile's ODR, and
+     * a plausible zero rate offset */
+    model->gyro_noise_rad_s = 0.002;
+    model->gyro_bias_rad_s[0] = 0.004;
+    model->gyro_bias_rad_s[1] = -0.003;
+    model->gyro_bias_rad_s[2] = 0.002;
+    model->accel_noise_m_s2 = 0.02;
+
+    /* IF_INC is set on reset, and CTRL9_XL has the DEN bits set */
+    model->regs[CTRL3_C] = 0x04;
+    model->regs[CTRL9_XL] = LSM6DSOX_CTRL9_XL_DEFAULT;
+
+    model->mock.ctx = model;
+    model->mock.write = lsm6dsox_model_write;
+    model->mock.read = lsm6dsox_model_read;
+}
+
+
+/** Puts the device behind 'aux' on the model's auxiliary bus, at 7 bit I2C
+ * address 'address', for the sensor hub to talk to. 'aux' has to have its
+ * 'read' and 'write' set. */
+void lsm6dsox_model_attach_aux(struct lsm6dsox_model *model, struct sensor_bus_mock *aux, \
+    uint8_t address) {
+
+    model->aux = aux;
+    model->aux_address = address;
+}
+
+
+/** Moves the sensor's clock on to 'time_s', producing every sample (and FIFO
+ * word) that falls due on the way from the quad's current state, and updates
+ * INT1. Meant to be called after each step of the quad model. */
+void lsm6dsox_model_update(struct lsm6dsox_model *model, double time_s) {
+    struct lsm6dsox_ctrl1_xl ctrl1_xl;
+    struct lsm6dsox_ctrl2_g ctrl2_g;
+    struct lsm6dsox_fifo_ctrl3 fifo_ctrl3;
+    struct lsm6dsox_fifo_ctrl4 fifo_ctrl4;
+    memcpy(&ctrl1_xl, &model->regs[CTRL1_XL], 1);
+    memcpy(&ctrl2_g, &model->regs[CTRL2_G], 1);
+    memcpy(&fifo_ctrl3, &model->regs[FIFO_CTRL3], 1);
+    memcpy(&fifo_ctrl4, &model->regs[FIFO_CTRL4], 1);
+
+    model->time_s = time_s;
+
+    /* 1. Output registers */
+    const double clock_rate = lsm6dsox_model_clock_rate(model);
+    double odr_g_hz = esp_i2c_lsm6dsox_odr_g_to_hz((lsm6dsox_odr_g_t) ctrl2_g.odr_g) * clock_rate;
+    if (odr_g_hz > 0.0 && model->next_odr_g_s <= time_s) {
+        double g[3];
+        quad_model_sense_gyro(model->quad, g);
+        float sensitivity = lsm6dsox_model_gyro_sensitivity(model);
+        for (int i = 0; i < 3; i++) {
+            double mdps = (g[i] + model->gyro_bias_rad_s[i] \
+                + sim_random_gaussian(&model->random, model->gyro_noise_rad_s)) \
+                * 180000.0 / M_PI;
+            model->raw_g[i] = lsm6dsox_model_quantize(mdps, sensitivity);
+        }
+        model->drdy_g = 1;
+        while (model->next_odr_g_s <= time_s) model->next_odr_g_s += 1.0 / odr_g_hz;
+    }
+
+    double odr_xl_hz = lsm6dsox_model_odr_xl_hz(ctrl1_xl.odr_xl) * clock_rate;
+    if (odr_xl_hz > 0.0 && model->next_odr_xl_s <= time_s) {
+        double a[3];
+        quad_model_sense_accel(model->quad, a);
+        float sensitivity = lsm6dsox_model_accel_sensitivity(model);
+        for (int i = 0; i < 3; i++) {
+            double mg = (a[i] + sim_random_gaussian(&model->random, model->accel_noise_m_s2)) \
+                * 1000.0 / QUAD_MODEL_GRAVITY_M_S2;
+            model->raw_xl[i] = lsm6dsox_model_quantize(mg, sensitivity);
+        }
+        model->drdy_xl = 1;
+        while (model->next_odr_xl_s <= time_s) model->next_odr_xl_s += 1.0 / odr_xl_hz;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        model->regs[OUTX_L_G + 2 * i] = (uint16_t) model->raw_g[i] & 0xFF;
+        model->regs[OUTX_L_G + 2 * i + 1] = (uint16_t) model->raw_g[i] >> 8;
+        model->regs[OUTX_L_A + 2 * i] = (uint16_t) model->raw_xl[i] & 0xFF;
+        model->regs[OUTX_L_A + 2 * i + 1] = (uint16_t) model->raw_xl[i] >> 8;
+    }
+
+    /* 2. FIFO. Timestamps are batched every 1, 8 or 32 gyroscope batch
+     * events, ahead of the sample they belong to */
+    if (fifo_ctrl4.fifo_mode != LSM6DSOX_FIFO_MODE_BYPASS) {
+        double bdr_gy_hz = esp_i2c_lsm6dsox_bdr_gy_to_hz((lsm6dsox_bdr_gy_t) fifo_ctrl3.bdr_gy) \
+            * clock_rate;
+        if (bdr_gy_hz > 0.0 && model->next_bdr_gy_s <= time_s) {
+            static const uint32_t ts_decimation[] = { 0, 1, 8, 32 };
+            uint32_t decimation = ts_decimation[fifo_ctrl4.dec_ts_batch];
+            if (decimation && (model->batch_events % decimation) == 0) {
+                uint32_t timestamp = lsm6dsox_model_timestamp(model);
+                uint8_t data[6] = {
+                    (uint8_t) timestamp, (uint8_t) (timestamp >> 8),
+                    (uint8_t) (timestamp >> 16), (uint8_t) (timestamp >> 24), 0, 0,
+                };
+                lsm6dsox_model_fifo_push(model, LSM6DSOX_TAG_TIMESTAMP, data);
+            }
+            model->batch_events++;
+            model->fifo_tag_cnt++;
+            lsm6dsox_model_fifo_push_triplet(model, LSM6DSOX_TAG_GYRO_NC, model->raw_g);
+            while (model->next_bdr_gy_s <= time_s) model->next_bdr_gy_s += 1.0 / bdr_gy_hz;
+        }
+
+        double bdr_xl_hz = lsm6dsox_model_bdr_xl_hz(fifo_ctrl3.bdr_xl) * clock_rate;
+        if (bdr_xl_hz > 0.0 && model->next_bdr_xl_s <= time_s) {
+            lsm6dsox_model_fifo_push_triplet(model, LSM6DSOX_TAG_XL_NC, model->raw_xl);
+            while (model->next_bdr_xl_s <= time_s) model->next_bdr_xl_s += 1.0 / bdr_xl_hz;
+        }
+    }
+
+    /* 3. Sensor hub. It runs on accelerometer samples, at most SHUB_ODR of
+     * them a second */
+    struct lsm6dsox_master_config master_config;
+    struct lsm6dsox_slv0_config slv0_config;
+    memcpy(&master_config, &model->shub_regs[MASTER_CONFIG], 1);
+    memcpy(&slv0_config, &model->shub_regs[SLV0_CONFIG], 1);
+    if (master_config.master_on && odr_xl_hz > 0.0 && model->next_shub_s <= time_s) {
+        double shub_hz = lsm6dsox_model_shub_odr_hz[slv0_config.shub_odr] * clock_rate;
+        if (shub_hz > odr_xl_hz) shub_hz = odr_xl_hz;
+        lsm6dsox_model_shub_cycle(model);
+        while (model->next_shub_s <= time_s) model->next_shub_s += 1.0 / shub_hz;
+    }
+
+    lsm6dsox_model_update_int1(model);
+}
+
+
+static uint8_t lsm6dsox_model_read_byte(struct lsm6dsox_model *model, uint8_t reg) {
+    uint32_t timestamp;
+
+    if (lsm6dsox_model_shub_reg(model, reg)) {
+        return model->shub_regs[reg];
+    }
+
+    switch (reg) {
+        case WHO_AM_I:
+            return LSM6DSOX_MODEL_WHO_AM_I;
+        case STATUS_MASTER_MAINPAGE:
+            return model->shub_regs[STATUS_MASTER];
+        case FIFO_STATUS1:
+            return model->fifo_level & 0xFF;
+        case FIFO_STATUS2: {
+            struct lsm6dsox_fifo_status2 status2 = {};
+            uint16_t watermark = lsm6dsox_model_watermark(model);
+            status2.diff_fifo_hi = (model->fifo_level >> 8) & 0x3;
+            status2.fifo_ovr_ia = model->fifo_ovr;
+            status2.fifo_full_ia = model->fifo_level == LSM6DSOX_MODEL_FIFO_WORDS;
+            status2.fifo_wtm_ia = watermark > 0 && model->fifo_level >= watermark;
+            /* The overrun flag is cleared once it has been seen */
+            model->fifo_ovr = 0;
+            uint8_t byte;
+            memcpy(&byte, &status2, 1);
+            return byte;
+        }
+        case TIMESTAMP0:
+        case TIMESTAMP0 + 1:
+        case TIMESTAMP0 + 2:
+        case TIMESTAMP0 + 3:
+            timestamp = lsm6dsox_model_timestamp(model);
+            return (timestamp >> (8 * (reg - TIMESTAMP0))) & 0xFF;
+        case INTERNAL_FREQ_FINE:
+            /* The factory trim only gets the error to the nearest step */
+            return (uint8_t) (int8_t) lround(model->clock_error / LSM6DSOX_FREQ_FINE_STEP);
+        case FIFO_DATA_OUT_TAG:
+            /* Reading the tag moves on to the next word */
+            if (model->fifo_level > 0) {
+                memcpy(model->fifo_out, model->fifo[model->fifo_head], sizeof(model->fifo_out));
+                model->fifo_head = (model->fifo_head + 1) % LSM6DSOX_MODEL_FIFO_WORDS;
+                model->fifo_level--;
+            } else {
+                memset(model->fifo_out, 0, sizeof(model->fifo_out));
+            }
+            return model->fifo_out[0];
+        default:
+            break;
+    }
+
+    if (reg > FIFO_DATA_OUT_TAG && reg <= FIFO_DATA_OUT_Z_H) {
+        return model->fifo_out[reg - FIFO_DATA_OUT_TAG];
+    }
+    if (reg >= OUTX_L_G && reg <= OUTZ_H_G) {
+        model->drdy_g = 0;
+    }
+    if (reg >= OUTX_L_A && reg <= OUTZ_H_A) {
+        model->drdy_xl = 0;
+    }
+
+    return model->regs[reg & 0x7F];
+}
+
+
+static uint8_t lsm6dsox_model_next_reg(const struct lsm6dsox_model *model, uint8_t reg) {
+    struct lsm6dsox_ctrl3_c ctrl3_c;
+    memcpy(&ctrl3_c, &model->regs[CTRL3_C], 1);
+
+    if (!ctrl3_c.if_inc) {
+        return reg;
+    }
+    /* The FIFO output registers roll over so that words can be read back to
+     * back */
+    if (reg == FIFO_DATA_OUT_Z_H) {
+        return FIFO_DATA_OUT_TAG;
+    }
+
+    return (reg + 1) & 0x7F;
+}
+
+
+static void lsm6dsox_model_read(void *ctx, uint8_t reg, uint8_t *data, size_t len) {
+    struct lsm6dsox_model *model = (struct lsm6dsox_model *) ctx;
+
+    for (size_t i = 0; i < len; i++) {
+        data[i] = lsm6dsox_model_read_byte(model, reg);
+        reg = lsm6dsox_model_next_reg(model, reg);
+    }
+
+    lsm6dsox_model_update_int1(model);
+}
+
+
+static void lsm6dsox_model_write(void *ctx, uint8_t reg, const uint8_t *data, size_t len) {
+    struct lsm6dsox_model *model = (struct lsm6dsox_model *) ctx;
+
+    for (size_t i = 0; i < len; i++) {
+        reg &= 0x7F;
+        if (lsm6dsox_model_shub_reg(model, reg)) {
+            uint8_t was = model->shub_regs[reg];
+            model->shub_regs[reg] = data[i];
+            if (reg == MASTER_CONFIG) {
+                lsm6dsox_model_shub_master_written(model, was);
+            }
+            reg = lsm6dsox_model_next_reg(model, reg);
+            continue;
+        }
+        if (reg != WHO_AM_I) {
+            model->regs[reg] = data[i];
+        }
+
+        switch (reg) {
+            case FIFO_CTRL4: {
+                struct lsm6dsox_fifo_ctrl4 fifo_ctrl4;
+                memcpy(&fifo_ctrl4, &data[i], 1);
+                if (fifo_ctrl4.fifo_mode == LSM6DSOX_FIFO_MODE_BYPASS) {
+                    lsm6dsox_model_fifo_flush(model);
+                }
+                break;
+            }
+            case FIFO_CTRL3:
+                model->next_bdr_gy_s = model->time_s;
+                model->next_bdr_xl_s = model->time_s;
+                break;
+            case CTRL1_XL:
+                model->next_odr_xl_s = model->time_s;
+                break;
+            case CTRL2_G:
+                model->next_odr_g_s = model->time_s;
+                break;
+            default:
+                break;
+        }
+
+        reg = lsm6dsox_model_next_reg(model, reg);
+    }
+
+    lsm6dsox_model_update_int1(model);
+}
@@ -0,0 +1,85 @@
+#ifndef __LSM6DSOX_MODEL_H_
+#define __LSM6DSOX_MODEL_H_
+
+#include <inttypes.h>
+
+#include "driver/gpio.h"
+
+#include "sensor-bus.h"
+
+#include "quad-model.h"
+#include "sim-random.h"
+
+
+#define LSM6DSOX_MODEL_WHO_AM_I 0x6C
+/* Roughly what fits in the real FIFO's 3KB of data */
+#define LSM6DSOX_MODEL_FIFO_WORDS 512
+
+
+/* An LSM6DSOX, as seen over I2C: the control registers, the output
+ * registers, the timestamp counter, the FIFO, the INT1 line and the sensor
+ * hub's slave 0, fed from a struct quad_model */
+struct lsm6dsox_model {
+    const struct quad_model *quad;
+    struct sim_random random;
+    gpio_num_t int1_pin;
+    /* Sensor imperfections */
+    double gyro_noise_rad_s;
+    double gyro_bias_rad_s[3];
+    double accel_noise_m_s2;
+    /* How far the internal oscillator (and so every ODR and the timestamp
+     * counter) is off, as a fraction: 0.001 runs 0.1% fast */
+    double clock_error;
+
+    uint8_t regs[128];
+    double time_s;
+    /* When the next output register update and FIFO batch of each sensor is
+     * due */
+    double next_odr_g_s;
+    double next_odr_xl_s;
+    double next_bdr_gy_s;
+    double next_bdr_xl_s;
+    uint32_t batch_events;
+    /* The latest sample of each sensor, as raw register values */
+    int16_t raw_g[3];
+    int16_t raw_xl[3];
+    /* Data-ready flags, cleared by reading the output registers */
+    uint8_t drdy_g;
+    uint8_t drdy_xl;
+
+    /* The FIFO, a ring buffer of words, and the word currently being read
+     * out of FIFO_DATA_OUT_TAG onwards */
+    uint8_t fifo[LSM6DSOX_MODEL_FIFO_WORDS][7];
+    uint16_t fifo_head;
+    uint16_t fifo_level;
+    uint8_t fifo_out[7];
+    uint8_t fifo_tag_cnt;
+    uint8_t fifo_ovr;
+    uint16_t fifo_max_level;
+    uint32_t fifo_overruns;
+
+    /* The sensor hub's bank of registers, switched in over SENSOR_HUB_1
+     * through STATUS_MASTER by FUNC_CFG_ACCESS, and the device on its
+     * auxiliary bus (NULL if there is none) */
+    uint8_t shub_regs[STATUS_MASTER + 1];
+    struct sensor_bus_mock *aux;
+    uint8_t aux_address;
+    double next_shub_s;
+    uint8_t shub_written;
+    uint32_t shub_cycles;
+
+    /* What the driver's struct sensor_bus is pointed at */
+    struct sensor_bus_mock mock;
+};
+
+
+void lsm6dsox_model_init(struct lsm6dsox_model *model, const struct quad_model *quad, \
+    gpio_num_t int1_pin, uint64_t seed);
+
+void lsm6dsox_model_update(struct lsm6dsox_model *model, double time_s);
+
+void lsm6dsox_model_attach_aux(struct lsm6dsox_model *model, struct sensor_bus_mock *aux, \
+    uint8_t address);
+
+
+#endif
@@ -0,0 +1,194 @@
+#include <math.h>
+#include <string.h>
+
+#include "quad-model.h"
+
+
+const struct quad_model_params quad_model_params_default = {
+    .mass_kg = 0.5,
+    .arm_m = 0.1,
+    .inertia_kg_m2 = { 2.5e-3, 2.5e-3, 4.5e-3 },
+    .max_thrust_n = 0.5 * QUAD_MODEL_GRAVITY_M_S2 * 2.0 / 4.0,
+    .yaw_torque_per_thrust_m = 0.016,
+    .motor_time_constant_s = 0.02,
+    .linear_drag_n_s_m = 0.5,
+    .angular_drag_n_m_s = 1e-4,
+    .max_rotor_hz = 400.0,
+    .vibration_m_s2 = 0.5,
+    .vibration_rad_s = 0.01,
+};
+
+/* Where each motor sits in the body frame (x, y), in units of the arm length,
+ * and which way its reaction torque pushes the body about z. Counter-clockwise
+ * props push the body clockwise */
+static const double motor_geometry[QUAD_MODEL_NUM_MOTORS][3] = {
+    {  M_SQRT1_2, -M_SQRT1_2, -1.0 }, /* Front right, counter-clockwise */
+    { -M_SQRT1_2, -M_SQRT1_2,  1.0 }, /* Rear right, clockwise */
+    { -M_SQRT1_2,  M_SQRT1_2, -1.0 }, /* Rear left, counter-clockwise */
+    {  M_SQRT1_2,  M_SQRT1_2,  1.0 }, /* Front left, clockwise */
+};
+
+
+/* Rotates 'v' by the unit quaternion 'q' (or by its inverse if 'inverse') */
+static void quat_rotate(const double *q, const double *v, double *out, int inverse) {
+    double w = q[0];
+    double x = inverse ? -q[1] : q[1];
+    double y = inverse ? -q[2] : q[2];
+    double z = inverse ? -q[3] : q[3];
+
+    /* t = 2 * (q_vec x v), out = v + w * t + q_vec x t */
+    double tx = 2.0 * (y * v[2] - z * v[1]);
+    double ty = 2.0 * (z * v[0] - x * v[2]);
+    double tz = 2.0 * (x * v[1] - y * v[0]);
+    out[0] = v[0] + w * tx + (y * tz - z * ty);
+    out[1] = v[1] + w * ty + (z * tx - x * tz);
+    out[2] = v[2] + w * tz + (x * ty - y * tx);
+}
+
+
+/** Takes a struct quad_model and puts it at rest, level and facing north at
+ * the origin, with its motors stopped. */
+void quad_model_init(struct quad_model *model, const struct quad_model_params *params) {
+    memset(model, 0, sizeof(*model));
+    model->params = *params;
+    model->q[0] = 1.0;
+    model->specific_force_m_s2[2] = QUAD_MODEL_GRAVITY_M_S2;
+    /* Spread the motors' phases out so that their vibration does not all add
+     * up */
+    for (int i = 0; i < QUAD_MODEL_NUM_MOTORS; i++) {
+        model->rotor_phase[i] = 0.5 * M_PI * i;
+    }
+}
+
+
+/** Advances 'model' by 'dt_s' seconds with each motor's ESC being given the
+ * matching entry of 'command' (0 to 1, as a fraction of full speed).
+ *
+ * There is no ground: with the motors off the model falls. */
+void quad_model_step(struct quad_model *model, const double *command, double dt_s) {
+    const struct quad_model_params *p = &model->params;
+
+    /* 1. Motors */
+    double thrust = 0.0;
+    double torque[3] = { 0.0, 0.0, 0.0 };
+    for (int i = 0; i < QUAD_MODEL_NUM_MOTORS; i++) {
+        double c = command[i];
+        if (c < 0.0) c = 0.0;
+        if (c > 1.0) c = 1.0;
+        model->rotor[i] += (c - model->rotor[i]) * dt_s / p->motor_time_constant_s;
+        model->rotor_phase[i] = fmod(model->rotor_phase[i] \
+            + 2.0 * M_PI * p->max_rotor_hz * model->rotor[i] * dt_s, 2.0 * M_PI);
+
+        double t = p->max_thrust_n * model->rotor[i] * model->rotor[i];
+        thrust += t;
+        /* r x (0, 0, t) */
+        torque[0] += motor_geometry[i][1] * p->arm_m * t;
+        torque[1] -= motor_geometry[i][0] * p->arm_m * t;
+        torque[2] += motor_geometry[i][2] * p->yaw_torque_per_thrust_m * t;
+    }
+
+    /* 2. Rotation: I * dw/dt = torque - w x (I * w) */
+    const double *inertia = p->inertia_kg_m2;
+    double *w = model->omega_rad_s;
+    double iw[3] = { inertia[0] * w[0], inertia[1] * w[1], inertia[2] * w[2] };
+    double gyroscopic[3] = {
+        w[1] * iw[2] - w[2] * iw[1],
+        w[2] * iw[0] - w[0] * iw[2],
+        w[0] * iw[1] - w[1] * iw[0],
+    };
+    for (int i = 0; i < 3; i++) {
+        double dw = (torque[i] - gyroscopic[i] - p->angular_drag_n_m_s * w[i]) / inertia[i];
+        w[i] += dw * dt_s;
+    }
+
+    /* dq/dt = 0.5 * q * (0, w) */
+    double *q = model->q;
+    double dq[4] = {
+        0.5 * (-q[1] * w[0] - q[2] * w[1] - q[3] * w[2]),
+        0.5 * ( q[0] * w[0] + q[2] * w[2] - q[3] * w[1]),
+        0.5 * ( q[0] * w[1] - q[1] * w[2] + q[3] * w[0]),
+        0.5 * ( q[0] * w[2] + q[1] * w[1] - q[2] * w[0]),
+    };
+    double norm = 0.0;
+    for (int i = 0; i < 4; i++) {
+        q[i] += dq[i] * dt_s;
+        norm += q[i] * q[i];
+    }
+    norm = sqrt(norm);
+    for (int i = 0; i < 4; i++) {
+        q[i] /= norm;
+    }
+
+    /* 3. Translation. The accelerometer feels everything but gravity */
+    double force_body[3] = { 0.0, 0.0, thrust };
+    double force_earth[3];
+    quat_rotate(q, force_body, force_earth, 0);
+    double non_gravity_earth[3];
+    for (int i = 0; i < 3; i++) {
+        non_gravity_earth[i] = (force_earth[i] \
+            - p->linear_drag_n_s_m * model->velocity_m_s[i]) / p->mass_kg;
+    }
+    quat_rotate(q, non_gravity_earth, model->specific_force_m_s2, 1);
+
+    for (int i = 0; i < 3; i++) {
+        double a = non_gravity_earth[i] - (i == 2 ? QUAD_MODEL_GRAVITY_M_S2 : 0.0);
+        model->velocity_m_s[i] += a * dt_s;
+        model->position_m[i] += model->velocity_m_s[i] * dt_s;
+    }
+
+    model->time_s += dt_s;
+}
+
+
+/** Gives the model's orientation as Euler angles, in radians, using the same
+ * convention as 'attitude_estimator_get_euler()'. */
+void quad_model_get_euler(const struct quad_model *model, double *roll, double *pitch, \
+    double *yaw) {
+
+    const double *q = model->q;
+    *roll = atan2(q[0] * q[1] + q[2] * q[3], 0.5 - q[1] * q[1] - q[2] * q[2]);
+    double sin_pitch = -2.0 * (q[1] * q[3] - q[0] * q[2]);
+    if (sin_pitch > 1.0) sin_pitch = 1.0;
+    if (sin_pitch < -1.0) sin_pitch = -1.0;
+    *pitch = asin(sin_pitch);
+    *yaw = atan2(q[1] * q[2] + q[0] * q[3], 0.5 - q[2] * q[2] - q[3] * q[3]);
+}
+
+
+/** Expresses the earth frame vector 'earth' in the body frame. */
+void quad_model_earth_to_body(const struct quad_model *model, const double *earth, \
+    double *body) {
+
+    quat_rotate(model->q, earth, body, 1);
+}
+
+
+/* Adds each motor's vibration, scaled by 'amplitude', to 'v' */
+static void quad_model_add_vibration(const struct quad_model *model, double amplitude, \
+    double *v) {
+
+    for (int i = 0; i < QUAD_MODEL_NUM_MOTORS; i++) {
+        double a = amplitude * model->rotor[i] * model->rotor[i];
+        double s = sin(model->rotor_phase[i]);
+        double c = cos(model->rotor_phase[i]);
+        v[0] += a * s;
+        v[1] += a * c;
+        v[2] += 0.5 * a * s;
+    }
+}
+
+
+/** What a perfectly aligned gyroscope reads right now, in rad/s, including
+ * motor vibration but no sensor noise. */
+void quad_model_sense_gyro(const struct quad_model *model, double *g_rad_s) {
+    memcpy(g_rad_s, model->omega_rad_s, sizeof(double) * 3);
+    quad_model_add_vibration(model, model->params.vibration_rad_s, g_rad_s);
+}
+
+
+/** What a perfectly aligned accelerometer reads right now, in m/s^2,
+ * including motor vibration but no sensor noise. */
+void quad_model_sense_accel(const struct quad_model *model, double *a_m_s2) {
+    memcpy(a_m_s2, model->specific_force_m_s2, sizeof(double) * 3);
+    quad_model_add_vibration(model, model->params.vibration_m_s2, a_m_s2);
+}
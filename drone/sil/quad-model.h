@@ -0,0 +1,81 @@
+#ifndef __QUAD_MODEL_H_
+#define __QUAD_MODEL_H_
+
+/* A rigid body model of a quad-X quadcopter, in the same frames the firmware
+ * uses: body axes x forward, y left, z up, and an earth frame with x pointing
+ * at magnetic north and z up. Motors are numbered like
+ * FLIGHT_CONTROLLER_MOTOR_*.
+ *
+ * Everything is kept in doubles. This only ever runs on the host, and the
+ * point is for the model to be a lot more accurate than the firmware under
+ * test. */
+
+
+#define QUAD_MODEL_NUM_MOTORS 4
+#define QUAD_MODEL_GRAVITY_M_S2 9.80665
+
+
+struct quad_model_params {
+    double mass_kg;
+    /* Distance from the centre to each motor */
+    double arm_m;
+    /* Principal moments of inertia about x, y and z */
+    double inertia_kg_m2[3];
+    /* Thrust of one motor at full speed. Thrust goes with the square of
+     * speed */
+    double max_thrust_n;
+    /* Reaction torque about z per newton of thrust */
+    double yaw_torque_per_thrust_m;
+    /* First order lag between the ESC command and the motor speed */
+    double motor_time_constant_s;
+    /* Linear and rotational drag coefficients */
+    double linear_drag_n_s_m;
+    double angular_drag_n_m_s;
+    /* Rotation frequency of a motor at full speed, and how much vibration
+     * (accelerometer, gyroscope) each motor adds at full speed. The sensor
+     * models do not model the LSM6DSOX's digital filters, so this reaches the
+     * firmware unfiltered (and aliased) */
+    double max_rotor_hz;
+    double vibration_m_s2;
+    double vibration_rad_s;
+};
+
+struct quad_model {
+    struct quad_model_params params;
+    double time_s;
+    double position_m[3]; /* Earth frame */
+    double velocity_m_s[3]; /* Earth frame */
+    /* Rotates body frame vectors into the earth frame, like the attitude
+     * estimator's */
+    double q[4];
+    double omega_rad_s[3]; /* Body frame */
+    /* Each motor's speed as a fraction of full speed, and the phase of its
+     * rotation (for the vibration) */
+    double rotor[QUAD_MODEL_NUM_MOTORS];
+    double rotor_phase[QUAD_MODEL_NUM_MOTORS];
+    /* What an ideal accelerometer would have read over the last step, in the
+     * body frame */
+    double specific_force_m_s2[3];
+};
+
+
+/* A ~500g quad with 2:1 thrust to weight */
+extern const struct quad_model_params quad_model_params_default;
+
+
+void quad_model_init(struct quad_model *model, const struct quad_model_params *params);
+
+void quad_model_step(struct quad_model *model, const double *command, double dt_s);
+
+void quad_model_get_euler(const struct quad_model *model, double *roll, double *pitch, \
+    double *yaw);
+
+void quad_model_earth_to_body(const struct quad_model *model, const double *earth, \
+    double *body);
+
+void quad_model_sense_gyro(const struct quad_model *model, double *g_rad_s);
+
+void quad_model_sense_accel(const struct quad_model *model, double *a_m_s2);
+
+
+#endif
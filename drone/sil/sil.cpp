@@ -0,0 +1,615 @@
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "driver/gpio.h"
+#include "esp_timer.h"
+
+/* Component includes */
+#include "esp32-i2c-lsm6dsox.h"
+#include "esp32-i2c-lis3mdl.h"
+#include "attitude-estimator.h"
+#include "flight-controller.h"
+#include "gyro-filter.h"
+#include "dshot.h"
+#include "blackbox-format.h"
+#include "sensor-task.h"
+
+/* SIL includes */
+#include "fake-esp-timer.h"
+#include "fake-freertos.h"
+#include "lis3mdl-model.h"
+#include "lsm6dsox-model.h"
+#include "quad-model.h"
+
+
+/* Each byte on an I2C bus is 8 data bits plus an ACK bit, and the start,
+ * repeated start and stop conditions take roughly a bit time each */
+#define I2C_BITS_PER_BYTE 9
+#define I2C_CONDITION_BITS 1
+/* An SPI transaction is the address byte then the data, with no
+ * acknowledgements, but queueing it with the ESP-IDF driver and waiting for
+ * it to finish costs a roughly fixed amount of time on top */
+#define SPI_TRANSACTION_OVERHEAD_S 15e-6
+
+/* The physics runs a lot faster than any sensor ODR so that samples land
+ * close to when they are due */
+#define SIL_PHYSICS_STEP_S 50e-6
+/* Results are only scored once the estimator has settled */
+#define SIL_SETTLE_S 1.0
+
+
+struct sil_options {
+    double duration_s;
+    int fifo;
+    int interrupt;
+    int magnetometer;
+    /* Have the LSM6DSOX's sensor hub read the magnetometer into the FIFO,
+     * instead of the ESP32 reading it over the bus */
+    int shub;
+    /* Run the rate loop on the raw gyroscope samples instead of the
+     * filtered ones */
+    int gyro_filter;
+    /* Wait for every read before doing anything else, instead of
+     * overlapping the processing of one burst with the next one's transfer */
+    int blocking;
+    uint32_t scl_speed_hz;
+    /* If not 0, the sensors are on an SPI bus clocked at this instead of on
+     * I2C */
+    uint32_t spi_speed_hz;
+    /* 0 for the firmware's, which depends on the bus */
+    int bdr;
+    /* How far the LSM6DSOX's oscillator is off, as a fraction */
+    double clock_error;
+    /* How long the sensor task's CPU work takes on the target, since the
+     * host's own timings say nothing about the ESP32's */
+    double cpu_s_per_sample;
+    double cpu_s_per_loop;
+    float estimator_kp;
+    float estimator_ki;
+    uint64_t seed;
+    const char *csv_path;
+    const char *record_path;
+    const char *blackbox_path;
+};
+
+struct sil_stats {
+    uint32_t loops;
+    uint32_t samples;
+    double busy_s;
+    double max_busy_s;
+    uint32_t scored;
+    double estimate_error_sq[3];
+    double tracking_error_sq[2];
+};
+
+
+/* Where the sensor task has got to within one wake-up, in seconds since it
+ * woke: 'cpu_s' is how far its own work has got, 'bus_free_s' is when the
+ * bus will be done with everything queued on it so far, and 'queued_s' is
+ * where the task had got to when it queued its latest read from each sensor.
+ * The sensor models answer reads instantly, so each transfer is placed on the
+ * bus afterwards from the bus counters */
+struct sil_timeline {
+    const struct sil_options *options;
+    double cpu_s;
+    double bus_free_s;
+    double bus_counted_s;
+    double queued_s[2];
+};
+
+
+/* The firmware's sensor task, run exactly as on the target
+ * (components/sensor-task) but with the drivers on the sensor models' mock
+ * buses. The simulated sensors are left uncalibrated */
+struct i2c_lsm6dsox i2c_lsm6dsox;
+struct i2c_lis3mdl i2c_lis3mdl;
+struct sensor_task sensor_task;
+struct lsm6dsox_fifo_config fifo_config;
+struct flight_controller_setpoint setpoint;
+/* The blackbox log, written straight to a file rather than through the
+ * firmware's flash writer */
+FILE *blackbox_file;
+struct blackbox_header blackbox_header;
+struct blackbox_encoder blackbox_encoder;
+
+
+static void usage(const char *argv0) {
+    fprintf(stderr, \
+        "Usage: %s [options]\n" \
+        "  --duration S     simulated seconds to fly for (default 10)\n" \
+        "  --registers      poll the output registers instead of the FIFO\n" \
+        "  --polled         wake every 2.5ms instead of on interrupts\n" \
+        "  --no-gyro-filter run the rate loop on the unfiltered gyroscope\n" \
+        "  --no-mag         leave the magnetometer off\n" \
+        "  --shub           read the magnetometer through the LSM6DSOX's sensor hub\n" \
+        "  --blocking       wait on each read instead of overlapping it with processing\n" \
+        "  --scl HZ         I2C clock for both sensors (default 100000)\n" \
+        "  --spi HZ         put both sensors on SPI at this clock instead of I2C\n" \
+        "  --bdr HZ         FIFO batch rate: 104, 208, 417, 833 or 1667 (default 417,\n" \
+        "                   1667 on spi)\n" \
+        "  --clock-error P  LSM6DSOX oscillator error, in percent (default 0.4)\n" \
+        "  --cpu-us N       target CPU time per sample, in us (default 15)\n" \
+        "  --kp K, --ki K   attitude estimator gains (default 2, 0.05)\n" \
+        "  --seed N         sensor noise seed (default 1)\n" \
+        "  --csv PATH       write a trace of the flight to PATH\n" \
+        "  --record PATH    log every LSM6DSOX bus transaction to PATH\n" \
+        "  --blackbox PATH  write a blackbox log of the flight to PATH\n", argv0);
+    exit(1);
+}
+
+
+static void parse_options(int argc, char **argv, struct sil_options *options) {
+    options->duration_s = 10.0;
+    options->fifo = 1;
+    options->interrupt = 1;
+    options->magnetometer = 1;
+    options->shub = 0;
+    options->gyro_filter = 1;
+    options->blocking = 0;
+    options->scl_speed_hz = 100000;
+    options->spi_speed_hz = 0;
+    options->bdr = 0;
+    options->clock_error = 0.004;
+    options->cpu_s_per_sample = 15e-6;
+    options->cpu_s_per_loop = 20e-6;
+    options->estimator_kp = sensor_task_profile_i2c.estimator_kp;
+    options->estimator_ki = sensor_task_profile_i2c.estimator_ki;
+    options->seed = 1;
+    options->csv_path = NULL;
+    options->record_path = NULL;
+    options->blackbox_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "--registers") == 0) {
+            options->fifo = 0;
+        } else if (strcmp(arg, "--polled") == 0) {
+            options->interrupt = 0;
+        } else if (strcmp(arg, "--no-mag") == 0) {
+            options->magnetometer = 0;
+        } else if (strcmp(arg, "--shub") == 0) {
+            options->shub = 1;
+        } else if (strcmp(arg, "--no-gyro-filter") == 0) {
+            options->gyro_filter = 0;
+        } else if (strcmp(arg, "--blocking") == 0) {
+            options->blocking = 1;
+        } else if (value && strcmp(arg, "--duration") == 0) {
+            options->duration_s = atof(value);
+            i++;
+        } else if (value && strcmp(arg, "--scl") == 0) {
+            options->scl_speed_hz = (uint32_t) atol(value);
+            i++;
+        } else if (value && strcmp(arg, "--spi") == 0) {
+            options->spi_speed_hz = (uint32_t) atol(value);
+            i++;
+        } else if (value && strcmp(arg, "--bdr") == 0) {
+            int hz = atoi(value);
+            switch (hz) {
+                case 104: options->bdr = LSM6DSOX_BDR_GY_104Hz; break;
+                case 208: options->bdr = LSM6DSOX_BDR_GY_208Hz; break;
+                case 417: options->bdr = LSM6DSOX_BDR_GY_417Hz; break;
+                case 833: options->bdr = LSM6DSOX_BDR_GY_833Hz; break;
+                case 1667: options->bdr = LSM6DSOX_BDR_GY_1667Hz; break;
+                default: usage(argv[0]);
+            }
+            i++;
+        } else if (value && strcmp(arg, "--clock-error") == 0) {
+            options->clock_error = atof(value) / 100.0;
+            i++;
+        } else if (value && strcmp(arg, "--cpu-us") == 0) {
+            options->cpu_s_per_sample = atof(value) * 1e-6;
+            i++;
+        } else if (value && strcmp(arg, "--kp") == 0) {
+            options->estimator_kp = (float) atof(value);
+            i++;
+        } else if (value && strcmp(arg, "--ki") == 0) {
+            options->estimator_ki = (float) atof(value);
+            i++;
+        } else if (value && strcmp(arg, "--seed") == 0) {
+            options->seed = strtoull(value, NULL, 0);
+            i++;
+        } else if (value && strcmp(arg, "--csv") == 0) {
+            options->csv_path = value;
+            i++;
+        } else if (value && strcmp(arg, "--record") == 0) {
+            options->record_path = value;
+            i++;
+        } else if (value && strcmp(arg, "--blackbox") == 0) {
+            options->blackbox_path = value;
+            i++;
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    /* The sensor hub's samples only reach the ESP32 through the FIFO */
+    if (options->shub && !options->fifo) {
+        usage(argv[0]);
+    }
+    options->shub = options->shub && options->magnetometer;
+}
+
+
+/* The flight the SIL flies: hover, then a roll, a pitch and a yaw
+ * manoeuvre */
+static void update_setpoint(double time_s, float hover_throttle) {
+    setpoint.roll = 0.0f;
+    setpoint.pitch = 0.0f;
+    setpoint.yaw_rate = 0.0f;
+    setpoint.throttle = hover_throttle;
+    setpoint.armed = 1;
+
+    if (time_s >= 2.0 && time_s < 4.0) {
+        setpoint.roll = 0.35f;
+    } else if (time_s >= 4.0 && time_s < 6.0) {
+        setpoint.pitch = -0.25f;
+    } else if (time_s >= 6.0 && time_s < 8.0) {
+        setpoint.yaw_rate = 1.0f;
+    }
+}
+
+
+/* The sensor task's surroundings {{{ */
+/* How long everything 'bus' has been asked to do so far would have taken on
+ * a real I2C bus clocked at 'scl_speed_hz'. Every transaction addresses the
+ * device and sends the register byte, and a read then addresses it again
+ * after a repeated start */
+static double i2c_busy_s(const struct sensor_bus *bus, uint32_t scl_speed_hz) {
+    const struct sensor_bus_stats *stats = &bus->stats;
+    uint64_t transactions = stats->reads + stats->writes;
+    uint64_t bits = transactions * (I2C_CONDITION_BITS * 2 + I2C_BITS_PER_BYTE * 2) \
+        + stats->reads * (I2C_CONDITION_BITS + I2C_BITS_PER_BYTE) \
+        + stats->bytes * I2C_BITS_PER_BYTE;
+
+    return (double) bits / (double) scl_speed_hz;
+}
+
+
+/* The same for an SPI bus clocked at 'spi_speed_hz' */
+static double spi_busy_s(const struct sensor_bus *bus, uint32_t spi_speed_hz) {
+    const struct sensor_bus_stats *stats = &bus->stats;
+    uint64_t transactions = stats->reads + stats->writes;
+    uint64_t bits = (transactions + stats->bytes) * 8;
+
+    return transactions * SPI_TRANSACTION_OVERHEAD_S + (double) bits / (double) spi_speed_hz;
+}
+
+
+/* Behind the sensor hub, the LIS3MDL is not on the bus at all, and what its
+ * driver does through the hub is already counted on the LSM6DSOX's bus */
+static double bus_total_busy_s(const struct sil_options *options) {
+    if (options->spi_speed_hz) {
+        return spi_busy_s(&i2c_lsm6dsox.bus, options->spi_speed_hz) \
+            + (options->shub ? 0.0 : spi_busy_s(&i2c_lis3mdl.bus, options->spi_speed_hz));
+    }
+    return i2c_busy_s(&i2c_lsm6dsox.bus, options->scl_speed_hz) \
+        + (options->shub ? 0.0 : i2c_busy_s(&i2c_lis3mdl.bus, options->scl_speed_hz));
+}
+
+
+/* The sensor task has queued a read from 'sensor' */
+static void timeline_read_started(void *ctx, enum sensor_task_sensor sensor) {
+    struct sil_timeline *timeline = (struct sil_timeline *) ctx;
+    timeline->queued_s[sensor] = timeline->cpu_s;
+}
+
+
+/* The sensor task has waited for its latest read from 'sensor'. The
+ * transfers since the last one waited for go on the bus once both it is free
+ * and the read was queued, and the task carries on once they are done */
+static void timeline_read_finished(void *ctx, enum sensor_task_sensor sensor) {
+    struct sil_timeline *timeline = (struct sil_timeline *) ctx;
+    double queued_s = timeline->queued_s[sensor];
+    double bus_s = bus_total_busy_s(timeline->options);
+    double start_s = (queued_s > timeline->bus_free_s) ? queued_s : timeline->bus_free_s;
+    timeline->bus_free_s = start_s + (bus_s - timeline->bus_counted_s);
+    timeline->bus_counted_s = bus_s;
+    if (timeline->bus_free_s > timeline->cpu_s) {
+        timeline->cpu_s = timeline->bus_free_s;
+    }
+}
+
+
+/* The sensor task has flown an IMU sample, which takes it
+ * 'cpu_s_per_sample' on the target. It is logged as the firmware logs it */
+static void timeline_imu_sample(void *ctx, const struct lsm6dsox_fifo_sample *sample) {
+    struct sil_timeline *timeline = (struct sil_timeline *) ctx;
+    timeline->cpu_s += timeline->options->cpu_s_per_sample;
+
+    if (blackbox_file) {
+        struct blackbox_record record;
+        sensor_task_pack_record(&sensor_task, sample, blackbox_header.start_time_us, &record);
+        uint8_t frame[BLACKBOX_FRAME_MAX_LEN];
+        fwrite(frame, 1, blackbox_encode(&blackbox_encoder, &record, frame), blackbox_file);
+    }
+}
+
+
+/* Sets up the sensor task the way the options ask, with its drivers on the
+ * sensor models' buses (the LIS3MDL's behind the LSM6DSOX's sensor hub, if
+ * that is where it is), and brings it up as the firmware does */
+static void bring_up_sensor_task(const struct sil_options *options, \
+    struct lsm6dsox_model *lsm6dsox, struct lis3mdl_model *lis3mdl, FILE *record, \
+    struct sil_timeline *timeline) {
+
+    struct sensor_task_config config = options->spi_speed_hz ? sensor_task_profile_spi \
+        : sensor_task_profile_i2c;
+    config.acquisition_mode = options->fifo ? IMU_ACQUISITION_FIFO : IMU_ACQUISITION_REGISTERS;
+    config.sampling_mode = options->interrupt ? IMU_SAMPLING_INTERRUPT : IMU_SAMPLING_POLLED;
+    config.magnetometer_enabled = options->magnetometer;
+    config.magnetometer_link = options->shub ? MAGNETOMETER_SENSOR_HUB : MAGNETOMETER_DIRECT;
+    fifo_config = *config.fifo;
+    if (options->bdr) {
+        fifo_config.bdr_xl = (lsm6dsox_bdr_xl_t) options->bdr;
+        fifo_config.bdr_gy = (lsm6dsox_bdr_gy_t) options->bdr;
+    }
+    config.fifo = &fifo_config;
+    config.estimator_kp = options->estimator_kp;
+    config.estimator_ki = options->estimator_ki;
+    if (!options->gyro_filter) {
+        config.gyro_filter = NULL;
+    }
+    config.blocking = options->blocking;
+
+    const struct sensor_task_hooks hooks = {
+        .ctx = timeline,
+        .stage_done = NULL,
+        .read_started = timeline_read_started,
+        .read_finished = timeline_read_finished,
+        .magnetometer_sample = NULL,
+        .imu_sample = timeline_imu_sample,
+        .motor_output = NULL,
+    };
+    sensor_task_init(&sensor_task, &config, &hooks, &i2c_lsm6dsox, &i2c_lis3mdl);
+
+    sensor_bus_init_mock(&i2c_lsm6dsox.bus, &lsm6dsox->mock);
+    sensor_bus_record(&i2c_lsm6dsox.bus, record);
+    if (options->shub) {
+        lsm6dsox_model_attach_aux(lsm6dsox, &lis3mdl->mock, config.shub_lis3mdl_address);
+    } else {
+        sensor_bus_init_mock(&i2c_lis3mdl.bus, &lis3mdl->mock);
+    }
+    ESP_ERROR_CHECK(sensor_task_begin_sensors(&sensor_task));
+
+    lsm6dsox_model_update(lsm6dsox, 0.0);
+    lis3mdl_model_update(lis3mdl, 0.0);
+    ESP_ERROR_CHECK(sensor_task_begin_loops(&sensor_task));
+}
+/* }}} */
+
+
+/* What the ESCs make of the motor commands: each one goes through a DShot
+ * frame and back, so the quantisation matches the target's */
+static void escs_decode(const float *command, double *throttle) {
+    for (int i = 0; i < FLIGHT_CONTROLLER_NUM_MOTORS; i++) {
+        uint16_t frame = dshot_encode_frame(dshot_throttle_to_value(command[i]), 0);
+        uint16_t value = frame >> 5;
+        if (dshot_checksum(frame >> 4) != (frame & 0x0F) || value < DSHOT_VALUE_THROTTLE_MIN) {
+            throttle[i] = 0.0;
+        } else {
+            throttle[i] = (double) (value - DSHOT_VALUE_THROTTLE_MIN) \
+                / (double) (DSHOT_VALUE_THROTTLE_MAX - DSHOT_VALUE_THROTTLE_MIN);
+        }
+    }
+}
+
+
+static double wrap_angle(double a) {
+    while (a > M_PI) a -= 2.0 * M_PI;
+    while (a < -M_PI) a += 2.0 * M_PI;
+    return a;
+}
+
+
+static double wall_clock_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+
+int main(int argc, char **argv) {
+    struct sil_options options;
+    parse_options(argc, argv, &options);
+
+    FILE *csv = NULL;
+    if (options.csv_path) {
+        csv = fopen(options.csv_path, "w");
+        if (!csv) {
+            perror(options.csv_path);
+            return 1;
+        }
+        fprintf(csv, "t,roll,pitch,yaw,est_roll,est_pitch,est_yaw,sp_roll,sp_pitch," \
+            "sp_yaw_rate,m0,m1,m2,m3,fifo_level\n");
+    }
+
+    /* 1. The world: a quad hovering with its motors already spun up */
+    static struct quad_model quad;
+    static struct lsm6dsox_model lsm6dsox;
+    static struct lis3mdl_model lis3mdl;
+    quad_model_init(&quad, &quad_model_params_default);
+    float hover_throttle = (float) sqrt(quad.params.mass_kg * QUAD_MODEL_GRAVITY_M_S2 \
+        / (QUAD_MODEL_NUM_MOTORS * quad.params.max_thrust_n));
+    for (int i = 0; i < QUAD_MODEL_NUM_MOTORS; i++) {
+        quad.rotor[i] = hover_throttle;
+    }
+    lsm6dsox_model_init(&lsm6dsox, &quad, \
+        options.interrupt ? sensor_task_profile_i2c.lsm6dsox_int1_pin : GPIO_NUM_NC, \
+        options.seed);
+    lsm6dsox.clock_error = options.clock_error;
+    lis3mdl_model_init(&lis3mdl, &quad, \
+        options.interrupt ? sensor_task_profile_i2c.lis3mdl_drdy_pin : GPIO_NUM_NC, \
+        options.seed + 1);
+
+    /* 2. The firmware, brought up the same way the sensor task does it */
+    FILE *record = NULL;
+    if (options.record_path) {
+        record = fopen(options.record_path, "w");
+        if (!record) {
+            perror(options.record_path);
+            return 1;
+        }
+    }
+    struct sil_timeline timeline = {};
+    timeline.options = &options;
+    bring_up_sensor_task(&options, &lsm6dsox, &lis3mdl, record, &timeline);
+
+    if (options.blackbox_path) {
+        blackbox_file = fopen(options.blackbox_path, "wb");
+        if (!blackbox_file) {
+            perror(options.blackbox_path);
+            return 1;
+        }
+        blackbox_header_init(&blackbox_header, esp_timer_get_time(), \
+            sensor_task.estimator.config.sample_period_s, sensor_task.estimator.config.kp, \
+            sensor_task.estimator.config.ki, &sensor_task.gyro_calibration_raw, \
+            &sensor_task.accel_calibration_raw);
+        fwrite(&blackbox_header, sizeof(blackbox_header), 1, blackbox_file);
+        blackbox_encoder_init(&blackbox_encoder);
+    }
+
+    /* 3. Fly. The sensor task is modelled as being busy for as long as its
+     * bus transactions and CPU work would take on the target, and its motor
+     * commands only reach the motors once it is done */
+    struct sil_stats stats = {};
+    double throttle[QUAD_MODEL_NUM_MOTORS];
+    double pending_throttle[QUAD_MODEL_NUM_MOTORS];
+    for (int i = 0; i < QUAD_MODEL_NUM_MOTORS; i++) {
+        throttle[i] = pending_throttle[i] = hover_throttle;
+    }
+    double task_free_s = 0.0;
+    double last_wake_s = 0.0;
+    double wall_start_s = wall_clock_s();
+
+    while (quad.time_s < options.duration_s) {
+        double t = quad.time_s;
+
+        if (t >= task_free_s) {
+            memcpy(throttle, pending_throttle, sizeof(throttle));
+
+            uint32_t notified = 0;
+            if (options.interrupt) {
+                notified = fake_freertos_take_notification();
+                if (!notified && t - last_wake_s >= SENSOR_TASK_INTERRUPT_TIMEOUT_MS * 1e-3) {
+                    notified = SENSOR_TASK_NOTIFY_ALL;
+                }
+            } else if (t - last_wake_s >= SENSOR_TASK_POLL_PERIOD_US * 1e-6) {
+                notified = SENSOR_TASK_NOTIFY_ALL;
+            }
+
+            if (notified) {
+                timeline.cpu_s = 0.0;
+                timeline.bus_free_s = 0.0;
+                timeline.bus_counted_s = bus_total_busy_s(&options);
+                last_wake_s = t;
+                update_setpoint(t, hover_throttle);
+
+                int num_samples = sensor_task_service(&sensor_task, notified, &setpoint);
+
+                double busy_s = timeline.cpu_s + options.cpu_s_per_loop;
+                task_free_s = t + busy_s;
+                escs_decode(sensor_task.motor, pending_throttle);
+
+                stats.loops++;
+                stats.samples += num_samples;
+                stats.busy_s += busy_s;
+                if (busy_s > stats.max_busy_s) stats.max_busy_s = busy_s;
+
+                double roll, pitch, yaw;
+                float est_roll, est_pitch, est_yaw;
+                quad_model_get_euler(&quad, &roll, &pitch, &yaw);
+                attitude_estimator_get_euler(&sensor_task.estimator, &est_roll, &est_pitch, \
+                    &est_yaw);
+                if (t >= SIL_SETTLE_S) {
+                    double estimate_error[3] = {
+                        wrap_angle(est_roll - roll),
+                        wrap_angle(est_pitch - pitch),
+                        wrap_angle(est_yaw - yaw),
+                    };
+                    for (int i = 0; i < 3; i++) {
+                        stats.estimate_error_sq[i] += estimate_error[i] * estimate_error[i];
+                    }
+                    stats.tracking_error_sq[0] += (setpoint.roll - roll) * (setpoint.roll - roll);
+                    stats.tracking_error_sq[1] += (setpoint.pitch - pitch) * (setpoint.pitch - pitch);
+                    stats.scored++;
+                }
+                if (csv) {
+                    fprintf(csv, "%.6f,%.5f,%.5f,%.5f,%.5f,%.5f,%.5f,%.4f,%.4f,%.4f," \
+                        "%.4f,%.4f,%.4f,%.4f,%u\n", t, roll, pitch, yaw, est_roll, \
+                        est_pitch, est_yaw, setpoint.roll, setpoint.pitch, setpoint.yaw_rate, \
+                        sensor_task.motor[0], sensor_task.motor[1], sensor_task.motor[2], \
+                        sensor_task.motor[3], lsm6dsox.fifo_level);
+                }
+            }
+        }
+
+        quad_model_step(&quad, throttle, SIL_PHYSICS_STEP_S);
+        fake_esp_timer_set(quad.time_s);
+        lsm6dsox_model_update(&lsm6dsox, quad.time_s);
+        lis3mdl_model_update(&lis3mdl, quad.time_s);
+    }
+
+    double wall_s = wall_clock_s() - wall_start_s;
+    if (csv) {
+        fclose(csv);
+    }
+    if (record) {
+        fclose(record);
+    }
+    if (blackbox_file) {
+        fclose(blackbox_file);
+    }
+
+    /* 4. Report */
+    double scored = stats.scored ? (double) stats.scored : 1.0;
+    printf("simulated %.2fs in %.3fs (%.0fx real time)\n", quad.time_s, wall_s, \
+        quad.time_s / wall_s);
+    printf("acquisition: %s, %s, %s %" PRIu32 "Hz%s\n", options.fifo ? "fifo" : "registers", \
+        options.interrupt ? "interrupt" : "polled", options.spi_speed_hz ? "spi" : "i2c scl", \
+        options.spi_speed_hz ? options.spi_speed_hz : options.scl_speed_hz, \
+        !options.magnetometer ? ", no magnetometer" \
+            : options.shub ? ", magnetometer through the sensor hub" : "");
+    printf("sensor task: %" PRIu32 " loops, %" PRIu32 " samples (%.1f/loop, %.0f/s)\n", \
+        stats.loops, stats.samples, stats.loops ? (double) stats.samples / stats.loops : 0.0, \
+        stats.samples / quad.time_s);
+    printf("sensor task busy: %.1f%% (max %.0fus per loop)\n", \
+        100.0 * stats.busy_s / quad.time_s, stats.max_busy_s * 1e6);
+    const struct sensor_bus_stats *lis3mdl_stats = &i2c_lis3mdl.bus.stats;
+    const struct sensor_bus_stats no_stats = {};
+    if (options.shub) {
+        lis3mdl_stats = &no_stats;
+    }
+    printf("bus: %" PRIu32 " transactions, %" PRIu64 " bytes, %.1f%% utilisation\n", \
+        i2c_lsm6dsox.bus.stats.reads + i2c_lsm6dsox.bus.stats.writes \
+            + lis3mdl_stats->reads + lis3mdl_stats->writes, \
+        i2c_lsm6dsox.bus.stats.bytes + lis3mdl_stats->bytes, \
+        100.0 * bus_total_busy_s(&options) / quad.time_s);
+    printf("fifo: max level %u words, %" PRIu32 " words lost to overrun\n", \
+        lsm6dsox.fifo_max_level, lsm6dsox.fifo_overruns);
+    printf("estimate rms error: roll %.3f°, pitch %.3f°, yaw %.3f°\n", \
+        sqrt(stats.estimate_error_sq[0] / scored) * 180.0 / M_PI, \
+        sqrt(stats.estimate_error_sq[1] / scored) * 180.0 / M_PI, \
+        sqrt(stats.estimate_error_sq[2] / scored) * 180.0 / M_PI);
+    printf("tracking rms error: roll %.3f°, pitch %.3f°\n", \
+        sqrt(stats.tracking_error_sq[0] / scored) * 180.0 / M_PI, \
+        sqrt(stats.tracking_error_sq[1] / scored) * 180.0 / M_PI);
+    printf("imu sample period: %.1fus (actual %.1fus)", sensor_task.sample_period_s * 1e6, \
+        1e6 / (stats.samples / quad.time_s));
+    if (options.fifo) {
+        printf(", clock %.4fus/tick (actual %.4fus)", i2c_lsm6dsox.clock.us_per_tick, \
+            LSM6DSOX_TIMESTAMP_LSB_US / (1.0 + options.clock_error));
+    }
+    printf("\n");
+    if (options.gyro_filter) {
+        printf("gyro notch: %.0f %.0f %.0f Hz\n", sensor_task.gyro_filter.dyn_notch_hz[0], \
+            sensor_task.gyro_filter.dyn_notch_hz[1], sensor_task.gyro_filter.dyn_notch_hz[2]);
+    }
+
+    return 0;
+}
@@ -0,0 +1,32 @@
+#include <inttypes.h>
+#include <math.h>
+
+#include "sim-random.h"
+
+
+void sim_random_seed(struct sim_random *r, uint64_t seed) {
+    /* xorshift gets stuck at 0 */
+    r->state = seed ? seed : 0x9E3779B97F4A7C15ULL;
+}
+
+
+/** Returns a number in (0, 1]. */
+double sim_random_uniform(struct sim_random *r) {
+    /* xorshift64* */
+    r->state ^= r->state >> 12;
+    r->state ^= r->state << 25;
+    r->state ^= r->state >> 27;
+    uint64_t x = r->state * 0x2545F4914F6CDD1DULL;
+
+    return ((double) (x >> 11) + 1.0) / 9007199254740992.0;
+}
+
+
+/** Returns a normally distributed number with mean 0 and standard deviation
+ * 'stddev' (Box-Muller). */
+double sim_random_gaussian(struct sim_random *r, double stddev) {
+    double u1 = sim_random_uniform(r);
+    double u2 = sim_random_uniform(r);
+
+    return stddev * sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
@@ -0,0 +1,20 @@
+#ifndef __SIM_RANDOM_H_
+#define __SIM_RANDOM_H_
+
+#include <inttypes.h>
+
+/* A small seeded generator for sensor noise, so that SIL runs are
+ * repeatable */
+struct sim_random {
+    uint64_t state;
+};
+
+
+void sim_random_seed(struct sim_random *r, uint64_t seed);
+
+double sim_random_uniform(struct sim_random *r);
+
+double sim_random_gaussian(struct sim_random *r, double stddev);
+
+
+#endif
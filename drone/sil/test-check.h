@@ -0,0 +1,54 @@
+#ifndef __SIL_TEST_CHECK_H_
+#define __SIL_TEST_CHECK_H_
+
+/* Just enough of a test harness for the host tests (the test-*.cpp files):
+ * each check that fails is printed and counted, and the test's main() ends
+ * with 'return test_check_result();', which ctest takes as pass or fail */
+
+#include <math.h>
+#include <stdio.h>
+
+
+static int test_check_failures;
+
+
+#define TEST_CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            test_check_failures++; \
+        } \
+    } while (0)
+
+#define TEST_CHECK_EQUAL(actual, expected) do { \
+        long long actual_ = (long long) (actual); \
+        long long expected_ = (long long) (expected); \
+        if (actual_ != expected_) { \
+            fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, \
+                #actual, actual_, expected_); \
+            test_check_failures++; \
+        } \
+    } while (0)
+
+#define TEST_CHECK_NEAR(actual, expected, tolerance) do { \
+        double actual_ = (double) (actual); \
+        double expected_ = (double) (expected); \
+        if (!(fabs(actual_ - expected_) <= (tolerance))) { \
+            fprintf(stderr, "%s:%d: %s is %g, expected %g +- %g\n", __FILE__, __LINE__, \
+                #actual, actual_, expected_, (double) (tolerance)); \
+            test_check_failures++; \
+        } \
+    } while (0)
+
+
+/* Prints how the test went and returns its exit status */
+static inline int test_check_result(const char *name) {
+    if (test_check_failures) {
+        printf("%s: %d checks failed\n", name, test_check_failures);
+        return 1;
+    }
+    printf("%s: ok\n", name);
+    return 0;
+}
+
+
+#endif
@@ -0,0 +1,65 @@
+/* Host test for the DShot frame encoding, against frames worked out by hand
+ * from the protocol: the 11 bit value, the telemetry bit, then the XOR of
+ * the three nibbles above it.
+ *
+ *   ./build-sil/test-dshot
+ */
+#include <inttypes.h>
+
+#include "dshot.h"
+
+#include "test-check.h"
+
+
+int main(void) {
+    /* value, telemetry, frame */
+    static const uint16_t frames[][3] = {
+        /* The usual worked example: 1046 is 0x416, 0x82C with the telemetry
+         * bit, and 8 ^ 2 ^ C = 6 */
+        { 1046, 0, 0x82C6 },
+        { 1046, 1, 0x82D7 },
+        { DSHOT_VALUE_MOTOR_STOP, 0, 0x0000 },
+        { DSHOT_VALUE_THROTTLE_MIN, 0, 0x0606 },
+        { DSHOT_VALUE_THROTTLE_MAX, 0, 0xFFEE },
+        /* Commands have to be sent with the telemetry bit set */
+        { 1, 1, 0x0033 },
+        /* Anything above 11 bits is dropped */
+        { 0x0800 | 1046, 0, 0x82C6 },
+    };
+    for (size_t i = 0; i < sizeof(frames) / sizeof(frames[0]); i++) {
+        TEST_CHECK_EQUAL(dshot_encode_frame(frames[i][0], (uint8_t) frames[i][1]), \
+            frames[i][2]);
+    }
+
+    TEST_CHECK_EQUAL(dshot_checksum(0x82C), 0x6);
+    TEST_CHECK_EQUAL(dshot_checksum(0xFFF), 0xF);
+    TEST_CHECK_EQUAL(dshot_checksum(0x000), 0x0);
+
+    /* Every frame's checksum nibbles XOR to zero with the rest of it */
+    for (uint16_t value = 0; value <= DSHOT_VALUE_THROTTLE_MAX; value++) {
+        uint16_t frame = dshot_encode_frame(value, value & 1);
+        uint16_t xor_nibbles = (frame ^ (frame >> 4) ^ (frame >> 8) ^ (frame >> 12)) & 0x0F;
+        if (xor_nibbles != 0) {
+            TEST_CHECK_EQUAL(xor_nibbles, 0);
+            break;
+        }
+        TEST_CHECK_EQUAL(frame >> 5, value);
+    }
+
+    /* Throttle: stopped at or below 0, the full range spread over (0, 1] and
+     * clamped above it */
+    TEST_CHECK_EQUAL(dshot_throttle_to_value(-1.0f), DSHOT_VALUE_MOTOR_STOP);
+    TEST_CHECK_EQUAL(dshot_throttle_to_value(0.0f), DSHOT_VALUE_MOTOR_STOP);
+    TEST_CHECK_EQUAL(dshot_throttle_to_value(1e-6f), DSHOT_VALUE_THROTTLE_MIN);
+    TEST_CHECK_EQUAL(dshot_throttle_to_value(0.5f), 1048);
+    TEST_CHECK_EQUAL(dshot_throttle_to_value(1.0f), DSHOT_VALUE_THROTTLE_MAX);
+    TEST_CHECK_EQUAL(dshot_throttle_to_value(1.5f), DSHOT_VALUE_THROTTLE_MAX);
+
+    /* DShot600: every bit lasts the same 1.67us, 0s and 1s alike */
+    TEST_CHECK_EQUAL(DSHOT600_T0H_TICKS + DSHOT600_T0L_TICKS, \
+        DSHOT600_T1H_TICKS + DSHOT600_T1L_TICKS);
+    TEST_CHECK_NEAR((DSHOT600_T0H_TICKS + DSHOT600_T0L_TICKS) * 1e6 / DSHOT600_RESOLUTION_HZ, \
+        1.0e6 / 600e3, 0.01);
+
+    return test_check_result("test-dshot");
+}
@@ -0,0 +1,230 @@
+/* Host test for the gyroscope filters: runs sine waves at known frequencies
+ * through each kind of filter and checks how much of them comes out, both a
+ * sample at a time and a block at a time, then injects a motor vibration
+ * tone into the gyroscope filter bank and checks that its dynamic notch
+ * finds it, takes it out, and follows it when it moves.
+ *
+ *   ./build-sil/test-filter
+ */
+#include <math.h>
+#include <string.h>
+
+#include "filter.h"
+#include "gyro-filter.h"
+
+#include "test-check.h"
+
+
+/* The LSM6DSOX's 1.667kHz ODR, what the drone flies at */
+#define TEST_SAMPLE_PERIOD_S (1.0f / 1666.7f)
+/* How long a tone is run through a filter before its output is measured,
+ * and how long it is then measured for */
+#define TEST_SETTLE_SAMPLES 2000
+#define TEST_MEASURE_SAMPLES 2000
+/* Samples per call to 'gyro_filter_apply()': a FIFO burst */
+#define TEST_BLOCK_LEN 8
+
+
+/* The amplitude of the 'hz' component of the 'len' samples at 'x', by
+ * correlating them with a sine and a cosine */
+static float amplitude_at(const float *x, int len, float hz) {
+    double re = 0.0;
+    double im = 0.0;
+    for (int i = 0; i < len; i++) {
+        double angle = 2.0 * M_PI * hz * i * TEST_SAMPLE_PERIOD_S;
+        re += x[i] * cos(angle);
+        im += x[i] * sin(angle);
+    }
+    return (float) (2.0 * sqrt(re * re + im * im) / len);
+}
+
+
+/* How much of a unit sine at 'hz' comes out of the filter described by
+ * 'config', once it has settled. Run a block at a time if 'block' */
+static float gain_at(const struct filter_config *config, float hz, bool block) {
+    static float x[TEST_SETTLE_SAMPLES + TEST_MEASURE_SAMPLES];
+    const int len = TEST_SETTLE_SAMPLES + TEST_MEASURE_SAMPLES;
+    for (int i = 0; i < len; i++) {
+        x[i] = sinf(2.0f * (float) M_PI * hz * i * TEST_SAMPLE_PERIOD_S);
+    }
+
+    struct filter f;
+    filter_init(&f, config, TEST_SAMPLE_PERIOD_S);
+    if (block) {
+        for (int i = 0; i < len; i += TEST_BLOCK_LEN) {
+            filter_apply_block(&f, &x[i], TEST_BLOCK_LEN);
+        }
+    } else {
+        for (int i = 0; i < len; i++) {
+            x[i] = filter_apply(&f, x[i]);
+        }
+    }
+    return amplitude_at(&x[TEST_SETTLE_SAMPLES], TEST_MEASURE_SAMPLES, hz);
+}
+
+
+/* Checks the gain of 'config' at 'hz' against 'expected', both ways of
+ * running it */
+static void check_gain(const struct filter_config *config, float hz, float expected, \
+    float tolerance) {
+
+    TEST_CHECK_NEAR(gain_at(config, hz, false), expected, tolerance);
+    TEST_CHECK_NEAR(gain_at(config, hz, true), expected, tolerance);
+}
+
+
+/* The gain of a continuous first order low-pass at 'hz' */
+static float pt1_gain(float cutoff_hz, float hz) {
+    return 1.0f / sqrtf(1.0f + (hz / cutoff_hz) * (hz / cutoff_hz));
+}
+
+
+static void test_frequency_response(void) {
+    const float cutoff_hz = 100.0f;
+    const float minus_3db = 0.7071068f;
+
+    /* 1. PT1: 3dB down at the cutoff, and rolling off at about 6dB an
+     * octave above it, a little less towards the Nyquist frequency */
+    struct filter_config pt1 = { FILTER_PT1, cutoff_hz, 0.0f };
+    check_gain(&pt1, 10.0f, pt1_gain(cutoff_hz, 10.0f), 0.005f);
+    check_gain(&pt1, cutoff_hz, minus_3db, 0.005f);
+    check_gain(&pt1, 200.0f, 0.5f, 0.05f);
+    check_gain(&pt1, 400.0f, 0.25f, 0.02f);
+
+    /* 2. PT2: also 3dB down at the cutoff, flatter below it and steeper
+     * above it */
+    struct filter_config pt2 = { FILTER_PT2, cutoff_hz, 0.0f };
+    check_gain(&pt2, cutoff_hz, minus_3db, 0.005f);
+    TEST_CHECK(gain_at(&pt2, 50.0f, false) > gain_at(&pt1, 50.0f, false));
+    TEST_CHECK(gain_at(&pt2, 200.0f, false) < gain_at(&pt1, 200.0f, false));
+    TEST_CHECK(gain_at(&pt2, 400.0f, false) < 0.6f * gain_at(&pt1, 400.0f, false));
+
+    /* 3. Butterworth biquad: maximally flat, 1 / sqrt(1 + (f / fc)^4), in the
+     * pass band, 3dB down at the cutoff exactly (the bilinear transform is
+     * prewarped there) and steeper than the PT2 above it */
+    struct filter_config lpf = { FILTER_BIQUAD_LPF, cutoff_hz, 0.0f };
+    check_gain(&lpf, 10.0f, 1.0f, 0.001f);
+    check_gain(&lpf, 50.0f, 1.0f / sqrtf(1.0f + 0.5f * 0.5f * 0.5f * 0.5f), 0.005f);
+    check_gain(&lpf, cutoff_hz, minus_3db, 0.005f);
+    TEST_CHECK(gain_at(&lpf, 400.0f, false) < 0.05f);
+    TEST_CHECK(gain_at(&lpf, 200.0f, false) < gain_at(&pt2, 200.0f, false));
+
+    /* 4. Notch: takes out its centre frequency, and leaves an octave either
+     * side of it nearly untouched */
+    struct filter_config notch = { FILTER_NOTCH, 200.0f, 5.0f };
+    check_gain(&notch, 200.0f, 0.0f, 0.005f);
+    check_gain(&notch, 100.0f, 1.0f, 0.02f);
+    check_gain(&notch, 400.0f, 1.0f, 0.02f);
+    check_gain(&notch, 10.0f, 1.0f, 0.005f);
+
+    /* 5. Retuned to a new centre, the notch moves there */
+    struct filter f;
+    filter_init(&f, &notch, TEST_SAMPLE_PERIOD_S);
+    filter_notch_retune(&f, 300.0f, 5.0f, TEST_SAMPLE_PERIOD_S);
+    struct filter g;
+    struct filter_config moved = { FILTER_NOTCH, 300.0f, 5.0f };
+    filter_init(&g, &moved, TEST_SAMPLE_PERIOD_S);
+    for (int i = 0; i < 5; i++) {
+        TEST_CHECK_NEAR(f.coeffs[i], g.coeffs[i], 1e-6);
+    }
+
+    /* 6. No cutoff, or one at or above the Nyquist frequency, passes
+     * everything through */
+    struct filter_config off = { FILTER_BIQUAD_LPF, 0.0f, 0.0f };
+    check_gain(&off, 400.0f, 1.0f, 0.001f);
+    struct filter_config too_high = { FILTER_BIQUAD_LPF, 900.0f, 0.0f };
+    check_gain(&too_high, 400.0f, 1.0f, 0.001f);
+    struct filter_config pt1_too_high = { FILTER_PT1, 900.0f, 0.0f };
+    check_gain(&pt1_too_high, 400.0f, 1.0f, 0.001f);
+}
+
+
+/* Runs 'seconds' of gyroscope samples through 'gf' a FIFO burst at a time:
+ * a slow manoeuvre on every axis, and a 'tone_hz' vibration on top (if it is
+ * not 0). '*t' counts the samples across calls. Leaves the filtered samples
+ * of the last TEST_MEASURE_SAMPLES in 'out' */
+static void run_gyro(struct gyro_filter *gf, float tone_hz, float seconds, int *t, \
+    float (*out)[TEST_MEASURE_SAMPLES]) {
+
+    int len = (int) (seconds / TEST_SAMPLE_PERIOD_S) / TEST_BLOCK_LEN * TEST_BLOCK_LEN;
+    for (int n = 0; n < len; n += TEST_BLOCK_LEN) {
+        float block[GYRO_FILTER_NUM_AXES][TEST_BLOCK_LEN];
+        for (int i = 0; i < TEST_BLOCK_LEN; i++) {
+            float time_s = (*t + i) * TEST_SAMPLE_PERIOD_S;
+            for (int axis = 0; axis < GYRO_FILTER_NUM_AXES; axis++) {
+                block[axis][i] = 0.5f * sinf(2.0f * (float) M_PI * (2.0f + axis) * time_s);
+                if (tone_hz > 0.0f) {
+                    /* Each axis sees the vibration at its own phase */
+                    block[axis][i] += sinf(2.0f * (float) M_PI * tone_hz * time_s + axis);
+                }
+            }
+        }
+        float *const axes[GYRO_FILTER_NUM_AXES] = { block[0], block[1], block[2] };
+        gyro_filter_apply(gf, axes, TEST_BLOCK_LEN);
+        *t += TEST_BLOCK_LEN;
+
+        int first = len - TEST_MEASURE_SAMPLES;
+        for (int i = 0; i < TEST_BLOCK_LEN; i++) {
+            if (n + i >= first) {
+                for (int axis = 0; axis < GYRO_FILTER_NUM_AXES; axis++) {
+                    out[axis][n + i - first] = block[axis][i];
+                }
+            }
+        }
+    }
+}
+
+
+static void test_dynamic_notch(void) {
+    /* The drone's notch, on its own so only it can take the tone out */
+    struct gyro_filter_config config = {};
+    config.dyn_notch_min_hz = 60.0f;
+    config.dyn_notch_max_hz = 600.0f;
+    config.dyn_notch_q = 3.0f;
+    static struct gyro_filter gf;
+    gyro_filter_init(&gf, &config, TEST_SAMPLE_PERIOD_S);
+    TEST_CHECK(gf.dyn_notch_enabled);
+    static float out[GYRO_FILTER_NUM_AXES][TEST_MEASURE_SAMPLES];
+    int t = 0;
+
+    /* 1. With nothing but the manoeuvre, there is no peak to move to, and
+     * the notch stays where it started */
+    float start_hz = gf.dyn_notch_hz[0];
+    run_gyro(&gf, 0.0f, 2.0f, &t, out);
+    for (int axis = 0; axis < GYRO_FILTER_NUM_AXES; axis++) {
+        TEST_CHECK_NEAR(gf.dyn_notch_hz[axis], start_hz, 1e-3);
+    }
+
+    /* 2. A vibration at 250Hz, between FFT bins, is found on every axis to
+     * well within a bin, and all but taken out, while the manoeuvre goes
+     * through */
+    const float bin_hz = 1.0f / (GYRO_FILTER_FFT_LEN * TEST_SAMPLE_PERIOD_S);
+    run_gyro(&gf, 250.0f, 2.0f, &t, out);
+    for (int axis = 0; axis < GYRO_FILTER_NUM_AXES; axis++) {
+        TEST_CHECK_NEAR(gf.dyn_notch_hz[axis], 250.0f, 0.25f * bin_hz);
+        TEST_CHECK(amplitude_at(out[axis], TEST_MEASURE_SAMPLES, 250.0f) < 0.1f);
+        TEST_CHECK_NEAR(amplitude_at(out[axis], TEST_MEASURE_SAMPLES, 2.0f + axis), 0.5f, 0.02f);
+    }
+
+    /* 3. The motors speed up: the notch follows the vibration to 400Hz */
+    run_gyro(&gf, 400.0f, 2.0f, &t, out);
+    for (int axis = 0; axis < GYRO_FILTER_NUM_AXES; axis++) {
+        TEST_CHECK_NEAR(gf.dyn_notch_hz[axis], 400.0f, 0.25f * bin_hz);
+        TEST_CHECK(amplitude_at(out[axis], TEST_MEASURE_SAMPLES, 400.0f) < 0.1f);
+    }
+
+    /* 4. A vibration below the notch's range is left alone: the notch does
+     * not chase it down out of its range */
+    run_gyro(&gf, 30.0f, 2.0f, &t, out);
+    for (int axis = 0; axis < GYRO_FILTER_NUM_AXES; axis++) {
+        TEST_CHECK(gf.dyn_notch_hz[axis] >= gf.min_bin * bin_hz);
+    }
+}
+
+
+int main(void) {
+    test_frequency_response();
+    test_dynamic_notch();
+
+    return test_check_result("test-filter");
+}
@@ -0,0 +1,135 @@
+/* Host test for the I2C bus manager, and the sensor bus's I2C backend under
+ * it, on a fake I2C master driver (fake-i2c-master.cpp): a device is brought
+ * up at the fastest speed it answers at, one-off failures are retried after
+ * clearing the bus, repeated ones fall back to a slower speed, and a bus
+ * still busy with a transaction that timed out is never reset or has its
+ * device removed from under the driver. The late completion of that
+ * transaction must not be taken for the next one's either.
+ *
+ *   ./build-sil/test-i2c-bus-manager
+ */
+#include <inttypes.h>
+#include <string.h>
+
+#include "driver/i2c_master.h"
+#include "i2c-bus-manager.h"
+#include "sensor-bus.h"
+
+#include "fake-i2c-master.h"
+#include "test-check.h"
+
+
+#define TEST_ADDRESS 0x6A
+#define TEST_WHO_AM_I_REG 0x0F
+#define TEST_WHO_AM_I 0x6C
+#define TEST_REG_A 0x20
+#define TEST_REG_B 0x21
+
+
+static const uint32_t test_speeds_hz[] = { 1000000, 400000, 100000 };
+
+
+int main(void) {
+    struct fake_i2c_target target = {};
+    target.address = TEST_ADDRESS;
+    target.max_speed_hz = 400000;
+    target.regs[TEST_WHO_AM_I_REG] = TEST_WHO_AM_I;
+    target.regs[TEST_REG_A] = 0x11;
+    target.regs[TEST_REG_B] = 0x22;
+    fake_i2c_master_init();
+    fake_i2c_master_add_target(&target);
+    const struct fake_i2c_master_stats *stats = fake_i2c_master_get_stats();
+
+    struct i2c_bus_manager manager;
+    i2c_master_bus_config_t bus_config = {};
+    bus_config.trans_queue_depth = 4;
+    TEST_CHECK_EQUAL(i2c_bus_manager_init(&manager, &bus_config, \
+        I2C_BUS_MANAGER_DEFAULT_RETRIES, SENSOR_BUS_DEFAULT_TIMEOUT_MS), ESP_OK);
+
+    /* 1. A device nothing answers for is not added, and leaves no handle
+     * behind */
+    struct sensor_bus missing_bus;
+    struct i2c_bus_manager_device missing = {};
+    missing.address = TEST_ADDRESS + 1;
+    missing.speeds_hz = test_speeds_hz;
+    missing.num_speeds = 3;
+    missing.who_am_i_reg = TEST_WHO_AM_I_REG;
+    missing.who_am_i = TEST_WHO_AM_I;
+    TEST_CHECK_EQUAL(i2c_bus_manager_add_device(&manager, &missing, &missing_bus), \
+        ESP_ERR_NOT_FOUND);
+    TEST_CHECK_EQUAL(stats->devices, 0);
+
+    /* 2. The device is brought up at 400kHz, the fastest it answers at */
+    struct sensor_bus bus;
+    struct i2c_bus_manager_device device = {};
+    device.address = TEST_ADDRESS;
+    device.speeds_hz = test_speeds_hz;
+    device.num_speeds = 3;
+    device.who_am_i_reg = TEST_WHO_AM_I_REG;
+    device.who_am_i = TEST_WHO_AM_I;
+    TEST_CHECK_EQUAL(i2c_bus_manager_add_device(&manager, &device, &bus), ESP_OK);
+    TEST_CHECK_EQUAL(i2c_bus_manager_speed_hz(&device), 400000);
+    TEST_CHECK_EQUAL(device.fallbacks, 1);
+    TEST_CHECK_EQUAL(stats->devices, 1);
+
+    /* 3. A one-off failure is retried at the same speed, after clearing the
+     * bus */
+    uint32_t resets = manager.bus_resets;
+    uint8_t value = 0;
+    target.fail_next = 1;
+    TEST_CHECK_EQUAL(sensor_bus_read(&bus, TEST_REG_A, &value, 1), ESP_OK);
+    TEST_CHECK_EQUAL(value, 0x11);
+    TEST_CHECK_EQUAL(device.retries, 1);
+    TEST_CHECK_EQUAL(manager.bus_resets, resets + 1);
+    TEST_CHECK_EQUAL(i2c_bus_manager_speed_hz(&device), 400000);
+
+    /* 4. A device which stops answering at its speed is moved down to the
+     * next one for the last retry, which gets through */
+    target.max_speed_hz = 100000;
+    value = 0;
+    TEST_CHECK_EQUAL(sensor_bus_read(&bus, TEST_REG_B, &value, 1), ESP_OK);
+    TEST_CHECK_EQUAL(value, 0x22);
+    TEST_CHECK_EQUAL(i2c_bus_manager_speed_hz(&device), 100000);
+    TEST_CHECK_EQUAL(device.fallbacks, 2);
+    TEST_CHECK_EQUAL(device.retries, 1 + I2C_BUS_MANAGER_DEFAULT_RETRIES);
+    TEST_CHECK_EQUAL(device.failures, 0);
+    TEST_CHECK_EQUAL(stats->devices, 1);
+
+    /* 5. With no slower speed left, the error goes back to the driver after
+     * the last retry */
+    target.max_speed_hz = 0;
+    TEST_CHECK(sensor_bus_read(&bus, TEST_REG_A, &value, 1) != ESP_OK);
+    TEST_CHECK_EQUAL(device.failures, 1);
+    target.max_speed_hz = 100000;
+
+    /* 6. A write and then a read time out with the bus stalled. Neither is
+     * retried while they are still queued: the bus is not reset and the
+     * device keeps its handle */
+    const uint8_t written[2] = { 0xA5, 0x5A };
+    fake_i2c_master_stall(true);
+    TEST_CHECK_EQUAL(sensor_bus_write(&bus, TEST_REG_A, written, 2), ESP_ERR_TIMEOUT);
+    uint8_t stale = 0;
+    TEST_CHECK_EQUAL(sensor_bus_read(&bus, TEST_WHO_AM_I_REG, &stale, 1), ESP_ERR_TIMEOUT);
+    TEST_CHECK_EQUAL(device.failures, 3);
+    TEST_CHECK_EQUAL(stats->resets_while_busy, 0);
+    TEST_CHECK_EQUAL(stats->removed_while_busy, 0);
+
+    /* 7. Once the bus is going again, the stalled write still goes out with
+     * its own data, and the stalled read's completion, which comes in first,
+     * is not taken for the next read's */
+    fake_i2c_master_stall(false);
+    value = 0;
+    TEST_CHECK_EQUAL(sensor_bus_read(&bus, TEST_REG_B, &value, 1), ESP_OK);
+    TEST_CHECK_EQUAL(value, 0x5A);
+    TEST_CHECK_EQUAL(target.regs[TEST_REG_A], 0xA5);
+    value = 0;
+    TEST_CHECK_EQUAL(sensor_bus_read(&bus, TEST_WHO_AM_I_REG, &value, 1), ESP_OK);
+    TEST_CHECK_EQUAL(value, TEST_WHO_AM_I);
+
+    /* 8. Nothing went wrong with the driver along the way */
+    TEST_CHECK_EQUAL(stats->resets_while_busy, 0);
+    TEST_CHECK_EQUAL(stats->removed_while_busy, 0);
+    TEST_CHECK_EQUAL(stats->devices, 1);
+
+    return test_check_result("test-i2c-bus-manager");
+}
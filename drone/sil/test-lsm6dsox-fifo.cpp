@@ -0,0 +1,202 @@
+/* Host test for the LSM6DSOX driver's FIFO decoder: builds a stream of FIFO
+ * words the way the device tags them (gyroscope, accelerometer, timestamp,
+ * sensor hub and words the drone ignores), feeds it through
+ * 'esp_i2c_lsm6dsox_fifo_decode()' and checks the samples that come out:
+ * their values, how a slower sensor's value is held, how a sample split
+ * across two bursts is put back together and how each one is timed. Also
+ * checks how many words a sample is expected to take up.
+ *
+ *   ./build-sil/test-lsm6dsox-fifo
+ */
+#include <inttypes.h>
+#include <math.h>
+#include <string.h>
+
+#include "esp32-i2c-lsm6dsox.h"
+#include "sensor-bus.h"
+
+#include "test-check.h"
+
+
+#define TEST_MAX_WORDS 32
+
+
+/* A burst of FIFO words, as read from FIFO_DATA_OUT_TAG onwards */
+struct fifo_stream {
+    uint8_t words[TEST_MAX_WORDS * LSM6DSOX_FIFO_WORD_LEN];
+    int num_words;
+};
+
+
+/* Appends a word tagged 'tag' (TAG_SENSOR is the top 5 bits of the tag byte)
+ * holding the little-endian triplet 'x', 'y', 'z' */
+static void push_triplet(struct fifo_stream *stream, lsm6dsox_fifo_tag_t tag, int16_t x, \
+    int16_t y, int16_t z) {
+
+    uint8_t *word = &stream->words[stream->num_words++ * LSM6DSOX_FIFO_WORD_LEN];
+    const int16_t xyz[3] = { x, y, z };
+    word[0] = (uint8_t) (tag << 3);
+    for (int j = 0; j < 3; j++) {
+        word[1 + 2 * j] = (uint16_t) xyz[j] & 0xFF;
+        word[2 + 2 * j] = (uint16_t) xyz[j] >> 8;
+    }
+}
+
+
+/* Appends a timestamp word for 'ticks' */
+static void push_timestamp(struct fifo_stream *stream, uint32_t ticks) {
+    uint8_t *word = &stream->words[stream->num_words++ * LSM6DSOX_FIFO_WORD_LEN];
+    memset(word, 0, LSM6DSOX_FIFO_WORD_LEN);
+    word[0] = (uint8_t) (LSM6DSOX_TAG_TIMESTAMP << 3);
+    for (int j = 0; j < 4; j++) {
+        word[1 + j] = (ticks >> (8 * j)) & 0xFF;
+    }
+}
+
+
+static void check_triplet(const int16_t *actual, int16_t x, int16_t y, int16_t z) {
+    TEST_CHECK_EQUAL(actual[0], x);
+    TEST_CHECK_EQUAL(actual[1], y);
+    TEST_CHECK_EQUAL(actual[2], z);
+}
+
+
+int main(void) {
+    static struct sensor_bus_mock mock;
+    static struct i2c_lsm6dsox lsm6dsox;
+    sensor_bus_init_mock(&lsm6dsox.bus, &mock);
+    lsm6dsox.int1.pin = GPIO_NUM_NC;
+    TEST_CHECK_EQUAL(esp_i2c_lsm6dsox_begin(&lsm6dsox, &lsm6dsox_profile_flight_1k6hz), ESP_OK);
+
+    /* Batching at 417Hz (416Hz by the datasheet), the timestamp counter's
+     * 25us ticks put gyroscope words about 96 ticks apart until a pair of
+     * timestamp words says otherwise */
+    const struct lsm6dsox_fifo_config fifo_config = {
+        .bdr_xl = LSM6DSOX_BDR_XL_417Hz,
+        .bdr_gy = LSM6DSOX_BDR_GY_417Hz,
+        .watermark = 4,
+        .mode = LSM6DSOX_FIFO_MODE_STREAM,
+        .ts_batch = LSM6DSOX_DEC_TS_32,
+    };
+    esp_i2c_lsm6dsox_fifo_begin(&lsm6dsox, &fifo_config);
+    const float nominal_ticks = 1e6f / (416.0f * LSM6DSOX_TIMESTAMP_LSB_US);
+    TEST_CHECK_NEAR(lsm6dsox.fifo_ts_ticks_per_gyro, nominal_ticks, 1e-3);
+
+    struct lsm6dsox_fifo_sample samples[TEST_MAX_WORDS];
+    struct fifo_stream stream = {};
+
+    /* 1. A timestamp, then a gyroscope and accelerometer pair, a sensor hub
+     * reading, another pair and a gyroscope word on its own: the
+     * accelerometer is batched more slowly than the gyroscope for a moment,
+     * so the third sample holds the second accelerometer value. A
+     * temperature word and a sensor hub NACK go by without making samples */
+    push_timestamp(&stream, 1000);
+    push_triplet(&stream, LSM6DSOX_TAG_GYRO_NC, 1, -2, 3);
+    push_triplet(&stream, LSM6DSOX_TAG_XL_NC, 100, -200, 2048);
+    push_triplet(&stream, LSM6DSOX_TAG_SHUB_SLAVE0, -300, 400, -32768);
+    push_triplet(&stream, LSM6DSOX_TAG_TEMPERATURE, 0x7F, 0, 0);
+    push_triplet(&stream, LSM6DSOX_TAG_GYRO_NC, 4, 5, -6);
+    push_triplet(&stream, LSM6DSOX_TAG_XL_NC, 101, -201, 2047);
+    push_triplet(&stream, LSM6DSOX_TAG_GYRO_NC, 7, 8, 9);
+    push_triplet(&stream, LSM6DSOX_TAG_SHUB_NACK, 0, 0, 0);
+    push_triplet(&stream, LSM6DSOX_TAG_GYRO_NC, -32768, 32767, -1);
+
+    int num_samples = esp_i2c_lsm6dsox_fifo_decode(&lsm6dsox, stream.words, \
+        stream.num_words, samples);
+    TEST_CHECK_EQUAL(num_samples, 3);
+
+    check_triplet(samples[0].g_raw, 1, -2, 3);
+    check_triplet(samples[0].a_raw, 100, -200, 2048);
+    TEST_CHECK_EQUAL(samples[0].m_new, 0);
+    TEST_CHECK_EQUAL(samples[0].timestamp, 1000);
+    /* The clock has not been synced with esp_timer, so samples are untimed
+     * by it */
+    TEST_CHECK_EQUAL(samples[0].time_us, 0);
+
+    check_triplet(samples[1].g_raw, 4, 5, -6);
+    check_triplet(samples[1].a_raw, 101, -201, 2047);
+    check_triplet(samples[1].m_raw, -300, 400, -32768);
+    TEST_CHECK_EQUAL(samples[1].m_new, 1);
+    TEST_CHECK_EQUAL(samples[1].timestamp, 1000 + lroundf(nominal_ticks));
+
+    check_triplet(samples[2].g_raw, 7, 8, 9);
+    check_triplet(samples[2].a_raw, 101, -201, 2047);
+    check_triplet(samples[2].m_raw, -300, 400, -32768);
+    TEST_CHECK_EQUAL(samples[2].m_new, 0);
+    TEST_CHECK_EQUAL(samples[2].timestamp, 1000 + lroundf(2 * nominal_ticks));
+
+    TEST_CHECK_EQUAL(lsm6dsox.shub_nacks, 1);
+
+    /* 2. The last gyroscope word is still waiting for its accelerometer
+     * word, which comes at the start of the next burst. Then a timestamp
+     * word 4 gyroscope words on from the first, 400 ticks later: the words
+     * are really 100 ticks apart rather than 96, and the samples after it
+     * are spaced that far */
+    stream.num_words = 0;
+    push_triplet(&stream, LSM6DSOX_TAG_XL_NC, 102, -202, 2046);
+    push_timestamp(&stream, 1400);
+    push_triplet(&stream, LSM6DSOX_TAG_GYRO_NC, 10, 11, 12);
+    push_triplet(&stream, LSM6DSOX_TAG_XL_NC, 103, -203, 2045);
+    push_triplet(&stream, LSM6DSOX_TAG_GYRO_NC, 13, 14, 15);
+    push_triplet(&stream, LSM6DSOX_TAG_XL_NC, 104, -204, 2044);
+
+    num_samples = esp_i2c_lsm6dsox_fifo_decode(&lsm6dsox, stream.words, \
+        stream.num_words, samples);
+    TEST_CHECK_EQUAL(num_samples, 3);
+
+    check_triplet(samples[0].g_raw, -32768, 32767, -1);
+    check_triplet(samples[0].a_raw, 102, -202, 2046);
+    TEST_CHECK_EQUAL(samples[0].timestamp, 1000 + lroundf(3 * nominal_ticks));
+
+    TEST_CHECK_NEAR(lsm6dsox.fifo_ts_ticks_per_gyro, 100.0f, 1e-3);
+    check_triplet(samples[1].g_raw, 10, 11, 12);
+    check_triplet(samples[1].a_raw, 103, -203, 2045);
+    TEST_CHECK_EQUAL(samples[1].timestamp, 1400);
+    check_triplet(samples[2].g_raw, 13, 14, 15);
+    check_triplet(samples[2].a_raw, 104, -204, 2044);
+    TEST_CHECK_EQUAL(samples[2].timestamp, 1500);
+    /* The sensor hub reading is still held */
+    check_triplet(samples[2].m_raw, -300, 400, -32768);
+
+    /* 3. A timestamp word too far out to be trusted (words were lost) does
+     * not retune the spacing */
+    stream.num_words = 0;
+    push_timestamp(&stream, 5000);
+    push_triplet(&stream, LSM6DSOX_TAG_GYRO_NC, 16, 17, 18);
+    push_triplet(&stream, LSM6DSOX_TAG_XL_NC, 105, -205, 2043);
+    num_samples = esp_i2c_lsm6dsox_fifo_decode(&lsm6dsox, stream.words, \
+        stream.num_words, samples);
+    TEST_CHECK_EQUAL(num_samples, 1);
+    TEST_CHECK_NEAR(lsm6dsox.fifo_ts_ticks_per_gyro, 100.0f, 1e-3);
+    TEST_CHECK_EQUAL(samples[0].timestamp, 5000);
+
+    /* 4. How many words each gyroscope sample takes up: the gyroscope's and
+     * the accelerometer's, a timestamp every 32, and the sensor hub's at
+     * 104Hz out of 416Hz. Without the accelerometer or the timestamps, only
+     * the gyroscope's is left, and without the gyroscope there are no
+     * samples to count */
+    struct lsm6dsox_fifo_config rates = {};
+    rates.bdr_xl = LSM6DSOX_BDR_XL_417Hz;
+    rates.bdr_gy = LSM6DSOX_BDR_GY_417Hz;
+    rates.ts_batch = LSM6DSOX_DEC_TS_32;
+    struct lsm6dsox_shub_config shub_config = {};
+    shub_config.odr = LSM6DSOX_SHUB_ODR_104Hz;
+    shub_config.batch = 1;
+    TEST_CHECK_NEAR(esp_i2c_lsm6dsox_fifo_words_per_sample(&rates, NULL), \
+        2.0f + 1.0f / 32, 1e-6);
+    TEST_CHECK_NEAR(esp_i2c_lsm6dsox_fifo_words_per_sample(&rates, &shub_config), \
+        2.0f + 1.0f / 32 + 0.25f, 1e-6);
+    shub_config.batch = 0;
+    TEST_CHECK_NEAR(esp_i2c_lsm6dsox_fifo_words_per_sample(&rates, &shub_config), \
+        2.0f + 1.0f / 32, 1e-6);
+    rates.bdr_gy = LSM6DSOX_BDR_GY_833Hz;
+    TEST_CHECK_NEAR(esp_i2c_lsm6dsox_fifo_words_per_sample(&rates, NULL), \
+        1.5f + 1.0f / 32, 1e-2);
+    rates.bdr_xl = LSM6DSOX_BDR_XL_OFF;
+    rates.ts_batch = LSM6DSOX_DEC_TS_OFF;
+    TEST_CHECK_NEAR(esp_i2c_lsm6dsox_fifo_words_per_sample(&rates, NULL), 1.0f, 1e-6);
+    rates.bdr_gy = LSM6DSOX_BDR_GY_OFF;
+    TEST_CHECK_EQUAL(esp_i2c_lsm6dsox_fifo_words_per_sample(&rates, NULL), 0.0f);
+
+    return test_check_result("test-lsm6dsox-fifo");
+}
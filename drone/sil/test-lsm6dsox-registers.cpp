@@ -0,0 +1,112 @@
+/* Host test for the LSM6DSOX driver's output register read: loads OUTX_L_G
+ * through OUTZ_H_A into a mock register map and checks what
+ * 'esp_i2c_lsm6dsox_get_gyro_accel_data()' makes of them. The registers are
+ * little-endian two's complement, so the interesting cases are the byte
+ * order and the sign bit (0x8000 is the most negative reading, 0xFFFF is -1).
+ *
+ *   ./build-sil/test-lsm6dsox-registers
+ */
+#include <inttypes.h>
+#include <string.h>
+
+#include "esp32-i2c-lsm6dsox.h"
+#include "sensor-bus.h"
+
+#include "test-check.h"
+
+
+/* Puts 'g_raw' and 'a_raw' in the output registers, low byte first */
+static void load_output_registers(struct sensor_bus_mock *mock, const uint16_t *g_raw, \
+    const uint16_t *a_raw) {
+
+    for (int axis = 0; axis < 3; axis++) {
+        mock->regs[OUTX_L_G + 2 * axis] = g_raw[axis] & 0xFF;
+        mock->regs[OUTX_L_G + 2 * axis + 1] = g_raw[axis] >> 8;
+        mock->regs[OUTX_L_A + 2 * axis] = a_raw[axis] & 0xFF;
+        mock->regs[OUTX_L_A + 2 * axis + 1] = a_raw[axis] >> 8;
+    }
+}
+
+
+/* Loads one sample and checks it comes back as 'g_expected' and 'a_expected'
+ * counts, in SI units */
+static void check_sample(struct i2c_lsm6dsox *lsm6dsox, struct sensor_bus_mock *mock, \
+    const uint16_t *g_raw, const uint16_t *a_raw, const int32_t *g_expected, \
+    const int32_t *a_expected) {
+
+    load_output_registers(mock, g_raw, a_raw);
+    float g_rad_s[3];
+    float a_m_s2[3];
+    TEST_CHECK_EQUAL(esp_i2c_lsm6dsox_get_gyro_accel_data(lsm6dsox, g_rad_s, a_m_s2), ESP_OK);
+    for (int axis = 0; axis < 3; axis++) {
+        TEST_CHECK_NEAR(g_rad_s[axis], g_expected[axis] * lsm6dsox->gyroscope_scale_rad_s, \
+            1e-6);
+        TEST_CHECK_NEAR(a_m_s2[axis], a_expected[axis] * lsm6dsox->accelerometer_scale_m_s2, \
+            1e-6);
+    }
+}
+
+
+int main(void) {
+    static struct sensor_bus_mock mock;
+    static struct i2c_lsm6dsox lsm6dsox;
+    sensor_bus_init_mock(&lsm6dsox.bus, &mock);
+    lsm6dsox.int1.pin = GPIO_NUM_NC;
+
+    /* The mock's register map reads back whatever the driver writes, so
+     * the flight profile comes up at +-2000dps and +-16g */
+    TEST_CHECK_EQUAL(esp_i2c_lsm6dsox_begin(&lsm6dsox, &lsm6dsox_profile_flight_1k6hz), ESP_OK);
+    TEST_CHECK_NEAR(lsm6dsox.gyroscope_scale_rad_s, \
+        LSM6DSOX_GYRO_SENSITIVITY_FS_2000DPS * LSM6DSOX_MDPS_TO_RAD_PER_S, 1e-9);
+    TEST_CHECK_NEAR(lsm6dsox.accelerometer_scale_m_s2, \
+        LSM6DSOX_ACC_SENSITIVITY_FS_16G * LSM6DSOX_MG_TO_M_PER_S2, 1e-9);
+
+    /* Each axis gets its own value, so a mix up between axes or between the
+     * gyroscope and the accelerometer shows */
+    {
+        const uint16_t g_raw[3] = { 0x1234, 0x0056, 0x7800 };
+        const uint16_t a_raw[3] = { 0x0001, 0x0100, 0x4321 };
+        const int32_t g_expected[3] = { 0x1234, 0x56, 0x7800 };
+        const int32_t a_expected[3] = { 1, 256, 0x4321 };
+        check_sample(&lsm6dsox, &mock, g_raw, a_raw, g_expected, a_expected);
+    }
+
+    /* The extremes of the range, and the sign bit on its own in the high
+     * byte */
+    {
+        const uint16_t g_raw[3] = { 0x8000, 0xFFFF, 0x7FFF };
+        const uint16_t a_raw[3] = { 0xFFFF, 0x8000, 0x0080 };
+        const int32_t g_expected[3] = { -32768, -1, 32767 };
+        const int32_t a_expected[3] = { -1, -32768, 128 };
+        check_sample(&lsm6dsox, &mock, g_raw, a_raw, g_expected, a_expected);
+    }
+
+    /* A stationary board: nothing on the gyroscope, 1g on Z */
+    {
+        const uint16_t g_raw[3] = { 0, 0, 0 };
+        const uint16_t a_raw[3] = { 0, 0, 2048 };
+        const int32_t g_expected[3] = { 0, 0, 0 };
+        const int32_t a_expected[3] = { 0, 0, 2048 };
+        check_sample(&lsm6dsox, &mock, g_raw, a_raw, g_expected, a_expected);
+    }
+
+    /* The raw half of the read, which is what the FIFO-less sensor task
+     * decodes, sees the same counts */
+    {
+        const uint16_t g_raw[3] = { 0x8000, 0x0001, 0xFFFE };
+        const uint16_t a_raw[3] = { 0x7FFF, 0xFF00, 0x00FF };
+        load_output_registers(&mock, g_raw, a_raw);
+        int16_t g[3];
+        int16_t a[3];
+        TEST_CHECK_EQUAL(esp_i2c_lsm6dsox_get_gyro_accel_data_start(&lsm6dsox), ESP_OK);
+        TEST_CHECK_EQUAL(esp_i2c_lsm6dsox_get_gyro_accel_data_finish(&lsm6dsox, g, a), ESP_OK);
+        TEST_CHECK_EQUAL(g[0], -32768);
+        TEST_CHECK_EQUAL(g[1], 1);
+        TEST_CHECK_EQUAL(g[2], -2);
+        TEST_CHECK_EQUAL(a[0], 32767);
+        TEST_CHECK_EQUAL(a[1], -256);
+        TEST_CHECK_EQUAL(a[2], 255);
+    }
+
+    return test_check_result("test-lsm6dsox-registers");
+}
@@ -0,0 +1,145 @@
+/* Host test for the flight controller's PID: its response to setpoint and
+ * measurement steps term by term, a closed loop step against a simple plant
+ * with a constant disturbance (which only the I-term can take out), and the
+ * anti-windup, which has to keep the integrator from growing while the
+ * output is saturated so that the loop comes back out of saturation
+ * straight away.
+ *
+ *   ./build-sil/test-pid
+ */
+#include <math.h>
+#include <string.h>
+
+#include "flight-controller.h"
+
+#include "test-check.h"
+
+
+#define TEST_DT_S 0.001f
+
+
+/* Runs 'pid' in closed loop for 'seconds' against a plant whose rate of
+ * change is the PID's output minus 'disturbance', starting from '*x', and
+ * leaves the plant's state in '*x'. Returns the largest output seen */
+static float run_closed_loop(struct pid *pid, float setpoint, float disturbance, float *x, \
+    float seconds) {
+
+    float max_output = 0.0f;
+    int num_steps = (int) (seconds / TEST_DT_S + 0.5f);
+    for (int i = 0; i < num_steps; i++) {
+        float u = pid_update(pid, setpoint, *x, TEST_DT_S);
+        if (fabsf(u) > max_output) {
+            max_output = fabsf(u);
+        }
+        *x += (u - disturbance) * TEST_DT_S;
+    }
+
+    return max_output;
+}
+
+
+int main(void) {
+    struct pid pid;
+
+    /* 1. Term by term, with no D-term filter. A setpoint step only goes
+     * through P (and FF), since the D-term acts on the measurement */
+    {
+        const struct pid_config config = {
+            .kp = 2.0f, .ki = 10.0f, .kd = 0.01f, .kff = 0.5f,
+            .integral_limit = 100.0f, .output_limit = 1000.0f,
+            .d_lpf = { .type = FILTER_NONE, .cutoff_hz = 0.0f, .q = 0.0f },
+        };
+        pid_init(&pid, &config, TEST_DT_S);
+        /* P: 2 * 1, FF: 0.5 * 1, I: 10 * 1 * 0.001, no D kick */
+        TEST_CHECK_NEAR(pid_update(&pid, 1.0f, 0.0f, TEST_DT_S), 2.5f + 0.01f, 1e-5);
+        TEST_CHECK_NEAR(pid.integral, 0.01f, 1e-6);
+        /* A measurement step of 0.5: P drops by 1, and D kicks by
+         * -0.01 * 0.5 / 0.001 = -5 */
+        TEST_CHECK_NEAR(pid_update(&pid, 1.0f, 0.5f, TEST_DT_S), 1.0f + 0.5f + 0.015f - 5.0f, \
+            1e-4);
+        /* The measurement holds, so the D-term goes away */
+        TEST_CHECK_NEAR(pid_update(&pid, 1.0f, 0.5f, TEST_DT_S), 1.0f + 0.5f + 0.02f, 1e-4);
+        /* The integrator is clamped, well before the output saturates */
+        for (int i = 0; i < 100000; i++) {
+            pid_update(&pid, 1.0f, 0.5f, TEST_DT_S);
+        }
+        TEST_CHECK_NEAR(pid.integral, config.integral_limit, 1e-6);
+        pid_reset(&pid);
+        TEST_CHECK_EQUAL(pid.integral, 0.0f);
+        /* Armed while already rolling at 2 rad/s: the first update after the
+         * reset has no D kick (0.01 * 2 / 0.001 = 20 with a zeroed history),
+         * only P (2 * -2) and I (10 * -2 * 0.001). The D-term picks up from
+         * there */
+        TEST_CHECK_NEAR(pid_update(&pid, 0.0f, 2.0f, TEST_DT_S), -4.0f - 0.02f, 1e-4);
+        TEST_CHECK_NEAR(pid_update(&pid, 0.0f, 2.1f, TEST_DT_S), \
+            -4.2f - 0.041f - 1.0f, 1e-4);
+    }
+
+    /* 2. A closed loop step against a constant disturbance. P alone settles
+     * short, by disturbance / kp; with the I-term the error goes to zero */
+    {
+        const float disturbance = 0.5f;
+        struct pid_config config = {
+            .kp = 5.0f, .ki = 0.0f, .kd = 0.0f, .kff = 0.0f,
+            .integral_limit = 1.0f, .output_limit = 10.0f,
+            .d_lpf = { .type = FILTER_PT1, .cutoff_hz = 100.0f, .q = 0.0f },
+        };
+        float x = 0.0f;
+        pid_init(&pid, &config, TEST_DT_S);
+        run_closed_loop(&pid, 1.0f, disturbance, &x, 5.0f);
+        TEST_CHECK_NEAR(x, 1.0f - disturbance / config.kp, 1e-3);
+
+        config.ki = 10.0f;
+        x = 0.0f;
+        pid_init(&pid, &config, TEST_DT_S);
+        run_closed_loop(&pid, 1.0f, disturbance, &x, 5.0f);
+        TEST_CHECK_NEAR(x, 1.0f, 1e-3);
+        TEST_CHECK_NEAR(pid.integral, disturbance, 1e-3);
+    }
+
+    /* 3. Anti-windup. A step far bigger than the output limit saturates the
+     * output for a while. The integrator must not grow while it is, or it
+     * would have to unwind afterwards and the plant would overshoot */
+    {
+        const struct pid_config config = {
+            .kp = 5.0f, .ki = 10.0f, .kd = 0.0f, .kff = 0.0f,
+            .integral_limit = 10.0f, .output_limit = 1.0f,
+            .d_lpf = { .type = FILTER_NONE, .cutoff_hz = 0.0f, .q = 0.0f },
+        };
+        float x = 0.0f;
+        pid_init(&pid, &config, TEST_DT_S);
+        /* Saturated the whole time: 1 unit/s towards a setpoint 2 units
+         * away */
+        float max_output = run_closed_loop(&pid, 2.0f, 0.0f, &x, 1.0f);
+        TEST_CHECK_NEAR(max_output, config.output_limit, 1e-6);
+        TEST_CHECK_NEAR(x, 1.0f, 1e-3);
+        TEST_CHECK_NEAR(pid.integral, 0.0f, 1e-6);
+
+        /* Let it reach the setpoint. The overshoot stays small, as it would
+         * without the saturation. A wound up integrator (at its limit of 10
+         * by now) would push it well past */
+        float peak = x;
+        for (int i = 0; i < 5000; i++) {
+            run_closed_loop(&pid, 2.0f, 0.0f, &x, TEST_DT_S);
+            if (x > peak) {
+                peak = x;
+            }
+        }
+        TEST_CHECK(peak < 2.0f + 0.1f);
+        TEST_CHECK_NEAR(x, 2.0f, 1e-3);
+
+        /* Saturated the other way, and back: the integrator does not wind
+         * up in that direction either */
+        pid_update(&pid, -100.0f, x, TEST_DT_S);
+        const float integral = pid.integral;
+        for (int i = 0; i < 1000; i++) {
+            TEST_CHECK_NEAR(pid_update(&pid, -100.0f, x, TEST_DT_S), -config.output_limit, \
+                1e-6);
+        }
+        TEST_CHECK(pid.integral >= integral - 1e-6f);
+        /* Once the error goes away, the output leaves saturation at once */
+        TEST_CHECK(fabsf(pid_update(&pid, x, x, TEST_DT_S)) < config.output_limit);
+    }
+
+    return test_check_result("test-pid");
+}
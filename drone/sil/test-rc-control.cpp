@@ -0,0 +1,227 @@
+/* Host test for the remote control's arming and failsafe state machine: runs
+ * it once per sensor task loop against a simulated link, with the remote's
+ * sticks and switch set by hand and frames dropped at will, and checks when
+ * the drone arms, disarms and fails safe, and what it flies meanwhile.
+ *
+ *   ./build-sil/test-rc-control
+ */
+#include <stdbool.h>
+#include <string.h>
+
+#include "rc-control.h"
+
+#include "test-check.h"
+
+
+/* How often the state machine is run: the sensor task's 4.8ms loop, which is
+ * not a multiple of the link's period, so frames are picked up at every age */
+#define TEST_LOOP_PERIOD_US 4800
+
+
+/* The remote, the link and the drone's end of it */
+struct test_link {
+    /* What the remote is sending, and whether its frames get through */
+    struct rc_link_command command;
+    bool connected;
+    /* The latest command to get through, and when */
+    struct rc_link_command received;
+    int64_t received_us;
+    int64_t next_frame_us;
+    int64_t now_us;
+    bool can_arm;
+
+    struct rc_control rc;
+    struct flight_controller_setpoint setpoint;
+};
+
+
+static void test_link_init(struct test_link *link) {
+    memset(link, 0, sizeof(*link));
+    link->now_us = 1000000;
+    link->next_frame_us = link->now_us;
+    link->can_arm = true;
+    rc_control_init(&link->rc);
+}
+
+
+/* Sets the remote's sticks and its arm switch */
+static void set_sticks(struct test_link *link, float roll, float pitch, float yaw, \
+    float throttle, bool armed) {
+
+    link->command.roll = roll;
+    link->command.pitch = pitch;
+    link->command.yaw = yaw;
+    link->command.throttle = throttle;
+    link->command.flags = (uint8_t) ((link->command.flags & ~RC_LINK_FLAG_ARMED) \
+        | (armed ? RC_LINK_FLAG_ARMED : 0));
+}
+
+
+/* Runs 'ms' of sensor task loops, with the remote sending a frame every
+ * RC_LINK_PERIOD_US */
+static void run(struct test_link *link, int ms) {
+    int64_t end_us = link->now_us + (int64_t) ms * 1000;
+    while (link->now_us < end_us) {
+        while (link->next_frame_us <= link->now_us) {
+            if (link->connected) {
+                link->received = link->command;
+                link->received_us = link->next_frame_us;
+            }
+            link->next_frame_us += RC_LINK_PERIOD_US;
+        }
+        rc_control_update(&link->rc, &link->received, link->received_us, link->now_us, \
+            link->can_arm, &link->setpoint);
+        link->now_us += TEST_LOOP_PERIOD_US;
+    }
+}
+
+
+static void check_disarmed(const struct test_link *link) {
+    TEST_CHECK_EQUAL(link->rc.state, RC_CONTROL_DISARMED);
+    TEST_CHECK_EQUAL(link->setpoint.armed, 0);
+    TEST_CHECK(link->setpoint.throttle == 0.0f);
+}
+
+
+/* Arms from disarmed the way the pilot would: switch off, throttle down,
+ * switch on */
+static void arm(struct test_link *link) {
+    set_sticks(link, 0.0f, 0.0f, 0.0f, 0.0f, false);
+    run(link, 50);
+    set_sticks(link, 0.0f, 0.0f, 0.0f, 0.0f, true);
+    run(link, 50);
+    TEST_CHECK_EQUAL(link->rc.state, RC_CONTROL_ARMED);
+    TEST_CHECK_EQUAL(link->setpoint.armed, 1);
+}
+
+
+int main(void) {
+    struct test_link link;
+
+    /* 1. No frames at all: stays disarmed */
+    test_link_init(&link);
+    run(&link, 500);
+    check_disarmed(&link);
+
+    /* 2. Booting with the arm switch already on does not arm, however long
+     * it is left on. Turning it off and on again does */
+    test_link_init(&link);
+    link.connected = true;
+    set_sticks(&link, 0.0f, 0.0f, 0.0f, 0.0f, true);
+    run(&link, 1000);
+    check_disarmed(&link);
+    arm(&link);
+
+    /* 3. Flies the sticks, scaled, while armed, and disarms as soon as the
+     * switch goes off, whatever the throttle */
+    set_sticks(&link, 1.0f, -0.5f, 0.25f, 0.6f, true);
+    run(&link, 20);
+    TEST_CHECK_NEAR(link.setpoint.roll, RC_MAX_ANGLE_RAD, 1e-6);
+    TEST_CHECK_NEAR(link.setpoint.pitch, -0.5f * RC_MAX_ANGLE_RAD, 1e-6);
+    TEST_CHECK_NEAR(link.setpoint.yaw_rate, 0.25f * RC_MAX_YAW_RATE_RAD_S, 1e-6);
+    TEST_CHECK_NEAR(link.setpoint.throttle, 0.6f, 1e-6);
+    set_sticks(&link, 1.0f, -0.5f, 0.25f, 0.6f, false);
+    run(&link, 20);
+    check_disarmed(&link);
+    TEST_CHECK(link.setpoint.roll == 0.0f);
+    TEST_CHECK(link.setpoint.yaw_rate == 0.0f);
+
+    /* 4. Does not arm with the throttle up, or while something else is
+     * going on, and arms once neither is true any more without the switch
+     * having to go off again */
+    test_link_init(&link);
+    link.connected = true;
+    set_sticks(&link, 0.0f, 0.0f, 0.0f, 0.0f, false);
+    run(&link, 50);
+    set_sticks(&link, 0.0f, 0.0f, 0.0f, RC_ARM_THROTTLE_MAX, true);
+    run(&link, 200);
+    check_disarmed(&link);
+    set_sticks(&link, 0.0f, 0.0f, 0.0f, 0.0f, true);
+    link.can_arm = false;
+    run(&link, 200);
+    check_disarmed(&link);
+    link.can_arm = true;
+    run(&link, 20);
+    TEST_CHECK_EQUAL(link.rc.state, RC_CONTROL_ARMED);
+    /* Once armed, 'can_arm' no longer matters */
+    link.can_arm = false;
+    run(&link, 200);
+    TEST_CHECK_EQUAL(link.rc.state, RC_CONTROL_ARMED);
+
+    /* 5. A link lost for less than RC_FAILSAFE_TIMEOUT_MS is ridden
+     * through. Past it, the drone levels out on a reduced throttle, and the
+     * pilot gets it back as soon as the link comes back */
+    test_link_init(&link);
+    link.connected = true;
+    arm(&link);
+    set_sticks(&link, 0.5f, 0.5f, 0.5f, 0.5f, true);
+    run(&link, 20);
+    link.connected = false;
+    run(&link, RC_FAILSAFE_TIMEOUT_MS - 10);
+    TEST_CHECK_EQUAL(link.rc.state, RC_CONTROL_ARMED);
+    run(&link, 20);
+    TEST_CHECK_EQUAL(link.rc.state, RC_CONTROL_FAILSAFE);
+    TEST_CHECK_EQUAL(link.rc.failsafes, 1);
+    TEST_CHECK_EQUAL(link.setpoint.armed, 1);
+    TEST_CHECK(link.setpoint.roll == 0.0f);
+    TEST_CHECK(link.setpoint.pitch == 0.0f);
+    TEST_CHECK(link.setpoint.yaw_rate == 0.0f);
+    TEST_CHECK_NEAR(link.setpoint.throttle, 0.5f * RC_FAILSAFE_THROTTLE_SCALE, 1e-6);
+    /* The failsafe throttle holds, rather than being scaled down again
+     * every loop */
+    run(&link, 500);
+    TEST_CHECK_NEAR(link.setpoint.throttle, 0.5f * RC_FAILSAFE_THROTTLE_SCALE, 1e-6);
+    link.connected = true;
+    run(&link, 20);
+    TEST_CHECK_EQUAL(link.rc.state, RC_CONTROL_ARMED);
+    TEST_CHECK_NEAR(link.setpoint.throttle, 0.5f, 1e-6);
+
+    /* 6. The link coming back with the switch off disarms */
+    link.connected = false;
+    run(&link, RC_FAILSAFE_TIMEOUT_MS + 20);
+    TEST_CHECK_EQUAL(link.rc.state, RC_CONTROL_FAILSAFE);
+    TEST_CHECK_EQUAL(link.rc.failsafes, 2);
+    set_sticks(&link, 0.0f, 0.0f, 0.0f, 0.0f, false);
+    link.connected = true;
+    run(&link, 20);
+    check_disarmed(&link);
+
+    /* 7. A link not back within RC_FAILSAFE_LAND_MS disarms. When it does
+     * come back with the switch still on, the drone stays disarmed until
+     * the switch has been off */
+    test_link_init(&link);
+    link.connected = true;
+    arm(&link);
+    set_sticks(&link, 0.0f, 0.0f, 0.0f, 0.5f, true);
+    run(&link, 20);
+    link.connected = false;
+    run(&link, RC_FAILSAFE_TIMEOUT_MS + RC_FAILSAFE_LAND_MS - 50);
+    TEST_CHECK_EQUAL(link.rc.state, RC_CONTROL_FAILSAFE);
+    run(&link, 100);
+    check_disarmed(&link);
+    set_sticks(&link, 0.0f, 0.0f, 0.0f, 0.0f, true);
+    link.connected = true;
+    run(&link, 500);
+    check_disarmed(&link);
+    arm(&link);
+
+    /* 8. Frames the remote flags failsafe count as a lost link, even though
+     * they keep arriving, and do not count as the switch being off */
+    test_link_init(&link);
+    link.connected = true;
+    arm(&link);
+    set_sticks(&link, 0.0f, 0.0f, 0.0f, 0.4f, true);
+    run(&link, 20);
+    link.command.flags |= RC_LINK_FLAG_FAILSAFE;
+    run(&link, 20);
+    TEST_CHECK_EQUAL(link.rc.state, RC_CONTROL_FAILSAFE);
+    TEST_CHECK_NEAR(link.setpoint.throttle, 0.4f * RC_FAILSAFE_THROTTLE_SCALE, 1e-6);
+    run(&link, RC_FAILSAFE_LAND_MS + 20);
+    check_disarmed(&link);
+    link.command.flags &= (uint8_t) ~RC_LINK_FLAG_FAILSAFE;
+    set_sticks(&link, 0.0f, 0.0f, 0.0f, 0.0f, true);
+    run(&link, 200);
+    check_disarmed(&link);
+
+    return test_check_result("test-rc-control");
+}
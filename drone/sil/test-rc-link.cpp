@@ -0,0 +1,187 @@
+/* Host test for the remote control link's protocol: a frame coded against
+ * one worked out by hand (its CRC from an independent CRC-16/CCITT-FALSE),
+ * sticks coded and decoded, every single bit error caught, and the
+ * receiver's handling of lost, late, repeated and wrapped sequence numbers
+ * and of a remote that restarts.
+ *
+ *   ./build-sil/test-rc-link
+ */
+#include <inttypes.h>
+#include <string.h>
+
+#include "rc-link.h"
+
+#include "test-check.h"
+
+
+/* Sends a frame with sequence number 'sequence' and a throttle of
+ * 'throttle' to 'rx', returning what it made of it */
+static enum rc_link_result send(struct rc_link_receiver *rx, uint16_t sequence, \
+    float throttle, struct rc_link_command *received) {
+
+    struct rc_link_command command = {};
+    command.throttle = throttle;
+    uint8_t frame[RC_LINK_FRAME_LEN];
+    rc_link_encode(&command, sequence, frame);
+    return rc_link_receive(rx, frame, sizeof(frame), received);
+}
+
+
+static void test_frame(void) {
+    /* 1. Every byte of a frame, worked out by hand: 0.5 is 16384 (rounded
+     * up from 16383.5), -1 is -32767, 0x8001, and full throttle 0x7FFF */
+    struct rc_link_command command = {};
+    command.roll = 0.5f;
+    command.pitch = -1.0f;
+    command.yaw = 0.0f;
+    command.throttle = 1.0f;
+    command.flags = RC_LINK_FLAG_ARMED;
+    static const uint8_t expected[RC_LINK_FRAME_LEN] = {
+        0xC5, 0x01, 0x34, 0x12, 0x01, 0x00, 0x40, 0x01, 0x80, 0x00, 0x00, 0xFF, 0x7F, \
+        0xE3, 0xBD,
+    };
+    uint8_t frame[RC_LINK_FRAME_LEN];
+    rc_link_encode(&command, 0x1234, frame);
+    for (int i = 0; i < RC_LINK_FRAME_LEN; i++) {
+        TEST_CHECK_EQUAL(frame[i], expected[i]);
+    }
+
+    /* 2. It decodes back to the same command, to within a channel step */
+    struct rc_link_command decoded;
+    uint16_t sequence = 0;
+    TEST_CHECK_EQUAL(rc_link_decode(frame, sizeof(frame), &decoded, &sequence), RC_LINK_OK);
+    TEST_CHECK_EQUAL(sequence, 0x1234);
+    TEST_CHECK_EQUAL(decoded.flags, RC_LINK_FLAG_ARMED);
+    TEST_CHECK_NEAR(decoded.roll, 0.5f, 1.0 / RC_LINK_STICK_MAX);
+    TEST_CHECK_NEAR(decoded.pitch, -1.0f, 1e-6);
+    TEST_CHECK_NEAR(decoded.yaw, 0.0f, 1e-6);
+    TEST_CHECK_NEAR(decoded.throttle, 1.0f, 1e-6);
+
+    /* 3. Sticks out of range are clamped, throttle to 0 at the bottom, and
+     * not-a-number goes to the bottom of the range */
+    command.roll = 2.0f;
+    command.pitch = -3.0f;
+    command.yaw = NAN;
+    command.throttle = -0.5f;
+    rc_link_encode(&command, 1, frame);
+    TEST_CHECK_EQUAL(rc_link_decode(frame, sizeof(frame), &decoded, &sequence), RC_LINK_OK);
+    TEST_CHECK_NEAR(decoded.roll, 1.0f, 1e-6);
+    TEST_CHECK_NEAR(decoded.pitch, -1.0f, 1e-6);
+    TEST_CHECK_NEAR(decoded.yaw, -1.0f, 1e-6);
+    TEST_CHECK_NEAR(decoded.throttle, 0.0f, 1e-6);
+
+    /* 4. Every single bit error is caught, and leaves the command and
+     * sequence number alone */
+    rc_link_encode(&command, 0x1234, frame);
+    int caught = 0;
+    for (int bit = 0; bit < RC_LINK_FRAME_LEN * 8; bit++) {
+        uint8_t corrupt[RC_LINK_FRAME_LEN];
+        memcpy(corrupt, frame, sizeof(corrupt));
+        corrupt[bit / 8] ^= (uint8_t) (1 << (bit % 8));
+        sequence = 0xBEEF;
+        if (rc_link_decode(corrupt, sizeof(corrupt), &decoded, &sequence) == RC_LINK_CORRUPT \
+            && sequence == 0xBEEF) {
+            caught++;
+        }
+    }
+    TEST_CHECK_EQUAL(caught, RC_LINK_FRAME_LEN * 8);
+
+    /* 5. So is a frame of the wrong length */
+    TEST_CHECK_EQUAL(rc_link_decode(frame, sizeof(frame) - 1, &decoded, &sequence), \
+        RC_LINK_CORRUPT);
+    TEST_CHECK_EQUAL(rc_link_decode(frame, sizeof(frame) + 1, &decoded, &sequence), \
+        RC_LINK_CORRUPT);
+}
+
+
+static void test_receiver(void) {
+    struct rc_link_receiver rx;
+    struct rc_link_command received = {};
+    rc_link_receiver_init(&rx);
+
+    /* 1. The first frame is accepted whatever its sequence number, and
+     * frames in order after it */
+    TEST_CHECK_EQUAL(send(&rx, 100, 0.1f, &received), RC_LINK_OK);
+    TEST_CHECK_EQUAL(send(&rx, 101, 0.2f, &received), RC_LINK_OK);
+    TEST_CHECK_NEAR(received.throttle, 0.2f, 1e-4);
+    TEST_CHECK_EQUAL(rx.frames, 2);
+    TEST_CHECK_EQUAL(rx.lost, 0);
+
+    /* 2. A gap counts the frames that never came */
+    TEST_CHECK_EQUAL(send(&rx, 105, 0.3f, &received), RC_LINK_OK);
+    TEST_CHECK_EQUAL(rx.lost, 3);
+
+    /* 3. A repeated frame, and one that arrives after a newer one, are
+     * thrown away without touching the command */
+    TEST_CHECK_EQUAL(send(&rx, 105, 0.9f, &received), RC_LINK_STALE);
+    TEST_CHECK_EQUAL(send(&rx, 103, 0.9f, &received), RC_LINK_STALE);
+    TEST_CHECK_NEAR(received.throttle, 0.3f, 1e-4);
+    TEST_CHECK_EQUAL(rx.stale, 2);
+    TEST_CHECK_EQUAL(rx.frames, 3);
+
+    /* 4. A corrupt frame is counted, and leaves the command alone */
+    uint8_t frame[RC_LINK_FRAME_LEN];
+    struct rc_link_command command = {};
+    command.throttle = 0.9f;
+    rc_link_encode(&command, 106, frame);
+    frame[6] ^= 0x10;
+    TEST_CHECK_EQUAL(rc_link_receive(&rx, frame, sizeof(frame), &received), RC_LINK_CORRUPT);
+    TEST_CHECK_EQUAL(rx.corrupt, 1);
+    TEST_CHECK_NEAR(received.throttle, 0.3f, 1e-4);
+
+    /* 5. The sequence number wraps from 0xFFFF to 0 without anything being
+     * lost or stale, and a gap across the wrap is counted like any other */
+    rc_link_receiver_init(&rx);
+    TEST_CHECK_EQUAL(send(&rx, 0xFFFE, 0.0f, &received), RC_LINK_OK);
+    TEST_CHECK_EQUAL(send(&rx, 0xFFFF, 0.0f, &received), RC_LINK_OK);
+    TEST_CHECK_EQUAL(send(&rx, 0x0000, 0.0f, &received), RC_LINK_OK);
+    TEST_CHECK_EQUAL(rx.lost, 0);
+    TEST_CHECK_EQUAL(send(&rx, 0xFFFF, 0.0f, &received), RC_LINK_STALE);
+    TEST_CHECK_EQUAL(send(&rx, 0xFFFD, 0.0f, &received), RC_LINK_STALE);
+    TEST_CHECK_EQUAL(send(&rx, 0x0003, 0.0f, &received), RC_LINK_OK);
+    TEST_CHECK_EQUAL(rx.lost, 2);
+    rc_link_receiver_init(&rx);
+    TEST_CHECK_EQUAL(send(&rx, 0xFFFE, 0.0f, &received), RC_LINK_OK);
+    TEST_CHECK_EQUAL(send(&rx, 0x0001, 0.0f, &received), RC_LINK_OK);
+    TEST_CHECK_EQUAL(rx.lost, 2);
+
+    /* 6. A jump far ahead is the remote having restarted, or the link
+     * having been down for minutes, not thousands of lost frames */
+    uint32_t lost = rx.lost;
+    TEST_CHECK_EQUAL(send(&rx, 0x6000, 0.0f, &received), RC_LINK_OK);
+    TEST_CHECK_EQUAL(rx.lost, lost);
+    /* The same goes for a jump far back */
+    TEST_CHECK_EQUAL(send(&rx, 0x1000, 0.0f, &received), RC_LINK_OK);
+    TEST_CHECK_EQUAL(rx.lost, lost);
+
+    /* 7. A remote that restarts with a lower sequence number is taken back
+     * after a short run of stale frames, rather than ignored until its
+     * sequence number catches up */
+    rc_link_receiver_init(&rx);
+    TEST_CHECK_EQUAL(send(&rx, 5000, 0.5f, &received), RC_LINK_OK);
+    uint16_t sequence = 0;
+    int stale = 0;
+    while (send(&rx, sequence++, 0.7f, &received) == RC_LINK_STALE && stale < 100) {
+        stale++;
+    }
+    TEST_CHECK(stale > 0);
+    TEST_CHECK(stale < 10);
+    TEST_CHECK_NEAR(received.throttle, 0.7f, 1e-4);
+    TEST_CHECK_EQUAL(send(&rx, sequence++, 0.7f, &received), RC_LINK_OK);
+
+    /* 8. Whereas a few late frames between good ones never add up to that,
+     * however many of them there are */
+    rc_link_receiver_init(&rx);
+    for (uint16_t n = 1; n < 200; n++) {
+        TEST_CHECK_EQUAL(send(&rx, (uint16_t) (n * 2), 0.0f, &received), RC_LINK_OK);
+        TEST_CHECK_EQUAL(send(&rx, (uint16_t) (n * 2 - 1), 0.0f, &received), RC_LINK_STALE);
+    }
+}
+
+
+int main(void) {
+    test_frame();
+    test_receiver();
+
+    return test_check_result("test-rc-link");
+}
@@ -0,0 +1,214 @@
+/* Host test for the rate-monotonic scheduler, on FreeRTOS tasks and
+ * esp_timers simulated on one core (fake-tasks.cpp): priorities are given
+ * out by rate, a fast job doing its work keeps to its deadlines however long
+ * a slow job below it runs for, and a job that overruns its period has its
+ * misses and skipped releases counted rather than its releases queued up.
+ *
+ *   ./build-sil/test-scheduler
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "scheduler.h"
+
+#include "fake-tasks.h"
+#include "test-check.h"
+
+
+#define TEST_LOWEST_PRIORITY 5
+#define TEST_HIGHEST_PRIORITY 8
+#define TEST_STACK_SIZE 4096
+
+
+/* What a job does when it runs, and what it saw */
+struct test_job {
+    uint32_t work_us;
+    uint32_t begins;
+    uint32_t runs;
+    /* Whether 'begin()' ran in the job's own task, before any run */
+    bool began_first;
+    TaskHandle_t begin_task;
+    StackType_t stack[TEST_STACK_SIZE];
+};
+
+
+static void test_job_begin(void *arg) {
+    struct test_job *job = (struct test_job *) arg;
+    job->begins++;
+    job->began_first = job->runs == 0;
+    job->begin_task = xTaskGetCurrentTaskHandle();
+}
+
+
+static void test_job_run(void *arg) {
+    struct test_job *job = (struct test_job *) arg;
+    job->runs++;
+    fake_tasks_work(job->work_us);
+}
+
+
+static struct scheduler_job_config test_job_config(const char *name, uint32_t period_us, \
+    struct test_job *job) {
+
+    struct scheduler_job_config config = {};
+    config.name = name;
+    config.period_us = period_us;
+    config.core = tskNO_AFFINITY;
+    config.stack = job->stack;
+    config.stack_size = sizeof(job->stack);
+    config.begin = test_job_begin;
+    config.run = test_job_run;
+    config.arg = job;
+    return config;
+}
+
+
+/* Jobs that are turned away. Neither scheduler is started */
+static void test_add(void) {
+    static struct scheduler s;
+    static struct test_job job;
+    scheduler_init(&s, TEST_LOWEST_PRIORITY, TEST_HIGHEST_PRIORITY);
+
+    /* 1. A job with no period, 'run()' or stack */
+    struct scheduler_job_config config = test_job_config("bad", 0, &job);
+    TEST_CHECK_EQUAL(scheduler_add(&s, &config), ESP_ERR_INVALID_ARG);
+    config = test_job_config("bad", 1000, &job);
+    config.run = NULL;
+    TEST_CHECK_EQUAL(scheduler_add(&s, &config), ESP_ERR_INVALID_ARG);
+    config = test_job_config("bad", 1000, &job);
+    config.stack = NULL;
+    TEST_CHECK_EQUAL(scheduler_add(&s, &config), ESP_ERR_INVALID_ARG);
+    TEST_CHECK_EQUAL(s.num_jobs, 0);
+
+    /* 2. One more than SCHEDULER_MAX_JOBS */
+    config = test_job_config("job", 1000, &job);
+    for (int i = 0; i < SCHEDULER_MAX_JOBS; i++) {
+        TEST_CHECK_EQUAL(scheduler_add(&s, &config), ESP_OK);
+    }
+    TEST_CHECK_EQUAL(scheduler_add(&s, &config), ESP_ERR_NO_MEM);
+}
+
+
+enum {
+    TEST_FAST,
+    TEST_FAST_2,
+    TEST_MEDIUM,
+    TEST_SLOW,
+    TEST_LOG,
+    TEST_TELEMETRY,
+    TEST_NUM_JOBS,
+};
+
+
+int main(void) {
+    test_add();
+
+    /* A control loop and a second job at the same rate, something in
+     * between, and housekeeping at three slower rates than the band has
+     * priorities for */
+    static const char *const names[TEST_NUM_JOBS] = {
+        "fast", "fast2", "medium", "slow", "log", "telemetry",
+    };
+    static const uint32_t periods_us[TEST_NUM_JOBS] = {
+        1000, 1000, 2500, 10000, 50000, 100000,
+    };
+    static const uint32_t work_us[TEST_NUM_JOBS] = { 200, 100, 50, 3000, 100, 100 };
+    static const UBaseType_t priorities[TEST_NUM_JOBS] = { 8, 8, 7, 6, 5, 5 };
+
+    static struct scheduler s;
+    static struct test_job jobs[TEST_NUM_JOBS];
+    fake_tasks_init();
+    scheduler_init(&s, TEST_LOWEST_PRIORITY, TEST_HIGHEST_PRIORITY);
+    for (int i = 0; i < TEST_NUM_JOBS; i++) {
+        jobs[i].work_us = work_us[i];
+        struct scheduler_job_config config = test_job_config(names[i], periods_us[i], &jobs[i]);
+        TEST_CHECK_EQUAL(scheduler_add(&s, &config), ESP_OK);
+    }
+
+    /* 1. Jobs with the same period share a priority, the shorter the period
+     * the higher it is, and once the band runs out the slowest periods share
+     * its bottom */
+    TEST_CHECK_EQUAL(scheduler_start(&s), ESP_OK);
+    for (int i = 0; i < TEST_NUM_JOBS; i++) {
+        TEST_CHECK_EQUAL(s.jobs[i].priority, priorities[i]);
+    }
+
+    /* 2. Once started, nothing more can be added, and it cannot be started
+     * again */
+    struct scheduler_job_config config = test_job_config("late", 1000, &jobs[0]);
+    TEST_CHECK_EQUAL(scheduler_add(&s, &config), ESP_ERR_INVALID_STATE);
+    TEST_CHECK_EQUAL(scheduler_start(&s), ESP_ERR_INVALID_STATE);
+
+    /* 3. A second of flight. Each job's 'begin()' runs once, in its own
+     * task, before its first run. Every job keeps to its deadlines, and the
+     * fast ones respond within their own work and each other's, however
+     * long the slow job runs: it is preempted instead, and takes longer */
+    fake_tasks_run(1000000);
+    struct scheduler_job_stats stats[TEST_NUM_JOBS];
+    for (int i = 0; i < TEST_NUM_JOBS; i++) {
+        scheduler_get_stats(&s, i, &stats[i]);
+        TEST_CHECK_EQUAL(jobs[i].begins, 1);
+        TEST_CHECK(jobs[i].began_first);
+        TEST_CHECK(jobs[i].begin_task == s.jobs[i].task);
+        TEST_CHECK_EQUAL(stats[i].runs, jobs[i].runs);
+        TEST_CHECK(stats[i].runs >= 1000000 / periods_us[i] - 1);
+        TEST_CHECK(stats[i].runs <= 1000000 / periods_us[i]);
+        TEST_CHECK_EQUAL(stats[i].misses, 0);
+        TEST_CHECK_EQUAL(stats[i].skipped, 0);
+    }
+    TEST_CHECK(stats[TEST_FAST].max_response_us <= work_us[TEST_FAST]);
+    TEST_CHECK(stats[TEST_FAST_2].max_response_us \
+        <= work_us[TEST_FAST] + work_us[TEST_FAST_2]);
+    TEST_CHECK(stats[TEST_SLOW].max_response_us \
+        >= work_us[TEST_SLOW] + 3 * (work_us[TEST_FAST] + work_us[TEST_FAST_2]));
+
+    /* 4. Clearing the statistics */
+    scheduler_reset_stats(&s);
+    scheduler_get_stats(&s, TEST_SLOW, &stats[TEST_SLOW]);
+    TEST_CHECK_EQUAL(stats[TEST_SLOW].runs, 0);
+    TEST_CHECK_EQUAL(stats[TEST_SLOW].max_response_us, 0);
+
+    /* 5. The slow job starts taking longer than its period to run, even
+     * before it is preempted. Every run misses its deadline, and the
+     * releases that came while it was running are skipped, not run late one
+     * after the other. Each run is timed from the latest release, so its
+     * response stays within a period or two of its work, rather than
+     * growing with every skipped release. Nothing above it notices */
+    jobs[TEST_SLOW].work_us = 11000;
+    fake_tasks_run(1000000);
+    for (int i = 0; i < TEST_NUM_JOBS; i++) {
+        scheduler_get_stats(&s, i, &stats[i]);
+    }
+    TEST_CHECK(stats[TEST_SLOW].runs > 0);
+    TEST_CHECK(stats[TEST_SLOW].skipped > 0);
+    TEST_CHECK_EQUAL(stats[TEST_SLOW].misses, stats[TEST_SLOW].runs);
+    TEST_CHECK(stats[TEST_SLOW].runs + stats[TEST_SLOW].skipped >= 1000000 / 10000 - 2);
+    TEST_CHECK(stats[TEST_SLOW].runs + stats[TEST_SLOW].skipped <= 1000000 / 10000);
+    TEST_CHECK(stats[TEST_SLOW].max_response_us < 2 * periods_us[TEST_SLOW] + 11000);
+    for (int i = TEST_FAST; i < TEST_SLOW; i++) {
+        TEST_CHECK_EQUAL(stats[i].misses, 0);
+        TEST_CHECK_EQUAL(stats[i].skipped, 0);
+    }
+    TEST_CHECK(stats[TEST_FAST].max_response_us <= work_us[TEST_FAST]);
+
+    /* 6. The dump has a line for each job */
+    FILE *dump = tmpfile();
+    scheduler_dump(&s, dump);
+    rewind(dump);
+    char line[128];
+    int lines = 0;
+    while (fgets(line, sizeof(line), dump) != NULL) {
+        if (lines > 0) {
+            TEST_CHECK(strncmp(line, names[lines - 1], strlen(names[lines - 1])) == 0);
+        }
+        lines++;
+    }
+    fclose(dump);
+    TEST_CHECK_EQUAL(lines, 1 + TEST_NUM_JOBS);
+
+    return test_check_result("test-scheduler");
+}
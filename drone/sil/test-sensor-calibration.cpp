@@ -0,0 +1,308 @@
+/* Host test for the sensor calibration fits: simulates a gyroscope with a
+ * bias, an accelerometer with a known bias, scale and misalignment, and a
+ * magnetometer with known hard and soft iron distortion, feeds each fit what
+ * those sensors would read, and checks that the calibration it comes up with
+ * takes the errors back out. Also checks that the fits turn down a drone
+ * that moved, was not lined up, or was not turned far enough.
+ *
+ *   ./build-sil/test-sensor-calibration
+ */
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "sensor-calibration.h"
+
+#include "test-check.h"
+
+
+#define G SENSOR_CALIBRATION_STANDARD_GRAVITY
+
+/* Samples taken per accelerometer position, and the noise on them */
+#define TEST_ACCEL_SAMPLES 100
+#define TEST_ACCEL_NOISE_M_S2 0.05f
+
+/* The earth's field strength, and how many directions the magnetometer is
+ * turned through */
+#define TEST_FIELD_UT 50.0f
+#define TEST_MAG_SAMPLES 500
+
+
+/* The simulated accelerometer reads 'accel_matrix' * true + 'accel_bias':
+ * a few percent of scale error and a degree or so of misalignment on each
+ * axis */
+static const float accel_matrix[3][3] = {
+    { 1.03f, 0.015f, -0.02f },
+    { 0.01f, 0.97f, 0.025f },
+    { -0.015f, 0.02f, 1.01f },
+};
+static const float accel_bias[3] = { 0.3f, -0.2f, 0.45f };
+
+/* The simulated magnetometer reads 'mag_soft_iron' * true + 'mag_hard_iron'.
+ * The soft iron is symmetric, as the fit assumes */
+static const float mag_soft_iron[3][3] = {
+    { 1.15f, 0.06f, -0.04f },
+    { 0.06f, 0.88f, 0.05f },
+    { -0.04f, 0.05f, 1.02f },
+};
+static const float mag_hard_iron[3] = { 35.0f, -20.0f, 60.0f };
+
+
+static void transform(const float (*matrix)[3], const float *offset, const float *in, \
+    float *out) {
+
+    for (int i = 0; i < 3; i++) {
+        out[i] = matrix[i][0] * in[0] + matrix[i][1] * in[1] + matrix[i][2] * in[2] + offset[i];
+    }
+}
+
+
+static float norm(const float *v) {
+    return sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+}
+
+
+/* The direction of the 'i'th of 'n' points spread evenly over a sphere (a
+ * Fibonacci sphere) */
+static void sphere_point(int i, int n, float *v) {
+    float z = 1.0f - 2.0f * ((float) i + 0.5f) / (float) n;
+    float r = sqrtf(1.0f - z * z);
+    float angle = (float) i * (float) M_PI * (3.0f - sqrtf(5.0f));
+    v[0] = r * cosf(angle);
+    v[1] = r * sinf(angle);
+    v[2] = z;
+}
+
+
+/* Holds the accelerometer still with 'g_true' as the true reading, and
+ * returns what comes of taking it as one of the six positions */
+static enum sensor_calibration_result take_position(struct sensor_calibration_accel *accel, \
+    const float *g_true) {
+
+    struct sensor_calibration_stats stats;
+    sensor_calibration_stats_reset(&stats);
+    for (int n = 0; n < TEST_ACCEL_SAMPLES; n++) {
+        float reading[3];
+        transform(accel_matrix, accel_bias, g_true, reading);
+        /* Noise that averages out to nothing */
+        for (int i = 0; i < 3; i++) {
+            reading[i] += ((n + i) % 2 == 0) ? TEST_ACCEL_NOISE_M_S2 : -TEST_ACCEL_NOISE_M_S2;
+        }
+        sensor_calibration_stats_add(&stats, reading);
+    }
+    return sensor_calibration_accel_add_position(accel, &stats);
+}
+
+
+static void test_gyro_bias(void) {
+    const float bias[3] = { 0.012f, -0.034f, 0.005f };
+    struct sensor_calibration_stats stats;
+    struct sensor_calibration cal;
+
+    /* 1. Nothing to work from */
+    sensor_calibration_stats_reset(&stats);
+    TEST_CHECK_EQUAL(sensor_calibration_gyro_bias(&stats, &cal), SENSOR_CALIBRATION_INCOMPLETE);
+
+    /* 2. Held still, the bias is subtracted */
+    for (int n = 0; n < 200; n++) {
+        float reading[3];
+        for (int i = 0; i < 3; i++) {
+            reading[i] = bias[i] + ((n % 2 == 0) ? 0.005f : -0.005f);
+        }
+        sensor_calibration_stats_add(&stats, reading);
+    }
+    TEST_CHECK_EQUAL(sensor_calibration_gyro_bias(&stats, &cal), SENSOR_CALIBRATION_OK);
+    float corrected[3];
+    sensor_calibration_apply(&cal, bias, corrected);
+    for (int i = 0; i < 3; i++) {
+        TEST_CHECK_NEAR(cal.offset[i], -bias[i], 1e-6);
+        TEST_CHECK_NEAR(corrected[i], 0.0f, 1e-6);
+    }
+
+    /* 3. Turned while measuring */
+    sensor_calibration_stats_reset(&stats);
+    for (int n = 0; n < 200; n++) {
+        float reading[3] = { bias[0], bias[1], bias[2] + ((n < 100) ? 0.0f : 0.1f) };
+        sensor_calibration_stats_add(&stats, reading);
+    }
+    TEST_CHECK_EQUAL(sensor_calibration_gyro_bias(&stats, &cal), SENSOR_CALIBRATION_MOVED);
+}
+
+
+static void test_accel(void) {
+    struct sensor_calibration_accel accel;
+    struct sensor_calibration cal;
+    sensor_calibration_accel_reset(&accel);
+
+    /* 1. Tilted halfway between two axes is none of the six positions */
+    const float tilted[3] = { 0.7071f * G, 0.0f, 0.7071f * G };
+    TEST_CHECK_EQUAL(take_position(&accel, tilted), SENSOR_CALIBRATION_BAD_POSITION);
+    TEST_CHECK_EQUAL(accel.taken, 0);
+
+    /* 2. Each axis up, then down, is recognised as its position. Until all
+     * six are in, there is nothing to solve */
+    for (int p = 0; p < SENSOR_CALIBRATION_ACCEL_POSITIONS; p++) {
+        TEST_CHECK_EQUAL(sensor_calibration_accel_solve(&accel, &cal), \
+            SENSOR_CALIBRATION_INCOMPLETE);
+        float g_true[3] = {};
+        g_true[p / 2] = (p % 2 == 0) ? G : -G;
+        TEST_CHECK_EQUAL(take_position(&accel, g_true), SENSOR_CALIBRATION_OK);
+        TEST_CHECK_EQUAL(accel.taken, (1 << (p + 1)) - 1);
+    }
+    TEST_CHECK(sensor_calibration_accel_complete(&accel));
+
+    /* 3. The fit takes out the bias, scale and misalignment, not just in the
+     * six positions but at any attitude */
+    TEST_CHECK_EQUAL(sensor_calibration_accel_solve(&accel, &cal), SENSOR_CALIBRATION_OK);
+    TEST_CHECK(sensor_calibration_is_valid(&cal));
+    for (int n = 0; n < 50; n++) {
+        float g_true[3];
+        sphere_point(n, 50, g_true);
+        for (int i = 0; i < 3; i++) {
+            g_true[i] *= G;
+        }
+        float reading[3];
+        float corrected[3];
+        transform(accel_matrix, accel_bias, g_true, reading);
+        sensor_calibration_apply(&cal, reading, corrected);
+        for (int i = 0; i < 3; i++) {
+            TEST_CHECK_NEAR(corrected[i], g_true[i], 1e-3);
+        }
+    }
+
+    /* 4. Retaking a position replaces it rather than adding to it */
+    const float up[3] = { 0.0f, 0.0f, G };
+    TEST_CHECK_EQUAL(take_position(&accel, up), SENSOR_CALIBRATION_OK);
+    struct sensor_calibration again;
+    TEST_CHECK_EQUAL(sensor_calibration_accel_solve(&accel, &again), SENSOR_CALIBRATION_OK);
+    TEST_CHECK(memcmp(&cal, &again, sizeof(cal)) == 0);
+
+    /* 5. Moving while a position is taken */
+    struct sensor_calibration_stats stats;
+    sensor_calibration_stats_reset(&stats);
+    for (int n = 0; n < TEST_ACCEL_SAMPLES; n++) {
+        float reading[3] = { 0.0f, (n % 2 == 0) ? 1.0f : -1.0f, G };
+        sensor_calibration_stats_add(&stats, reading);
+    }
+    TEST_CHECK_EQUAL(sensor_calibration_accel_add_position(&accel, &stats), \
+        SENSOR_CALIBRATION_MOVED);
+}
+
+
+/* Turns the magnetometer through 'count' of 'n' directions spread over a
+ * sphere, with 'hard_iron' as its hard iron, feeding each reading to 'mag' */
+static void turn_mag(struct sensor_calibration_mag *mag, int count, int n, \
+    const float *hard_iron) {
+
+    sensor_calibration_mag_reset(mag);
+    for (int i = 0; i < count; i++) {
+        float field[3];
+        float reading[3];
+        sphere_point(i, n, field);
+        for (int j = 0; j < 3; j++) {
+            field[j] *= TEST_FIELD_UT;
+        }
+        transform(mag_soft_iron, hard_iron, field, reading);
+        sensor_calibration_mag_add(mag, reading);
+    }
+}
+
+
+/* Turned through every direction, the fit maps the readings back onto a
+ * sphere centred on zero. With a symmetric soft iron matrix nothing is
+ * rotated either, so each corrected reading points the way the field did,
+ * scaled to the sphere's radius: the geometric mean of the ellipsoid's, which
+ * is the field times the cube root of the soft iron matrix's determinant */
+static void check_mag_fit(const float *hard_iron) {
+    struct sensor_calibration_mag mag;
+    struct sensor_calibration cal;
+    turn_mag(&mag, TEST_MAG_SAMPLES, TEST_MAG_SAMPLES, hard_iron);
+    TEST_CHECK_EQUAL(sensor_calibration_mag_solve(&mag, &cal), SENSOR_CALIBRATION_OK);
+    TEST_CHECK(sensor_calibration_is_valid(&cal));
+
+    const float (*s)[3] = mag_soft_iron;
+    float det = s[0][0] * (s[1][1] * s[2][2] - s[1][2] * s[2][1]) \
+        - s[0][1] * (s[1][0] * s[2][2] - s[1][2] * s[2][0]) \
+        + s[0][2] * (s[1][0] * s[2][1] - s[1][1] * s[2][0]);
+    float scale = cbrtf(det);
+
+    float centre[3];
+    sensor_calibration_apply(&cal, hard_iron, centre);
+    TEST_CHECK_NEAR(norm(centre), 0.0f, 0.01f);
+
+    /* Directions the fit never saw as well as the ones it did */
+    for (int n = 0; n < 100; n++) {
+        float field[3];
+        float reading[3];
+        float corrected[3];
+        sphere_point(n, 100, field);
+        for (int i = 0; i < 3; i++) {
+            field[i] *= TEST_FIELD_UT;
+        }
+        transform(mag_soft_iron, hard_iron, field, reading);
+        sensor_calibration_apply(&cal, reading, corrected);
+        TEST_CHECK_NEAR(norm(corrected), scale * TEST_FIELD_UT, 0.01f);
+        for (int i = 0; i < 3; i++) {
+            TEST_CHECK_NEAR(corrected[i], scale * field[i], 0.02f);
+        }
+    }
+}
+
+
+static void test_mag(void) {
+    struct sensor_calibration_mag mag;
+    struct sensor_calibration cal;
+
+    /* 1. Too few samples, even spread over every direction */
+    turn_mag(&mag, SENSOR_CALIBRATION_MAG_MIN_SAMPLES - 1, \
+        SENSOR_CALIBRATION_MAG_MIN_SAMPLES - 1, mag_hard_iron);
+    TEST_CHECK_EQUAL(sensor_calibration_mag_solve(&mag, &cal), SENSOR_CALIBRATION_INCOMPLETE);
+
+    /* 2. Plenty of samples, but the drone was only ever tipped a little:
+     * the field stays within a cap around the z axis */
+    turn_mag(&mag, TEST_MAG_SAMPLES, TEST_MAG_SAMPLES * 10, mag_hard_iron);
+    TEST_CHECK(sensor_calibration_mag_solve(&mag, &cal) != SENSOR_CALIBRATION_OK);
+
+    /* 3. A hard iron weaker than the earth's field, and one stronger than
+     * it, as it often is next to a drone's motors and battery leads, which
+     * leaves zero outside the ellipsoid */
+    const float weak_hard_iron[3] = { 5.0f, -3.0f, 8.0f };
+    check_mag_fit(weak_hard_iron);
+    check_mag_fit(mag_hard_iron);
+}
+
+
+/* A calibration with the sensor's scale folded in gives the same from raw
+ * samples as the calibration does from the samples in SI units */
+static void test_fold_scale(void) {
+    struct sensor_calibration cal;
+    memcpy(cal.matrix, accel_matrix, sizeof(cal.matrix));
+    memcpy(cal.offset, accel_bias, sizeof(cal.offset));
+    const float scale = 0.000598f;
+
+    struct sensor_calibration folded;
+    sensor_calibration_fold_scale(&cal, scale, &folded);
+    const int16_t raw[3] = { 1234, -16000, 8191 };
+    const float si[3] = { raw[0] * scale, raw[1] * scale, raw[2] * scale };
+    float from_raw[3];
+    float from_si[3];
+    sensor_calibration_apply_raw(&folded, raw, from_raw);
+    sensor_calibration_apply(&cal, si, from_si);
+    for (int i = 0; i < 3; i++) {
+        TEST_CHECK_NEAR(from_raw[i], from_si[i], 1e-4);
+    }
+
+    /* A flipped axis is not a calibration */
+    folded.matrix[1][1] = -folded.matrix[1][1];
+    TEST_CHECK(!sensor_calibration_is_valid(&folded));
+}
+
+
+int main(void) {
+    test_gyro_bias();
+    test_accel();
+    test_mag();
+    test_fold_scale();
+
+    return test_check_result("test-sensor-calibration");
+}
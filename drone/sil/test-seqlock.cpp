@@ -0,0 +1,115 @@
+/* Host stress test for the seqlock: one pthread writes a struct over and
+ * over while several others read it, and every copy a reader gets has to be
+ * one whole write. Each write fills every word of the struct with the same
+ * sequence number, so a copy torn between two writes shows up as words that
+ * differ. Each reader also checks that the writes it sees never go
+ * backwards.
+ *
+ * The host's cores race for real here, unlike in the SIL, so this is the
+ * test for the memory ordering in seqlock.h (on x86 that mostly checks the
+ * compiler barriers; run it on an ARM host for the CPU's).
+ *
+ *   ./build-sil/test-seqlock [writes]
+ */
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "seqlock.h"
+
+#include "test-check.h"
+
+
+#define TEST_READERS 3
+/* Big enough that a copy takes a while, so readers and the writer overlap */
+#define TEST_WORDS 32
+
+
+struct shared_data {
+    uint32_t words[TEST_WORDS];
+};
+
+
+struct seqlock shared_seqlock = SEQLOCK_INITIALIZER;
+struct shared_data shared;
+static uint32_t writes_done;
+
+
+struct reader_result {
+    uint64_t reads;
+    uint64_t retries;
+    uint64_t torn;
+    uint64_t backwards;
+};
+
+
+static void *writer(void *arg) {
+    const uint32_t num_writes = *(const uint32_t *) arg;
+    struct shared_data data;
+
+    for (uint32_t n = 1; n <= num_writes; n++) {
+        for (int i = 0; i < TEST_WORDS; i++) {
+            data.words[i] = n;
+        }
+        seqlock_write(&shared_seqlock, &shared, &data, sizeof(data));
+    }
+    __atomic_store_n(&writes_done, 1, __ATOMIC_RELEASE);
+
+    return NULL;
+}
+
+
+static void *reader(void *arg) {
+    struct reader_result *result = (struct reader_result *) arg;
+    struct shared_data data;
+    uint32_t last = 0;
+
+    while (!__atomic_load_n(&writes_done, __ATOMIC_ACQUIRE)) {
+        result->retries += seqlock_read(&shared_seqlock, &data, &shared, sizeof(data));
+        result->reads++;
+        for (int i = 1; i < TEST_WORDS; i++) {
+            if (data.words[i] != data.words[0]) {
+                result->torn++;
+                break;
+            }
+        }
+        if (data.words[0] < last) {
+            result->backwards++;
+        }
+        last = data.words[0];
+    }
+
+    return NULL;
+}
+
+
+int main(int argc, char **argv) {
+    uint32_t num_writes = (argc > 1) ? (uint32_t) strtoul(argv[1], NULL, 0) : 2000000;
+
+    pthread_t readers[TEST_READERS];
+    struct reader_result results[TEST_READERS] = {};
+    for (int r = 0; r < TEST_READERS; r++) {
+        pthread_create(&readers[r], NULL, reader, &results[r]);
+    }
+    pthread_t writer_thread;
+    pthread_create(&writer_thread, NULL, writer, &num_writes);
+
+    pthread_join(writer_thread, NULL);
+    for (int r = 0; r < TEST_READERS; r++) {
+        pthread_join(readers[r], NULL);
+        printf("reader %d: %" PRIu64 " reads, %" PRIu64 " retries\n", r, results[r].reads, \
+            results[r].retries);
+        TEST_CHECK_EQUAL(results[r].torn, 0);
+        TEST_CHECK_EQUAL(results[r].backwards, 0);
+    }
+
+    /* Once the writer is done, a read gets its last write */
+    struct shared_data data;
+    TEST_CHECK_EQUAL(seqlock_read(&shared_seqlock, &data, &shared, sizeof(data)), 0);
+    TEST_CHECK_EQUAL(data.words[0], num_writes);
+    TEST_CHECK_EQUAL(data.words[TEST_WORDS - 1], num_writes);
+    TEST_CHECK_EQUAL(shared_seqlock.sequence, 2 * num_writes);
+
+    return test_check_result("test-seqlock");
+}
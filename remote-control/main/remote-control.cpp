@@ -3,146 +3,301 @@
 #include <string.h>
 #include <inttypes.h>
 
-#include "esp_hidd_api.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "esp_adc/adc_oneshot.h"
 #include "driver/gpio.h"
 #include "esp_system.h"
+#include "nvs_flash.h"
 #include "freertos/FreeRTOS.h"
-#include "freertos/semphr.h"
 #include "freertos/task.h"
 
+#include "rc-link.h"
 #include "remote-control.h"
 
+#if RC_TRANSPORT == RC_TRANSPORT_ESPNOW
+#include "rc-link-espnow.h"
+#else
+#include "esp_bt.h"
+#include "esp_bt_device.h"
+#include "esp_bt_main.h"
+#include "esp_gap_bt_api.h"
+#include "esp_hidd_api.h"
+#endif
 
-/* HID report descriptor for a generic joystick. The contents of the report
- * are: Moving information for X and Y cursors, 3 buttons, and a wheel. */
+
+/* The sticks are potentiometers on ADC1 (ADC2 cannot be used alongside the
+ * radio), and the arm switch pulls its pin to ground when on */
+#define ROLL_STICK_ADC_CHANNEL ADC_CHANNEL_6 /* GPIO 34 */
+#define PITCH_STICK_ADC_CHANNEL ADC_CHANNEL_7 /* GPIO 35 */
+#define YAW_STICK_ADC_CHANNEL ADC_CHANNEL_4 /* GPIO 32 */
+#define THROTTLE_STICK_ADC_CHANNEL ADC_CHANNEL_5 /* GPIO 33 */
+#define ARM_SWITCH_PIN_NUM GPIO_NUM_25
+/* The full scale of a 12 bit ADC reading */
+#define STICK_RAW_MAX 4095
+/* How far a centred stick can be from its resting position and still read
+ * as centred, as a fraction of full scale */
+#define STICK_DEADBAND 0.02f
+
+/* The sender runs above everything but the Bluetooth stack, so frames go out
+ * on time */
+#define SENDER_PRIORITY (configMAX_PRIORITIES - 3)
+#define SENDER_STACK_SIZE 4096
+/* How often a remote that is waiting to be paired asks again: every 20
+ * frame periods, 100ms */
+#define PAIRING_REQUEST_FRAMES 20
+/* How often 'app_main()' checks whether pairing is done, to store the
+ * drone's address */
+#define PAIRING_POLL_MS 100
+
+
+#if RC_TRANSPORT == RC_TRANSPORT_BLUETOOTH
+/* HID report descriptor for a vendor defined device with one input report:
+ * an RC_LINK_FRAME_LEN byte rc-link frame. There are no report IDs, so the
+ * report is exactly the frame */
 uint8_t hid_rc_descriptor[] = {
-    0x05, 0x01,                    // USAGE_PAGE (Generic Desktop)
-    0x09, 0x02,                    // USAGE (Mouse)
+    0x06, 0x00, 0xff,              // USAGE_PAGE (Vendor Defined 0xFF00)
+    0x09, 0x01,                    // USAGE (Vendor Usage 1)
     0xa1, 0x01,                    // COLLECTION (Application)
 
-    0x09, 0x01,                    //   USAGE (Pointer)
-    0xa1, 0x00,                    //   COLLECTION (Physical)
-
-    0x05, 0x09,                    //     USAGE_PAGE (Button)
-    0x19, 0x01,                    //     USAGE_MINIMUM (Button 1)
-    0x29, 0x03,                    //     USAGE_MAXIMUM (Button 3)
-    0x15, 0x00,                    //     LOGICAL_MINIMUM (0)
-    0x25, 0x01,                    //     LOGICAL_MAXIMUM (1)
-    0x95, 0x03,                    //     REPORT_COUNT (3)
-    0x75, 0x01,                    //     REPORT_SIZE (1)
-    0x81, 0x02,                    //     INPUT (Data,Var,Abs)
-    0x95, 0x01,                    //     REPORT_COUNT (1)
-    0x75, 0x05,                    //     REPORT_SIZE (5)
-    0x81, 0x03,                    //     INPUT (Cnst,Var,Abs)
-
-    0x05, 0x01,                    //     USAGE_PAGE (Generic Desktop)
-    0x09, 0x30,                    //     USAGE (X)
-    0x09, 0x31,                    //     USAGE (Y)
-    0x09, 0x38,                    //     USAGE (Wheel)
-    0x15, 0x81,                    //     LOGICAL_MINIMUM (-127)
-    0x25, 0x7f,                    //     LOGICAL_MAXIMUM (127)
-    0x75, 0x08,                    //     REPORT_SIZE (8)
-    0x95, 0x03,                    //     REPORT_COUNT (3)
-    0x81, 0x06,                    //     INPUT (Data,Var,Rel)
-
-    0xc0,                          //   END_COLLECTION
+    0x09, 0x01,                    //   USAGE (Vendor Usage 1)
+    0x15, 0x00,                    //   LOGICAL_MINIMUM (0)
+    0x26, 0xff, 0x00,              //   LOGICAL_MAXIMUM (255)
+    0x75, 0x08,                    //   REPORT_SIZE (8)
+    0x95, RC_LINK_FRAME_LEN,       //   REPORT_COUNT (RC_LINK_FRAME_LEN)
+    0x81, 0x02,                    //   INPUT (Data,Var,Abs)
+
     0xc0                           // END_COLLECTION
 };
 
 const int hid_rc_descriptor_len = sizeof(hid_rc_descriptor);
+#endif
 
 
-struct controller_data cd = {
-    .x = 0.0,
-    .y = 0.0,
+const struct stick_config roll_stick_config = {
+    .channel = ROLL_STICK_ADC_CHANNEL,
+    .inverted = false,
+    .centred = true,
+};
+const struct stick_config pitch_stick_config = {
+    .channel = PITCH_STICK_ADC_CHANNEL,
+    .inverted = true,
+    .centred = true,
+};
+const struct stick_config yaw_stick_config = {
+    .channel = YAW_STICK_ADC_CHANNEL,
+    .inverted = false,
+    .centred = true,
+};
+const struct stick_config throttle_stick_config = {
+    .channel = THROTTLE_STICK_ADC_CHANNEL,
+    .inverted = false,
+    .centred = false,
 };
 
+struct remote_control remote;
 
-/* Integrity check of the report ID and report type for GET_REPORT request
- * from HID host. Boot Protocol Mode requires report ID. For Report Protocol
- * Mode, when the report descriptor does not declare report ID Global ITEMS,
- * the report ID does not exist in the GET_REPORT request, and a value of 0 for
- * report_id will occur in ESP_HIDD_GET_REPORT_EVT callback parameter. */
-bool check_report_id_type(uint8_t report_id, uint8_t report_type)
-{
-    bool ret = false;
-    xSemaphoreTake(s_local_param.mouse_mutex, portMAX_DELAY);
-    do {
-        if (report_type != ESP_HIDD_REPORT_TYPE_INPUT) {
-            break;
+
+/** Sets up 'stick' as the axis wired as 'config' says, taking the current
+ * reading as its resting position. */
+static esp_err_t stick_begin(struct stick *stick, const struct stick_config *config) {
+    stick->config = config;
+
+    adc_oneshot_chan_cfg_t channel_config = {
+        .atten = ADC_ATTEN_DB_12,
+        .bitwidth = ADC_BITWIDTH_12,
+    };
+    esp_err_t err = adc_oneshot_config_channel(remote.adc, config->channel, &channel_config);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    return adc_oneshot_read(remote.adc, config->channel, &stick->rest_raw);
+}
+
+
+/** Reads 'stick' into 'value': -1 to 1 for a centred stick, 0 to 1
+ * otherwise, measured from its resting position. */
+static esp_err_t stick_read(const struct stick *stick, float *value) {
+    int raw;
+    esp_err_t err = adc_oneshot_read(remote.adc, stick->config->channel, &raw);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    /* Scale each side of the resting position separately, so that both ends
+     * of the travel reach full scale even if the rest is off centre */
+    int offset = raw - stick->rest_raw;
+    int range = (offset >= 0) ? STICK_RAW_MAX - stick->rest_raw : stick->rest_raw;
+    float v = (range > 0) ? (float) offset / range : 0.0f;
+    if (stick->config->inverted) {
+        v = -v;
+    }
+    if (stick->config->centred) {
+        if (fabsf(v) < STICK_DEADBAND) {
+            v = 0.0f;
         }
-        if (s_local_param.protocol_mode == ESP_HIDD_BOOT_MODE) {
-            if (report_id == ESP_HIDD_BOOT_REPORT_ID_MOUSE) {
-                ret = true;
-                break;
-            }
-        } else {
-            if (report_id == 0) {
-                ret = true;
-                break;
-            }
+    } else if (v < 0.0f) {
+        v = 0.0f;
+    }
+    *value = v;
+
+    return ESP_OK;
+}
+
+
+/* Reads the sticks and the arm switch into 'command'. If a stick can't be
+ * read, the command is sent with RC_LINK_FLAG_FAILSAFE set rather than with
+ * a made up value */
+static void read_command(struct rc_link_command *command) {
+    command->flags = 0;
+    if (stick_read(&remote.roll, &command->roll) != ESP_OK \
+        || stick_read(&remote.pitch, &command->pitch) != ESP_OK \
+        || stick_read(&remote.yaw, &command->yaw) != ESP_OK \
+        || stick_read(&remote.throttle, &command->throttle) != ESP_OK) {
+
+        remote.read_failures++;
+        memset(command, 0, sizeof(*command));
+        command->flags = RC_LINK_FLAG_FAILSAFE;
+        return;
+    }
+
+    bool arm_switch_on = gpio_get_level(ARM_SWITCH_PIN_NUM) == 0;
+    if (!arm_switch_on) {
+        remote.arm_switch_seen_off = true;
+    } else if (remote.arm_switch_seen_off) {
+        command->flags |= RC_LINK_FLAG_ARMED;
+    }
+}
+
+
+/* Wakes the sender task every RC_LINK_PERIOD_US. The FreeRTOS tick is too
+ * coarse for that, so it is done from a high resolution timer */
+static void sender_timer_cb(void *arg) {
+    xTaskNotifyGive(remote.sender);
+}
+
+
+#if RC_TRANSPORT == RC_TRANSPORT_ESPNOW
+/* Whether there is anyone to send frames to yet. A remote that is waiting to
+ * be paired asks to be every so often instead */
+static bool link_ready(void) {
+    static uint32_t frames_until_request = 0;
+
+    if (rc_link_espnow_pairing(&remote.espnow)) {
+        if (frames_until_request == 0) {
+            rc_link_espnow_request_pairing(&remote.espnow);
+            frames_until_request = PAIRING_REQUEST_FRAMES;
         }
-    } while (0);
+        frames_until_request--;
+        return false;
+    }
+    return rc_link_espnow_paired(&remote.espnow);
+}
+
+
+/* ESP-NOW copies the frame before 'esp_now_send()' returns, and reports
+ * whether the drone got it later, from the Wi-Fi task */
+static esp_err_t send_frame(const uint8_t *frame) {
+    return rc_link_espnow_send(&remote.espnow, frame, RC_LINK_FRAME_LEN);
+}
+#else
+static bool link_ready(void) {
+    return __atomic_load_n(&remote.connected, __ATOMIC_ACQUIRE);
+}
 
-    if (!ret) {
-        if (s_local_param.protocol_mode == ESP_HIDD_BOOT_MODE) {
-            esp_bt_hid_device_report_error(ESP_HID_PAR_HANDSHAKE_RSP_ERR_INVALID_REP_ID);
+
+/* The Bluetooth stack copies the report before
+ * 'esp_bt_hid_device_send_report()' returns */
+static esp_err_t send_frame(const uint8_t *frame) {
+    return esp_bt_hid_device_send_report(ESP_HIDD_REPORT_TYPE_INTRDATA, 0, RC_LINK_FRAME_LEN, \
+        (uint8_t *) frame);
+}
+#endif
+
+
+/* Samples the sticks and sends them to the drone as an rc-link frame,
+ * every RC_LINK_PERIOD_US. This is the only task that touches the sticks,
+ * the sequence number and the frame buffer, so there is nothing to lock */
+static void sender(void *arg) {
+    struct rc_link_command command;
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        read_command(&command);
+        if (!link_ready()) {
+            continue;
+        }
+
+        rc_link_encode(&command, remote.sequence++, remote.frame);
+        if (send_frame(remote.frame) == ESP_OK) {
+            remote.frames_sent++;
         } else {
-            esp_bt_hid_device_report_error(ESP_HID_PAR_HANDSHAKE_RSP_ERR_INVALID_REP_ID);
+            remote.send_failures++;
         }
     }
-    xSemaphoreGive(s_local_param.mouse_mutex);
-    return ret;
 }
 
-// send the buttons, change in x, and change in y
-void send_mouse_report(uint8_t buttons, char dx, char dy, char wheel)
-{
-    uint8_t report_id;
-    uint16_t report_size;
-    xSemaphoreTake(s_local_param.mouse_mutex, portMAX_DELAY);
-    if (s_local_param.protocol_mode == ESP_HIDD_REPORT_MODE) {
-        report_id = 0;
-        report_size = REPORT_PROTOCOL_MOUSE_REPORT_SIZE;
-        s_local_param.buffer[0] = buttons;
-        s_local_param.buffer[1] = dx;
-        s_local_param.buffer[2] = dy;
-        s_local_param.buffer[3] = wheel;
-    } else {
-        // Boot Mode
-        report_id = ESP_HIDD_BOOT_REPORT_ID_MOUSE;
-        report_size = ESP_HIDD_BOOT_REPORT_SIZE_MOUSE - 1;
-        s_local_param.buffer[0] = buttons;
-        s_local_param.buffer[1] = dx;
-        s_local_param.buffer[2] = dy;
+
+/** Sets up the sticks and the arm switch and starts sending frames. Nothing
+ * goes out until the drone connects. */
+static esp_err_t sender_begin(void) {
+    adc_oneshot_unit_init_cfg_t adc_config = {
+        .unit_id = ADC_UNIT_1,
+    };
+    esp_err_t err = adc_oneshot_new_unit(&adc_config, &remote.adc);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if ((err = stick_begin(&remote.roll, &roll_stick_config)) != ESP_OK \
+        || (err = stick_begin(&remote.pitch, &pitch_stick_config)) != ESP_OK \
+        || (err = stick_begin(&remote.yaw, &yaw_stick_config)) != ESP_OK \
+        || (err = stick_begin(&remote.throttle, &throttle_stick_config)) != ESP_OK) {
+        return err;
+    }
+
+    gpio_config_t arm_switch_config = {
+        .pin_bit_mask = 1ULL << ARM_SWITCH_PIN_NUM,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_DISABLE,
+    };
+    if ((err = gpio_config(&arm_switch_config)) != ESP_OK) {
+        return err;
     }
-    esp_bt_hid_device_send_report(ESP_HIDD_REPORT_TYPE_INTRDATA, report_id, report_size, s_local_param.buffer);
-    xSemaphoreGive(s_local_param.mouse_mutex);
-}
 
+    /* Start somewhere random, so a restarted remote's frames don't look like
+     * old ones to the drone */
+    remote.sequence = (uint16_t) esp_random();
 
-void mouse_move_task(void *pvParameters)
-{
-    const char *TAG = "mouse_move_task";
-
-    ESP_LOGI(TAG, "starting");
-    for (;;) {
-        s_local_param.x_dir = 1;
-        int8_t step = 10;
-        for (int i = 0; i < 2; i++) {
-            xSemaphoreTake(s_local_param.mouse_mutex, portMAX_DELAY);
-            s_local_param.x_dir *= -1;
-            xSemaphoreGive(s_local_param.mouse_mutex);
-            for (int j = 0; j < 100; j++) {
-                send_mouse_report(0, s_local_param.x_dir * step, 0, 0);
-                vTaskDelay(50 / portTICK_PERIOD_MS);
-            }
-        }
-        vTaskDelay(1000 / portTICK_PERIOD_MS);
+    if (xTaskCreate(sender, "sender", SENDER_STACK_SIZE, NULL, SENDER_PRIORITY, \
+        &remote.sender) != pdPASS) {
+        return ESP_ERR_NO_MEM;
     }
+
+    esp_timer_create_args_t timer_args = {
+        .callback = sender_timer_cb,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "sender",
+        .skip_unhandled_events = true,
+    };
+    if ((err = esp_timer_create(&timer_args, &remote.timer)) != ESP_OK) {
+        return err;
+    }
+    return esp_timer_start_periodic(remote.timer, RC_LINK_PERIOD_US);
 }
 
 
+#if RC_TRANSPORT == RC_TRANSPORT_ESPNOW
+/* The drone sends nothing but pairing acknowledgements, which the link
+ * handles itself */
+static void receive_nothing(const uint8_t *data, size_t len, void *arg) {
+}
+#else
 static void print_bt_address(void)
 {
     const char *TAG = "bt_address";
@@ -208,30 +363,6 @@ void esp_bt_gap_cb(esp_bt_gap_cb_event_t event, esp_bt_gap_cb_param_t *param)
 }
 
 
-void bt_app_task_start_up(void)
-{
-    s_local_param.mouse_mutex = xSemaphoreCreateMutex();
-    memset(s_local_param.buffer, 0, REPORT_BUFFER_SIZE);
-    xTaskCreate(mouse_move_task, "mouse_move_task", 2 * 1024, NULL, configMAX_PRIORITIES - 3, &s_local_param.mouse_task_hdl);
-    return;
-}
-
-
-void bt_app_task_shut_down(void)
-{
-    if (s_local_param.mouse_task_hdl) {
-        vTaskDelete(s_local_param.mouse_task_hdl);
-        s_local_param.mouse_task_hdl = NULL;
-    }
-
-    if (s_local_param.mouse_mutex) {
-        vSemaphoreDelete(s_local_param.mouse_mutex);
-        s_local_param.mouse_mutex = NULL;
-    }
-    return;
-}
-
-
 void esp_bt_hidd_cb(esp_hidd_cb_event_t event, esp_hidd_cb_param_t *param)
 {
     static const char *TAG = "esp_bt_hidd_cb";
@@ -239,7 +370,7 @@ void esp_bt_hidd_cb(esp_hidd_cb_event_t event, esp_hidd_cb_param_t *param)
     case ESP_HIDD_INIT_EVT:
         if (param->init.status == ESP_HIDD_SUCCESS) {
             ESP_LOGI(TAG, "setting hid parameters");
-            esp_bt_hid_device_register_app(&s_local_param.app_param, &s_local_param.both_qos, &s_local_param.both_qos);
+            esp_bt_hid_device_register_app(&remote.app_param, &remote.both_qos, &remote.both_qos);
         } else {
             ESP_LOGE(TAG, "init hidd failed!");
         }
@@ -274,7 +405,7 @@ void esp_bt_hidd_cb(esp_hidd_cb_event_t event, esp_hidd_cb_param_t *param)
                 ESP_LOGI(TAG, "connected to %02x:%02x:%02x:%02x:%02x:%02x", param->open.bd_addr[0],
                          param->open.bd_addr[1], param->open.bd_addr[2], param->open.bd_addr[3], param->open.bd_addr[4],
                          param->open.bd_addr[5]);
-                bt_app_task_start_up();
+                __atomic_store_n(&remote.connected, 1, __ATOMIC_RELEASE);
                 ESP_LOGI(TAG, "making self non-discoverable and non-connectable.");
                 esp_bt_gap_set_scan_mode(ESP_BT_NON_CONNECTABLE, ESP_BT_NON_DISCOVERABLE);
             } else {
@@ -290,8 +421,9 @@ void esp_bt_hidd_cb(esp_hidd_cb_event_t event, esp_hidd_cb_param_t *param)
             if (param->close.conn_status == ESP_HIDD_CONN_STATE_DISCONNECTING) {
                 ESP_LOGI(TAG, "disconnecting...");
             } else if (param->close.conn_status == ESP_HIDD_CONN_STATE_DISCONNECTED) {
-                ESP_LOGI(TAG, "disconnected!");
-                bt_app_task_shut_down();
+                ESP_LOGI(TAG, "disconnected! %" PRIu32 " frames sent, %" PRIu32 " failed", \
+                    remote.frames_sent, remote.send_failures);
+                __atomic_store_n(&remote.connected, 0, __ATOMIC_RELEASE);
                 ESP_LOGI(TAG, "making self discoverable and connectable again.");
                 esp_bt_gap_set_scan_mode(ESP_BT_CONNECTABLE, ESP_BT_GENERAL_DISCOVERABLE);
             } else {
@@ -302,10 +434,9 @@ void esp_bt_hidd_cb(esp_hidd_cb_event_t event, esp_hidd_cb_param_t *param)
         }
         break;
     case ESP_HIDD_SEND_REPORT_EVT:
-        if (param->send_report.status == ESP_HIDD_SUCCESS) {
-            ESP_LOGI(TAG, "ESP_HIDD_SEND_REPORT_EVT id:0x%02x, type:%d", param->send_report.report_id,
-                     param->send_report.report_type);
-        } else {
+        /* This comes back for every frame, so only failures are worth
+         * printing */
+        if (param->send_report.status != ESP_HIDD_SUCCESS) {
             ESP_LOGE(TAG, "ESP_HIDD_SEND_REPORT_EVT id:0x%02x, type:%d, status:%d, reason:%d",
                      param->send_report.report_id, param->send_report.report_type, param->send_report.status,
                      param->send_report.reason);
@@ -317,40 +448,18 @@ void esp_bt_hidd_cb(esp_hidd_cb_event_t event, esp_hidd_cb_param_t *param)
     case ESP_HIDD_GET_REPORT_EVT:
         ESP_LOGI(TAG, "ESP_HIDD_GET_REPORT_EVT id:0x%02x, type:%d, size:%d", param->get_report.report_id,
                  param->get_report.report_type, param->get_report.buffer_size);
-        if (check_report_id_type(param->get_report.report_id, param->get_report.report_type)) {
-            uint8_t report_id;
-            uint16_t report_len;
-            if (s_local_param.protocol_mode == ESP_HIDD_REPORT_MODE) {
-                report_id = 0;
-                report_len = REPORT_PROTOCOL_MOUSE_REPORT_SIZE;
-            } else {
-                // Boot Mode
-                report_id = ESP_HIDD_BOOT_REPORT_ID_MOUSE;
-                report_len = ESP_HIDD_BOOT_REPORT_SIZE_MOUSE - 1;
-            }
-            xSemaphoreTake(s_local_param.mouse_mutex, portMAX_DELAY);
-            esp_bt_hid_device_send_report(param->get_report.report_type, report_id, report_len, s_local_param.buffer);
-            xSemaphoreGive(s_local_param.mouse_mutex);
-        } else {
-            ESP_LOGE(TAG, "check_report_id failed!");
-        }
+        /* Frames are only ever pushed out on the interrupt channel. One
+         * asked for over the control channel would be out of date by the
+         * time it got there */
+        esp_bt_hid_device_report_error(ESP_HID_PAR_HANDSHAKE_RSP_ERR_UNSUPPORTED_REQ);
         break;
     case ESP_HIDD_SET_REPORT_EVT:
         ESP_LOGI(TAG, "ESP_HIDD_SET_REPORT_EVT");
         break;
     case ESP_HIDD_SET_PROTOCOL_EVT:
-        ESP_LOGI(TAG, "ESP_HIDD_SET_PROTOCOL_EVT");
-        if (param->set_protocol.protocol_mode == ESP_HIDD_BOOT_MODE) {
-            ESP_LOGI(TAG, "  - boot protocol");
-            xSemaphoreTake(s_local_param.mouse_mutex, portMAX_DELAY);
-            s_local_param.x_dir = -1;
-            xSemaphoreGive(s_local_param.mouse_mutex);
-        } else if (param->set_protocol.protocol_mode == ESP_HIDD_REPORT_MODE) {
-            ESP_LOGI(TAG, "  - report protocol");
-        }
-        xSemaphoreTake(s_local_param.mouse_mutex, portMAX_DELAY);
-        s_local_param.protocol_mode = param->set_protocol.protocol_mode;
-        xSemaphoreGive(s_local_param.mouse_mutex);
+        /* There is no boot protocol version of a vendor defined report, so
+         * the frames go out the same either way */
+        ESP_LOGI(TAG, "ESP_HIDD_SET_PROTOCOL_EVT mode:%d", param->set_protocol.protocol_mode);
         break;
     case ESP_HIDD_INTR_DATA_EVT:
         ESP_LOGI(TAG, "ESP_HIDD_INTR_DATA_EVT");
@@ -360,7 +469,7 @@ void esp_bt_hidd_cb(esp_hidd_cb_event_t event, esp_hidd_cb_param_t *param)
         if (param->vc_unplug.status == ESP_HIDD_SUCCESS) {
             if (param->close.conn_status == ESP_HIDD_CONN_STATE_DISCONNECTED) {
                 ESP_LOGI(TAG, "disconnected!");
-                bt_app_task_shut_down();
+                __atomic_store_n(&remote.connected, 0, __ATOMIC_RELEASE);
                 ESP_LOGI(TAG, "making self discoverable and connectable again.");
                 esp_bt_gap_set_scan_mode(ESP_BT_CONNECTABLE, ESP_BT_GENERAL_DISCOVERABLE);
             } else {
@@ -376,35 +485,12 @@ void esp_bt_hidd_cb(esp_hidd_cb_event_t event, esp_hidd_cb_param_t *param)
 }
 
 
-/* /1* Send controller data over Bluetooth to the drone *1/ */
-/* void app_main(void) { */
-/*     /1* Set the frequency of the loop in this function to 3 ticks *1/ */
-/*     const TickType_t taskFrequency = 3; */
-/*     TickType_t lastWakeTime; */
-
-/*     while (1) { */
-/*         /1* Update the lastWakeTime variable to have the current time *1/ */
-/*         lastWakeTime = xTaskGetTickCount(); */
-
-
-/*         /1* Delay such that this loop executes every 'taskFrequency' ticks *1/ */
-/*         vTaskDelayUntil(&lastWakeTime, taskFrequency); */
-/*     } */
-/* } */
-
-
-void app_main(void)
+/* Brings up the Bluetooth stack as a HID device the drone can connect to */
+static void bluetooth_begin(void)
 {
-    const char *TAG = "app_main";
+    const char *TAG = "bluetooth_begin";
     esp_err_t ret;
 
-    ret = nvs_flash_init();
-    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-        ESP_ERROR_CHECK(nvs_flash_erase());
-        ret = nvs_flash_init();
-    }
-    ESP_ERROR_CHECK( ret );
-
     ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_BLE));
 
     esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
@@ -438,7 +524,7 @@ void app_main(void)
     }
 
     ESP_LOGI(TAG, "setting device name");
-    esp_bt_gap_set_device_name("HID Mouse Example");
+    esp_bt_gap_set_device_name("Drone Remote");
 
     ESP_LOGI(TAG, "setting cod major, peripheral");
     esp_bt_cod_t cod;
@@ -451,21 +537,17 @@ void app_main(void)
 	// call of `esp_bt_hid_device_register_app` after profile initialization
 	// finishes
     do {
-        s_local_param.app_param.name = "Mouse";
-        s_local_param.app_param.description = "Mouse Example";
-        s_local_param.app_param.provider = "ESP32";
-        s_local_param.app_param.subclass = ESP_HID_CLASS_MIC;
-        s_local_param.app_param.desc_list = hid_mouse_descriptor;
-        s_local_param.app_param.desc_list_len = hid_mouse_descriptor_len;
+        remote.app_param.name = "Drone Remote";
+        remote.app_param.description = "rc-link remote control";
+        remote.app_param.provider = "ESP32";
+        remote.app_param.subclass = ESP_HID_CLASS_GPD;
+        remote.app_param.desc_list = hid_rc_descriptor;
+        remote.app_param.desc_list_len = hid_rc_descriptor_len;
 
 		// don't set the qos parameters
-        memset(&s_local_param.both_qos, 0, sizeof(esp_hidd_qos_param_t));
+        memset(&remote.both_qos, 0, sizeof(esp_hidd_qos_param_t));
     } while (0);
 
-	// Report Protocol Mode is the default mode, according to Bluetooth HID
-	// specification
-    s_local_param.protocol_mode = ESP_HIDD_REPORT_MODE;
-
     ESP_LOGI(TAG, "register hid device callback");
     esp_bt_hid_device_register_callback(esp_bt_hidd_cb);
 
@@ -486,5 +568,53 @@ void app_main(void)
     esp_bt_gap_set_pin(pin_type, 0, pin_code);
 
     print_bt_address();
+}
+#endif
+
+
+void app_main(void)
+{
+    const char *TAG = "app_main";
+    esp_err_t ret;
+
+    ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        ret = nvs_flash_init();
+    }
+    ESP_ERROR_CHECK( ret );
+
+#if RC_TRANSPORT == RC_TRANSPORT_ESPNOW
+    if ((ret = rc_link_espnow_begin(&remote.espnow, RC_LINK_ESPNOW_REMOTE, receive_nothing, \
+        NULL)) != ESP_OK) {
+        ESP_LOGE(TAG, "starting esp-now failed: %s", esp_err_to_name(ret));
+        return;
+    }
+#endif
+
+    if ((ret = sender_begin()) != ESP_OK) {
+        ESP_LOGE(TAG, "starting the sender failed: %s", esp_err_to_name(ret));
+        return;
+    }
+
+#if RC_TRANSPORT == RC_TRANSPORT_ESPNOW
+    /* Powering up with the arm switch on asks to be paired with whichever
+     * drone is listening for a remote */
+    if (gpio_get_level(ARM_SWITCH_PIN_NUM) == 0 || !rc_link_espnow_paired(&remote.espnow)) {
+        ESP_LOGI(TAG, "asking to be paired");
+        rc_link_espnow_start_pairing(&remote.espnow);
+        /* The drone's address is stored from here rather than from the
+         * Wi-Fi task, which pairs, since that must not wait on the flash */
+        while (rc_link_espnow_pairing(&remote.espnow)) {
+            vTaskDelay(PAIRING_POLL_MS / portTICK_PERIOD_MS);
+        }
+        if ((ret = rc_link_espnow_save_peer(&remote.espnow)) != ESP_OK) {
+            ESP_LOGE(TAG, "storing the drone's address failed: %s", esp_err_to_name(ret));
+        }
+        ESP_LOGI(TAG, "paired");
+    }
+#else
+    bluetooth_begin();
+#endif
     ESP_LOGI(TAG, "exiting");
 }
@@ -2,16 +2,82 @@
 #define __REMOTE_CONTROL_H_
 
 #include <inttypes.h>
+#include <stdbool.h>
 
-#include "freertos/semphr.h"
+#include "driver/gpio.h"
+#include "esp_adc/adc_oneshot.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 
-#include "esp32-i2c-lsm6dsox.h"
-#include "esp32-i2c-lis3mdl.h"
+#include "rc-link.h"
 
 
-struct controller_data {
-	double x; /* These are stored in Radians */
-	double y;
+/* Which link the frames go over. ESP-NOW needs nothing but the Wi-Fi
+ * driver. Bluetooth sends each frame as a HID report, and needs Classic
+ * Bluetooth and its HID device profile enabled in menuconfig */
+#define RC_TRANSPORT_ESPNOW 0
+#define RC_TRANSPORT_BLUETOOTH 1
+#ifndef RC_TRANSPORT
+#define RC_TRANSPORT RC_TRANSPORT_ESPNOW
+#endif
+
+#if RC_TRANSPORT == RC_TRANSPORT_ESPNOW
+#include "rc-link-espnow.h"
+#else
+#include "esp_hidd_api.h"
+#endif
+
+
+/* How one stick axis is wired to the ADC */
+struct stick_config {
+    adc_channel_t channel;
+    /* If true, a higher reading means a lower stick value */
+    bool inverted;
+    /* If true, the stick's resting position is its centre (roll, pitch and
+     * yaw) rather than the bottom of its travel (throttle) */
+    bool centred;
+};
+
+/* One stick axis: its wiring plus where its resting position was read at
+ * boot */
+struct stick {
+    const struct stick_config *config;
+    int rest_raw;
+};
+
+struct remote_control {
+#if RC_TRANSPORT == RC_TRANSPORT_ESPNOW
+    struct rc_link_espnow espnow;
+#else
+    /* Set and cleared by the Bluetooth callbacks, read by the sender task */
+    uint32_t connected;
+
+    /* The HID device's SDP record and L2CAP parameters, which have to stay
+     * around until the HID device is registered */
+    esp_hidd_app_param_t app_param;
+    esp_hidd_qos_param_t both_qos;
+#endif
+
+    /* Owned by the sender task */
+    adc_oneshot_unit_handle_t adc;
+    struct stick roll;
+    struct stick pitch;
+    struct stick yaw;
+    struct stick throttle;
+    /* The arm switch has to be seen off before it can arm, so the remote
+     * never boots up sending an armed command */
+    bool arm_switch_seen_off;
+    uint16_t sequence;
+    uint8_t frame[RC_LINK_FRAME_LEN];
+
+    TaskHandle_t sender;
+    esp_timer_handle_t timer;
+
+    /* Counters, written by the sender task */
+    uint32_t frames_sent;
+    uint32_t send_failures;
+    uint32_t read_failures;
 };
 
 